@@ -1,6 +1,10 @@
 // ReSharper disable CppParameterMayBeConstPtrOrRef
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <tuple>
+#include <optional>
 #include <functional>
 #include <string>
 #include <fstream>
@@ -12,38 +16,44 @@
 #include <algorithm>
 #include <ctime>
 #include <cmath>
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <memory>
+#include <chrono>
+#include <bit>
+#include <array>
+#include <string_view>
+#include <span>
+#include <filesystem>
+#include <cstring>
+#include <type_traits>
+#include <cstdio>
+#include <charconv>
+#include <csignal>
+#include <new>
+#include <cstdlib>
+#ifdef _WIN32
+#include <io.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 #pragma region Utility
 
-// Converts a decimal to a percentage string, ensuring it stays within 0-100%
-std::string formatToPercentage(double decimal) {
-    double percentage = decimal * 100;
-    if (percentage < 0) {
-        percentage = 0;
-    } else if (percentage > 100) {
-        percentage = 100;
-    }
-    int intPercentage = static_cast<int>(percentage);
-    std::ostringstream oss;
-    oss << std::fixed << std::setprecision(2) << intPercentage << "%";
-    return oss.str();
-}
-
-// Type alias for key-value pairs
-using KeyValuePair = std::pair<std::string, std::string>;
-
-// Prints key-value pairs with padding for alignment
-void printWithPadding(const std::vector<KeyValuePair> &items) {
-    size_t maxKeyLength = 0;
-    for (const auto &item: items) {
-        maxKeyLength = std::max(maxKeyLength, item.first.length());
-    }
-    for (const auto &item: items) {
-        std::cout << std::left << std::setw(maxKeyLength + 2) << item.first
-                  << item.second << std::endl;
-    }
-}
-
 // Returns the current date in "YYYY-MM-DD" format
 std::string getCurrentDate() {
     std::time_t t = std::time(nullptr);
@@ -53,543 +63,7510 @@ std::string getCurrentDate() {
     return oss.str();
 }
 
-// Parses a date string and returns the year and month
-std::pair<int, int> parseYearMonth(const std::string &dateStr) {
-    int year = std::stoi(dateStr.substr(0, 4));
-    int month = std::stoi(dateStr.substr(5, 2));
-    return {year, month};
+// Amounts are stored in integer minor units (1/100 of the currency unit)
+constexpr int64_t MINOR_UNITS_PER_UNIT = 100;
+
+// Largest amount, in currency units, that an item may have. Its minor units stay below 2^53, so
+// they convert exactly, and sums of many of them stay far from the limits of int64_t.
+constexpr double MAX_AMOUNT = 1e13;
+
+// Returns true if an amount in currency units is finite and within MAX_AMOUNT
+bool isValidAmount(double amount) {
+    return std::abs(amount) <= MAX_AMOUNT; // False for NaN
 }
 
-// Global currency setting
-const std::string &CURRENCY = "IDR";
+// Converts an amount to integer minor units. Throws std::invalid_argument if it is not a valid amount.
+int64_t toMinorUnits(double amount) {
+    if (!isValidAmount(amount)) throw std::invalid_argument("Amount out of range");
+    return std::llround(amount * MINOR_UNITS_PER_UNIT);
+}
 
-// Formats a number as Indonesian Rupiah (IDR) with thousands separators
-std::string formatIDR(double amount) {
-    std::ostringstream oss;
-    oss << std::fixed << std::setprecision(0) << amount;
-    std::string numStr = oss.str();
-    bool isNegative = (amount < 0);
-    int n = numStr.length();
-    int insertPosition = n - 3;
-    if (isNegative) {
-        insertPosition -= 1;
-    }
-    while (insertPosition > 0) {
-        numStr.insert(insertPosition, ".");
-        insertPosition -= 3;
-    }
-    return "IDR " + numStr;
+// Converts integer minor units back to an amount
+double fromMinorUnits(int64_t minorUnits) {
+    return static_cast<double>(minorUnits) / MINOR_UNITS_PER_UNIT;
 }
 
-// Formats a currency amount based on the CURRENCY setting
-std::string formatCurrency(double amount) {
-    std::ostringstream oss;
-    if (CURRENCY == "IDR") {
-        oss << formatIDR(amount);
-    } else if (CURRENCY == "USD") {
-        oss.imbue(std::locale("en_US.UTF-8"));
-        oss << "USD " << std::fixed << std::setprecision(2) << amount;
-    } else {
-        return "Unsupported currency";
+// Longest text writeMinorUnits() produces: a sign, 19 digits and the decimal point
+constexpr size_t MAX_MINOR_UNITS_LENGTH = 24;
+
+// Writes minor units as a plain decimal number ("1500000" or "1234.56") and returns the end of the text
+char *writeMinorUnits(char *out, int64_t minorUnits) {
+    uint64_t magnitude = minorUnits < 0 ? 0 - static_cast<uint64_t>(minorUnits) : static_cast<uint64_t>(minorUnits);
+    if (minorUnits < 0) *out++ = '-';
+    out = std::to_chars(out, out + MAX_MINOR_UNITS_LENGTH, magnitude / MINOR_UNITS_PER_UNIT).ptr;
+    uint64_t fraction = magnitude % MINOR_UNITS_PER_UNIT;
+    if (fraction != 0) {
+        *out++ = '.';
+        *out++ = static_cast<char>('0' + fraction / 10);
+        *out++ = static_cast<char>('0' + fraction % 10);
     }
-    return oss.str();
+    return out;
 }
 
-#pragma endregion Utility
+// Formats minor units as a plain decimal number ("1500000" or "1234.56")
+std::string formatMinorUnits(int64_t minorUnits) {
+    char buffer[MAX_MINOR_UNITS_LENGTH];
+    return {buffer, writeMinorUnits(buffer, minorUnits)};
+}
 
-#pragma region Model
+// Currencies an amount can be held in
+enum class Currency {
+    IDR,
+    USD
+};
 
-// Enumeration for financial item types
-enum class ItemType {
-    Asset,
-    Liability,
-    Income,
-    Expense
+// How amounts of a currency are written
+template<Currency C>
+struct CurrencyFormat;
+
+template<>
+struct CurrencyFormat<Currency::IDR> {
+    static constexpr std::string_view code = "IDR";
+    static constexpr char groupSeparator = '.';
+    static constexpr char decimalSeparator = ',';
+    static constexpr int fractionDigits = 0;
 };
 
-// Represents a financial item with various attributes
-class FinancialItem {
-private:
-    std::string category;
-    ItemType type;
-    std::string name;
-    double amount;
-    std::string date;
-    double probability;
+template<>
+struct CurrencyFormat<Currency::USD> {
+    static constexpr std::string_view code = "USD";
+    static constexpr char groupSeparator = ',';
+    static constexpr char decimalSeparator = '.';
+    static constexpr int fractionDigits = 2;
+};
 
-public:
-    // Constructor
-    FinancialItem(ItemType type, std::string &name, std::string &category, double amount, std::string &date,
-                  double probability)
-        : type(type), name(name), category(category), amount(amount), date(date), probability(probability) {
-    }
+// An exact amount of money: integer minor units tagged with the currency. Sums of Money never drift
+// the way sums of doubles do.
+template<Currency C>
+struct BasicMoney {
+    int64_t minorUnits = 0;
 
-    // Displays the item details
-    void display() const {
-        std::string typeName = getTypeName();
-        std::cout << "(" << date << ") " << name << " (" << category << "): " << formatCurrency(amount) << " (" <<
-                  typeName << ") " << (probability * 100) << "%\n";
-    }
+    constexpr BasicMoney() = default;
 
-    // Returns the type name as a string
-    [[nodiscard]] std::string getTypeName() const {
-        switch (type) {
-            case ItemType::Asset: return "Asset";
-            case ItemType::Liability: return "Liability";
-            case ItemType::Income: return "Income";
-            case ItemType::Expense: return "Expense";
-        }
-        return "";
+    constexpr explicit BasicMoney(int64_t minorUnits) : minorUnits(minorUnits) {
     }
 
-    // Serializes the item to a file
-    void serialize(std::ofstream &out) const {
-        out << getTypeName() << "," << name << "," << category << "," << amount << "," << date << "," << probability <<
-            "\n";
+    // Converts an amount in currency units, rounding to the nearest minor unit. Throws
+    // std::invalid_argument if the amount is not finite or exceeds MAX_AMOUNT.
+    static BasicMoney fromUnits(double amount) {
+        return BasicMoney(toMinorUnits(amount));
     }
 
-    // Getters for item attributes
-    [[nodiscard]] std::string getName() const { return name; }
-    [[nodiscard]] ItemType getType() const { return type; }
-    [[nodiscard]] double getAmount() const { return amount; }
-    [[nodiscard]] std::string getDate() const { return date; }
-    [[nodiscard]] double getProbability() const { return probability; }
-    [[nodiscard]] std::string getCategory() const { return category; }
-
-    // Deserializes an item from a string
-    static FinancialItem deserialize(const std::string &input) {
-        std::istringstream in(input);
-        std::string typeName, name, category, date, amount, probability;
-        std::getline(in, typeName, ',');
-        std::getline(in, name, ',');
-        std::getline(in, category, ',');
-        std::getline(in, amount, ',');
-        std::getline(in, date, ',');
-        std::getline(in, probability);
-
-        ItemType type;
-        if (typeName == "Asset") type = ItemType::Asset;
-        else if (typeName == "Liability") type = ItemType::Liability;
-        else if (typeName == "Income") type = ItemType::Income;
-        else if (typeName == "Expense") type = ItemType::Expense;
-        else throw std::invalid_argument("Invalid item type");
+    // Returns the amount in currency units, for statistics that are not exact anyway
+    [[nodiscard]] double units() const { return fromMinorUnits(minorUnits); }
 
-        return FinancialItem(type, name, category, std::stod(amount), date, std::stod(probability));
+    constexpr BasicMoney &operator+=(BasicMoney other) {
+        minorUnits += other.minorUnits;
+        return *this;
     }
-};
-
-// CSV header for serialization
-const std::string &HEADER = "Type,Name,Category,Amount,Date,Probability";
 
-// Serializes all financial items to a file
-void serializeAllItems(const std::vector<FinancialItem> &items, const std::string &filename) {
-    std::ofstream out(filename);
-    out << HEADER << "\n";
-    for (const auto &item: items) {
-        item.serialize(out);
+    constexpr BasicMoney &operator-=(BasicMoney other) {
+        minorUnits -= other.minorUnits;
+        return *this;
     }
-}
 
-// Deserializes all financial items from a file
-void deserializeAllItems(std::vector<FinancialItem> &items, const std::string &filename) {
-    std::ifstream in(filename);
-    while (in.peek() != EOF) {
-        std::string line = "";
-        std::getline(in, line);
-        if (line == HEADER) continue;
-        items.push_back(FinancialItem::deserialize(line));
-    }
-}
+    constexpr BasicMoney operator+(BasicMoney other) const { return BasicMoney(minorUnits + other.minorUnits); }
+    constexpr BasicMoney operator-(BasicMoney other) const { return BasicMoney(minorUnits - other.minorUnits); }
+    constexpr BasicMoney operator-() const { return BasicMoney(-minorUnits); }
+    constexpr auto operator<=>(const BasicMoney &other) const = default;
+};
 
-// Manages the state of all financial items
-struct GlobalState {
-    std::vector<FinancialItem> items;
+// Formatted money in a fixed buffer, so formatting an amount never allocates
+struct MoneyText {
+    char data[48];
+    size_t length = 0;
 
-    GlobalState() {
-        load();
-    }
+    [[nodiscard]] std::string_view view() const { return {data, length}; }
+    operator std::string_view() const { return view(); }
+};
 
-    // Sorts items by date
-    void sortByDate() {
-        /**
-        *
-        Insertion Sort: This algorithm builds the final sorted array one item at a time. It is much less efficient on large lists than more advanced algorithms such as quicksort, heapsort, or merge sort.
+// Formats money as "<code> <amount>" in one pass over the digits, with the currency's group and
+// decimal separators chosen at compile time. Minor units beyond the displayed fraction digits are
+// rounded half away from zero.
+template<Currency C>
+MoneyText formatMoney(BasicMoney<C> money) {
+    using Format = CurrencyFormat<C>;
+    constexpr uint64_t dropped = Format::fractionDigits == 0 ? MINOR_UNITS_PER_UNIT
+                                 : Format::fractionDigits == 1 ? MINOR_UNITS_PER_UNIT / 10 : 1;
+    constexpr uint64_t kept = MINOR_UNITS_PER_UNIT / dropped;
 
-        Algorithm Steps:
+    uint64_t magnitude = money.minorUnits < 0 ? 0 - static_cast<uint64_t>(money.minorUnits)
+                                              : static_cast<uint64_t>(money.minorUnits);
+    magnitude = magnitude / dropped + (magnitude % dropped * 2 >= dropped ? 1 : 0);
 
-        Start from the second element (index 1) and assume the first element is sorted.
-        Compare the current element with the elements in the sorted part.
-        Shift all elements larger than the current element to the right.
-        Insert the current element into its correct position in the sorted part.
-        Repeat for all elements.
-        */
-        for (size_t i = 1; i < items.size(); ++i) {
-            FinancialItem key = items[i];
-            size_t j = i;
+    MoneyText text;
+    char *out = std::copy(Format::code.begin(), Format::code.end(), text.data);
+    *out++ = ' ';
+    if (money.minorUnits < 0 && magnitude != 0) *out++ = '-';
 
-            // Move elements of items[0..i-1], that are greater than key, to one position ahead
-            // of their current position
-            while (j > 0 && items[j - 1].getDate() > key.getDate()) {
-                items[j] = items[j - 1];
-                --j;
-            }
-            items[j] = key;
+    // Copy the integer digits, starting a group wherever the remaining digit count is a multiple of 3
+    char digits[20];
+    const char *digitsEnd = std::to_chars(digits, digits + sizeof digits, magnitude / kept).ptr;
+    for (const char *digit = digits; digit != digitsEnd; ++digit) {
+        if (digit != digits && (digitsEnd - digit) % 3 == 0) *out++ = Format::groupSeparator;
+        *out++ = *digit;
+    }
+    if constexpr (Format::fractionDigits > 0) {
+        *out++ = Format::decimalSeparator;
+        uint64_t fraction = magnitude % kept;
+        for (uint64_t place = kept / 10; place > 0; place /= 10) {
+            *out++ = static_cast<char>('0' + fraction / place % 10);
         }
     }
+    text.length = static_cast<size_t>(out - text.data);
+    return text;
+}
 
-    // Returns all items
-    [[nodiscard]] std::vector<FinancialItem> getItems() const {
-        return items;
+// Appends text as a quoted JSON string
+void appendJsonString(std::string &out, std::string_view text) {
+    out += '"';
+    for (char c: text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof escaped, "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
     }
+    out += '"';
+}
 
-    // Returns items for the current month
-    [[nodiscard]] std::vector<FinancialItem> getItemsThisMonth() const {
-        std::vector<FinancialItem> itemsThisMonth;
-        auto [currentYear, currentMonth] = parseYearMonth(getCurrentDate());
+// Parses a whole string as a number without depending on the locale; surrounding spaces are ignored
+template<typename T>
+bool parseNumber(std::string_view text, T &value) {
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+    if (!text.empty() && text.front() == '+') text.remove_prefix(1);
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return !text.empty() && error == std::errc() && end == text.data() + text.size();
+}
 
-        for (const auto &item: items) {
-            auto [year, month] = parseYearMonth(item.getDate());
-            if (year == currentYear && month == currentMonth) {
-                itemsThisMonth.push_back(item);
-            }
-        }
-        return itemsThisMonth;
-    }
+// A calendar date split into its parts
+struct CivilDate {
+    int year;
+    int month;
+    int day;
+};
 
-    // Returns all items up to the end of the current month
-    [[nodiscard]] std::vector<FinancialItem> getAllItemsBeforeEndOfMonth() const {
-        std::vector<FinancialItem> itemsBeforeEndOfMonth;
-        auto [currentYear, currentMonth] = parseYearMonth(getCurrentDate());
+// Converts a calendar date to days since 1970-01-01 (proleptic Gregorian calendar)
+int32_t daysFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int yearOfEra = year - era * 400;
+    const int dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
 
-        for (const auto &item: items) {
-            auto [year, month] = parseYearMonth(item.getDate());
-            if (year < currentYear || (year == currentYear && month <= currentMonth)) {
-                itemsBeforeEndOfMonth.push_back(item);
-            }
-        }
-        return itemsBeforeEndOfMonth;
-    }
+// Converts days since 1970-01-01 back to a calendar date
+CivilDate civilFromDays(int32_t days) {
+    days += 719468;
+    const int era = (days >= 0 ? days : days - 146096) / 146097;
+    const int dayOfEra = days - era * 146097;
+    const int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const int shiftedMonth = (5 * dayOfYear + 2) / 153;
+    const int day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+    const int month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+    return {yearOfEra + era * 400 + (month <= 2), month, day};
+}
 
-    // Saves the state to disk
-    void save() {
-        this->sortByDate();
-        try {
-            serializeAllItems(items, "financial_items.csv");
-            serializeAllItems(items, "financial_items_backup.csv");
-        } catch (const std::exception &e) {
-            std::cerr << "Error saving items: " << e.what() << std::endl;
-        }
-    }
+// Returns the number of days in a month (1-12) of the proleptic Gregorian calendar
+int daysInMonth(int year, int month) {
+    if (month == 2) return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0) ? 29 : 28;
+    return month == 4 || month == 6 || month == 9 || month == 11 ? 30 : 31;
+}
 
-    // Loads the state from disk
-    void load() {
-        try {
-            items.clear();
-            deserializeAllItems(items, "financial_items.csv");
-            this->sortByDate();
-        } catch (const std::exception &e) {
-            std::cerr << "Error loading items: " << e.what() << std::endl;
-        }
+// Parses a "YYYY-MM-DD" date into days since 1970-01-01; returns false if it is not a valid date
+bool tryParseDate(std::string_view text, int32_t &days) {
+    size_t firstDash = text.find('-', 1);
+    size_t secondDash = firstDash == std::string_view::npos ? firstDash : text.find('-', firstDash + 1);
+    int year = 0, month = 0, day = 0;
+    if (secondDash == std::string_view::npos || !parseNumber(text.substr(0, firstDash), year) ||
+        !parseNumber(text.substr(firstDash + 1, secondDash - firstDash - 1), month) ||
+        !parseNumber(text.substr(secondDash + 1), day) || month < 1 || month > 12 || day < 1 ||
+        day > daysInMonth(year, month)) {
+        return false;
     }
-};
+    days = daysFromCivil(year, month, day);
+    return true;
+}
 
-// Global state instance
-GlobalState globalState;
+// Parses a "YYYY-MM-DD" date into days since 1970-01-01
+int32_t parseDate(const std::string &dateStr) {
+    int32_t days;
+    if (!tryParseDate(dateStr, days)) throw std::invalid_argument("Invalid date: " + dateStr);
+    return days;
+}
 
-#pragma endregion Model
+// Longest text writeDate() produces
+constexpr size_t MAX_DATE_LENGTH = 16;
 
-#pragma region CLIUtility
+// Writes days since 1970-01-01 as "YYYY-MM-DD" and returns the end of the text
+char *writeDate(char *out, int32_t days) {
+    CivilDate date = civilFromDays(days);
+    auto writePadded = [&out](int value, int width) {
+        char digits[12];
+        char *end = std::to_chars(digits, digits + sizeof digits, value).ptr;
+        for (int pad = width - static_cast<int>(end - digits); pad > 0; --pad) *out++ = '0';
+        out = std::copy(digits, end, out);
+    };
+    writePadded(date.year, 4);
+    *out++ = '-';
+    writePadded(date.month, 2);
+    *out++ = '-';
+    writePadded(date.day, 2);
+    return out;
+}
 
-// Clears the console screen
-void clearScreen() {
-#ifdef _WIN32
-    system("CLS");
-#else
-    system("clear");
-#endif
+// Formats days since 1970-01-01 as "YYYY-MM-DD"
+std::string formatDate(int32_t days) {
+    char text[MAX_DATE_LENGTH];
+    return {text, writeDate(text, days)};
 }
 
-// Saves the program state to disk
-void saveProgram() {
-    globalState.save();
+// Returns today as days since 1970-01-01
+int32_t currentDay() {
+    return parseDate(getCurrentDate());
 }
 
-// Loads the program state from disk
-void loadProgram() {
-    globalState.load();
+// Returns the first day of the month containing the given day
+int32_t firstDayOfMonth(int32_t days) {
+    CivilDate date = civilFromDays(days);
+    return daysFromCivil(date.year, date.month, 1);
 }
 
-// Exits the program after saving the state
-void exitProgram() {
-    std::cout << "Exiting program...\n";
-    saveProgram();
-    exit(0);
+// Returns the last day of the month containing the given day
+int32_t lastDayOfMonth(int32_t days) {
+    CivilDate date = civilFromDays(days);
+    return date.month == 12 ? daysFromCivil(date.year + 1, 1, 1) - 1 : daysFromCivil(date.year, date.month + 1, 1) - 1;
 }
 
-// Pauses execution until the user presses Enter
-void waitToContinue() {
-    std::cout << std::endl;
-    std::cout << "Press Enter to continue...";
-    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    std::cin.get();
-    std::cout << std::endl;
+// Returns a key for the calendar month containing the given day (year * 12 + month - 1)
+int32_t monthOf(int32_t days) {
+    CivilDate date = civilFromDays(days);
+    return date.year * 12 + date.month - 1;
 }
 
-// Template function to get user input with a default value
-template<typename T>
-void getInput(const std::string &fieldName, T *variable, const T &defaultValue) {
-    std::cout << "Enter " << fieldName << " [" << defaultValue << "]: ";
-    std::string input;
-    std::getline(std::cin, input);
+// Global currency setting
+constexpr Currency CURRENCY = Currency::IDR;
 
-    if (input.empty()) {
-        *variable = defaultValue;
-    } else {
-        std::istringstream(input) >> *variable;
-    }
+// Money in the currency of the ledger
+using Money = BasicMoney<CURRENCY>;
+
+// Formats an amount in the CURRENCY setting
+std::string formatCurrency(Money amount) {
+    return std::string(formatMoney(amount).view());
 }
 
-// Displays a menu and executes the selected option
-void displayMenu(const std::vector<std::pair<std::string, std::function<void()> > > &menu) {
-    std::string choice;
-    while (true) {
-        std::cout << "\n-------- Main Menu --------\n";
-        for (size_t i = 0; i < menu.size(); ++i) {
-            std::cout << i + 1 << ". " << menu[i].first << "\n";
-        }
+#pragma endregion Utility
 
-        getInput("choice", &choice, std::string(""));
+#pragma region Concurrency
 
-        try {
-            int index = std::stoi(choice) - 1;
-            if (index >= 0 && index < static_cast<int>(menu.size())) {
-                clearScreen();
-                menu[index].second();
-                break;
-            } else {
-                std::cout << "Invalid choice. Please try again.\n";
+// Fixed-size thread pool where each worker owns a task deque and idle workers steal from the others
+class WorkStealingPool {
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue> > queues;
+    std::vector<std::thread> workers;
+    std::mutex stateMutex;
+    std::condition_variable taskAvailable;
+    size_t queuedTasks = 0;
+    bool stopping = false;
+    std::atomic<size_t> nextQueue{0};
+
+    // Takes a task from the worker's own queue (newest first) or steals from another (oldest first)
+    bool takeTask(size_t workerIndex, std::function<void()> &task) {
+        {
+            WorkerQueue &own = *queues[workerIndex];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
             }
-        } catch (const std::exception &) {
-            std::cout << "Invalid input. Please enter a number.\n";
         }
-        waitToContinue();
-        clearScreen();
+        for (size_t offset = 1; offset < queues.size(); ++offset) {
+            WorkerQueue &victim = *queues[(workerIndex + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
     }
-    waitToContinue();
-}
-
-#pragma endregion CLIUtility
-
-#pragma region Application
 
-// Calculates the financial outcome based on item occurrences
-double calculateOutcome(const std::vector<FinancialItem> &items, const std::vector<bool> &occurrence) {
-    double totalAssets = 0.0;
-    for (size_t i = 0; i < items.size(); ++i) {
-        if (occurrence[i]) {
-            if (items[i].getType() == ItemType::Expense || items[i].getType() == ItemType::Liability) {
-                totalAssets -= items[i].getAmount();
-            } else {
-                totalAssets += items[i].getAmount();
+    void workerLoop(size_t workerIndex) {
+        while (true) {
+            std::function<void()> task;
+            if (takeTask(workerIndex, task)) {
+                {
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    --queuedTasks;
+                }
+                task();
+                continue;
             }
+            std::unique_lock<std::mutex> lock(stateMutex);
+            taskAvailable.wait(lock, [this] { return stopping || queuedTasks > 0; });
+            if (stopping && queuedTasks == 0) return;
         }
     }
-    return totalAssets;
-}
 
-// Calculates the probability of a scenario based on item occurrences
-double calculateProbability(const std::vector<FinancialItem> &items, const std::vector<bool> &occurrence) {
-    double probability = 1.0;
-    for (size_t i = 0; i < items.size(); ++i) {
-        if (occurrence[i]) {
-            probability *= items[i].getProbability();
-        } else {
-            probability *= (1 - items[i].getProbability());
+public:
+    explicit WorkStealingPool(unsigned threadCount = 0) {
+        if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i < threadCount; ++i) {
+            queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
         }
     }
-    return probability;
-}
 
-// Evaluates all possible financial scenarios and returns a summary
-std::vector<KeyValuePair> evaluateScenarios(const std::vector<FinancialItem> &items) {
-    std::vector<FinancialItem> variableItems; // Items with probability less than 1
-    double fixedAssets = 0.0; // Total assets from items with probability 1
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        taskAvailable.notify_all();
+        for (auto &worker: workers) worker.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
 
-    // Separate fixed and variable items
-    for (const auto &item: items) {
-        if (item.getProbability() == 0.0) {
-            continue; // Skip impossible events
+    // Queues a task on the next worker in round-robin order
+    void submit(std::function<void()> task) {
+        WorkerQueue &queue = *queues[nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
         }
-        if (item.getProbability() == 1.0) {
-            if (item.getType() == ItemType::Expense || item.getType() == ItemType::Liability) {
-                fixedAssets -= item.getAmount(); // Subtract fixed expenses or liabilities
-            } else {
-                fixedAssets += item.getAmount(); // Add fixed assets or income
-            }
-        } else {
-            variableItems.push_back(item);
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            ++queuedTasks;
         }
+        taskAvailable.notify_one();
     }
 
-    size_t n = variableItems.size();
-    double maxAssets = -std::numeric_limits<double>::infinity();
-    double minAssets = std::numeric_limits<double>::infinity();
-    double maxProbability = 0.0;
-    double minProbability = 1.0;
-    double mostLikelyAssets = fixedAssets;
-    double leastLikelyAssets = fixedAssets;
-
-    // Iterate over all possible combinations of variable items
-
-    // If n = 3, then 1 in binary is 0001.
-    // Shifting left by 3 positions gives 1000, which is 8 in decimal, equivalent to 2^3
-    for (size_t i = 0; i < (1 << n); ++i) { //     //  (from 0 to 2^n - 1):
-        /**
-        For n = 3, the combinations are:
-                        financial item1  item2   item3
-i = 0 (binary 000): occurrence = {false, false, false}
-i = 1 (binary 001): occurrence = {true, false, false}
-i = 2 (binary 010): occurrence = {false, true, false}
-i = 3 (binary 011): occurrence = {true, true, false}
-i = 4 (binary 100): occurrence = {false, false, true}
-i = 5 (binary 101): occurrence = {true, false, true}
-i = 6 (binary 110): occurrence = {false, true, true}
-i = 7 (binary 111): occurrence = {true, true, true}
-         */
-        std::vector<bool> occurrence(n);
-        for (size_t itemIndex = 0; itemIndex < n; ++itemIndex) {
-            // Suppose i = 5 (which is 0101 in binary) and itemIndex = 2:
-            /*
-Step 1: Calculate 1 << itemIndex:
-1 << 2 gives 0100.
+    // Runs one queued task on the calling thread. Returns false if no task was queued.
+    bool runPendingTask() {
+        std::function<void()> task;
+        if (!takeTask(nextQueue.load(std::memory_order_relaxed) % queues.size(), task)) return false;
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            --queuedTasks;
+        }
+        task();
+        return true;
+    }
 
-Step 2: Perform i & (1 << itemIndex):
-0101 (binary for i)
-0100 (binary for 1 << 2)
+    [[nodiscard]] unsigned size() const {
+        return static_cast<unsigned>(workers.size());
+    }
+};
 
-Result: 0100 (since only the third bit is 1 in both)
-Step 3: Check != 0:
+// Returns the process-wide pool sized to the hardware
+WorkStealingPool &sharedPool() {
+    static WorkStealingPool pool;
+    return pool;
+}
 
-The result 0100 is not zero, so isItemIncluded is true.
-            */
-            bool isItemIncluded = (i & (1 << itemIndex)) != 0; // Check if the bit is set
-            occurrence[itemIndex] = isItemIncluded;
-        }
+// Runs body(0..count-1) on the shared pool and blocks until every call has finished. While its calls
+// are queued, the caller runs queued tasks itself, so a parallelFor inside a pool task cannot leave
+// every worker waiting for tasks that no worker is free to run.
+void parallelFor(size_t count, const std::function<void(size_t)> &body) {
+    if (count == 1) {
+        body(0);
+        return;
+    }
+    std::mutex doneMutex;
+    std::condition_variable doneCondition;
+    size_t remaining = count;
+    for (size_t index = 0; index < count; ++index) {
+        sharedPool().submit([&, index] {
+            body(index);
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (--remaining == 0) doneCondition.notify_all();
+        });
+    }
+    while (sharedPool().runPendingTask()) {
+        std::lock_guard<std::mutex> lock(doneMutex);
+        if (remaining == 0) return;
+    }
+    // Every call has been taken by a thread that will finish it
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCondition.wait(lock, [&] { return remaining == 0; });
+}
 
-        double currentAssets = fixedAssets + calculateOutcome(variableItems, occurrence);
-        double currentProbability = calculateProbability(variableItems, occurrence);
+// First-in first-out queue of bounded size between the stages of a pipeline. push() waits while the
+// queue is full, so a fast stage cannot run ahead of a slow one, and pop() waits while it is empty.
+// Closing the queue ends the pipeline in both directions: later pushes fail, and pops fail once the
+// remaining values are taken.
+template<typename T>
+class BoundedQueue {
+private:
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<T> values;
+    size_t capacity;
+    bool closed = false;
 
-        // Update best and worst asset scenarios
-        if (currentAssets > maxAssets) maxAssets = currentAssets;
-        if (currentAssets < minAssets) minAssets = currentAssets;
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {
+    }
 
-        // Update most and least likely scenarios
-        if (currentProbability > maxProbability) {
-            maxProbability = currentProbability;
-            mostLikelyAssets = currentAssets;
-        }
-        if (currentProbability < minProbability) {
-            minProbability = currentProbability;
-            leastLikelyAssets = currentAssets;
-        }
+    // Adds a value, waiting while the queue is full; returns false if the queue is closed
+    bool push(T value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || values.size() < capacity; });
+        if (closed) return false;
+        values.push_back(std::move(value));
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
     }
 
-    // Prepare results
-    std::vector<KeyValuePair> executiveSummary;
-    executiveSummary.emplace_back("", "");
-    executiveSummary.emplace_back("Scenarios Evaluation of All Budget Items", "");
-    executiveSummary.emplace_back("Projected Total Assets by The End", "");
-    executiveSummary.emplace_back("Best Case Scenario", ": " + formatCurrency(maxAssets));
-    executiveSummary.emplace_back("Worst Case Scenario", ": " + formatCurrency(minAssets));
-    executiveSummary.emplace_back("Most Likely Outcome",
-                                  ": " + formatCurrency(mostLikelyAssets) + " (" + formatToPercentage(maxProbability) +
-                                  ")");
-    executiveSummary.emplace_back("Least Likely Outcome",
-                                  ": " + formatCurrency(leastLikelyAssets) + " (" + formatToPercentage(minProbability) +
-                                  ")");
+    // Takes the oldest value, waiting while the queue is empty; returns false once it is closed and empty
+    bool pop(T &value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !values.empty(); });
+        if (values.empty()) return false;
+        value = std::move(values.front());
+        values.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
 
-    return executiveSummary;
+// Returns true if the pointer is the only owner of its object, which may then be changed in place.
+// The fence orders those changes after every read made by owners on other threads before they let go.
+template<typename T>
+bool ownsExclusively(const std::shared_ptr<T> &pointer) {
+    if (pointer.use_count() != 1) return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
 }
 
-// Displays a detailed financial summary
-void viewDetailedSummary() {
-    std::unordered_map<std::string, double> categoryToAmount;
-    double totalAssets = 0.0, currentAssets = 0.0;
+// Mutex guarding a lazily built cache of a copyable class; every copy gets its own unlocked mutex
+class CacheMutex {
+private:
+    std::mutex mutex;
 
-    for (const auto &item: globalState.getAllItemsBeforeEndOfMonth()) {
-        bool isFuture = item.getDate() > getCurrentDate();
-        if (item.getType() == ItemType::Expense) {
-            categoryToAmount[item.getCategory()] += item.getAmount();
-            totalAssets -= item.getAmount();
-            if (!isFuture) currentAssets -= item.getAmount();
-        }
+public:
+    CacheMutex() = default;
 
-        if (item.getType() == ItemType::Income) {
-            totalAssets += item.getAmount();
-            if (!isFuture) currentAssets += item.getAmount();
-        }
+    CacheMutex(const CacheMutex &) {
+    }
 
-        if (item.getType() == ItemType::Asset) {
-            totalAssets += item.getAmount();
-            if (!isFuture) currentAssets += item.getAmount();
-        }
+    CacheMutex &operator=(const CacheMutex &) {
+        return *this;
     }
 
-    // Sort and print top 3 categories
-    std::vector<std::pair<std::string, double>> sortedCategories(categoryToAmount.begin(), categoryToAmount.end());
-    std::sort(sortedCategories.begin(), sortedCategories.end(),
-              [](const std::pair<std::string, double> &a, const std::pair<std::string, double> &b) {
-                  return a.second > b.second;
-              });
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+};
 
-    std::vector<KeyValuePair> executiveSummary;
-    std::ostringstream ossTop3ExpenseCategories;
-    for (size_t i = 0; i < std::min(sortedCategories.size(), static_cast<size_t>(3)); ++i) {
-        ossTop3ExpenseCategories << i + 1 << ". " << sortedCategories[i].first << ": " << formatCurrency(
-            sortedCategories[i].second) << "\n";
-    }
-    executiveSummary.emplace_back("Summary This Month", "");
-    executiveSummary.emplace_back("Top 3 Expense by Categories", ": \n" + ossTop3ExpenseCategories.str());
+#pragma endregion Concurrency
 
-    executiveSummary.emplace_back("Projected End of Month Assets", ": " + formatCurrency(totalAssets));
-    executiveSummary.emplace_back("Current Assets", ": " + formatCurrency(currentAssets));
+#pragma region Instrumentation
 
-    auto scenarioResults = evaluateScenarios(globalState.getItems());
-    executiveSummary.insert(executiveSummary.end(), scenarioResults.begin(), scenarioResults.end());
-    printWithPadding(executiveSummary);
-}
+// Operations timed by the instrumentation. Each one is a function on a hot path of a session.
+enum class Probe : uint8_t {
+    DeserializeAllItems,
+    SerializeAllItems,
+    OpenLedgerFile,
+    WriteLedgerFile,
+    SortByDate,
+    JournalAppend,
+    SyncFile,
+    Load,
+    Save,
+    Compact,
+    ClearScreen,
+    RebuildAggregates,
+    ProjectCashFlow,
+    SummarizeScenarios,
+    SimulateScenarios,
+    EnumerateScenarios,
+    BatchCommand,
+    ClosePeriod,
+    WriteColdSegment,
+    OpenColdSegment,
+    ImportStatement,
+    Count
+};
 
-// Displays a summary of financial items for the current month
-void viewSummary() {
-    double totalAssets = 0.0;
-    double totalLiabilities = 0.0;
-    double totalIncome = 0.0;
-    double totalExpenses = 0.0;
-
-    for (const auto &item: globalState.getItemsThisMonth()) {
-        switch (item.getType()) {
-            case ItemType::Asset:
-                totalAssets += item.getAmount();
-                break;
-            case ItemType::Liability:
-                totalLiabilities += item.getAmount();
-                break;
-            case ItemType::Income:
-                totalIncome += item.getAmount();
-                break;
-            case ItemType::Expense:
-                totalExpenses += item.getAmount();
-                break;
-        }
-    }
+constexpr size_t PROBE_COUNT = static_cast<size_t>(Probe::Count);
 
-    printWithPadding({
-        {"Summary This Month", ""},
-        {"Total Assets", ": " + formatCurrency(totalAssets)},
-        {"Total Liabilities", ": " + formatCurrency(totalLiabilities)},
-        {"Total Income", ": " + formatCurrency(totalIncome)},
-        {"Total Expenses", ": " + formatCurrency(totalExpenses)}
-    });
+// Returns the name of an operation as it appears in statistics and traces
+const char *probeName(Probe probe) {
+    switch (probe) {
+        case Probe::DeserializeAllItems: return "deserializeAllItems";
+        case Probe::SerializeAllItems: return "serializeAllItems";
+        case Probe::OpenLedgerFile: return "openLedgerFile";
+        case Probe::WriteLedgerFile: return "writeLedgerFile";
+        case Probe::SortByDate: return "sortByDate";
+        case Probe::JournalAppend: return "journalAppend";
+        case Probe::SyncFile: return "syncFile";
+        case Probe::Load: return "load";
+        case Probe::Save: return "save";
+        case Probe::Compact: return "compact";
+        case Probe::ClearScreen: return "clearScreen";
+        case Probe::RebuildAggregates: return "rebuildAggregates";
+        case Probe::ProjectCashFlow: return "projectCashFlow";
+        case Probe::SummarizeScenarios: return "summarizeScenarios";
+        case Probe::SimulateScenarios: return "simulateScenarios";
+        case Probe::EnumerateScenarios: return "enumerateScenarios";
+        case Probe::BatchCommand: return "batchCommand";
+        case Probe::ClosePeriod: return "closePeriod";
+        case Probe::WriteColdSegment: return "writeColdSegment";
+        case Probe::OpenColdSegment: return "openColdSegment";
+        case Probe::ImportStatement: return "importStatement";
+        case Probe::Count: break;
+    }
+    return "unknown";
+}
+
+// Latency histogram buckets: bucket b counts calls that took less than 2^b nanoseconds
+constexpr size_t LATENCY_BUCKETS = 48;
+
+// Most spans kept for a trace; later spans are counted but dropped
+constexpr size_t MAX_TRACE_EVENTS = 1 << 20;
+
+// Counters of one operation. They are only updated while instrumentation is enabled.
+struct ProbeCounters {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> totalNanoseconds{0};
+    std::atomic<uint64_t> maxNanoseconds{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> allocatedBytes{0};
+    std::array<std::atomic<uint64_t>, LATENCY_BUCKETS> latency{};
+};
+
+// A completed call of an operation, as written to a Chrome trace
+struct TraceEvent {
+    Probe probe;
+    uint32_t thread;
+    uint64_t startNanoseconds; // Since instrumentation was enabled
+    uint64_t durationNanoseconds;
+    uint64_t allocations;
+};
+
+// Process-wide instrumentation: per-operation call counters, latency histograms and allocation counts,
+// and optionally every call as a trace span. While disabled, a timed scope costs one relaxed load.
+struct Instrumentation {
+    std::atomic<bool> tracing{false};
+    std::chrono::steady_clock::time_point origin;
+    std::array<ProbeCounters, PROBE_COUNT> probes;
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> allocatedBytes{0};
+    std::mutex traceMutex;
+    std::vector<TraceEvent> trace;
+    uint64_t droppedTraceEvents = 0;
+    std::atomic<uint32_t> nextThread{0};
+};
+
+// Set once statistics are collected. It is constant-initialized, so the allocation counter can read it
+// before any other global exists.
+std::atomic<bool> instrumentationActive{false};
+
+// Returns the process-wide instrumentation. It is never destroyed, so calls timed during exit still
+// find it.
+Instrumentation &instrumentation() {
+    static Instrumentation *instance = new Instrumentation;
+    return *instance;
+}
+
+// Allocations made by this thread while instrumentation is enabled
+thread_local uint64_t threadAllocations = 0;
+thread_local uint64_t threadAllocatedBytes = 0;
+
+// Starts collecting statistics, and trace spans as well when tracing is true
+void enableInstrumentation(bool tracing) {
+    Instrumentation &state = instrumentation();
+    state.origin = std::chrono::steady_clock::now();
+    state.tracing.store(tracing, std::memory_order_relaxed);
+    instrumentationActive.store(true, std::memory_order_release);
+}
+
+// Returns true while statistics are collected
+inline bool instrumentationEnabled() {
+    return instrumentationActive.load(std::memory_order_acquire);
+}
+
+// Returns a small number identifying the calling thread in traces
+uint32_t traceThreadId() {
+    thread_local uint32_t id = instrumentation().nextThread.fetch_add(1, std::memory_order_relaxed) + 1;
+    return id;
+}
+
+// Times the enclosing scope as one call of an operation, together with the allocations this thread
+// makes meanwhile. Nested scopes are counted in full by each of them.
+class ScopedTimer {
+private:
+    Probe probe;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+    uint64_t startAllocations = 0;
+    uint64_t startAllocatedBytes = 0;
+
+public:
+    explicit ScopedTimer(Probe probe) : probe(probe), active(instrumentationEnabled()) {
+        if (!active) return;
+        startAllocations = threadAllocations;
+        startAllocatedBytes = threadAllocatedBytes;
+        start = std::chrono::steady_clock::now();
+    }
+
+    ~ScopedTimer() {
+        if (!active) return;
+        const auto end = std::chrono::steady_clock::now();
+        const uint64_t nanoseconds = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        const uint64_t allocations = threadAllocations - startAllocations;
+
+        Instrumentation &state = instrumentation();
+        ProbeCounters &counters = state.probes[static_cast<size_t>(probe)];
+        counters.calls.fetch_add(1, std::memory_order_relaxed);
+        counters.totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        counters.allocations.fetch_add(allocations, std::memory_order_relaxed);
+        counters.allocatedBytes.fetch_add(threadAllocatedBytes - startAllocatedBytes, std::memory_order_relaxed);
+        uint64_t previousMax = counters.maxNanoseconds.load(std::memory_order_relaxed);
+        while (nanoseconds > previousMax &&
+               !counters.maxNanoseconds.compare_exchange_weak(previousMax, nanoseconds, std::memory_order_relaxed)) {
+        }
+        const size_t bucket = std::min<size_t>(std::bit_width(nanoseconds), LATENCY_BUCKETS - 1);
+        counters.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+
+        if (!state.tracing.load(std::memory_order_relaxed)) return;
+        const uint64_t offset = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(start - state.origin).count());
+        const uint32_t thread = traceThreadId();
+        std::lock_guard<std::mutex> lock(state.traceMutex);
+        if (state.trace.size() < MAX_TRACE_EVENTS) {
+            state.trace.push_back({probe, thread, offset, nanoseconds, allocations});
+        } else {
+            ++state.droppedTraceEvents;
+        }
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+};
+
+// Counts an allocation for the instrumentation, if it is enabled
+inline void countAllocation(size_t size) {
+    if (!instrumentationEnabled()) return;
+    ++threadAllocations;
+    threadAllocatedBytes += size;
+    Instrumentation &state = instrumentation();
+    state.allocations.fetch_add(1, std::memory_order_relaxed);
+    state.allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+// Every allocation goes through here so the instrumentation can count it. Array and nothrow
+// allocations forward to this one.
+void *operator new(size_t size) {
+    countAllocation(size);
+    while (true) {
+        if (void *memory = std::malloc(size == 0 ? 1 : size)) return memory;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+// Kept out of line: inlined into callers, GCC mistakes the free() for a mismatched deallocation
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void *memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    ::operator delete(memory);
+}
+
+// Returns the smallest latency bucket bound below which the given fraction of calls completed
+uint64_t latencyPercentile(const ProbeCounters &counters, uint64_t calls, double fraction) {
+    uint64_t cumulative = 0;
+    for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+        cumulative += counters.latency[bucket].load(std::memory_order_relaxed);
+        if (static_cast<double>(cumulative) >= fraction * static_cast<double>(calls)) {
+            return std::min(uint64_t{1} << bucket, counters.maxNanoseconds.load(std::memory_order_relaxed));
+        }
+    }
+    return counters.maxNanoseconds.load(std::memory_order_relaxed);
+}
+
+// Converts nanoseconds to milliseconds
+double nanosecondsToMilliseconds(uint64_t nanoseconds) {
+    return static_cast<double>(nanoseconds) / 1e6;
+}
+
+// Writes the statistics of every operation that was called as an aligned table. Percentiles are the
+// upper bounds of the histogram buckets, so they are accurate to a factor of 2.
+void writeStatisticsTable(std::ostream &out) {
+    Instrumentation &state = instrumentation();
+    if (!instrumentationEnabled()) {
+        out << "Statistics are collected when the program is started with --stats, --stats-json or --trace.\n";
+        return;
+    }
+    out << std::left << std::setw(22) << "operation" << std::right << std::setw(9) << "calls" << std::setw(12)
+        << "total ms" << std::setw(11) << "mean ms" << std::setw(11) << "p50 ms" << std::setw(11) << "p99 ms"
+        << std::setw(11) << "max ms" << std::setw(12) << "allocs" << std::setw(12) << "alloc KiB" << "\n";
+    out << std::fixed << std::setprecision(3);
+    for (size_t index = 0; index < PROBE_COUNT; ++index) {
+        const ProbeCounters &counters = state.probes[index];
+        const uint64_t calls = counters.calls.load(std::memory_order_relaxed);
+        if (calls == 0) continue;
+        const uint64_t total = counters.totalNanoseconds.load(std::memory_order_relaxed);
+        out << std::left << std::setw(22) << probeName(static_cast<Probe>(index)) << std::right << std::setw(9)
+            << calls << std::setw(12) << nanosecondsToMilliseconds(total) << std::setw(11)
+            << nanosecondsToMilliseconds(total / calls) << std::setw(11)
+            << nanosecondsToMilliseconds(latencyPercentile(counters, calls, 0.5)) << std::setw(11)
+            << nanosecondsToMilliseconds(latencyPercentile(counters, calls, 0.99)) << std::setw(11)
+            << nanosecondsToMilliseconds(counters.maxNanoseconds.load(std::memory_order_relaxed)) << std::setw(12)
+            << counters.allocations.load(std::memory_order_relaxed) << std::setw(12)
+            << counters.allocatedBytes.load(std::memory_order_relaxed) / 1024 << "\n";
+    }
+    out << std::defaultfloat << std::setprecision(6);
+    out << "Allocations: " << state.allocations.load(std::memory_order_relaxed) << " ("
+        << state.allocatedBytes.load(std::memory_order_relaxed) / 1024 << " KiB) in "
+        << nanosecondsToMilliseconds(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - state.origin).count()))
+        << " ms\n";
+}
+
+// Writes the statistics as one JSON object. Each histogram entry is [upper bound in ns, calls].
+void writeStatisticsJson(std::ostream &out) {
+    Instrumentation &state = instrumentation();
+    std::string json = "{\"elapsedMs\":";
+    json += std::to_string(nanosecondsToMilliseconds(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - state.origin)
+            .count())));
+    json += ",\"allocations\":" + std::to_string(state.allocations.load(std::memory_order_relaxed));
+    json += ",\"allocatedBytes\":" + std::to_string(state.allocatedBytes.load(std::memory_order_relaxed));
+    json += ",\"operations\":[";
+    bool first = true;
+    for (size_t index = 0; index < PROBE_COUNT; ++index) {
+        const ProbeCounters &counters = state.probes[index];
+        const uint64_t calls = counters.calls.load(std::memory_order_relaxed);
+        if (calls == 0) continue;
+        const uint64_t total = counters.totalNanoseconds.load(std::memory_order_relaxed);
+        json += first ? "{\"name\":" : ",{\"name\":";
+        first = false;
+        appendJsonString(json, probeName(static_cast<Probe>(index)));
+        json += ",\"calls\":" + std::to_string(calls);
+        json += ",\"totalMs\":" + std::to_string(nanosecondsToMilliseconds(total));
+        json += ",\"meanMs\":" + std::to_string(nanosecondsToMilliseconds(total / calls));
+        json += ",\"p50Ms\":" + std::to_string(nanosecondsToMilliseconds(latencyPercentile(counters, calls, 0.5)));
+        json += ",\"p99Ms\":" + std::to_string(nanosecondsToMilliseconds(latencyPercentile(counters, calls, 0.99)));
+        json += ",\"maxMs\":" +
+                std::to_string(nanosecondsToMilliseconds(counters.maxNanoseconds.load(std::memory_order_relaxed)));
+        json += ",\"allocations\":" + std::to_string(counters.allocations.load(std::memory_order_relaxed));
+        json += ",\"allocatedBytes\":" + std::to_string(counters.allocatedBytes.load(std::memory_order_relaxed));
+        json += ",\"histogram\":[";
+        bool firstBucket = true;
+        for (size_t bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+            const uint64_t count = counters.latency[bucket].load(std::memory_order_relaxed);
+            if (count == 0) continue;
+            json += firstBucket ? "[" : ",[";
+            firstBucket = false;
+            json += std::to_string(uint64_t{1} << bucket) + "," + std::to_string(count) + "]";
+        }
+        json += "]}";
+    }
+    json += "]}\n";
+    out << json;
+}
+
+// Writes the recorded spans in the Chrome trace-event format, which chrome://tracing and Perfetto open
+void writeChromeTrace(std::ostream &out) {
+    Instrumentation &state = instrumentation();
+    std::lock_guard<std::mutex> lock(state.traceMutex);
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":";
+    json += std::to_string(state.droppedTraceEvents) + "},\"traceEvents\":[\n";
+    char number[32];
+    for (size_t index = 0; index < state.trace.size(); ++index) {
+        const TraceEvent &event = state.trace[index];
+        if (index > 0) json += ",\n";
+        json += "{\"name\":";
+        appendJsonString(json, probeName(event.probe));
+        json += ",\"cat\":\"budget\",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(event.thread);
+        // Timestamps are in microseconds
+        std::snprintf(number, sizeof number, "%.3f", static_cast<double>(event.startNanoseconds) / 1e3);
+        json += ",\"ts\":";
+        json += number;
+        std::snprintf(number, sizeof number, "%.3f", static_cast<double>(event.durationNanoseconds) / 1e3);
+        json += ",\"dur\":";
+        json += number;
+        json += ",\"args\":{\"allocations\":" + std::to_string(event.allocations) + "}}";
+        if (json.size() >= 1 << 16) {
+            out << json;
+            json.clear();
+        }
+    }
+    json += "\n]}\n";
+    out << json;
+}
+
+// Writes statistics to a file with the given writer. Throws std::runtime_error if it cannot be written.
+void writeStatisticsFile(const std::string &filename, void (*write)(std::ostream &)) {
+    std::ofstream file(filename, std::ios::binary);
+    if (file) write(file);
+    if (!file) throw std::runtime_error("Cannot write " + filename);
+}
+
+#pragma endregion Instrumentation
+
+#pragma region Model
+
+// Enumeration for financial item types
+enum class ItemType : uint8_t {
+    Asset,
+    Liability,
+    Income,
+    Expense
+};
+
+// Number of values in ItemType
+constexpr size_t ITEM_TYPE_COUNT = 4;
+
+// Returns the type name as a string
+std::string_view itemTypeName(ItemType type) {
+    switch (type) {
+        case ItemType::Asset: return "Asset";
+        case ItemType::Liability: return "Liability";
+        case ItemType::Income: return "Income";
+        case ItemType::Expense: return "Expense";
+    }
+    return "";
+}
+
+// Parses a type name back into an ItemType
+ItemType parseItemType(std::string_view typeName) {
+    if (typeName == "Asset") return ItemType::Asset;
+    if (typeName == "Liability") return ItemType::Liability;
+    if (typeName == "Income") return ItemType::Income;
+    if (typeName == "Expense") return ItemType::Expense;
+    throw std::invalid_argument("Invalid item type: " + std::string(typeName));
+}
+
+// Represents a financial item with various attributes
+class FinancialItem {
+private:
+    std::string category;
+    ItemType type;
+    std::string name;
+    Money amount;
+    std::string date;
+    double probability;
+
+public:
+    // Constructor
+    FinancialItem(ItemType type, std::string &name, std::string &category, Money amount, std::string &date,
+                  double probability)
+        : type(type), name(name), category(category), amount(amount), date(date), probability(probability) {
+    }
+
+    // Returns the type name as a string
+    [[nodiscard]] std::string getTypeName() const {
+        return std::string(itemTypeName(type));
+    }
+
+    // Getters for item attributes
+    [[nodiscard]] std::string getName() const { return name; }
+    [[nodiscard]] ItemType getType() const { return type; }
+    [[nodiscard]] Money getAmount() const { return amount; }
+    [[nodiscard]] std::string getDate() const { return date; }
+    [[nodiscard]] double getProbability() const { return probability; }
+    [[nodiscard]] std::string getCategory() const { return category; }
+};
+
+// Units of a recurrence interval
+enum class RecurrenceUnit : uint8_t {
+    Day,
+    Week,
+    Month
+};
+
+// Returns the unit name as a string
+std::string_view recurrenceUnitName(RecurrenceUnit unit) {
+    switch (unit) {
+        case RecurrenceUnit::Day: return "day";
+        case RecurrenceUnit::Week: return "week";
+        case RecurrenceUnit::Month: return "month";
+    }
+    return "";
+}
+
+// Parses a unit name, singular or plural, back into a RecurrenceUnit
+RecurrenceUnit parseRecurrenceUnit(std::string_view unitName) {
+    if (unitName.size() > 1 && unitName.back() == 's') unitName.remove_suffix(1);
+    if (unitName == "day") return RecurrenceUnit::Day;
+    if (unitName == "week") return RecurrenceUnit::Week;
+    if (unitName == "month") return RecurrenceUnit::Month;
+    throw std::invalid_argument("Invalid recurrence unit: " + std::string(unitName));
+}
+
+// End date of a schedule that runs forever
+constexpr int32_t NO_END_DATE = std::numeric_limits<int32_t>::max();
+
+// When a recurring transaction occurs: every interval units from the start date, up to an end date
+// and at most count times. Occurrences are computed rather than stored, so a query only pays for
+// the occurrences inside its window. Monthly schedules keep the start's day of the month, moved to
+// the last day in shorter months.
+struct RecurrenceSchedule {
+    int32_t start = 0;          // Days since 1970-01-01 of the first occurrence
+    int32_t end = NO_END_DATE;  // No occurrence falls after this day
+    uint32_t count = 0;         // Maximum number of occurrences, 0 for no limit
+    uint32_t interval = 1;      // Units between occurrences, at least 1
+    RecurrenceUnit unit = RecurrenceUnit::Month;
+
+    // Returns the date of occurrence k (counted from 0), ignoring the end date and count
+    [[nodiscard]] int32_t occurrence(uint64_t k) const {
+        if (unit != RecurrenceUnit::Month) {
+            const int64_t step = int64_t{interval} * (unit == RecurrenceUnit::Week ? 7 : 1);
+            return static_cast<int32_t>(start + static_cast<int64_t>(k) * step);
+        }
+        const CivilDate first = civilFromDays(start);
+        const int64_t month = first.month - 1 + static_cast<int64_t>(k) * interval;
+        const int32_t monthStart = daysFromCivil(first.year + static_cast<int>(month / 12),
+                                                 static_cast<int>(month % 12) + 1, 1);
+        return std::min(monthStart + first.day - 1, lastDayOfMonth(monthStart));
+    }
+
+    // Returns the number of occurrences dated on or before day, in O(1)
+    [[nodiscard]] uint64_t countThrough(int32_t day) const {
+        day = std::min(day, end);
+        if (day < start) return 0;
+        uint64_t occurrences;
+        if (unit == RecurrenceUnit::Month) {
+            occurrences = static_cast<uint64_t>(monthOf(day) - monthOf(start)) / interval + 1;
+            if (occurrence(occurrences - 1) > day) --occurrences;
+        } else {
+            const int64_t step = int64_t{interval} * (unit == RecurrenceUnit::Week ? 7 : 1);
+            occurrences = static_cast<uint64_t>((int64_t{day} - start) / step) + 1;
+        }
+        return count != 0 ? std::min<uint64_t>(occurrences, count) : occurrences;
+    }
+
+    // Returns the number of occurrences dated within [firstDay, lastDay]
+    [[nodiscard]] uint64_t countBetween(int32_t firstDay, int32_t lastDay) const {
+        if (firstDay > lastDay) return 0;
+        return countThrough(lastDay) - (firstDay > start ? countThrough(firstDay - 1) : 0);
+    }
+
+    // Calls visit(date) for each occurrence dated within [firstDay, lastDay], in date order
+    template<typename Visitor>
+    void forEachOccurrence(int32_t firstDay, int32_t lastDay, Visitor visit) const {
+        if (firstDay > lastDay) return;
+        const uint64_t last = countThrough(lastDay);
+        for (uint64_t k = firstDay > start ? countThrough(firstDay - 1) : 0; k < last; ++k) visit(occurrence(k));
+    }
+};
+
+// Returns the effect of an amount of the given type on total assets (expenses and liabilities are negative)
+int64_t signedAmount(ItemType type, int64_t amount) {
+    return type == ItemType::Expense || type == ItemType::Liability ? -amount : amount;
+}
+
+// A transaction that repeats on a schedule, stored once in the ledger. Each occurrence has the
+// rule's amount and happens independently with the rule's probability.
+struct RecurrenceRule {
+    uint64_t id = 0;         // From the same sequence as item ids
+    int64_t amount = 0;      // Minor units
+    double probability = 1.0;
+    uint32_t categoryId = 0; // Ids in the ledger's string pools
+    uint32_t nameId = 0;
+    RecurrenceSchedule schedule;
+    ItemType type = ItemType::Asset;
+};
+
+static_assert(std::is_trivially_copyable_v<RecurrenceRule>);
+
+// How the members of a scenario group depend on each other
+enum class ScenarioGroupKind : uint8_t {
+    Exclusive,  // At most one member occurs; a member's probability is the chance that it is the one
+    Bundle,     // All members occur together, or none does, with the group's probability
+    Conditional // A member can only occur if the parent item does; its probability is given the parent
+};
+
+// Returns the kind name as a string
+std::string_view scenarioGroupKindName(ScenarioGroupKind kind) {
+    switch (kind) {
+        case ScenarioGroupKind::Exclusive: return "exclusive";
+        case ScenarioGroupKind::Bundle: return "bundle";
+        case ScenarioGroupKind::Conditional: return "conditional";
+    }
+    return "";
+}
+
+// Parses a kind name back into a ScenarioGroupKind
+ScenarioGroupKind parseScenarioGroupKind(std::string_view kindName) {
+    if (kindName == "exclusive") return ScenarioGroupKind::Exclusive;
+    if (kindName == "bundle") return ScenarioGroupKind::Bundle;
+    if (kindName == "conditional") return ScenarioGroupKind::Conditional;
+    throw std::invalid_argument("Invalid scenario group kind: " + std::string(kindName));
+}
+
+// Items whose outcomes are linked, which scenario evaluation treats as a single factor instead of as
+// independent items. The member item ids are kept in the ledger, group after group.
+struct ScenarioGroup {
+    uint64_t id = 0;          // From the same sequence as item ids
+    uint64_t parentId = 0;    // Item the members of a conditional group depend on, otherwise 0
+    double probability = 1.0; // Chance that a bundle occurs; unused by the other kinds
+    uint32_t nameId = 0;      // Id in the ledger's name pool
+    uint32_t memberCount = 0;
+    ScenarioGroupKind kind = ScenarioGroupKind::Exclusive;
+};
+
+static_assert(std::is_trivially_copyable_v<ScenarioGroup>);
+
+// A run of whole months whose settled items were moved to a cold segment file and replaced by closing
+// balances (see Ledger::closePeriod())
+struct ClosedPeriod {
+    int32_t firstDay = 0;  // First day of the first month
+    int32_t lastDay = 0;   // Last day of the last month
+    uint64_t itemCount = 0; // Items moved to the segment
+};
+
+static_assert(std::is_trivially_copyable_v<ClosedPeriod>);
+static_assert(sizeof(ClosedPeriod) == 16); // No padding, so it is written to the ledger file as is
+
+// Name of the items that hold the closing balances of a closed month
+constexpr std::string_view CLOSING_BALANCE_NAME = "Closing balance";
+
+// Interns strings so that each distinct value is stored once and referred to by a dense 32-bit id.
+// The first ids may come from a string table in a mapped ledger file; the lookup index over them
+// is only built when a lookup is needed.
+class StringPool {
+private:
+    // Strings added in memory, in blocks that double in size and are never moved once allocated
+    static constexpr size_t FIRST_BLOCK_STRINGS = 64;
+    static constexpr size_t BLOCK_COUNT = 34 - std::bit_width(FIRST_BLOCK_STRINGS); // Enough for 2^32 strings
+
+    // Strings added in memory and the index over every string of the pool. Copies of a pool share them
+    // the way copies of a Column share its storage: the pool that made them keeps appending in place,
+    // and each copy only reads the strings it was taken with. The index holds every string added so far,
+    // so a lookup ignores the ids at or past the pool's own size.
+    struct Strings {
+        std::array<std::vector<std::string>, BLOCK_COUNT> blocks; // Block b holds FIRST_BLOCK_STRINGS << b
+        size_t count = 0;
+        std::mutex indexMutex; // Guards ids and indexed, which the appending pool changes while copies look up
+        std::unordered_map<std::string_view, uint32_t> ids;
+        bool indexed = true;
+    };
+
+    const uint32_t *mappedOffsets = nullptr; // mappedCount + 1 offsets into mappedBytes
+    const char *mappedBytes = nullptr;
+    uint32_t mappedCount = 0;
+    std::shared_ptr<Strings> strings = std::make_shared<Strings>();
+    size_t addedCount = 0; // Strings of the shared blocks that belong to this pool
+    bool appender = true;  // Made the strings, so it is the one pool that may append to them while shared
+
+    // Returns the block that holds the string added with a given index
+    static size_t blockOf(size_t index) {
+        return std::bit_width(index / FIRST_BLOCK_STRINGS + 1) - 1;
+    }
+
+    // Returns the string added with a given index, which is stable while the strings are alive
+    [[nodiscard]] const std::string &added(size_t index) const {
+        const size_t block = blockOf(index);
+        return strings->blocks[block][index + FIRST_BLOCK_STRINGS - (FIRST_BLOCK_STRINGS << block)];
+    }
+
+    // Indexes every string if that has not been done yet; the caller holds the index mutex
+    void ensureIndexed() const {
+        if (strings->indexed) return;
+        strings->ids.reserve(mappedCount + strings->count);
+        for (uint32_t id = 0; id < mappedCount + strings->count; ++id) {
+            strings->ids.emplace(id < mappedCount ? get(id) : std::string_view(added(id - mappedCount)), id);
+        }
+        strings->indexed = true;
+    }
+
+    // Returns strings this pool may append to. A copy that adds a string first copies the strings it
+    // reads into strings of its own; the pool that made the strings appends without copying.
+    Strings &appendableStrings() {
+        if (appender && addedCount == strings->count) return *strings;
+        auto copy = std::make_shared<Strings>();
+        copy->indexed = false;
+        for (size_t index = 0; index < addedCount; ++index) appendTo(*copy, added(index));
+        strings = std::move(copy);
+        appender = true;
+        return *strings;
+    }
+
+    // Appends a string to the blocks, allocating the next block when the last one is full
+    static void appendTo(Strings &target, std::string_view value) {
+        const size_t blockIndex = blockOf(target.count);
+        std::vector<std::string> &block = target.blocks[blockIndex];
+        if (block.capacity() == 0) block.reserve(FIRST_BLOCK_STRINGS << blockIndex);
+        block.emplace_back(value);
+        ++target.count;
+    }
+
+public:
+    StringPool() = default;
+
+    // Shares the other pool's strings without copying them
+    StringPool(const StringPool &other)
+        : mappedOffsets(other.mappedOffsets), mappedBytes(other.mappedBytes), mappedCount(other.mappedCount),
+          strings(other.strings), addedCount(other.addedCount), appender(false) {
+    }
+
+    StringPool(StringPool &&other) noexcept = default;
+    StringPool &operator=(StringPool &&other) noexcept = default;
+
+    StringPool &operator=(const StringPool &other) {
+        if (this != &other) {
+            StringPool copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    // Uses a string table from a mapped file as the first ids of the pool
+    void attach(const uint32_t *offsets, const char *bytes, uint32_t count) {
+        clear();
+        mappedOffsets = offsets;
+        mappedBytes = bytes;
+        mappedCount = count;
+        strings->indexed = count == 0;
+    }
+
+    // Returns the id of a string, adding it to the pool if needed
+    uint32_t intern(std::string_view value) {
+        uint32_t id;
+        if (find(value, id)) return id;
+        Strings &own = appendableStrings();
+        id = static_cast<uint32_t>(size());
+        std::lock_guard<std::mutex> lock(own.indexMutex);
+        ensureIndexed();
+        appendTo(own, value);
+        ++addedCount;
+        own.ids.emplace(added(addedCount - 1), id);
+        return id;
+    }
+
+    // Looks up the id of a string without adding it
+    [[nodiscard]] bool find(std::string_view value, uint32_t &id) const {
+        std::lock_guard<std::mutex> lock(strings->indexMutex);
+        ensureIndexed();
+        auto it = strings->ids.find(value);
+        if (it == strings->ids.end() || it->second >= size()) return false;
+        id = it->second;
+        return true;
+    }
+
+    [[nodiscard]] std::string_view get(uint32_t id) const {
+        if (id < mappedCount) {
+            return {mappedBytes + mappedOffsets[id], mappedOffsets[id + 1] - mappedOffsets[id]};
+        }
+        return added(id - mappedCount);
+    }
+
+    [[nodiscard]] size_t size() const { return mappedCount + addedCount; }
+
+    void clear() {
+        mappedOffsets = nullptr;
+        mappedBytes = nullptr;
+        mappedCount = 0;
+        strings = std::make_shared<Strings>();
+        addedCount = 0;
+        appender = true;
+    }
+};
+
+// Array of fixed-width values that either owns its storage or refers to a read-only mapped file.
+// Copies of a column share its storage and copy it on write, so a copy is never changed by the column
+// it was taken from: a column whose storage is mapped or shared copies it into storage of its own the
+// first time it is modified. Appending is the exception. A copy only reads the values it was taken
+// with, so the column that made the storage keeps appending to its spare capacity in place.
+template<typename T>
+class Column {
+private:
+    std::shared_ptr<std::vector<T> > owned; // Null while the values are mapped
+    const T *values = nullptr;
+    size_t count = 0;
+    bool appender = false; // Made the storage, so it is the one column that may append to it while shared
+
+    // Copies the values into storage of this column's own with room for at least capacity values
+    void copyValues(size_t capacity) {
+        auto copy = std::make_shared<std::vector<T> >();
+        copy->reserve(capacity);
+        copy->assign(values, values + count);
+        owned = std::move(copy);
+        appender = true;
+        sync();
+    }
+
+    // Returns storage that no other column uses. Values appended by a column this one was copied
+    // from are dropped.
+    std::vector<T> &mutableValues() {
+        if (!owned || !ownsExclusively(owned)) {
+            copyValues(count);
+        } else if (owned->size() != count) {
+            owned->resize(count);
+        }
+        return *owned;
+    }
+
+    // Returns storage that can take another n values at the end without changing the values any copy reads
+    std::vector<T> &appendableValues(size_t n) {
+        if (owned && appender && count + n <= owned->capacity()) return *owned;
+        if (owned && ownsExclusively(owned)) return mutableValues();
+        copyValues(std::max(count + n, 2 * count));
+        return *owned;
+    }
+
+    void sync() {
+        values = owned->data();
+        count = owned->size();
+    }
+
+public:
+    Column() = default;
+
+    Column(const Column &other) : owned(other.owned), values(other.values), count(other.count) {
+    }
+
+    Column(Column &&other) noexcept = default;
+    Column &operator=(Column &&other) noexcept = default;
+
+    Column &operator=(const Column &other) {
+        if (this != &other) {
+            Column copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    [[nodiscard]] size_t size() const { return count; }
+    [[nodiscard]] const T *data() const { return values; }
+    const T &operator[](size_t index) const { return values[index]; }
+
+    // Refers to count values in a mapped file instead of owned storage
+    void attach(const T *data, size_t size) {
+        owned.reset();
+        values = data;
+        count = size;
+        appender = false;
+    }
+
+    // Changes one value. Unchanged values are skipped, so editing a row copies only the columns it changes.
+    void set(size_t index, const T &value) {
+        if (values[index] == value) return;
+        mutableValues()[index] = value;
+    }
+
+    void insert(size_t index, const T &value) {
+        if (index == count) {
+            push_back(value);
+            return;
+        }
+        auto &target = mutableValues();
+        target.insert(target.begin() + static_cast<std::ptrdiff_t>(index), value);
+        sync();
+    }
+
+    void erase(size_t index) {
+        auto &target = mutableValues();
+        target.erase(target.begin() + static_cast<std::ptrdiff_t>(index));
+        sync();
+    }
+
+    // Moves one value to another index, shifting the values in between
+    void move(size_t from, size_t to) {
+        auto first = mutableValues().begin();
+        if (from < to) {
+            std::rotate(first + from, first + from + 1, first + to + 1);
+        } else if (to < from) {
+            std::rotate(first + to, first + from, first + from + 1);
+        }
+    }
+
+    void append(const T *data, size_t size) {
+        auto &target = appendableValues(size);
+        target.insert(target.end(), data, data + size);
+        sync();
+    }
+
+    void push_back(const T &value) {
+        appendableValues(1).push_back(value);
+        sync();
+    }
+
+    void resize(size_t size) {
+        mutableValues().resize(size);
+        sync();
+    }
+
+    void reserve(size_t capacity) {
+        if (owned && ownsExclusively(owned) && owned->capacity() >= capacity) return;
+        copyValues(capacity);
+    }
+
+    void assign(std::vector<T> &&newValues) {
+        owned = std::make_shared<std::vector<T> >(std::move(newValues));
+        appender = true;
+        sync();
+    }
+
+    void clear() {
+        owned.reset();
+        values = nullptr;
+        count = 0;
+        appender = false;
+    }
+};
+
+// Rows in each segment of a SegmentedColumn but the last
+constexpr size_t COLUMN_SEGMENT_SHIFT = 14;
+constexpr size_t COLUMN_SEGMENT_ROWS = size_t{1} << COLUMN_SEGMENT_SHIFT;
+
+// Returns the row after the last one of the segment that holds a row
+constexpr size_t segmentEnd(size_t row) {
+    return (row | (COLUMN_SEGMENT_ROWS - 1)) + 1;
+}
+
+// Column of a ledger's rows, split into segments of COLUMN_SEGMENT_ROWS values that copies share and
+// copy on write one at a time, so changing a row of a column that a snapshot also reads copies one
+// segment instead of the column. Each segment either owns its storage or refers to a read-only mapped
+// file. Appending works as in Column: the column that made the last segment keeps appending to its
+// spare capacity in place, and a copy only reads the values it was taken with. Loops over many rows
+// run a segment at a time, using valuesFrom() and segmentEnd().
+template<typename T>
+class SegmentedColumn {
+private:
+    struct Segment {
+        std::shared_ptr<std::vector<T> > owned; // Null while the values are mapped
+        const T *values = nullptr;
+    };
+
+    std::vector<Segment> segments;
+    size_t count = 0;
+    bool appender = false; // Made the last segment's storage, so it may append to it while shared
+
+    // Returns how many values the last segment holds; there must be one
+    [[nodiscard]] size_t lastSegmentSize() const {
+        return count - ((segments.size() - 1) << COLUMN_SEGMENT_SHIFT);
+    }
+
+    // Returns the values of a segment in storage that no other column uses. Values appended to the
+    // last segment by a column this one was copied from are dropped.
+    T *mutableSegment(size_t index) {
+        Segment &segment = segments[index];
+        const bool last = index + 1 == segments.size();
+        const size_t size = last ? lastSegmentSize() : COLUMN_SEGMENT_ROWS;
+        if (!segment.owned || !ownsExclusively(segment.owned)) {
+            auto copy = std::make_shared<std::vector<T> >(segment.values, segment.values + size);
+            segment.owned = std::move(copy);
+            if (last) appender = true;
+        } else if (segment.owned->size() != size) {
+            segment.owned->resize(size);
+        }
+        segment.values = segment.owned->data();
+        return segment.owned->data();
+    }
+
+    // Returns the storage of the last segment, which must have room for another n values, ready to
+    // take them at the end without changing the values any copy reads
+    std::vector<T> &appendableLastSegment(size_t n) {
+        Segment &segment = segments.back();
+        const size_t size = lastSegmentSize();
+        if (segment.owned && appender && size + n <= segment.owned->capacity()) return *segment.owned;
+        const size_t capacity = std::min(COLUMN_SEGMENT_ROWS, std::max(size + n, 2 * size));
+        if (segment.owned && ownsExclusively(segment.owned)) {
+            segment.owned->resize(size);
+        } else {
+            auto copy = std::make_shared<std::vector<T> >();
+            copy->reserve(capacity);
+            copy->assign(segment.values, segment.values + size);
+            segment.owned = std::move(copy);
+        }
+        segment.owned->reserve(capacity);
+        appender = true;
+        return *segment.owned;
+    }
+
+public:
+    SegmentedColumn() = default;
+
+    SegmentedColumn(const SegmentedColumn &other) : segments(other.segments), count(other.count) {
+    }
+
+    SegmentedColumn(SegmentedColumn &&other) noexcept = default;
+    SegmentedColumn &operator=(SegmentedColumn &&other) noexcept = default;
+
+    SegmentedColumn &operator=(const SegmentedColumn &other) {
+        if (this != &other) {
+            SegmentedColumn copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    [[nodiscard]] size_t size() const { return count; }
+
+    const T &operator[](size_t index) const {
+        return segments[index >> COLUMN_SEGMENT_SHIFT].values[index & (COLUMN_SEGMENT_ROWS - 1)];
+    }
+
+    // Returns the values from a row to the end of its segment, which is segmentEnd(row) or the end of the column
+    [[nodiscard]] const T *valuesFrom(size_t row) const {
+        return segments[row >> COLUMN_SEGMENT_SHIFT].values + (row & (COLUMN_SEGMENT_ROWS - 1));
+    }
+
+    // Returns the first row in [first, last) whose value is not before(value), where before() holds for
+    // the values of a run of rows at the start of the range and for no later row, as in std::partition_point
+    template<typename Predicate>
+    [[nodiscard]] size_t partitionPoint(size_t first, size_t last, Predicate before) const {
+        while (first < last) {
+            const size_t middle = first + (last - first) / 2;
+            if (before((*this)[middle])) {
+                first = middle + 1;
+            } else {
+                last = middle;
+            }
+        }
+        return first;
+    }
+
+    // Refers to count values in a mapped file instead of owned storage
+    void attach(const T *data, size_t size) {
+        clear();
+        for (size_t offset = 0; offset < size; offset += COLUMN_SEGMENT_ROWS) {
+            segments.push_back({nullptr, data + offset});
+        }
+        count = size;
+    }
+
+    // Changes one value. Unchanged values are skipped, so editing a row copies only the segments it changes.
+    void set(size_t index, const T &value) {
+        if ((*this)[index] == value) return;
+        mutableSegment(index >> COLUMN_SEGMENT_SHIFT)[index & (COLUMN_SEGMENT_ROWS - 1)] = value;
+    }
+
+    // Inserts a value, shifting every later value one row on, a segment at a time from the end
+    void insert(size_t index, const T &value) {
+        if (index == count) {
+            push_back(value);
+            return;
+        }
+        const T inserted = value; // The value may be one of this column's, which shifting changes
+        push_back((*this)[count - 1]);
+        for (size_t segment = segments.size(); segment-- > index >> COLUMN_SEGMENT_SHIFT;) {
+            const size_t base = segment << COLUMN_SEGMENT_SHIFT;
+            const size_t first = std::max(index, base) - base;
+            const size_t last = std::min(count, base + COLUMN_SEGMENT_ROWS) - base;
+            T *values = mutableSegment(segment);
+            std::copy_backward(values + first, values + last - 1, values + last);
+            values[first] = base + first == index ? inserted : (*this)[base - 1]; // Not shifted yet
+        }
+    }
+
+    // Removes a value, shifting every later value one row back, a segment at a time from the start
+    void erase(size_t index) {
+        for (size_t segment = index >> COLUMN_SEGMENT_SHIFT; segment < segments.size(); ++segment) {
+            const size_t base = segment << COLUMN_SEGMENT_SHIFT;
+            const size_t first = std::max(index, base) - base;
+            const size_t last = std::min(count, base + COLUMN_SEGMENT_ROWS) - base;
+            T *values = mutableSegment(segment);
+            std::copy(values + first + 1, values + last, values + first);
+            if (base + last < count) values[last - 1] = (*this)[base + last]; // Not shifted yet
+        }
+        resize(count - 1);
+    }
+
+    // Moves one value to another index, shifting the values in between
+    void move(size_t from, size_t to) {
+        const T value = (*this)[from];
+        for (size_t index = from; index < to; ++index) set(index, (*this)[index + 1]);
+        for (size_t index = from; index > to; --index) set(index, (*this)[index - 1]);
+        set(to, value);
+    }
+
+    void append(const T *data, size_t size) {
+        while (size > 0) {
+            if (segments.empty() || lastSegmentSize() == COLUMN_SEGMENT_ROWS) {
+                segments.push_back({std::make_shared<std::vector<T> >(), nullptr});
+            }
+            const size_t n = std::min(size, COLUMN_SEGMENT_ROWS - lastSegmentSize());
+            std::vector<T> &target = appendableLastSegment(n);
+            target.insert(target.end(), data, data + n);
+            segments.back().values = target.data();
+            count += n;
+            data += n;
+            size -= n;
+        }
+    }
+
+    void append(const SegmentedColumn &other) {
+        for (size_t row = 0; row < other.size(); row = segmentEnd(row)) {
+            append(other.valuesFrom(row), std::min(other.size(), segmentEnd(row)) - row);
+        }
+    }
+
+    void push_back(const T &value) {
+        const T appended = value; // The value may be one of this column's, which appending can move
+        append(&appended, 1);
+    }
+
+    void resize(size_t size) {
+        if (size > count) {
+            const std::vector<T> values(size - count);
+            append(values.data(), values.size());
+            return;
+        }
+        count = size;
+        segments.resize((size + COLUMN_SEGMENT_ROWS - 1) >> COLUMN_SEGMENT_SHIFT);
+        if (segments.empty()) return;
+        Segment &segment = segments.back();
+        if (segment.owned && ownsExclusively(segment.owned)) {
+            segment.owned->resize(lastSegmentSize());
+            segment.values = segment.owned->data();
+        } else {
+            appender = false; // A copy may read the values past the new end
+        }
+    }
+
+    void reserve(size_t capacity) {
+        segments.reserve((capacity + COLUMN_SEGMENT_ROWS - 1) >> COLUMN_SEGMENT_SHIFT);
+    }
+
+    void assign(std::vector<T> &&values) {
+        clear();
+        append(values.data(), values.size());
+    }
+
+    void clear() {
+        segments.clear();
+        count = 0;
+        appender = false;
+    }
+};
+
+// Totals in minor units, indexed by ItemType
+using TypeTotals = std::array<int64_t, ITEM_TYPE_COUNT>;
+
+// Effects on total assets in minor units (expenses and liabilities are negative), split by how
+// certain they are in the way the scenario evaluation splits them
+struct OutcomeTotals {
+    int64_t certain = 0;          // Probability 1
+    int64_t gains = 0;            // Uncertain and positive
+    int64_t losses = 0;           // Uncertain and negative
+    double expectedChange = 0.0;  // Uncertain, each weighted by its probability
+
+    void add(const OutcomeTotals &other) {
+        certain += other.certain;
+        gains += other.gains;
+        losses += other.losses;
+        expectedChange += other.expectedChange;
+    }
+};
+
+// Groups the rows of a date-ordered ledger by calendar month. Each month keeps its row count and
+// per-type totals, and running totals over the months answer "everything up to month X", so period
+// queries cost a binary search over the months instead of a scan over the rows.
+class MonthIndex {
+private:
+    std::vector<int32_t> months;            // Keys from monthOf() of the months that have rows, ascending
+    std::vector<size_t> rowCounts;
+    std::vector<TypeTotals> totals;
+    std::vector<size_t> firstRows;          // Row at which each month starts, followed by the row count
+    std::vector<TypeTotals> runningTotals;  // Totals of each month and every month before it
+
+    // Recomputes the first rows and running totals, which is linear in the number of months
+    void updateRunningTotals() {
+        firstRows.assign(1, 0);
+        runningTotals.resize(months.size());
+        TypeTotals sum{};
+        for (size_t i = 0; i < months.size(); ++i) {
+            firstRows.push_back(firstRows.back() + rowCounts[i]);
+            for (size_t type = 0; type < ITEM_TYPE_COUNT; ++type) sum[type] += totals[i][type];
+            runningTotals[i] = sum;
+        }
+    }
+
+    // Returns the position of a month among the months with rows, or of the first later month
+    [[nodiscard]] size_t lowerBound(int32_t month) const {
+        return std::lower_bound(months.begin(), months.end(), month) - months.begin();
+    }
+
+public:
+    bool operator==(const MonthIndex &other) const = default;
+
+    // Builds the index from date-ordered columns
+    void build(const SegmentedColumn<ItemType> &types, const SegmentedColumn<int64_t> &amounts,
+               const SegmentedColumn<int32_t> &dates) {
+        months.clear();
+        rowCounts.clear();
+        totals.clear();
+        int32_t monthEnd = std::numeric_limits<int32_t>::min();
+        for (size_t row = 0; row < dates.size(); ++row) {
+            if (dates[row] > monthEnd) {
+                months.push_back(monthOf(dates[row]));
+                rowCounts.push_back(0);
+                totals.emplace_back();
+                monthEnd = lastDayOfMonth(dates[row]);
+            }
+            ++rowCounts.back();
+            totals.back()[static_cast<size_t>(types[row])] += amounts[row];
+        }
+        updateRunningTotals();
+    }
+
+    // Records a row added to the given month
+    void add(int32_t month, ItemType type, int64_t amount) {
+        size_t i = lowerBound(month);
+        if (i == months.size() || months[i] != month) {
+            months.insert(months.begin() + static_cast<std::ptrdiff_t>(i), month);
+            rowCounts.insert(rowCounts.begin() + static_cast<std::ptrdiff_t>(i), 0);
+            totals.insert(totals.begin() + static_cast<std::ptrdiff_t>(i), TypeTotals{});
+        }
+        ++rowCounts[i];
+        totals[i][static_cast<size_t>(type)] += amount;
+        updateRunningTotals();
+    }
+
+    // Records a row removed from the given month
+    void remove(int32_t month, ItemType type, int64_t amount) {
+        size_t i = lowerBound(month);
+        if (i == months.size() || months[i] != month) return;
+        totals[i][static_cast<size_t>(type)] -= amount;
+        if (--rowCounts[i] == 0) {
+            months.erase(months.begin() + static_cast<std::ptrdiff_t>(i));
+            rowCounts.erase(rowCounts.begin() + static_cast<std::ptrdiff_t>(i));
+            totals.erase(totals.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+        updateRunningTotals();
+    }
+
+    // Returns the totals of the rows in a month
+    [[nodiscard]] TypeTotals monthTotals(int32_t month) const {
+        size_t i = lowerBound(month);
+        return i != months.size() && months[i] == month ? totals[i] : TypeTotals{};
+    }
+
+    // Returns the totals of the rows in a month and every month before it
+    [[nodiscard]] TypeTotals totalsThrough(int32_t month) const {
+        size_t end = std::upper_bound(months.begin(), months.end(), month) - months.begin();
+        return end == 0 ? TypeTotals{} : runningTotals[end - 1];
+    }
+
+    // Returns the half-open range of rows dated within a month
+    [[nodiscard]] std::pair<size_t, size_t> monthRows(int32_t month) const {
+        size_t i = lowerBound(month);
+        size_t first = firstRows[i];
+        return {first, i != months.size() && months[i] == month ? firstRows[i + 1] : first};
+    }
+};
+
+// Hash indexes from stable item ids, names and categories to items. Row numbers change whenever an
+// earlier row is inserted or removed, so an id maps to the item's date and the row is then found by
+// binary search among the rows of that day. Names and categories map to the ids that use them, in no
+// particular order, indexed by their interned ids. Each id also records where it is in those two
+// lists, so it is removed in O(1) by moving the last id of the list into its place.
+class ItemIndex {
+private:
+    struct Entry {
+        int32_t date;
+        uint32_t namePosition;
+        uint32_t categoryPosition;
+    };
+
+    std::unordered_map<uint64_t, Entry> entryById;
+    std::vector<std::vector<uint64_t> > idsByName;
+    std::vector<std::vector<uint64_t> > idsByCategory;
+
+    // Adds an id to a list and returns its position there
+    static uint32_t addTo(std::vector<std::vector<uint64_t> > &lists, uint32_t key, uint64_t id) {
+        if (key >= lists.size()) lists.resize(key + 1);
+        lists[key].push_back(id);
+        return static_cast<uint32_t>(lists[key].size() - 1);
+    }
+
+    // Removes the id at a position of a list, moving the list's last id into its place
+    void removeAt(std::vector<uint64_t> &list, uint32_t position, uint32_t Entry::*positionField) {
+        list[position] = list.back();
+        list.pop_back();
+        if (position < list.size()) entryById.find(list[position])->second.*positionField = position;
+    }
+
+    static const std::vector<uint64_t> &listAt(const std::vector<std::vector<uint64_t> > &lists, uint32_t key) {
+        static const std::vector<uint64_t> none;
+        return key < lists.size() ? lists[key] : none;
+    }
+
+public:
+    // Builds the indexes from the ledger columns
+    void build(const SegmentedColumn<uint64_t> &ids, const SegmentedColumn<int32_t> &dates,
+               const SegmentedColumn<uint32_t> &nameIds, const SegmentedColumn<uint32_t> &categoryIds) {
+        entryById.clear();
+        entryById.reserve(ids.size());
+        idsByName.clear();
+        idsByCategory.clear();
+        for (size_t row = 0; row < ids.size(); ++row) add(ids[row], dates[row], nameIds[row], categoryIds[row]);
+    }
+
+    // Records an item
+    void add(uint64_t id, int32_t date, uint32_t nameId, uint32_t categoryId) {
+        entryById[id] = {date, addTo(idsByName, nameId, id), addTo(idsByCategory, categoryId, id)};
+    }
+
+    // Forgets an item
+    void remove(uint64_t id, uint32_t nameId, uint32_t categoryId) {
+        auto it = entryById.find(id);
+        if (it == entryById.end()) return;
+        const Entry entry = it->second;
+        entryById.erase(it);
+        removeAt(idsByName[nameId], entry.namePosition, &Entry::namePosition);
+        removeAt(idsByCategory[categoryId], entry.categoryPosition, &Entry::categoryPosition);
+    }
+
+    // Records an edit to an item. Its lists only change when its name or category does.
+    void update(uint64_t id, int32_t date, uint32_t oldNameId, uint32_t oldCategoryId, uint32_t nameId,
+                uint32_t categoryId) {
+        auto it = entryById.find(id);
+        if (it == entryById.end()) return add(id, date, nameId, categoryId);
+        it->second.date = date;
+        if (nameId != oldNameId) {
+            removeAt(idsByName[oldNameId], it->second.namePosition, &Entry::namePosition);
+            it->second.namePosition = addTo(idsByName, nameId, id);
+        }
+        if (categoryId != oldCategoryId) {
+            removeAt(idsByCategory[oldCategoryId], it->second.categoryPosition, &Entry::categoryPosition);
+            it->second.categoryPosition = addTo(idsByCategory, categoryId, id);
+        }
+    }
+
+    // Looks up the date of an item
+    [[nodiscard]] bool findDate(uint64_t id, int32_t &date) const {
+        auto it = entryById.find(id);
+        if (it == entryById.end()) return false;
+        date = it->second.date;
+        return true;
+    }
+
+    // Returns the ids of the items with a name or category
+    [[nodiscard]] const std::vector<uint64_t> &withName(uint32_t nameId) const { return listAt(idsByName, nameId); }
+    [[nodiscard]] const std::vector<uint64_t> &inCategory(uint32_t categoryId) const {
+        return listAt(idsByCategory, categoryId);
+    }
+};
+
+// Returns the parent of a hierarchical category: "Food/Groceries" is a subcategory of "Food", and a
+// category without a '/' is a subcategory of the root, "". The root has no parent.
+std::string_view parentCategory(std::string_view category) {
+    const size_t slash = category.rfind('/');
+    return slash == std::string_view::npos ? std::string_view() : category.substr(0, slash);
+}
+
+// Returns true if category is the given ancestor or one of its subcategories, at any depth
+bool isWithinCategory(std::string_view category, std::string_view ancestor) {
+    return ancestor.empty() || (category.starts_with(ancestor) && (category.size() == ancestor.size() ||
+                                                                   category[ancestor.size()] == '/'));
+}
+
+// Totals of the rows by category and date that answer "total of a type in a category between two
+// dates" in O(log n). Categories form a hierarchy by their names (see parentCategory()), and each
+// category and each parent that a category name implies is a node whose totals include those of its
+// subcategories. The root node covers the whole ledger.
+//
+// Each node keeps, per item type, the dates of its rows in ascending order and a Fenwick tree over
+// their amounts in that order, so a date range is two binary searches and two prefix sums. A row is in
+// its category's node and every ancestor's. New rows are usually the latest, which append in O(log n);
+// an earlier date is inserted in place and rebuilds that node's tree in linear time, as inserting into
+// the ledger's columns does anyway. A removed row's amount is zeroed, and a node whose rows are mostly
+// removed is compacted.
+class CategoryRangeIndex {
+public:
+    static constexpr uint32_t ROOT = 0;
+
+private:
+    static constexpr uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+
+    // The rows of one type in one node, in date order. Rows with a zero amount are left out, so a zero
+    // marks a removed row.
+    struct Series {
+        std::vector<int32_t> dates;
+        std::vector<int64_t> amounts;
+        std::vector<int64_t> tree; // Fenwick tree: tree[i - 1] sums amounts (i - lowbit(i), i]
+        size_t removed = 0;
+
+        // Returns the sum of the first count amounts
+        [[nodiscard]] int64_t prefix(size_t count) const {
+            int64_t sum = 0;
+            for (size_t i = count; i > 0; i &= i - 1) sum += tree[i - 1];
+            return sum;
+        }
+
+        void rebuild() {
+            tree = amounts;
+            for (size_t i = 1; i <= tree.size(); ++i) {
+                const size_t parent = i + (i & (0 - i));
+                if (parent <= tree.size()) tree[parent - 1] += tree[i - 1];
+            }
+        }
+
+        void add(int32_t date, int64_t amount) {
+            if (amount == 0) return;
+            if (dates.empty() || date >= dates.back()) {
+                dates.push_back(date);
+                amounts.push_back(amount);
+                const size_t i = amounts.size();
+                tree.push_back(amount + prefix(i - 1) - prefix(i - (i & (0 - i))));
+                return;
+            }
+            const auto position = std::upper_bound(dates.begin(), dates.end(), date) - dates.begin();
+            dates.insert(dates.begin() + position, date);
+            amounts.insert(amounts.begin() + position, amount);
+            rebuild();
+        }
+
+        void remove(int32_t date, int64_t amount) {
+            if (amount == 0) return;
+            const auto first = std::lower_bound(dates.begin(), dates.end(), date) - dates.begin();
+            for (auto i = static_cast<size_t>(first); i < dates.size() && dates[i] == date; ++i) {
+                if (amounts[i] != amount) continue;
+                amounts[i] = 0;
+                for (size_t node = i + 1; node <= tree.size(); node += node & (0 - node)) tree[node - 1] -= amount;
+                if (++removed * 2 > dates.size()) compact();
+                return;
+            }
+        }
+
+        // Drops the removed rows
+        void compact() {
+            size_t write = 0;
+            for (size_t read = 0; read < dates.size(); ++read) {
+                if (amounts[read] == 0) continue;
+                dates[write] = dates[read];
+                amounts[write++] = amounts[read];
+            }
+            dates.resize(write);
+            amounts.resize(write);
+            removed = 0;
+            rebuild();
+        }
+
+        // Returns the total of the rows dated within [from, to]
+        [[nodiscard]] int64_t total(int32_t from, int32_t to) const {
+            if (from > to) return 0;
+            const auto first = std::lower_bound(dates.begin(), dates.end(), from) - dates.begin();
+            const auto last = std::upper_bound(dates.begin(), dates.end(), to) - dates.begin();
+            return prefix(static_cast<size_t>(last)) - prefix(static_cast<size_t>(first));
+        }
+    };
+
+    struct Node {
+        std::string path;
+        uint32_t parent = NO_NODE;
+        std::vector<uint32_t> children;
+        std::array<Series, ITEM_TYPE_COUNT> series;
+    };
+
+    std::vector<Node> nodes;
+    std::unordered_map<std::string, uint32_t> nodeByPath;
+    std::vector<uint32_t> nodeByCategory; // Node of each category id in the ledger's pool, once seen
+
+    // Returns the node of a category path, creating it and any missing ancestors
+    uint32_t nodeFor(std::string_view path) {
+        auto it = nodeByPath.find(std::string(path));
+        if (it != nodeByPath.end()) return it->second;
+        const uint32_t parent = nodeFor(parentCategory(path));
+        const auto node = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        nodes.back().path = path;
+        nodes.back().parent = parent;
+        nodes[parent].children.push_back(node);
+        nodeByPath.emplace(path, node);
+        return node;
+    }
+
+    // Returns the node of a category id, looking its name up the first time
+    uint32_t nodeFor(const StringPool &categories, uint32_t categoryId) {
+        if (categoryId >= nodeByCategory.size()) nodeByCategory.resize(categoryId + 1, NO_NODE);
+        if (nodeByCategory[categoryId] == NO_NODE) nodeByCategory[categoryId] = nodeFor(categories.get(categoryId));
+        return nodeByCategory[categoryId];
+    }
+
+public:
+    CategoryRangeIndex() {
+        nodes.emplace_back();
+        nodeByPath.emplace("", ROOT);
+    }
+
+    // Builds the index from the ledger columns, which may be in any order
+    void build(const SegmentedColumn<ItemType> &types, const SegmentedColumn<int64_t> &amounts,
+               const SegmentedColumn<int32_t> &dates, const SegmentedColumn<uint32_t> &categoryIds,
+               const StringPool &categories) {
+        *this = CategoryRangeIndex();
+        std::vector<uint32_t> order(dates.size());
+        bool sorted = true;
+        for (size_t row = 0; row < order.size(); ++row) {
+            order[row] = static_cast<uint32_t>(row);
+            if (row > 0 && dates[row] < dates[row - 1]) sorted = false;
+        }
+        if (!sorted) {
+            std::stable_sort(order.begin(), order.end(),
+                             [&dates](uint32_t a, uint32_t b) { return dates[a] < dates[b]; });
+        }
+        for (uint32_t row: order) {
+            if (amounts[row] == 0) continue;
+            for (uint32_t node = nodeFor(categories, categoryIds[row]); node != NO_NODE; node = nodes[node].parent) {
+                Series &series = nodes[node].series[static_cast<size_t>(types[row])];
+                series.dates.push_back(dates[row]);
+                series.amounts.push_back(amounts[row]);
+            }
+        }
+        for (Node &node: nodes) {
+            for (Series &series: node.series) series.rebuild();
+        }
+    }
+
+    // Records a row
+    void add(const StringPool &categories, uint32_t categoryId, ItemType type, int32_t date, int64_t amount) {
+        for (uint32_t node = nodeFor(categories, categoryId); node != NO_NODE; node = nodes[node].parent) {
+            nodes[node].series[static_cast<size_t>(type)].add(date, amount);
+        }
+    }
+
+    // Forgets a row
+    void remove(const StringPool &categories, uint32_t categoryId, ItemType type, int32_t date, int64_t amount) {
+        for (uint32_t node = nodeFor(categories, categoryId); node != NO_NODE; node = nodes[node].parent) {
+            nodes[node].series[static_cast<size_t>(type)].remove(date, amount);
+        }
+    }
+
+    // Looks up the node of a category path; the root's path is ""
+    [[nodiscard]] bool findNode(std::string_view path, uint32_t &node) const {
+        auto it = nodeByPath.find(std::string(path));
+        if (it == nodeByPath.end()) return false;
+        node = it->second;
+        return true;
+    }
+
+    [[nodiscard]] std::string_view path(uint32_t node) const { return nodes[node].path; }
+    [[nodiscard]] const std::vector<uint32_t> &children(uint32_t node) const { return nodes[node].children; }
+
+    // Returns the total of one type of the node's rows dated within [from, to], in O(log n)
+    [[nodiscard]] int64_t total(uint32_t node, ItemType type, int32_t from, int32_t to) const {
+        return nodes[node].series[static_cast<size_t>(type)].total(from, to);
+    }
+};
+
+class FinancialItemView;
+class MappedFile;
+
+// Columnar store of financial items: one segmented array per attribute, so that scans and
+// aggregations run over packed memory instead of chasing per-item string allocations. Rows are kept
+// in date order: single rows are inserted in place, bulk loads append and sort once.
+//
+// Copying a ledger is cheap: the copy shares the columns, strings and item index, and whichever side
+// changes first copies only the column segments it touches. snapshot() uses this to give readers on other
+// threads a consistent view that later changes never affect.
+class Ledger {
+private:
+    SegmentedColumn<ItemType> types;
+    SegmentedColumn<int64_t> amounts;       // Minor units
+    SegmentedColumn<int32_t> dates;         // Days since 1970-01-01
+    SegmentedColumn<uint32_t> categoryIds;  // Ids in categoryPool
+    SegmentedColumn<uint32_t> nameIds;      // Ids in namePool
+    SegmentedColumn<double> probabilities;
+    SegmentedColumn<uint64_t> ids;          // Stable item ids, never reused
+    Column<RecurrenceRule> recurrences; // In the order they were added
+    Column<ScenarioGroup> scenarioGroups; // In the order they were added
+    Column<uint64_t> groupMembers;        // Member item ids of each scenario group, group after group
+    Column<ClosedPeriod> closedPeriods;   // In date order, each starting after the one before
+    StringPool categoryPool;
+    StringPool namePool;
+    uint64_t nextItemId = 1;
+    std::shared_ptr<const MappedFile> backingFile; // Keeps mapped columns and strings alive
+    mutable MonthIndex monthIndex;
+    mutable bool monthIndexed = false; // False after bulk changes; the index is rebuilt when next used
+    mutable std::shared_ptr<ItemIndex> itemIndex; // Likewise null until used; shared with copies
+    mutable std::shared_ptr<CategoryRangeIndex> rangeIndex; // Likewise
+    mutable CacheMutex indexMutex;     // Lets several threads build the indexes of a snapshot
+
+    // Returns the id for a new row: the given one when replaying, otherwise the next unused one
+    uint64_t claimId(uint64_t id) {
+        if (id == 0) return nextItemId++;
+        nextItemId = std::max(nextItemId, id + 1);
+        return id;
+    }
+
+    // Returns the position of a scenario group's first member in the member list
+    [[nodiscard]] size_t memberOffset(size_t index) const {
+        size_t offset = 0;
+        for (size_t i = 0; i < index; ++i) offset += scenarioGroups[i].memberCount;
+        return offset;
+    }
+
+    [[nodiscard]] const ItemIndex &lookup() const {
+        std::lock_guard<CacheMutex> lock(indexMutex);
+        if (!itemIndex) {
+            itemIndex = std::make_shared<ItemIndex>();
+            itemIndex->build(ids, dates, nameIds, categoryIds);
+        }
+        return *itemIndex;
+    }
+
+    // Returns the item index to update in place, or null if there is none. An index shared with a copy
+    // is dropped rather than copied; the next lookup rebuilds it.
+    ItemIndex *mutableItemIndex() {
+        if (itemIndex && !ownsExclusively(itemIndex)) itemIndex.reset();
+        return itemIndex.get();
+    }
+
+    [[nodiscard]] const CategoryRangeIndex &ranges() const {
+        std::lock_guard<CacheMutex> lock(indexMutex);
+        if (!rangeIndex) {
+            rangeIndex = std::make_shared<CategoryRangeIndex>();
+            rangeIndex->build(types, amounts, dates, categoryIds, categoryPool);
+        }
+        return *rangeIndex;
+    }
+
+    // Returns the range index to update in place, or null if there is none, as mutableItemIndex() does
+    CategoryRangeIndex *mutableRangeIndex() {
+        if (rangeIndex && !ownsExclusively(rangeIndex)) rangeIndex.reset();
+        return rangeIndex.get();
+    }
+
+    // Replaces a row in place; replaceRow() also keeps the date order and month index
+    void setRow(size_t row, ItemType type, int64_t amount, int32_t date, std::string_view category,
+                std::string_view name, double probability) {
+        types.set(row, type);
+        amounts.set(row, amount);
+        dates.set(row, date);
+        categoryIds.set(row, categoryPool.intern(category));
+        nameIds.set(row, namePool.intern(name));
+        probabilities.set(row, probability);
+    }
+
+    // Returns the ids of the items whose outcomes are linked by a scenario group: the members, and the
+    // parents of conditional groups
+    [[nodiscard]] std::unordered_set<uint64_t> groupedItemIds() const {
+        std::unordered_set<uint64_t> grouped(groupMembers.data(), groupMembers.data() + groupMembers.size());
+        for (size_t index = 0; index < scenarioGroups.size(); ++index) {
+            if (scenarioGroups[index].parentId != 0) grouped.insert(scenarioGroups[index].parentId);
+        }
+        return grouped;
+    }
+
+    // Returns true if a row is settled: certain to occur and in no scenario group, so that only its
+    // amount matters to any summary
+    [[nodiscard]] bool isSettled(size_t row, const std::unordered_set<uint64_t> &grouped) const {
+        return probabilities[row] == 1.0 && !grouped.contains(ids[row]);
+    }
+
+    // Returns the rows in [firstRow, lastRow) of the rows dated within [firstDay, lastDay]
+    [[nodiscard]] std::pair<size_t, size_t> rowsBetween(int32_t firstDay, int32_t lastDay) const {
+        return {dates.partitionPoint(0, size(), [firstDay](int32_t date) { return date < firstDay; }),
+                dates.partitionPoint(0, size(), [lastDay](int32_t date) { return date <= lastDay; })};
+    }
+
+    // Throws std::invalid_argument unless [firstDay, lastDay] is a run of whole months after the last
+    // closed period
+    void checkClosablePeriod(int32_t firstDay, int32_t lastDay) const {
+        if (firstDay != firstDayOfMonth(firstDay) || lastDay != lastDayOfMonth(lastDay) || lastDay < firstDay) {
+            throw std::invalid_argument("A closed period must be a run of whole months");
+        }
+        if (closedPeriods.size() > 0 && firstDay <= closedPeriods[closedPeriods.size() - 1].lastDay) {
+            throw std::invalid_argument("The period overlaps one that is already closed");
+        }
+    }
+
+    friend void writeLedgerFile(const Ledger &items, const std::string &filename, uint64_t journalSequence,
+                                const std::string &backupFilename);
+    friend Ledger openLedgerFile(const std::string &filename, uint64_t *journalSequence);
+
+public:
+    [[nodiscard]] size_t size() const { return types.size(); }
+    [[nodiscard]] bool empty() const { return types.size() == 0; }
+
+    void reserve(size_t capacity) {
+        types.reserve(capacity);
+        amounts.reserve(capacity);
+        dates.reserve(capacity);
+        categoryIds.reserve(capacity);
+        nameIds.reserve(capacity);
+        probabilities.reserve(capacity);
+        ids.reserve(capacity);
+    }
+
+    void clear() {
+        types.clear();
+        amounts.clear();
+        dates.clear();
+        categoryIds.clear();
+        nameIds.clear();
+        probabilities.clear();
+        ids.clear();
+        recurrences.clear();
+        scenarioGroups.clear();
+        groupMembers.clear();
+        closedPeriods.clear();
+        categoryPool.clear();
+        namePool.clear();
+        nextItemId = 1;
+        backingFile.reset();
+        monthIndexed = false;
+        itemIndex.reset();
+        rangeIndex.reset();
+    }
+
+    // Inserts an item in date order, converting it to the packed representation, and returns its row
+    size_t insert(const FinancialItem &item) {
+        if (static_cast<size_t>(item.getType()) >= ITEM_TYPE_COUNT) {
+            throw std::invalid_argument("Invalid item type");
+        }
+        return insertRow(item.getType(), item.getAmount().minorUnits, parseDate(item.getDate()),
+                         item.getCategory(), item.getName(), item.getProbability());
+    }
+
+    // Replaces the item at the given row and returns the row it moved to to stay in date order
+    size_t set(size_t row, const FinancialItem &item) {
+        if (static_cast<size_t>(item.getType()) >= ITEM_TYPE_COUNT) {
+            throw std::invalid_argument("Invalid item type");
+        }
+        return replaceRow(row, item.getType(), item.getAmount().minorUnits, parseDate(item.getDate()),
+                          item.getCategory(), item.getName(), item.getProbability());
+    }
+
+    // Inserts a packed row after all rows dated on or before it, so the ledger stays in date order,
+    // and returns its index. The position is found by binary search. The row gets the given id, or a
+    // new one if id is 0.
+    size_t insertRow(ItemType type, int64_t amount, int32_t date, std::string_view category, std::string_view name,
+                     double probability, uint64_t id = 0) {
+        const size_t row = dates.partitionPoint(0, size(), [date](int32_t day) { return day <= date; });
+        if (row == size()) {
+            appendRow(type, amount, date, category, name, probability, id);
+            return row;
+        }
+        types.insert(row, type);
+        amounts.insert(row, amount);
+        dates.insert(row, date);
+        categoryIds.insert(row, categoryPool.intern(category));
+        nameIds.insert(row, namePool.intern(name));
+        probabilities.insert(row, probability);
+        ids.insert(row, claimId(id));
+        if (monthIndexed) monthIndex.add(monthOf(date), type, amount);
+        if (ItemIndex *index = mutableItemIndex()) index->add(ids[row], date, nameIds[row], categoryIds[row]);
+        if (CategoryRangeIndex *index = mutableRangeIndex()) {
+            index->add(categoryPool, categoryIds[row], type, date, amount);
+        }
+        return row;
+    }
+
+    // Replaces a packed row. If its new date no longer fits between its neighbours, the row moves after
+    // the rows dated on or before it, keeping the ledger in date order. Returns the row's new index.
+    size_t replaceRow(size_t row, ItemType type, int64_t amount, int32_t date, std::string_view category,
+                      std::string_view name, double probability) {
+        CategoryRangeIndex *ranges = mutableRangeIndex();
+        const uint32_t oldNameId = nameIds[row], oldCategoryId = categoryIds[row];
+        if (monthIndexed) monthIndex.remove(monthOf(dates[row]), types[row], amounts[row]);
+        if (ranges) ranges->remove(categoryPool, categoryIds[row], types[row], dates[row], amounts[row]);
+        setRow(row, type, amount, date, category, name, probability);
+        if (monthIndexed) monthIndex.add(monthOf(date), type, amount);
+        if (ItemIndex *index = mutableItemIndex()) {
+            index->update(ids[row], date, oldNameId, oldCategoryId, nameIds[row], categoryIds[row]);
+        }
+        if (ranges) ranges->add(categoryPool, categoryIds[row], type, date, amount);
+        auto onOrBefore = [date](int32_t day) { return day <= date; };
+        size_t target = row;
+        if (row > 0 && dates[row - 1] > date) {
+            target = dates.partitionPoint(0, row, onOrBefore);
+        } else if (row + 1 < size() && dates[row + 1] < date) {
+            target = dates.partitionPoint(row + 1, size(), onOrBefore) - 1;
+        }
+        if (target != row) {
+            types.move(row, target);
+            amounts.move(row, target);
+            dates.move(row, target);
+            categoryIds.move(row, target);
+            nameIds.move(row, target);
+            probabilities.move(row, target);
+            ids.move(row, target);
+        }
+        return target;
+    }
+
+    // Appends a packed row without regard to date order. Bulk loaders append all rows this way and
+    // then call sortByDate() once. The row gets the given id, or a new one if id is 0.
+    void appendRow(ItemType type, int64_t amount, int32_t date, std::string_view category, std::string_view name,
+                   double probability, uint64_t id = 0) {
+        if (!empty() && date < dates[size() - 1]) {
+            // Inserting rows out of order one at a time would rebuild the range index for each
+            monthIndexed = false;
+            rangeIndex.reset();
+        } else if (monthIndexed) {
+            monthIndex.add(monthOf(date), type, amount);
+        }
+        types.push_back(type);
+        amounts.push_back(amount);
+        dates.push_back(date);
+        categoryIds.push_back(categoryPool.intern(category));
+        nameIds.push_back(namePool.intern(name));
+        probabilities.push_back(probability);
+        ids.push_back(claimId(id));
+        if (ItemIndex *index = mutableItemIndex()) {
+            index->add(ids[size() - 1], date, nameIds[size() - 1], categoryIds[size() - 1]);
+        }
+        if (CategoryRangeIndex *index = mutableRangeIndex()) {
+            index->add(categoryPool, categoryIds[size() - 1], type, date, amount);
+        }
+    }
+
+    // Appends every row of another ledger without regard to date order, translating its string ids
+    // into this ledger's pools. The rows get new item ids.
+    void append(const Ledger &other) {
+        auto appendIds = [](SegmentedColumn<uint32_t> &target, const SegmentedColumn<uint32_t> &source,
+                            StringPool &pool, const StringPool &sourcePool) {
+            std::vector<uint32_t> idMap(sourcePool.size());
+            for (uint32_t id = 0; id < idMap.size(); ++id) idMap[id] = pool.intern(sourcePool.get(id));
+            std::vector<uint32_t> ids(source.size());
+            for (size_t row = 0; row < ids.size(); ++row) ids[row] = idMap[source[row]];
+            target.append(ids.data(), ids.size());
+        };
+        types.append(other.types);
+        amounts.append(other.amounts);
+        dates.append(other.dates);
+        appendIds(categoryIds, other.categoryIds, categoryPool, other.categoryPool);
+        appendIds(nameIds, other.nameIds, namePool, other.namePool);
+        probabilities.append(other.probabilities);
+        std::vector<uint64_t> newIds(other.size());
+        for (uint64_t &id: newIds) id = nextItemId++;
+        ids.append(newIds.data(), newIds.size());
+        for (size_t index = 0; index < other.recurrenceCount(); ++index) {
+            const RecurrenceRule &rule = other.recurrence(index);
+            insertRecurrence(rule.type, rule.amount, other.categoryPool.get(rule.categoryId),
+                             other.namePool.get(rule.nameId), rule.probability, rule.schedule);
+        }
+
+        // Scenario groups refer to the other ledger's item ids, so they are translated to the new ones.
+        // Members that no longer exist there are left out.
+        if (other.scenarioGroupCount() > 0) {
+            std::unordered_map<uint64_t, uint64_t> idMap;
+            for (size_t row = 0; row < other.size(); ++row) idMap.emplace(other.id(row), newIds[row]);
+            for (size_t index = 0; index < other.scenarioGroupCount(); ++index) {
+                ScenarioGroup group = other.scenarioGroup(index);
+                auto parent = idMap.find(group.parentId);
+                if (group.kind == ScenarioGroupKind::Conditional && parent == idMap.end()) continue;
+                group.parentId = parent == idMap.end() ? 0 : parent->second;
+                group.nameId = namePool.intern(other.namePool.get(group.nameId));
+                group.memberCount = 0;
+                for (uint64_t member: other.scenarioGroupMembers(index)) {
+                    auto it = idMap.find(member);
+                    if (it == idMap.end()) continue;
+                    groupMembers.push_back(it->second);
+                    ++group.memberCount;
+                }
+                group.id = claimId(0);
+                scenarioGroups.push_back(group);
+            }
+        }
+        monthIndexed = false;
+        itemIndex.reset();
+        rangeIndex.reset();
+    }
+
+    // Adds a recurring item that first occurs on the item's date and returns its id
+    uint64_t addRecurrence(const FinancialItem &item, RecurrenceSchedule schedule) {
+        if (static_cast<size_t>(item.getType()) >= ITEM_TYPE_COUNT) {
+            throw std::invalid_argument("Invalid item type");
+        }
+        schedule.start = parseDate(item.getDate());
+        return insertRecurrence(item.getType(), item.getAmount().minorUnits, item.getCategory(), item.getName(),
+                                item.getProbability(), schedule);
+    }
+
+    // Adds a recurrence rule and returns its id, which is the given one or a new one if id is 0.
+    // Throws std::invalid_argument if the schedule is invalid.
+    uint64_t insertRecurrence(ItemType type, int64_t amount, std::string_view category, std::string_view name,
+                              double probability, const RecurrenceSchedule &schedule, uint64_t id = 0) {
+        if (schedule.interval == 0) throw std::invalid_argument("Recurrence interval must be at least 1");
+        if (schedule.end < schedule.start) throw std::invalid_argument("Recurrence ends before it starts");
+        if (static_cast<size_t>(schedule.unit) > static_cast<size_t>(RecurrenceUnit::Month)) {
+            throw std::invalid_argument("Invalid recurrence unit");
+        }
+        RecurrenceRule rule;
+        rule.type = type;
+        rule.amount = amount;
+        rule.probability = probability;
+        rule.categoryId = categoryPool.intern(category);
+        rule.nameId = namePool.intern(name);
+        rule.schedule = schedule;
+        rule.id = claimId(id);
+        recurrences.push_back(rule);
+        return rule.id;
+    }
+
+    // Removes the recurrence rule with the given id; returns false if there is none
+    bool eraseRecurrence(uint64_t id) {
+        size_t index;
+        if (!findRecurrence(id, index)) return false;
+        recurrences.erase(index);
+        return true;
+    }
+
+    // Finds a recurrence rule by id. There are few rules, so they are searched in order.
+    [[nodiscard]] bool findRecurrence(uint64_t id, size_t &index) const {
+        const RecurrenceRule *first = recurrences.data(), *last = first + recurrences.size();
+        const RecurrenceRule *it = std::find_if(first, last,
+                                                [id](const RecurrenceRule &rule) { return rule.id == id; });
+        index = it - first;
+        return it != last;
+    }
+
+    [[nodiscard]] size_t recurrenceCount() const { return recurrences.size(); }
+    [[nodiscard]] const RecurrenceRule &recurrence(size_t index) const { return recurrences[index]; }
+
+    // Sums the occurrences of each item type's recurrence rules dated within [firstDay, lastDay].
+    // Each rule's occurrences are counted, not expanded, so the cost does not depend on the window.
+    [[nodiscard]] TypeTotals recurringTotals(int32_t firstDay, int32_t lastDay) const {
+        TypeTotals totals{};
+        for (size_t index = 0; index < recurrences.size(); ++index) {
+            const RecurrenceRule &rule = recurrences[index];
+            totals[static_cast<size_t>(rule.type)] +=
+                static_cast<int64_t>(rule.schedule.countBetween(firstDay, lastDay)) * rule.amount;
+        }
+        return totals;
+    }
+
+    // Adds a scenario group over existing items and returns its id, which is the given one or a new one if
+    // id is 0. An item can be a member of one group only, and conditional groups cannot be nested: the
+    // parent cannot be a member of another conditional group, nor a member the parent of one.
+    // Throws std::invalid_argument if the group is invalid.
+    uint64_t insertScenarioGroup(ScenarioGroupKind kind, std::string_view name, double probability,
+                                 uint64_t parentId, const std::vector<uint64_t> &memberIds, uint64_t id = 0) {
+        if (static_cast<size_t>(kind) > static_cast<size_t>(ScenarioGroupKind::Conditional)) {
+            throw std::invalid_argument("Invalid scenario group kind");
+        }
+        const size_t minimumMembers = kind == ScenarioGroupKind::Conditional ? 1 : 2;
+        if (memberIds.size() < minimumMembers) {
+            throw std::invalid_argument(std::string("A ") + std::string(scenarioGroupKindName(kind)) +
+                                        " group needs at least " + std::to_string(minimumMembers) +
+                                        (minimumMembers == 1 ? " member" : " members"));
+        }
+        if (kind == ScenarioGroupKind::Bundle && !(probability >= 0.0 && probability <= 1.0)) {
+            throw std::invalid_argument("Bundle probability must be between 0 and 1");
+        }
+
+        // Where every item already in a group stands: the kind of group it belongs to, and whether it
+        // is the parent of a conditional group
+        std::unordered_map<uint64_t, ScenarioGroupKind> memberships;
+        std::vector<uint64_t> parents;
+        for (size_t index = 0, offset = 0; index < scenarioGroups.size(); ++index) {
+            const ScenarioGroup &group = scenarioGroups[index];
+            for (size_t i = 0; i < group.memberCount; ++i) memberships.emplace(groupMembers[offset + i], group.kind);
+            if (group.kind == ScenarioGroupKind::Conditional) parents.push_back(group.parentId);
+            offset += group.memberCount;
+        }
+
+        size_t row;
+        double exclusiveProbability = 0.0;
+        for (size_t i = 0; i < memberIds.size(); ++i) {
+            const std::string member = "Item #" + std::to_string(memberIds[i]);
+            if (!findRow(memberIds[i], row)) throw std::invalid_argument(member + " does not exist");
+            if (std::find(memberIds.begin(), memberIds.begin() + i, memberIds[i]) != memberIds.begin() + i) {
+                throw std::invalid_argument(member + " is listed twice");
+            }
+            if (memberships.count(memberIds[i])) throw std::invalid_argument(member + " is already in a group");
+            if (kind == ScenarioGroupKind::Conditional &&
+                std::find(parents.begin(), parents.end(), memberIds[i]) != parents.end()) {
+                throw std::invalid_argument(member + " is the parent of a conditional group");
+            }
+            exclusiveProbability += probabilities[row];
+        }
+        if (kind == ScenarioGroupKind::Exclusive && exclusiveProbability > 1.0 + 1e-9) {
+            throw std::invalid_argument("The probabilities of exclusive items add up to more than 1");
+        }
+        if (kind == ScenarioGroupKind::Conditional) {
+            const std::string parent = "Parent item #" + std::to_string(parentId);
+            if (!findRow(parentId, row)) throw std::invalid_argument(parent + " does not exist");
+            if (std::find(memberIds.begin(), memberIds.end(), parentId) != memberIds.end()) {
+                throw std::invalid_argument(parent + " cannot also be a member");
+            }
+            auto membership = memberships.find(parentId);
+            if (membership != memberships.end() && membership->second == ScenarioGroupKind::Conditional) {
+                throw std::invalid_argument(parent + " is itself conditional");
+            }
+        } else {
+            parentId = 0;
+        }
+
+        ScenarioGroup group;
+        group.kind = kind;
+        group.parentId = parentId;
+        group.probability = kind == ScenarioGroupKind::Bundle ? probability : 1.0;
+        group.nameId = namePool.intern(name);
+        group.memberCount = static_cast<uint32_t>(memberIds.size());
+        group.id = claimId(id);
+        groupMembers.append(memberIds.data(), memberIds.size());
+        scenarioGroups.push_back(group);
+        return group.id;
+    }
+
+    // Removes the scenario group with the given id; returns false if there is none. Its items stay.
+    bool eraseScenarioGroup(uint64_t id) {
+        size_t index;
+        if (!findScenarioGroup(id, index)) return false;
+        const size_t offset = memberOffset(index);
+        for (size_t i = 0; i < scenarioGroups[index].memberCount; ++i) groupMembers.erase(offset);
+        scenarioGroups.erase(index);
+        return true;
+    }
+
+    // Finds a scenario group by id. There are few groups, so they are searched in order.
+    [[nodiscard]] bool findScenarioGroup(uint64_t id, size_t &index) const {
+        const ScenarioGroup *first = scenarioGroups.data(), *last = first + scenarioGroups.size();
+        const ScenarioGroup *it = std::find_if(first, last,
+                                               [id](const ScenarioGroup &group) { return group.id == id; });
+        index = it - first;
+        return it != last;
+    }
+
+    [[nodiscard]] size_t scenarioGroupCount() const { return scenarioGroups.size(); }
+    [[nodiscard]] const ScenarioGroup &scenarioGroup(size_t index) const { return scenarioGroups[index]; }
+
+    // Returns the item ids of a scenario group's members. Deleting an item does not remove it from its
+    // group, so some of them may no longer exist.
+    [[nodiscard]] std::span<const uint64_t> scenarioGroupMembers(size_t index) const {
+        return {groupMembers.data() + memberOffset(index), scenarioGroups[index].memberCount};
+    }
+
+    // Returns a copy of the settled rows dated within [firstDay, lastDay], with their ids: the rows that
+    // closePeriod() moves out of the ledger
+    [[nodiscard]] Ledger settledRows(int32_t firstDay, int32_t lastDay) const {
+        const std::unordered_set<uint64_t> grouped = groupedItemIds();
+        const auto [firstRow, lastRow] = rowsBetween(firstDay, lastDay);
+        Ledger settled;
+        for (size_t row = firstRow; row < lastRow; ++row) {
+            if (!isSettled(row, grouped)) continue;
+            settled.appendRow(types[row], amounts[row], dates[row], category(row), name(row), 1.0, ids[row]);
+        }
+        return settled;
+    }
+
+    // Closes the whole months within [firstDay, lastDay], which must follow the last closed period:
+    // removes their settled rows and adds, for each month, item type and category, one settled row
+    // with their total dated on the last day of the month, named CLOSING_BALANCE_NAME. Every monthly
+    // total, projection and scenario evaluation is unchanged; uncertain and grouped items stay as
+    // they are. The caller keeps the removed rows, taken with settledRows() first. Returns how many
+    // rows were removed. Throws std::invalid_argument if the period cannot be closed.
+    size_t closePeriod(int32_t firstDay, int32_t lastDay) {
+        checkClosablePeriod(firstDay, lastDay);
+        const std::unordered_set<uint64_t> grouped = groupedItemIds();
+        const auto [firstRow, lastRow] = rowsBetween(firstDay, lastDay);
+        // Totals by last day of the month, category and type
+        std::map<std::tuple<int32_t, uint32_t, ItemType>, int64_t> balances;
+        for (size_t row = firstRow; row < lastRow; ++row) {
+            if (!isSettled(row, grouped)) continue;
+            balances[{lastDayOfMonth(dates[row]), categoryIds[row], types[row]}] += amounts[row];
+        }
+        const size_t closed = eraseIf([&](size_t row) {
+            return row >= firstRow && row < lastRow && isSettled(row, grouped);
+        });
+        for (const auto &[key, total]: balances) {
+            if (total == 0) continue;
+            const auto &[monthEnd, categoryId, type] = key;
+            const std::string categoryName(categoryPool.get(categoryId));
+            appendRow(type, total, monthEnd, categoryName, CLOSING_BALANCE_NAME, 1.0);
+        }
+        sortByDate();
+        closedPeriods.push_back({firstDay, lastDay, closed});
+        return closed;
+    }
+
+    [[nodiscard]] size_t closedPeriodCount() const { return closedPeriods.size(); }
+    [[nodiscard]] const ClosedPeriod &closedPeriod(size_t index) const { return closedPeriods[index]; }
+
+    // Finds the closed period that contains a day
+    [[nodiscard]] bool findClosedPeriod(int32_t day, size_t &index) const {
+        const ClosedPeriod *first = closedPeriods.data(), *last = first + closedPeriods.size();
+        const ClosedPeriod *it = std::lower_bound(first, last, day, [](const ClosedPeriod &period, int32_t day) {
+            return period.lastDay < day;
+        });
+        index = it - first;
+        return it != last && it->firstDay <= day;
+    }
+
+    // Removes one row, keeping the order of the rest
+    void eraseRow(size_t row) {
+        if (monthIndexed) monthIndex.remove(monthOf(dates[row]), types[row], amounts[row]);
+        if (ItemIndex *index = mutableItemIndex()) index->remove(ids[row], nameIds[row], categoryIds[row]);
+        if (CategoryRangeIndex *index = mutableRangeIndex()) {
+            index->remove(categoryPool, categoryIds[row], types[row], dates[row], amounts[row]);
+        }
+        types.erase(row);
+        amounts.erase(row);
+        dates.erase(row);
+        categoryIds.erase(row);
+        nameIds.erase(row);
+        probabilities.erase(row);
+        ids.erase(row);
+    }
+
+    // Removes the item with the given id; returns false if there is none
+    bool eraseById(uint64_t id) {
+        size_t row;
+        if (!findRow(id, row)) return false;
+        eraseRow(row);
+        return true;
+    }
+
+    // Removes every item with the given name and returns how many were removed. The matches are found
+    // through the item index, and the later rows then shift back in one pass, updating the indexes.
+    size_t eraseByName(std::string_view name) {
+        uint32_t nameId;
+        if (!namePool.find(name, nameId)) return 0;
+        const std::vector<uint64_t> &matches = lookup().withName(nameId);
+        if (matches.size() <= 1) return !matches.empty() && eraseById(matches.front()) ? 1 : 0;
+        std::vector<size_t> rows;
+        rows.reserve(matches.size());
+        size_t row;
+        for (uint64_t id: matches) {
+            if (findRow(id, row)) rows.push_back(row);
+        }
+        std::sort(rows.begin(), rows.end());
+        eraseRows(rows);
+        return rows.size();
+    }
+
+    // Removes the given rows, which must be in ascending order, keeping the order of the rest. The
+    // indexes are updated row by row rather than dropped.
+    void eraseRows(const std::vector<size_t> &rows) {
+        if (rows.empty()) return;
+        ItemIndex *index = mutableItemIndex();
+        CategoryRangeIndex *ranges = mutableRangeIndex();
+        for (size_t row: rows) {
+            if (monthIndexed) monthIndex.remove(monthOf(dates[row]), types[row], amounts[row]);
+            if (index) index->remove(ids[row], nameIds[row], categoryIds[row]);
+            if (ranges) ranges->remove(categoryPool, categoryIds[row], types[row], dates[row], amounts[row]);
+        }
+        size_t next = 0;
+        compactRows([&rows, &next](size_t row) {
+            if (next == rows.size() || rows[next] != row) return false;
+            ++next;
+            return true;
+        }, rows.front());
+    }
+
+    // Removes every row for which shouldErase(row) is true, keeping the order of the rest
+    template<typename Predicate>
+    size_t eraseIf(Predicate shouldErase) {
+        size_t erased = compactRows(shouldErase, 0);
+        if (erased > 0) {
+            monthIndexed = false;
+            itemIndex.reset();
+            rangeIndex.reset();
+        }
+        return erased;
+    }
+
+    // Shifts back the rows from first on for which shouldErase(row) is false, calling it once for each
+    // row in ascending order, and returns how many were removed. The indexes are left to the caller.
+    template<typename Predicate>
+    size_t compactRows(Predicate shouldErase, size_t first) {
+        size_t write = first;
+        for (size_t read = first; read < size(); ++read) {
+            if (shouldErase(read)) continue;
+            if (write != read) {
+                types.set(write, types[read]);
+                amounts.set(write, amounts[read]);
+                dates.set(write, dates[read]);
+                categoryIds.set(write, categoryIds[read]);
+                nameIds.set(write, nameIds[read]);
+                probabilities.set(write, probabilities[read]);
+                ids.set(write, ids[read]);
+            }
+            ++write;
+        }
+        size_t erased = size() - write;
+        types.resize(write);
+        amounts.resize(write);
+        dates.resize(write);
+        categoryIds.resize(write);
+        nameIds.resize(write);
+        probabilities.resize(write);
+        ids.resize(write);
+        return erased;
+    }
+
+    // Reorders the rows so that new row i is old row order[i]
+    void permute(const std::vector<uint32_t> &order) {
+        auto gather = [&order](auto &column) {
+            std::vector<std::remove_cv_t<std::remove_reference_t<decltype(column[0])> > > reordered(order.size());
+            for (size_t i = 0; i < order.size(); ++i) reordered[i] = column[order[i]];
+            column.assign(std::move(reordered));
+        };
+        gather(types);
+        gather(amounts);
+        gather(dates);
+        gather(categoryIds);
+        gather(nameIds);
+        gather(probabilities);
+        gather(ids);
+        monthIndexed = false;
+    }
+
+    // Sorts rows by date, keeping the existing order of rows on the same day. Each row is packed into
+    // a 64-bit key (biased date above the row index) and the keys are radix sorted a byte at a time,
+    // skipping bytes on which all dates agree; the columns are then permuted once.
+    void sortByDate() {
+        ScopedTimer timer(Probe::SortByDate);
+        if (isSortedByDate()) return;
+        const size_t count = size();
+        std::vector<uint64_t> keys(count), buffer(count);
+        for (size_t row = 0; row < count; ++row) {
+            keys[row] = (uint64_t{static_cast<uint32_t>(dates[row]) ^ 0x80000000u} << 32) | row;
+        }
+        for (unsigned shift = 32; shift < 64; shift += 8) {
+            std::array<size_t, 256> counts{};
+            for (uint64_t key: keys) ++counts[(key >> shift) & 0xFF];
+            if (counts[(keys[0] >> shift) & 0xFF] == count) continue;
+            size_t offset = 0;
+            for (size_t &bucket: counts) {
+                size_t bucketSize = bucket;
+                bucket = offset;
+                offset += bucketSize;
+            }
+            for (uint64_t key: keys) buffer[counts[(key >> shift) & 0xFF]++] = key;
+            keys.swap(buffer);
+        }
+        std::vector<uint32_t> order(count);
+        for (size_t i = 0; i < count; ++i) order[i] = static_cast<uint32_t>(keys[i]);
+        permute(order);
+    }
+
+    // Returns true if rows are in date order
+    [[nodiscard]] bool isSortedByDate() const {
+        for (size_t row = 1; row < size(); ++row) {
+            if (dates[row] < dates[row - 1]) return false;
+        }
+        return true;
+    }
+
+    // Column accessors
+    [[nodiscard]] ItemType type(size_t row) const { return types[row]; }
+    [[nodiscard]] int64_t amount(size_t row) const { return amounts[row]; }
+    [[nodiscard]] int32_t date(size_t row) const { return dates[row]; }
+    [[nodiscard]] uint32_t categoryId(size_t row) const { return categoryIds[row]; }
+    [[nodiscard]] uint32_t nameId(size_t row) const { return nameIds[row]; }
+    [[nodiscard]] double probability(size_t row) const { return probabilities[row]; }
+    [[nodiscard]] uint64_t id(size_t row) const { return ids[row]; }
+    [[nodiscard]] std::string_view category(size_t row) const { return categoryPool.get(categoryIds[row]); }
+    [[nodiscard]] std::string_view name(size_t row) const { return namePool.get(nameIds[row]); }
+    [[nodiscard]] const StringPool &categories() const { return categoryPool; }
+    [[nodiscard]] const StringPool &names() const { return namePool; }
+
+    // Returns the effect of a row on total assets in minor units (expenses and liabilities are negative)
+    [[nodiscard]] int64_t signedAmount(size_t row) const {
+        return ::signedAmount(types[row], amounts[row]);
+    }
+
+    // Sums the amounts of each item type dated within [firstDay, lastDay]. The loop over each
+    // column segment is branch-free so the compiler can vectorize it.
+    [[nodiscard]] TypeTotals totalsByType(int32_t firstDay, int32_t lastDay) const {
+        TypeTotals totals{};
+        int64_t asset = 0, liability = 0, income = 0, expense = 0;
+        for (size_t first = 0; first < size(); first = segmentEnd(first)) {
+            const size_t count = std::min(size(), segmentEnd(first)) - first;
+            const auto *typeData = reinterpret_cast<const uint8_t *>(types.valuesFrom(first));
+            const int64_t *amountData = amounts.valuesFrom(first);
+            const int32_t *dateData = dates.valuesFrom(first);
+            for (size_t i = 0; i < count; ++i) {
+                const int64_t inRange = -static_cast<int64_t>((dateData[i] >= firstDay) & (dateData[i] <= lastDay));
+                const int64_t amount = amountData[i] & inRange;
+                const uint8_t type = typeData[i];
+                asset += amount & -static_cast<int64_t>(type == static_cast<uint8_t>(ItemType::Asset));
+                liability += amount & -static_cast<int64_t>(type == static_cast<uint8_t>(ItemType::Liability));
+                income += amount & -static_cast<int64_t>(type == static_cast<uint8_t>(ItemType::Income));
+                expense += amount & -static_cast<int64_t>(type == static_cast<uint8_t>(ItemType::Expense));
+            }
+        }
+        totals[static_cast<size_t>(ItemType::Asset)] = asset;
+        totals[static_cast<size_t>(ItemType::Liability)] = liability;
+        totals[static_cast<size_t>(ItemType::Income)] = income;
+        totals[static_cast<size_t>(ItemType::Expense)] = expense;
+        return totals;
+    }
+
+    // Sums the effect on total assets of rows [firstRow, lastRow) by how certain it is, taking every row as
+    // independent of the others. The rows in excludedRows, which is sorted, are left out. The main loop over
+    // each column segment is branch-free so the compiler can vectorize it; the few excluded rows are then
+    // taken back out. Uncertain rows are rare, so their probability-weighted sum takes a second pass only
+    // when there are any.
+    [[nodiscard]] OutcomeTotals outcomeTotals(size_t firstRow, size_t lastRow,
+                                              std::span<const size_t> excludedRows = {}) const {
+        int64_t certain = 0, gains = 0, losses = 0, uncertainCount = 0;
+        for (size_t first = firstRow; first < lastRow; first = segmentEnd(first)) {
+            const size_t count = std::min(lastRow, segmentEnd(first)) - first;
+            const auto *typeData = reinterpret_cast<const uint8_t *>(types.valuesFrom(first));
+            const int64_t *amountData = amounts.valuesFrom(first);
+            const double *probabilityData = probabilities.valuesFrom(first);
+            for (size_t i = 0; i < count; ++i) {
+                const uint8_t type = typeData[i];
+                const int64_t negate = -static_cast<int64_t>((type == static_cast<uint8_t>(ItemType::Expense)) |
+                                                             (type == static_cast<uint8_t>(ItemType::Liability)));
+                const int64_t delta = (amountData[i] ^ negate) - negate;
+                const double probability = probabilityData[i];
+                const int64_t isCertain = -static_cast<int64_t>(probability == 1.0);
+                const int64_t isUncertain = -static_cast<int64_t>((probability != 0.0) & (probability != 1.0));
+                const int64_t isLoss = delta >> 63;
+                certain += delta & isCertain;
+                gains += delta & ~isLoss & isUncertain;
+                losses += delta & isLoss & isUncertain;
+                uncertainCount -= isUncertain;
+            }
+        }
+        OutcomeTotals totals{certain, gains, losses, 0.0};
+        if (uncertainCount != 0) {
+            for (size_t row = firstRow; row < lastRow; ++row) {
+                const double probability = probabilities[row];
+                if (probability != 0.0 && probability != 1.0) {
+                    totals.expectedChange += static_cast<double>(signedAmount(row)) * probability;
+                }
+            }
+        }
+        for (auto row = std::lower_bound(excludedRows.begin(), excludedRows.end(), firstRow);
+             row != excludedRows.end() && *row < lastRow; ++row) {
+            const OutcomeTotals excluded = rowOutcome(*row);
+            totals.certain -= excluded.certain;
+            totals.gains -= excluded.gains;
+            totals.losses -= excluded.losses;
+            totals.expectedChange -= excluded.expectedChange;
+        }
+        return totals;
+    }
+
+    // Returns the effect on total assets of one row by how certain it is, as outcomeTotals() sums it
+    [[nodiscard]] OutcomeTotals rowOutcome(size_t row) const {
+        OutcomeTotals outcome;
+        const int64_t delta = signedAmount(row);
+        const double probability = probabilities[row];
+        if (probability == 1.0) {
+            outcome.certain = delta;
+        } else if (probability != 0.0) {
+            (delta < 0 ? outcome.losses : outcome.gains) = delta;
+            outcome.expectedChange = static_cast<double>(delta) * probability;
+        }
+        return outcome;
+    }
+
+    // Returns the month index over the rows, rebuilding it if a bulk change invalidated it.
+    // The rows must be in date order, which holds for any ledger outside of a bulk load.
+    [[nodiscard]] const MonthIndex &months() const {
+        std::lock_guard<CacheMutex> lock(indexMutex);
+        if (!monthIndexed) {
+            monthIndex.build(types, amounts, dates);
+            monthIndexed = true;
+        }
+        return monthIndex;
+    }
+
+    // Returns an immutable copy of the ledger that any number of threads may read while this one keeps
+    // changing. The copy shares the columns and strings instead of copying them. Its month index is
+    // built up front; its item and range indexes only if a reader uses them.
+    [[nodiscard]] std::shared_ptr<const Ledger> snapshot() const {
+        (void) months();
+        auto copy = std::make_shared<Ledger>(*this);
+        copy->itemIndex.reset(); // Sharing them would make the next change here drop them
+        copy->rangeIndex.reset();
+        return copy;
+    }
+
+    // Compares the maintained month index with one rebuilt from the rows
+    [[nodiscard]] bool monthIndexConsistent() const {
+        if (!monthIndexed) return true;
+        MonthIndex rebuilt;
+        rebuilt.build(types, amounts, dates);
+        return rebuilt == monthIndex;
+    }
+
+    // Finds the row of an item by id: a hash lookup of its date, then a binary search among that day's rows
+    [[nodiscard]] bool findRow(uint64_t id, size_t &row) const {
+        int32_t date;
+        if (!lookup().findDate(id, date)) return false;
+        for (size_t candidate = dates.partitionPoint(0, size(), [date](int32_t day) { return day < date; });
+             candidate < size() && dates[candidate] == date; ++candidate) {
+            if (ids[candidate] == id) {
+                row = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Returns the ids of the items with a name
+    [[nodiscard]] const std::vector<uint64_t> &idsWithName(std::string_view name) const {
+        static const std::vector<uint64_t> none;
+        uint32_t nameId;
+        return namePool.find(name, nameId) ? lookup().withName(nameId) : none;
+    }
+
+    // Returns the ids of the items in a category
+    [[nodiscard]] const std::vector<uint64_t> &idsInCategory(std::string_view category) const {
+        static const std::vector<uint64_t> none;
+        uint32_t categoryId;
+        return categoryPool.find(category, categoryId) ? lookup().inCategory(categoryId) : none;
+    }
+
+    // Returns the total of one item type in a category and its subcategories dated within [firstDay,
+    // lastDay], including the occurrences of recurring items. The empty category is the whole ledger.
+    // The rows take O(log n) through the range index; recurring items are counted, not expanded.
+    [[nodiscard]] int64_t rangeTotal(ItemType type, std::string_view category, int32_t firstDay,
+                                     int32_t lastDay) const {
+        const CategoryRangeIndex &index = ranges();
+        uint32_t node;
+        int64_t total = index.findNode(category, node) ? index.total(node, type, firstDay, lastDay) : 0;
+        for (size_t i = 0; i < recurrences.size(); ++i) {
+            const RecurrenceRule &rule = recurrences[i];
+            if (rule.type == type && isWithinCategory(categoryPool.get(rule.categoryId), category)) {
+                total += static_cast<int64_t>(rule.schedule.countBetween(firstDay, lastDay)) * rule.amount;
+            }
+        }
+        return total;
+    }
+
+    // Returns up to count direct subcategories of parent with the largest totals of one item type dated
+    // within [firstDay, lastDay], largest first, as rangeTotal() would give them. Subcategories with no
+    // total are left out. Each subcategory's total takes O(log n), so this does not scan the rows.
+    [[nodiscard]] std::vector<std::pair<std::string, int64_t> >
+    topCategories(ItemType type, std::string_view parent, int32_t firstDay, int32_t lastDay, size_t count) const {
+        const CategoryRangeIndex &index = ranges();
+        std::vector<std::pair<std::string, int64_t> > totals;
+        uint32_t node;
+        if (index.findNode(parent, node)) {
+            for (uint32_t child: index.children(node)) {
+                totals.emplace_back(index.path(child), index.total(child, type, firstDay, lastDay));
+            }
+        }
+        for (size_t i = 0; i < recurrences.size(); ++i) {
+            const RecurrenceRule &rule = recurrences[i];
+            const std::string_view category = categoryPool.get(rule.categoryId);
+            if (rule.type != type || category.size() == parent.size() || !isWithinCategory(category, parent)) {
+                continue;
+            }
+            // The subcategory of parent that the rule's category is in
+            const size_t start = parent.empty() ? 0 : parent.size() + 1;
+            const std::string_view child = category.substr(0, category.find('/', start));
+            auto it = std::find_if(totals.begin(), totals.end(), [child](const auto &entry) {
+                return entry.first == child;
+            });
+            if (it == totals.end()) it = totals.emplace(totals.end(), child, 0);
+            it->second += static_cast<int64_t>(rule.schedule.countBetween(firstDay, lastDay)) * rule.amount;
+        }
+        std::erase_if(totals, [](const auto &entry) { return entry.second == 0; });
+        count = std::min(count, totals.size());
+        std::partial_sort(totals.begin(), totals.begin() + static_cast<std::ptrdiff_t>(count), totals.end(),
+                          [](const auto &a, const auto &b) {
+                              return a.second != b.second ? a.second > b.second : a.first < b.first;
+                          });
+        totals.resize(count);
+        return totals;
+    }
+
+    // Thin item views for the CLI code
+    [[nodiscard]] FinancialItemView operator[](size_t row) const;
+};
+
+// Writes a CSV field, quoting it when it contains a delimiter, quote or line break (RFC 4180)
+void writeCsvField(std::ostream &out, std::string_view field) {
+    if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+        out << field;
+        return;
+    }
+    out << '"';
+    for (char c : field) {
+        if (c == '"') out << '"';
+        out << c;
+    }
+    out << '"';
+}
+
+// Read-only view of one ledger row with the FinancialItem getters
+class FinancialItemView {
+private:
+    const Ledger *ledger;
+    size_t row;
+
+public:
+    FinancialItemView(const Ledger &ledger, size_t row) : ledger(&ledger), row(row) {
+    }
+
+    // Serializes the item to a file
+    void serialize(std::ofstream &out) const {
+        out << getTypeName() << ",";
+        writeCsvField(out, getName());
+        out << ",";
+        writeCsvField(out, getCategory());
+        char amount[MAX_MINOR_UNITS_LENGTH];
+        out << ",";
+        out.write(amount, writeMinorUnits(amount, ledger->amount(row)) - amount);
+        out << "," << getDate() << "," << getProbability() << "\n";
+    }
+
+    // Copies the item out of the ledger
+    [[nodiscard]] FinancialItem toItem() const {
+        std::string name(getName()), category(getCategory()), date = getDate();
+        return FinancialItem(getType(), name, category, getAmount(), date, getProbability());
+    }
+
+    // Getters for item attributes
+    [[nodiscard]] size_t getRow() const { return row; }
+    [[nodiscard]] uint64_t getId() const { return ledger->id(row); }
+    [[nodiscard]] std::string_view getName() const { return ledger->name(row); }
+    [[nodiscard]] ItemType getType() const { return ledger->type(row); }
+    [[nodiscard]] std::string getTypeName() const { return std::string(itemTypeName(getType())); }
+    [[nodiscard]] Money getAmount() const { return Money(ledger->amount(row)); }
+    [[nodiscard]] std::string getDate() const { return formatDate(ledger->date(row)); }
+    [[nodiscard]] double getProbability() const { return ledger->probability(row); }
+    [[nodiscard]] std::string_view getCategory() const { return ledger->category(row); }
+};
+
+FinancialItemView Ledger::operator[](size_t row) const {
+    return {*this, row};
+}
+
+// CSV header for serialization
+const std::string &HEADER = "Type,Name,Category,Amount,Date,Probability";
+
+// Serializes all financial items to a file
+void serializeAllItems(const Ledger &items, const std::string &filename) {
+    ScopedTimer timer(Probe::SerializeAllItems);
+    std::ofstream out(filename);
+    out << HEADER << "\n";
+    for (size_t row = 0; row < items.size(); ++row) {
+        items[row].serialize(out);
+    }
+}
+
+// Files holding the ledger
+const std::string &LEDGER_FILENAME = "financial_items.ledger";
+const std::string &LEDGER_BACKUP_FILENAME = "financial_items_backup.ledger";
+const std::string &CSV_FILENAME = "financial_items.csv";
+
+// Binary ledger file layout: a header, one fixed-width block per column (8-byte aligned), the
+// recurrence rules, the scenario groups and their member ids, the closed periods, then the category
+// and name string tables (count + 1 uint32 offsets followed by the string bytes)
+constexpr char LEDGER_FILE_MAGIC[8] = {'B', 'U', 'D', 'G', 'E', 'T', 'L', 'G'};
+constexpr uint32_t LEDGER_FILE_VERSION = 6;
+constexpr uint32_t LEDGER_FLAG_SORTED_BY_DATE = 1;
+
+// Column blocks in file order
+enum LedgerColumn {
+    TypeColumn,
+    AmountColumn,
+    DateColumn,
+    CategoryColumn,
+    NameColumn,
+    ProbabilityColumn,
+    IdColumn,
+    LedgerColumnCount
+};
+
+// Versions 1 and 2 have no id column
+constexpr size_t V2_COLUMN_COUNT = IdColumn;
+
+struct LedgerFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t rowCount;
+    uint64_t columnOffsets[LedgerColumnCount];
+    uint64_t categoryTableOffset;
+    uint64_t nameTableOffset;
+    uint64_t fileSize;
+    uint32_t categoryCount;
+    uint32_t nameCount;
+    uint64_t journalSequence; // First journal record not included in this snapshot
+    uint64_t nextItemId;      // Id the next added item will get
+    uint64_t recurrenceOffset;
+    uint64_t recurrenceCount;
+    uint64_t scenarioGroupOffset;
+    uint64_t scenarioGroupCount;
+    uint64_t groupMemberOffset;
+    uint64_t groupMemberCount;
+    uint64_t closedPeriodOffset;
+    uint64_t closedPeriodCount;
+    uint64_t payloadChecksum; // FNV-1a of everything after the header
+    uint64_t headerChecksum;  // FNV-1a of the header with this field set to zero
+};
+
+// Version 5 header: no closed periods
+struct LedgerFileHeaderV5 {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t rowCount;
+    uint64_t columnOffsets[LedgerColumnCount];
+    uint64_t categoryTableOffset;
+    uint64_t nameTableOffset;
+    uint64_t fileSize;
+    uint32_t categoryCount;
+    uint32_t nameCount;
+    uint64_t journalSequence;
+    uint64_t nextItemId;
+    uint64_t recurrenceOffset;
+    uint64_t recurrenceCount;
+    uint64_t scenarioGroupOffset;
+    uint64_t scenarioGroupCount;
+    uint64_t groupMemberOffset;
+    uint64_t groupMemberCount;
+    uint64_t payloadChecksum;
+    uint64_t headerChecksum;
+};
+
+// Version 4 header: no scenario groups
+struct LedgerFileHeaderV4 {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t rowCount;
+    uint64_t columnOffsets[LedgerColumnCount];
+    uint64_t categoryTableOffset;
+    uint64_t nameTableOffset;
+    uint64_t fileSize;
+    uint32_t categoryCount;
+    uint32_t nameCount;
+    uint64_t journalSequence;
+    uint64_t nextItemId;
+    uint64_t recurrenceOffset;
+    uint64_t recurrenceCount;
+    uint64_t payloadChecksum;
+    uint64_t headerChecksum;
+};
+
+// Version 3 header: no recurrence rules
+struct LedgerFileHeaderV3 {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t rowCount;
+    uint64_t columnOffsets[LedgerColumnCount];
+    uint64_t categoryTableOffset;
+    uint64_t nameTableOffset;
+    uint64_t fileSize;
+    uint32_t categoryCount;
+    uint32_t nameCount;
+    uint64_t journalSequence;
+    uint64_t nextItemId;
+    uint64_t payloadChecksum;
+    uint64_t headerChecksum;
+};
+
+// Version 2 header: no id column and no next item id
+struct LedgerFileHeaderV2 {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t rowCount;
+    uint64_t columnOffsets[V2_COLUMN_COUNT];
+    uint64_t categoryTableOffset;
+    uint64_t nameTableOffset;
+    uint64_t fileSize;
+    uint32_t categoryCount;
+    uint32_t nameCount;
+    uint64_t journalSequence;
+    uint64_t payloadChecksum;
+    uint64_t headerChecksum;
+};
+
+// Version 1 header: like version 2 without the journal sequence
+struct LedgerFileHeaderV1 {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t rowCount;
+    uint64_t columnOffsets[V2_COLUMN_COUNT];
+    uint64_t categoryTableOffset;
+    uint64_t nameTableOffset;
+    uint64_t fileSize;
+    uint32_t categoryCount;
+    uint32_t nameCount;
+    uint64_t payloadChecksum;
+    uint64_t headerChecksum;
+};
+
+static_assert(std::is_trivially_copyable_v<LedgerFileHeader>);
+static_assert(std::is_trivially_copyable_v<LedgerFileHeaderV5>);
+static_assert(std::is_trivially_copyable_v<LedgerFileHeaderV4>);
+static_assert(std::is_trivially_copyable_v<LedgerFileHeaderV3>);
+static_assert(std::is_trivially_copyable_v<LedgerFileHeaderV2>);
+static_assert(std::is_trivially_copyable_v<LedgerFileHeaderV1>);
+
+// 64-bit FNV-1a hash, continued from a previous value
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xCBF29CE484222325ULL) {
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Returns the checksum of a header, ignoring its stored header checksum
+template<typename Header>
+uint64_t headerChecksum(Header header) {
+    header.headerChecksum = 0;
+    return fnv1a(&header, sizeof(header));
+}
+
+// Read-only view of a whole file. On POSIX systems the file is memory-mapped, so pages are only
+// read from disk when touched; elsewhere it is read into memory.
+class MappedFile {
+private:
+    const char *bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+
+public:
+    explicit MappedFile(const std::string &filename) {
+#ifdef _WIN32
+        std::ifstream in(filename, std::ios::binary);
+        if (!in) throw std::runtime_error("Cannot open " + filename);
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        bytes = buffer.data();
+        length = buffer.size();
+#else
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open " + filename);
+        struct stat info{};
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + filename);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void *mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Cannot map " + filename);
+            }
+            bytes = static_cast<const char *>(mapping);
+        }
+        ::close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (bytes) ::munmap(const_cast<char *>(bytes), length);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    [[nodiscard]] const char *data() const { return bytes; }
+    [[nodiscard]] size_t size() const { return length; }
+};
+
+// Number of fields in a CSV row (see HEADER)
+constexpr size_t CSV_FIELD_COUNT = 6;
+
+// Fields kept per record: a row, plus the command and schedule of a recurring batch command
+constexpr size_t CSV_MAX_FIELDS = CSV_FIELD_COUNT + 4;
+
+// CSV files are split into chunks of at least this many bytes to be parsed in parallel
+constexpr size_t CSV_MIN_CHUNK_BYTES = 1 << 20;
+
+// At most this many bad rows are listed when reporting an import
+constexpr size_t MAX_REPORTED_CSV_ERRORS = 10;
+
+// A CSV row that could not be imported
+struct CsvRowError {
+    size_t line;
+    std::string message;
+};
+
+// One record read by CsvReader. Fields point into the input buffer, or into the reader's scratch
+// storage for quoted fields that contained escaped quotes, and stay valid until the next record.
+struct CsvRecord {
+    std::array<std::string_view, CSV_MAX_FIELDS> fields;
+    size_t fieldCount = 0;          // Fields found in the record, which may exceed CSV_MAX_FIELDS
+    size_t line = 0;                // Line on which the record starts, counted from the start of the buffer
+    std::string_view text;          // The whole record without its line break
+    bool malformed = false;         // A quoted field was not closed or was followed by other characters
+};
+
+// Reads RFC 4180 records from a buffer without copying: fields may be quoted, and quoted fields
+// may contain commas, line breaks and doubled quotes. Both LF and CRLF line breaks are accepted.
+class CsvReader {
+private:
+    const char *position;
+    const char *end;
+    size_t line = 1;
+    std::array<std::string, CSV_MAX_FIELDS> scratch;
+
+    // Reads a quoted field starting at the opening quote; returns false if it is never closed
+    bool readQuotedField(std::string_view &field, std::string &unescaped) {
+        const char *start = ++position;
+        bool hasEscapes = false;
+        while (true) {
+            const auto *quote = static_cast<const char *>(std::memchr(position, '"', end - position));
+            if (!quote) {
+                line += std::count(position, end, '\n');
+                position = end;
+                return false;
+            }
+            line += std::count(position, quote, '\n');
+            position = quote + 1;
+            if (position == end || *position != '"') break;
+            hasEscapes = true;
+            ++position;
+        }
+        field = {start, static_cast<size_t>(position - 1 - start)};
+        if (hasEscapes) {
+            unescaped.clear();
+            for (size_t i = 0; i < field.size(); ++i) {
+                unescaped += field[i];
+                if (field[i] == '"') ++i;
+            }
+            field = unescaped;
+        }
+        return true;
+    }
+
+public:
+    CsvReader(const char *data, size_t size) : position(data), end(data + size) {
+    }
+
+    // Number of line breaks consumed so far
+    [[nodiscard]] size_t linesRead() const { return line - 1; }
+
+    // Reads the next record; returns false once the buffer is exhausted
+    bool next(CsvRecord &record) {
+        if (position == end) return false;
+        const char *recordStart = position;
+        record.line = line;
+        record.fieldCount = 0;
+        record.malformed = false;
+
+        while (true) {
+            std::string_view field;
+            if (position != end && *position == '"') {
+                std::string &unescaped = scratch[std::min(record.fieldCount, CSV_MAX_FIELDS - 1)];
+                if (!readQuotedField(field, unescaped)) {
+                    record.malformed = true;
+                    record.text = {recordStart, static_cast<size_t>(end - recordStart)};
+                    return true;
+                }
+            } else {
+                const char *start = position;
+                while (position != end && *position != ',' && *position != '\n') ++position;
+                field = {start, static_cast<size_t>(position - start)};
+                if (!field.empty() && field.back() == '\r' && (position == end || *position == '\n')) {
+                    field.remove_suffix(1);
+                }
+            }
+            if (record.fieldCount < CSV_MAX_FIELDS) record.fields[record.fieldCount] = field;
+            ++record.fieldCount;
+
+            if (position != end && *position == ',') {
+                ++position;
+                continue;
+            }
+            const char *recordEnd = position;
+            // A line ends with \n or \r\n, or with a lone \r at the end of the data
+            if (position != end && *position == '\r' && (position + 1 == end || position[1] == '\n')) ++position;
+            if (position != end && *position != '\n') {
+                // Characters after a closing quote: skip the rest of the line
+                record.malformed = true;
+                const auto *lineEnd = static_cast<const char *>(std::memchr(position, '\n', end - position));
+                position = lineEnd ? lineEnd : end;
+                recordEnd = position;
+            }
+            if (recordEnd != recordStart && recordEnd[-1] == '\r') --recordEnd;
+            record.text = {recordStart, static_cast<size_t>(recordEnd - recordStart)};
+            if (position != end) {
+                ++position;
+                ++line;
+            }
+            return true;
+        }
+    }
+};
+
+// Converts a CSV record into a ledger row, throwing std::invalid_argument if a value is invalid
+void appendCsvRecord(Ledger &items, const CsvRecord &record) {
+    if (record.malformed) throw std::invalid_argument("Malformed quoted field");
+    if (record.fieldCount != CSV_FIELD_COUNT) {
+        throw std::invalid_argument("Expected " + std::to_string(CSV_FIELD_COUNT) + " fields, found " +
+                                    std::to_string(record.fieldCount));
+    }
+    const auto &fields = record.fields;
+    ItemType type = parseItemType(fields[0]);
+    double amount, probability;
+    int32_t date;
+    if (!parseNumber(fields[3], amount) || !isValidAmount(amount)) {
+        throw std::invalid_argument("Invalid amount: " + std::string(fields[3]));
+    }
+    if (!tryParseDate(fields[4], date)) throw std::invalid_argument("Invalid date: " + std::string(fields[4]));
+    if (!parseNumber(fields[5], probability) || !std::isfinite(probability)) {
+        throw std::invalid_argument("Invalid probability: " + std::string(fields[5]));
+    }
+    items.appendRow(type, toMinorUnits(amount), date, fields[2], fields[1], probability);
+}
+
+// Parses every record of a buffer into a ledger, collecting the rows that could not be parsed.
+// Line numbers in the errors are relative to the start of the buffer.
+void parseCsvChunk(const char *data, size_t size, Ledger &items, std::vector<CsvRowError> &errors,
+                   size_t &linesRead) {
+    CsvReader reader(data, size);
+    CsvRecord record;
+    while (reader.next(record)) {
+        if (record.text.empty() || record.text == HEADER) continue;
+        try {
+            appendCsvRecord(items, record);
+        } catch (const std::invalid_argument &e) {
+            errors.push_back({record.line, e.what()});
+        }
+    }
+    linesRead = reader.linesRead();
+}
+
+// Finds where CSV records end by CsvReader's rules: a quote only opens a quoted field at the start of a
+// field, "" inside one is an escaped quote, and text after a closing quote runs to the end of the line.
+// It is fed the text one character at a time.
+struct CsvRecordScanner {
+    enum class State : uint8_t { FieldStart, Unquoted, Quoted, QuoteInQuoted, RestOfLine };
+    static constexpr size_t STATE_COUNT = 5;
+
+    State state = State::FieldStart;
+
+    // Advances over one character; returns true if it ends a record
+    bool advance(char c) {
+        const bool separator = c == ',' || c == '\n';
+        switch (state) {
+            case State::FieldStart:
+                state = c == '"' ? State::Quoted : separator ? State::FieldStart : State::Unquoted;
+                break;
+            case State::Unquoted:
+                if (separator) state = State::FieldStart;
+                break;
+            case State::Quoted:
+                if (c == '"') state = State::QuoteInQuoted;
+                break;
+            case State::QuoteInQuoted:
+                state = c == '"' ? State::Quoted : separator ? State::FieldStart : State::RestOfLine;
+                break;
+            case State::RestOfLine:
+                if (c == '\n') state = State::FieldStart;
+                break;
+        }
+        return c == '\n' && state == State::FieldStart;
+    }
+};
+
+// Returns the offsets at which a CSV buffer can be cut into about chunkCount chunks that each start
+// at the beginning of a record. Each range is scanned in parallel from every state a CsvRecordScanner
+// can be in, which gives the state it ends in for each state it starts in. Runs that reach the same state
+// are merged, which usually leaves one after the first record; a run inside a quoted field skips ahead
+// to the next quote. Chaining the ranges from the start of the buffer gives the state at each tentative
+// cut, which then moves forward to the end of the record it falls in.
+std::vector<size_t> splitCsvChunks(const char *data, size_t size, size_t chunkCount) {
+    using State = CsvRecordScanner::State;
+    constexpr size_t STATE_COUNT = CsvRecordScanner::STATE_COUNT;
+    std::vector<size_t> starts(chunkCount);
+    for (size_t i = 0; i < chunkCount; ++i) starts[i] = size / chunkCount * i;
+
+    std::vector<std::array<State, STATE_COUNT> > endStates(chunkCount);
+    parallelFor(chunkCount, [&](size_t i) {
+        const char *position = data + starts[i];
+        const char *rangeEnd = data + (i + 1 < chunkCount ? starts[i + 1] : size);
+        std::vector<CsvRecordScanner> runs;  // Distinct states reached so far
+        std::array<size_t, STATE_COUNT> runOf{}; // The run of each start state
+        for (size_t start = 0; start < STATE_COUNT; ++start) {
+            runs.push_back({static_cast<State>(start)});
+            runOf[start] = start;
+        }
+        auto mergeRuns = [&runs, &runOf] {
+            for (size_t k = runs.size(); k-- > 1;) {
+                for (size_t j = 0; j < k; ++j) {
+                    if (runs[j].state != runs[k].state) continue;
+                    for (size_t &run: runOf) run = run == k ? j : run > k ? run - 1 : run;
+                    runs.erase(runs.begin() + static_cast<ptrdiff_t>(k));
+                    break;
+                }
+            }
+        };
+        while (position < rangeEnd) {
+            mergeRuns();
+            if (runs.size() == 1) {
+                for (; position < rangeEnd; ++position) runs[0].advance(*position);
+                break;
+            }
+            if (runs.size() == 2 && (runs[0].state == State::Quoted || runs[1].state == State::Quoted)) {
+                CsvRecordScanner &other = runs[runs[0].state == State::Quoted ? 1 : 0];
+                const auto *quote = static_cast<const char *>(std::memchr(position, '"', rangeEnd - position));
+                for (const char *next = quote ? quote : rangeEnd; position < next; ++position) other.advance(*position);
+                if (position == rangeEnd) break;
+            }
+            for (CsvRecordScanner &run: runs) run.advance(*position);
+            ++position;
+        }
+        for (size_t start = 0; start < STATE_COUNT; ++start) endStates[i][start] = runs[runOf[start]].state;
+    });
+
+    std::vector<State> startStates(chunkCount);
+    State state = State::FieldStart;
+    for (size_t i = 0; i < chunkCount; ++i) {
+        startStates[i] = state;
+        state = endStates[i][static_cast<size_t>(state)];
+    }
+
+    parallelFor(chunkCount, [&](size_t i) {
+        if (i == 0) return;
+        CsvRecordScanner scanner{startStates[i]};
+        size_t position = starts[i];
+        while (position < size && !scanner.advance(data[position])) ++position;
+        starts[i] = std::min(position + 1, size);
+    });
+    for (size_t i = 1; i < chunkCount; ++i) starts[i] = std::max(starts[i], starts[i - 1]);
+    starts.push_back(size);
+    return starts;
+}
+
+// Deserializes all financial items from a CSV file. The file is mapped and split into chunks that
+// are parsed in parallel and appended in file order. Rows that cannot be parsed are skipped and
+// returned with their line numbers.
+std::vector<CsvRowError> deserializeAllItems(Ledger &items, const std::string &filename) {
+    ScopedTimer timer(Probe::DeserializeAllItems);
+    MappedFile file(filename);
+    const char *data = file.data();
+    size_t size = file.size();
+    if (size >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+        data += 3; // UTF-8 byte order mark written by spreadsheet programs
+        size -= 3;
+    }
+
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(size / CSV_MIN_CHUNK_BYTES, sharedPool().size() * 4));
+    std::vector<size_t> starts = splitCsvChunks(data, size, chunkCount);
+    std::vector<Ledger> chunks(chunkCount);
+    std::vector<std::vector<CsvRowError> > chunkErrors(chunkCount);
+    std::vector<size_t> chunkLines(chunkCount);
+    parallelFor(chunkCount, [&](size_t i) {
+        parseCsvChunk(data + starts[i], starts[i + 1] - starts[i], chunks[i], chunkErrors[i], chunkLines[i]);
+    });
+
+    std::vector<CsvRowError> errors;
+    size_t rows = items.size(), firstLine = 0;
+    for (const Ledger &chunk : chunks) rows += chunk.size();
+    items.reserve(rows);
+    for (size_t i = 0; i < chunkCount; ++i) {
+        items.append(chunks[i]);
+        for (CsvRowError &error : chunkErrors[i]) {
+            error.line += firstLine;
+            errors.push_back(std::move(error));
+        }
+        firstLine += chunkLines[i];
+    }
+    return errors;
+}
+
+// Prints the rows skipped by a CSV import
+void reportCsvErrors(const std::vector<CsvRowError> &errors, std::ostream &out) {
+    if (errors.empty()) return;
+    out << "Skipped " << errors.size() << " invalid rows:\n";
+    for (size_t i = 0; i < errors.size() && i < MAX_REPORTED_CSV_ERRORS; ++i) {
+        out << "  line " << errors[i].line << ": " << errors[i].message << "\n";
+    }
+    if (errors.size() > MAX_REPORTED_CSV_ERRORS) {
+        out << "  ... and " << errors.size() - MAX_REPORTED_CSV_ERRORS << " more\n";
+    }
+}
+
+// Forces buffered writes of a file to disk
+void syncFile(std::FILE *file) {
+    ScopedTimer timer(Probe::SyncFile);
+    std::fflush(file);
+#ifdef _WIN32
+    _commit(_fileno(file));
+#else
+    ::fsync(fileno(file));
+#endif
+}
+
+// Forces the entries of a directory, such as a file renamed into it, to disk. Windows has no
+// equivalent, and a rename there is durable once it returns.
+void syncDirectory(const std::filesystem::path &directory) {
+#ifndef _WIN32
+    int descriptor = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (descriptor < 0) return;
+    ::fsync(descriptor);
+    ::close(descriptor);
+#endif
+}
+
+// Copies records into their file layout field by field. The padding between fields is left zero,
+// so no uninitialized bytes of the records reach the file.
+template<typename Record, typename FieldVisitor>
+std::string packRecords(const Record *records, size_t count, FieldVisitor visitFields) {
+    std::string bytes(count * sizeof(Record), '\0');
+    for (size_t index = 0; index < count; ++index) {
+        char *out = bytes.data() + index * sizeof(Record);
+        visitFields(records[index], [out](size_t offset, const auto &field) {
+            std::memcpy(out + offset, &field, sizeof(field));
+        });
+    }
+    return bytes;
+}
+
+// Writes the ledger as a binary file. It is written to a temporary file that is synced and then renamed
+// over the old one, so a crash leaves either the old or the new file, never a half-written one.
+// journalSequence is the first journal record that the snapshot does not include. If a backup file is
+// given, the old file becomes the backup through a hard link (or a copy where links are not supported)
+// rather than by writing the ledger twice.
+void writeLedgerFile(const Ledger &items, const std::string &filename, uint64_t journalSequence = 0,
+                     const std::string &backupFilename = "") {
+    ScopedTimer timer(Probe::WriteLedgerFile);
+    LedgerFileHeader header{};
+    std::memcpy(header.magic, LEDGER_FILE_MAGIC, sizeof(header.magic));
+    header.version = LEDGER_FILE_VERSION;
+    header.flags = items.isSortedByDate() ? LEDGER_FLAG_SORTED_BY_DATE : 0;
+    header.rowCount = items.size();
+    header.categoryCount = static_cast<uint32_t>(items.categoryPool.size());
+    header.nameCount = static_cast<uint32_t>(items.namePool.size());
+    header.journalSequence = journalSequence;
+    header.nextItemId = items.nextItemId;
+
+    // Lay out the blocks, each starting on an 8-byte boundary
+    const size_t rows = items.size();
+    const size_t columnSizes[LedgerColumnCount] = {
+        rows * sizeof(ItemType), rows * sizeof(int64_t), rows * sizeof(int32_t),
+        rows * sizeof(uint32_t), rows * sizeof(uint32_t), rows * sizeof(double), rows * sizeof(uint64_t)
+    };
+    auto align = [](uint64_t offset) { return (offset + 7) & ~uint64_t{7}; };
+    uint64_t offset = sizeof(LedgerFileHeader);
+    for (size_t column = 0; column < LedgerColumnCount; ++column) {
+        header.columnOffsets[column] = offset;
+        offset = align(offset + columnSizes[column]);
+    }
+    header.recurrenceCount = items.recurrences.size();
+    header.recurrenceOffset = offset;
+    offset = align(offset + items.recurrences.size() * sizeof(RecurrenceRule));
+    header.scenarioGroupCount = items.scenarioGroups.size();
+    header.scenarioGroupOffset = offset;
+    offset = align(offset + items.scenarioGroups.size() * sizeof(ScenarioGroup));
+    header.groupMemberCount = items.groupMembers.size();
+    header.groupMemberOffset = offset;
+    offset = align(offset + items.groupMembers.size() * sizeof(uint64_t));
+    header.closedPeriodCount = items.closedPeriods.size();
+    header.closedPeriodOffset = offset;
+    offset = align(offset + items.closedPeriods.size() * sizeof(ClosedPeriod));
+
+    // String tables: offsets then bytes
+    auto buildTable = [](const StringPool &pool) {
+        std::vector<uint32_t> offsets{0};
+        std::string bytes;
+        for (uint32_t id = 0; id < pool.size(); ++id) {
+            bytes += pool.get(id);
+            offsets.push_back(static_cast<uint32_t>(bytes.size()));
+        }
+        return std::make_pair(offsets, bytes);
+    };
+    auto categoryTable = buildTable(items.categoryPool);
+    auto nameTable = buildTable(items.namePool);
+    header.categoryTableOffset = offset;
+    offset = align(offset + categoryTable.first.size() * sizeof(uint32_t) + categoryTable.second.size());
+    header.nameTableOffset = offset;
+    offset = align(offset + nameTable.first.size() * sizeof(uint32_t) + nameTable.second.size());
+    header.fileSize = offset;
+
+    // Records with padding inside are packed field by field
+    const std::string recurrenceBytes = packRecords(items.recurrences.data(), items.recurrences.size(),
+                                                    [](const RecurrenceRule &rule, auto put) {
+        constexpr size_t schedule = offsetof(RecurrenceRule, schedule);
+        put(offsetof(RecurrenceRule, id), rule.id);
+        put(offsetof(RecurrenceRule, amount), rule.amount);
+        put(offsetof(RecurrenceRule, probability), rule.probability);
+        put(offsetof(RecurrenceRule, categoryId), rule.categoryId);
+        put(offsetof(RecurrenceRule, nameId), rule.nameId);
+        put(schedule + offsetof(RecurrenceSchedule, start), rule.schedule.start);
+        put(schedule + offsetof(RecurrenceSchedule, end), rule.schedule.end);
+        put(schedule + offsetof(RecurrenceSchedule, count), rule.schedule.count);
+        put(schedule + offsetof(RecurrenceSchedule, interval), rule.schedule.interval);
+        put(schedule + offsetof(RecurrenceSchedule, unit), rule.schedule.unit);
+        put(offsetof(RecurrenceRule, type), rule.type);
+    });
+    const std::string scenarioGroupBytes = packRecords(items.scenarioGroups.data(), items.scenarioGroups.size(),
+                                                       [](const ScenarioGroup &group, auto put) {
+        put(offsetof(ScenarioGroup, id), group.id);
+        put(offsetof(ScenarioGroup, parentId), group.parentId);
+        put(offsetof(ScenarioGroup, probability), group.probability);
+        put(offsetof(ScenarioGroup, nameId), group.nameId);
+        put(offsetof(ScenarioGroup, memberCount), group.memberCount);
+        put(offsetof(ScenarioGroup, kind), group.kind);
+    });
+
+    // Collect the payload pieces in file order, each with the offset of the block it starts or 0 if it
+    // continues the one before; the blocks are separated by zero padding
+    struct Piece {
+        uint64_t blockStart;
+        const void *data;
+        size_t size;
+    };
+    std::vector<Piece> pieces;
+    auto addColumn = [&pieces, rows](uint64_t blockStart, const auto &column) {
+        pieces.push_back({blockStart, nullptr, 0});
+        for (size_t row = 0; row < rows; row = segmentEnd(row)) {
+            pieces.push_back({0, column.valuesFrom(row), (std::min(rows, segmentEnd(row)) - row) * sizeof(column[0])});
+        }
+    };
+    addColumn(header.columnOffsets[TypeColumn], items.types);
+    addColumn(header.columnOffsets[AmountColumn], items.amounts);
+    addColumn(header.columnOffsets[DateColumn], items.dates);
+    addColumn(header.columnOffsets[CategoryColumn], items.categoryIds);
+    addColumn(header.columnOffsets[NameColumn], items.nameIds);
+    addColumn(header.columnOffsets[ProbabilityColumn], items.probabilities);
+    addColumn(header.columnOffsets[IdColumn], items.ids);
+    pieces.push_back({header.recurrenceOffset, recurrenceBytes.data(), recurrenceBytes.size()});
+    pieces.push_back({header.scenarioGroupOffset, scenarioGroupBytes.data(), scenarioGroupBytes.size()});
+    pieces.push_back({header.groupMemberOffset, items.groupMembers.data(),
+                      items.groupMembers.size() * sizeof(uint64_t)});
+    pieces.push_back({header.closedPeriodOffset, items.closedPeriods.data(),
+                      items.closedPeriods.size() * sizeof(ClosedPeriod)});
+    pieces.push_back({header.categoryTableOffset, categoryTable.first.data(),
+                      categoryTable.first.size() * sizeof(uint32_t)});
+    pieces.push_back({0, categoryTable.second.data(), categoryTable.second.size()});
+    pieces.push_back({header.nameTableOffset, nameTable.first.data(), nameTable.first.size() * sizeof(uint32_t)});
+    pieces.push_back({0, nameTable.second.data(), nameTable.second.size()});
+
+    std::string temporary = filename + ".tmp";
+    std::FILE *out = std::fopen(temporary.c_str(), "wb");
+    if (!out) throw std::runtime_error("Cannot write " + temporary);
+    std::fwrite(&header, sizeof(header), 1, out);
+
+    const char zeros[8] = {};
+    uint64_t position = sizeof(header);
+    uint64_t checksum = fnv1a(nullptr, 0);
+    auto pad = [&](uint64_t target) {
+        std::fwrite(zeros, 1, target - position, out);
+        checksum = fnv1a(zeros, target - position, checksum);
+        position = target;
+    };
+    for (const Piece &piece: pieces) {
+        if (piece.blockStart != 0) pad(piece.blockStart);
+        if (piece.size == 0) continue;
+        std::fwrite(piece.data, 1, piece.size, out);
+        checksum = fnv1a(piece.data, piece.size, checksum);
+        position += piece.size;
+    }
+    pad(header.fileSize);
+
+    header.payloadChecksum = checksum;
+    header.headerChecksum = headerChecksum(header);
+    std::fseek(out, 0, SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, out);
+    syncFile(out);
+    const bool written = !std::ferror(out);
+    if (std::fclose(out) != 0 || !written) {
+        std::filesystem::remove(temporary);
+        throw std::runtime_error("Cannot write " + temporary);
+    }
+
+    if (!backupFilename.empty() && std::filesystem::exists(filename)) {
+        std::string linked = backupFilename + ".tmp";
+        std::error_code error;
+        std::filesystem::remove(linked, error);
+        std::filesystem::create_hard_link(filename, linked, error);
+        if (error) std::filesystem::copy_file(filename, linked, std::filesystem::copy_options::overwrite_existing);
+        std::filesystem::rename(linked, backupFilename);
+    }
+    std::filesystem::rename(temporary, filename);
+    syncDirectory(std::filesystem::path(filename).parent_path());
+}
+
+// Reads and validates the header of a binary ledger file, upgrading older versions in memory.
+// Returns the size of the header as stored in the file.
+size_t readLedgerFileHeader(const MappedFile &file, const std::string &filename, LedgerFileHeader &header) {
+    if (file.size() < sizeof(LedgerFileHeaderV1) ||
+        std::memcmp(file.data(), LEDGER_FILE_MAGIC, sizeof(LEDGER_FILE_MAGIC)) != 0) {
+        throw std::runtime_error(filename + " is not a ledger file");
+    }
+    uint32_t version;
+    std::memcpy(&version, file.data() + offsetof(LedgerFileHeader, version), sizeof(version));
+
+    // Older headers are copied field by field. Files before version 3 have no id column (offset 0),
+    // files before version 4 have no recurrence rules, files before version 5 no scenario groups and
+    // files before version 6 no closed periods.
+    auto upgrade = [&](auto old) {
+        if (file.size() < sizeof(old)) throw std::runtime_error(filename + " is corrupted");
+        std::memcpy(&old, file.data(), sizeof(old));
+        header = LedgerFileHeader{};
+        std::memcpy(header.magic, old.magic, sizeof(header.magic));
+        header.version = old.version;
+        header.flags = old.flags;
+        header.rowCount = old.rowCount;
+        std::copy(std::begin(old.columnOffsets), std::end(old.columnOffsets), header.columnOffsets);
+        header.categoryTableOffset = old.categoryTableOffset;
+        header.nameTableOffset = old.nameTableOffset;
+        header.fileSize = old.fileSize;
+        header.categoryCount = old.categoryCount;
+        header.nameCount = old.nameCount;
+        if constexpr (requires { old.journalSequence; }) header.journalSequence = old.journalSequence;
+        if constexpr (requires { old.nextItemId; }) header.nextItemId = old.nextItemId;
+        if constexpr (requires { old.recurrenceOffset; }) {
+            header.recurrenceOffset = old.recurrenceOffset;
+            header.recurrenceCount = old.recurrenceCount;
+        }
+        if constexpr (requires { old.scenarioGroupOffset; }) {
+            header.scenarioGroupOffset = old.scenarioGroupOffset;
+            header.scenarioGroupCount = old.scenarioGroupCount;
+            header.groupMemberOffset = old.groupMemberOffset;
+            header.groupMemberCount = old.groupMemberCount;
+        }
+        header.payloadChecksum = old.payloadChecksum;
+        header.headerChecksum = old.headerChecksum;
+        return old.headerChecksum == headerChecksum(old);
+    };
+
+    bool valid;
+    size_t headerSize;
+    if (version == 1) {
+        valid = upgrade(LedgerFileHeaderV1{});
+        headerSize = sizeof(LedgerFileHeaderV1);
+    } else if (version == 2) {
+        valid = upgrade(LedgerFileHeaderV2{});
+        headerSize = sizeof(LedgerFileHeaderV2);
+    } else if (version == 3) {
+        valid = upgrade(LedgerFileHeaderV3{});
+        headerSize = sizeof(LedgerFileHeaderV3);
+    } else if (version == 4) {
+        valid = upgrade(LedgerFileHeaderV4{});
+        headerSize = sizeof(LedgerFileHeaderV4);
+    } else if (version == 5) {
+        valid = upgrade(LedgerFileHeaderV5{});
+        headerSize = sizeof(LedgerFileHeaderV5);
+    } else if (version == LEDGER_FILE_VERSION && file.size() >= sizeof(header)) {
+        std::memcpy(&header, file.data(), sizeof(header));
+        valid = header.headerChecksum == headerChecksum(header);
+        headerSize = sizeof(header);
+    } else {
+        throw std::runtime_error(filename + " has unsupported version " + std::to_string(version));
+    }
+    if (!valid || header.fileSize != file.size()) {
+        throw std::runtime_error(filename + " is corrupted");
+    }
+    return headerSize;
+}
+
+// Returns the block of count values of type T at an offset in a mapped ledger file. Throws
+// std::runtime_error if the block does not lie within the file or is not aligned for T.
+template<typename T>
+const T *ledgerFileBlock(const MappedFile &file, const std::string &filename, uint64_t offset, uint64_t count) {
+    if (offset % alignof(T) != 0 || offset > file.size() || count > (file.size() - offset) / sizeof(T)) {
+        throw std::runtime_error(filename + " is corrupted");
+    }
+    return reinterpret_cast<const T *>(file.data() + offset);
+}
+
+// Opens a binary ledger file without copying it: the header is validated and the columns and
+// string tables refer directly to the mapped file. Every block is checked to lie within the file,
+// and the types and string ids of the rows are checked to be in range, in one pass over those columns.
+Ledger openLedgerFile(const std::string &filename, uint64_t *journalSequence = nullptr) {
+    ScopedTimer timer(Probe::OpenLedgerFile);
+    auto file = std::make_shared<const MappedFile>(filename);
+    LedgerFileHeader header{};
+    readLedgerFileHeader(*file, filename, header);
+    if (journalSequence) *journalSequence = header.journalSequence;
+
+    auto corrupted = [&filename] { return std::runtime_error(filename + " is corrupted"); };
+    const uint64_t rows = header.rowCount;
+    const auto *types = ledgerFileBlock<ItemType>(*file, filename, header.columnOffsets[TypeColumn], rows);
+    const auto *amounts = ledgerFileBlock<int64_t>(*file, filename, header.columnOffsets[AmountColumn], rows);
+    const auto *dates = ledgerFileBlock<int32_t>(*file, filename, header.columnOffsets[DateColumn], rows);
+    const auto *categoryIds = ledgerFileBlock<uint32_t>(*file, filename, header.columnOffsets[CategoryColumn], rows);
+    const auto *nameIds = ledgerFileBlock<uint32_t>(*file, filename, header.columnOffsets[NameColumn], rows);
+    const auto *probabilities = ledgerFileBlock<double>(*file, filename, header.columnOffsets[ProbabilityColumn], rows);
+    for (uint64_t row = 0; row < rows; ++row) {
+        if (static_cast<size_t>(types[row]) >= ITEM_TYPE_COUNT || categoryIds[row] >= header.categoryCount ||
+            nameIds[row] >= header.nameCount) {
+            throw corrupted();
+        }
+    }
+
+    Ledger items;
+    items.types.attach(types, rows);
+    items.amounts.attach(amounts, rows);
+    items.dates.attach(dates, rows);
+    items.categoryIds.attach(categoryIds, rows);
+    items.nameIds.attach(nameIds, rows);
+    items.probabilities.attach(probabilities, rows);
+
+    // A table's offsets must rise from 0 to at most the bytes left in the file
+    auto attachTable = [&](StringPool &pool, uint64_t tableOffset, uint32_t count) {
+        const auto *offsets = ledgerFileBlock<uint32_t>(*file, filename, tableOffset, uint64_t{count} + 1);
+        const uint64_t bytesOffset = tableOffset + (uint64_t{count} + 1) * sizeof(uint32_t);
+        if (offsets[0] != 0 || offsets[count] > file->size() - bytesOffset) throw corrupted();
+        for (uint32_t id = 0; id < count; ++id) {
+            if (offsets[id + 1] < offsets[id]) throw corrupted();
+        }
+        pool.attach(offsets, file->data() + bytesOffset, count);
+    };
+    attachTable(items.categoryPool, header.categoryTableOffset, header.categoryCount);
+    attachTable(items.namePool, header.nameTableOffset, header.nameCount);
+    if (header.columnOffsets[IdColumn] != 0) {
+        items.ids.attach(ledgerFileBlock<uint64_t>(*file, filename, header.columnOffsets[IdColumn], rows), rows);
+        items.nextItemId = header.nextItemId;
+    } else {
+        // Files from before item ids: number the rows in file order
+        std::vector<uint64_t> ids(rows);
+        for (size_t row = 0; row < ids.size(); ++row) ids[row] = row + 1;
+        items.ids.assign(std::move(ids));
+        items.nextItemId = rows + 1;
+    }
+
+    const auto *recurrences = ledgerFileBlock<RecurrenceRule>(*file, filename, header.recurrenceOffset,
+                                                              header.recurrenceCount);
+    for (uint64_t index = 0; index < header.recurrenceCount; ++index) {
+        const RecurrenceRule &rule = recurrences[index];
+        if (static_cast<size_t>(rule.type) >= ITEM_TYPE_COUNT || rule.categoryId >= header.categoryCount ||
+            rule.nameId >= header.nameCount || rule.schedule.interval == 0 ||
+            rule.schedule.unit > RecurrenceUnit::Month) {
+            throw corrupted();
+        }
+    }
+    const auto *groups = ledgerFileBlock<ScenarioGroup>(*file, filename, header.scenarioGroupOffset,
+                                                        header.scenarioGroupCount);
+    uint64_t memberCount = 0;
+    for (uint64_t index = 0; index < header.scenarioGroupCount; ++index) {
+        if (groups[index].kind > ScenarioGroupKind::Conditional || groups[index].nameId >= header.nameCount) {
+            throw corrupted();
+        }
+        memberCount += groups[index].memberCount;
+    }
+    if (memberCount != header.groupMemberCount) throw corrupted();
+    items.recurrences.attach(recurrences, header.recurrenceCount);
+    items.scenarioGroups.attach(groups, header.scenarioGroupCount);
+    items.groupMembers.attach(ledgerFileBlock<uint64_t>(*file, filename, header.groupMemberOffset,
+                                                        header.groupMemberCount),
+                              header.groupMemberCount);
+    items.closedPeriods.attach(ledgerFileBlock<ClosedPeriod>(*file, filename, header.closedPeriodOffset,
+                                                             header.closedPeriodCount),
+                               header.closedPeriodCount);
+    items.backingFile = std::move(file);
+    if (!(header.flags & LEDGER_FLAG_SORTED_BY_DATE)) items.sortByDate();
+    return items;
+}
+
+// Checks the payload checksum of a binary ledger file, which reads the whole file
+bool verifyLedgerFile(const std::string &filename) {
+    MappedFile file(filename);
+    LedgerFileHeader header{};
+    try {
+        size_t headerSize = readLedgerFileHeader(file, filename, header);
+        return header.payloadChecksum == fnv1a(file.data() + headerSize, file.size() - headerSize);
+    } catch (const std::runtime_error &) {
+        return false;
+    }
+}
+
+// Converts a CSV ledger into a binary ledger file
+void convertCsvToLedger(const std::string &csvFilename, const std::string &ledgerFilename) {
+    Ledger items;
+    reportCsvErrors(deserializeAllItems(items, csvFilename), std::cerr);
+    items.sortByDate();
+    writeLedgerFile(items, ledgerFilename);
+}
+
+// Cold segment file layout: a header, then the category and name string tables (count, then each
+// string's length and bytes) and the columns one after another, every integer as a LEB128 varint.
+// Dates are stored as the difference from the previous row, amounts and ids zigzag-encoded, ids as
+// the difference from the previous row, and categories and names as ids in the segment's own tables.
+// Rows in a segment are settled, so their probability is always 1 and is not stored. A typical row
+// takes about 10 bytes instead of the 37 of the ledger file.
+constexpr char COLD_SEGMENT_MAGIC[8] = {'B', 'U', 'D', 'G', 'E', 'T', 'C', 'S'};
+constexpr uint32_t COLD_SEGMENT_VERSION = 1;
+
+struct ColdSegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    int32_t firstDay;         // Period the segment holds the items of
+    int32_t lastDay;
+    uint64_t rowCount;
+    uint64_t payloadSize;
+    uint64_t payloadChecksum; // FNV-1a of everything after the header
+    uint64_t headerChecksum;  // FNV-1a of the header with this field set to zero
+};
+
+static_assert(std::is_trivially_copyable_v<ColdSegmentHeader>);
+
+// Returns the name of the cold segment file holding the items of a closed period, such as
+// financial_items_2023-01_2023-12.cold
+std::string coldSegmentFilename(int32_t firstDay, int32_t lastDay) {
+    return "financial_items_" + formatDate(firstDay).substr(0, 7) + "_" + formatDate(lastDay).substr(0, 7) + ".cold";
+}
+
+// Appends an unsigned LEB128 varint: 7 bits per byte, low bits first, high bit set on all but the last
+void appendVarint(std::string &out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// Maps signed values to unsigned ones with small magnitudes staying small: 0, -1, 1, -2, ... to 0, 1, 2, 3, ...
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Reads a varint written by appendVarint(); returns false if the data runs out or it is too long
+bool readVarint(const char *&position, const char *end, uint64_t &value) {
+    value = 0;
+    for (unsigned shift = 0; shift < 64 && position != end; shift += 7) {
+        const auto byte = static_cast<unsigned char>(*position++);
+        value |= uint64_t{byte & 0x7Fu} << shift;
+        if (byte < 0x80) return true;
+    }
+    return false;
+}
+
+// Writes the settled items of a closed period as a cold segment file. Like writeLedgerFile(), it
+// writes a temporary file, syncs it and renames it into place.
+void writeColdSegment(const Ledger &items, const std::string &filename, int32_t firstDay, int32_t lastDay) {
+    ScopedTimer timer(Probe::WriteColdSegment);
+    std::string payload;
+    for (const StringPool *pool: {&items.categories(), &items.names()}) {
+        appendVarint(payload, pool->size());
+        for (uint32_t id = 0; id < pool->size(); ++id) {
+            appendVarint(payload, pool->get(id).size());
+            payload += pool->get(id);
+        }
+    }
+    const size_t rows = items.size();
+    int32_t previousDate = 0;
+    for (size_t row = 0; row < rows; ++row) {
+        appendVarint(payload, zigzag(int64_t{items.date(row)} - previousDate));
+        previousDate = items.date(row);
+    }
+    for (size_t row = 0; row < rows; ++row) payload += static_cast<char>(items.type(row));
+    for (size_t row = 0; row < rows; ++row) appendVarint(payload, zigzag(items.amount(row)));
+    for (size_t row = 0; row < rows; ++row) appendVarint(payload, items.categoryId(row));
+    for (size_t row = 0; row < rows; ++row) appendVarint(payload, items.nameId(row));
+    uint64_t previousId = 0;
+    for (size_t row = 0; row < rows; ++row) {
+        appendVarint(payload, zigzag(static_cast<int64_t>(items.id(row) - previousId)));
+        previousId = items.id(row);
+    }
+
+    ColdSegmentHeader header{};
+    std::memcpy(header.magic, COLD_SEGMENT_MAGIC, sizeof(header.magic));
+    header.version = COLD_SEGMENT_VERSION;
+    header.firstDay = firstDay;
+    header.lastDay = lastDay;
+    header.rowCount = rows;
+    header.payloadSize = payload.size();
+    header.payloadChecksum = fnv1a(payload.data(), payload.size());
+    header.headerChecksum = headerChecksum(header);
+
+    std::string temporary = filename + ".tmp";
+    std::FILE *out = std::fopen(temporary.c_str(), "wb");
+    if (!out) throw std::runtime_error("Cannot write " + temporary);
+    std::fwrite(&header, sizeof(header), 1, out);
+    std::fwrite(payload.data(), 1, payload.size(), out);
+    syncFile(out);
+    const bool written = !std::ferror(out);
+    if (std::fclose(out) != 0 || !written) {
+        std::filesystem::remove(temporary);
+        throw std::runtime_error("Cannot write " + temporary);
+    }
+    std::filesystem::rename(temporary, filename);
+    syncDirectory(std::filesystem::path(filename).parent_path());
+}
+
+// Reads a cold segment file back into a ledger of its items, which keep their ids
+Ledger openColdSegment(const std::string &filename) {
+    ScopedTimer timer(Probe::OpenColdSegment);
+    MappedFile file(filename);
+    ColdSegmentHeader header{};
+    if (file.size() < sizeof(header)) throw std::runtime_error(filename + " is not a cold segment file");
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, COLD_SEGMENT_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(filename + " is not a cold segment file");
+    }
+    if (header.version != COLD_SEGMENT_VERSION) {
+        throw std::runtime_error(filename + " has unsupported version " + std::to_string(header.version));
+    }
+    const char *position = file.data() + sizeof(header), *end = file.data() + file.size();
+    if (header.headerChecksum != headerChecksum(header) || header.payloadSize != file.size() - sizeof(header) ||
+        header.payloadChecksum != fnv1a(position, header.payloadSize)) {
+        throw std::runtime_error(filename + " is corrupted");
+    }
+
+    auto next = [&]() {
+        uint64_t value;
+        if (!readVarint(position, end, value)) throw std::runtime_error(filename + " is corrupted");
+        return value;
+    };
+    std::vector<std::string_view> strings[2];
+    for (auto &table: strings) {
+        table.resize(std::min<uint64_t>(next(), file.size()));
+        for (std::string_view &string: table) {
+            const uint64_t length = next();
+            if (length > static_cast<uint64_t>(end - position)) throw std::runtime_error(filename + " is corrupted");
+            string = {position, static_cast<size_t>(length)};
+            position += length;
+        }
+    }
+    const size_t rows = std::min<uint64_t>(header.rowCount, file.size());
+    std::vector<int32_t> dates(rows);
+    std::vector<ItemType> types(rows);
+    int64_t date = 0;
+    for (int32_t &rowDate: dates) rowDate = static_cast<int32_t>(date += unzigzag(next()));
+    if (static_cast<size_t>(end - position) < rows) throw std::runtime_error(filename + " is corrupted");
+    for (ItemType &type: types) {
+        type = static_cast<ItemType>(*position++);
+        if (static_cast<size_t>(type) >= ITEM_TYPE_COUNT) throw std::runtime_error(filename + " is corrupted");
+    }
+    std::vector<int64_t> amounts(rows);
+    std::vector<uint64_t> categoryIds(rows), nameIds(rows);
+    for (int64_t &amount: amounts) amount = unzigzag(next());
+    for (uint64_t &id: categoryIds) {
+        if ((id = next()) >= strings[0].size()) throw std::runtime_error(filename + " is corrupted");
+    }
+    for (uint64_t &id: nameIds) {
+        if ((id = next()) >= strings[1].size()) throw std::runtime_error(filename + " is corrupted");
+    }
+
+    Ledger items;
+    items.reserve(rows);
+    uint64_t id = 0;
+    for (size_t row = 0; row < rows; ++row) {
+        id += static_cast<uint64_t>(unzigzag(next()));
+        items.appendRow(types[row], amounts[row], dates[row], strings[0][categoryIds[row]], strings[1][nameIds[row]],
+                        1.0, id);
+    }
+    return items;
+}
+
+// Journal of ledger mutations, replayed on top of the last snapshot when the ledger is loaded
+const std::string &JOURNAL_FILENAME = "financial_items.journal";
+const std::string &COMPACTING_JOURNAL_FILENAME = "financial_items.journal.compacting";
+
+// Appended journal records are fsync'd together at most this often
+constexpr auto JOURNAL_SYNC_INTERVAL = std::chrono::milliseconds(50);
+
+// The ledger is compacted into a new snapshot once the journal holds this many records
+constexpr uint64_t JOURNAL_COMPACTION_THRESHOLD = 1000;
+
+// Rows added in bulk are journaled in records of at most this many rows
+constexpr size_t JOURNAL_BULK_ROWS = 1 << 16;
+
+// Kinds of journal records. AddRow and EditRow are only written by versions from before item ids,
+// which identified edited rows by position; they are still replayed. AddItems holds rows added in
+// bulk, which are appended and then put in date order.
+enum class JournalOperation : uint8_t {
+    AddRow = 1,
+    EditRow = 2,
+    DeleteByName = 3,
+    AddItem = 4,
+    EditItem = 5,
+    DeleteItem = 6,
+    AddRecurrence = 7,
+    DeleteRecurrence = 8,
+    AddScenarioGroup = 9,
+    DeleteScenarioGroup = 10,
+    ClosePeriod = 11,
+    AddItems = 12
+};
+
+// Appends the bytes of a trivially copyable value to a buffer
+template<typename T>
+void appendBytes(std::string &buffer, const T &value) {
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+// Appends a length-prefixed string to a buffer
+void appendString(std::string &buffer, std::string_view value) {
+    appendBytes(buffer, static_cast<uint32_t>(value.size()));
+    buffer.append(value);
+}
+
+// Reads values written with appendBytes and appendString; every read fails once the data runs out
+class ByteReader {
+private:
+    const char *position;
+    const char *end;
+
+public:
+    ByteReader(const char *data, size_t size) : position(data), end(data + size) {
+    }
+
+    template<typename T>
+    bool read(T &value) {
+        if (static_cast<size_t>(end - position) < sizeof(T)) return false;
+        std::memcpy(&value, position, sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+
+    bool readString(std::string_view &value) {
+        uint32_t size;
+        if (!read(size) || static_cast<size_t>(end - position) < size) return false;
+        value = {position, size};
+        position += size;
+        return true;
+    }
+};
+
+// Appends a ledger row, preceded by its item id, to the payload of a journal record
+void appendJournalRow(std::string &payload, const Ledger &items, size_t row) {
+    appendBytes(payload, items.id(row));
+    appendBytes(payload, items.type(row));
+    appendBytes(payload, items.amount(row));
+    appendBytes(payload, items.date(row));
+    appendBytes(payload, items.probability(row));
+    appendString(payload, items.category(row));
+    appendString(payload, items.name(row));
+}
+
+// Encodes a ledger row as the payload of an AddItem or EditItem record
+std::string encodeJournalRow(const Ledger &items, size_t row) {
+    std::string payload;
+    appendJournalRow(payload, items, row);
+    return payload;
+}
+
+// Encodes rows [firstRow, lastRow) as the payload of an AddItems record: their count, then each row
+std::string encodeJournalRows(const Ledger &items, size_t firstRow, size_t lastRow) {
+    std::string payload;
+    appendBytes(payload, static_cast<uint32_t>(lastRow - firstRow));
+    for (size_t row = firstRow; row < lastRow; ++row) appendJournalRow(payload, items, row);
+    return payload;
+}
+
+// Encodes a recurrence rule as the payload of an AddRecurrence record
+std::string encodeJournalRecurrence(const Ledger &items, const RecurrenceRule &rule) {
+    std::string payload;
+    appendBytes(payload, rule.id);
+    appendBytes(payload, rule.type);
+    appendBytes(payload, rule.amount);
+    appendBytes(payload, rule.probability);
+    appendBytes(payload, rule.schedule.start);
+    appendBytes(payload, rule.schedule.end);
+    appendBytes(payload, rule.schedule.count);
+    appendBytes(payload, rule.schedule.interval);
+    appendBytes(payload, rule.schedule.unit);
+    appendString(payload, items.categories().get(rule.categoryId));
+    appendString(payload, items.names().get(rule.nameId));
+    return payload;
+}
+
+// Encodes a scenario group and its member ids as the payload of an AddScenarioGroup record
+std::string encodeJournalScenarioGroup(const Ledger &items, size_t index) {
+    const ScenarioGroup &group = items.scenarioGroup(index);
+    std::string payload;
+    appendBytes(payload, group.id);
+    appendBytes(payload, group.kind);
+    appendBytes(payload, group.probability);
+    appendBytes(payload, group.parentId);
+    appendString(payload, items.names().get(group.nameId));
+    appendBytes(payload, group.memberCount);
+    for (uint64_t member: items.scenarioGroupMembers(index)) appendBytes(payload, member);
+    return payload;
+}
+
+// Append-only log of mutations. Each record is
+//   payload size (uint32) | checksum (uint32) | sequence (uint64) | operation (uint8) | payload
+// where the checksum covers everything after it. Appends return immediately; a background
+// thread fsyncs whatever was appended since the last sync (group commit).
+class Journal {
+private:
+    std::FILE *file = nullptr;
+    std::string filename;
+    uint64_t nextSequence = 0;
+    bool dirty = false;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable stopRequested;
+    std::thread syncThread;
+
+    void syncLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            stopRequested.wait_for(lock, JOURNAL_SYNC_INTERVAL);
+            if (dirty && file) {
+                syncFile(file);
+                dirty = false;
+            }
+        }
+    }
+
+public:
+    Journal() = default;
+
+    ~Journal() {
+        close();
+    }
+
+    Journal(const Journal &) = delete;
+    Journal &operator=(const Journal &) = delete;
+
+    // Opens the journal for appending; new records are numbered from sequence
+    void open(const std::string &path, uint64_t sequence) {
+        close();
+        file = std::fopen(path.c_str(), "ab");
+        if (!file) throw std::runtime_error("Cannot open " + path);
+        filename = path;
+        nextSequence = sequence;
+        stopping = false;
+        syncThread = std::thread(&Journal::syncLoop, this);
+    }
+
+    // Syncs outstanding records and closes the journal
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        stopRequested.notify_all();
+        if (syncThread.joinable()) syncThread.join();
+        if (file) {
+            syncFile(file);
+            std::fclose(file);
+            file = nullptr;
+        }
+        dirty = false;
+    }
+
+    [[nodiscard]] bool isOpen() const { return file != nullptr; }
+
+    // Returns the sequence number the next record will get
+    [[nodiscard]] uint64_t sequence() const { return nextSequence; }
+
+    // Appends one record; it reaches the disk with the next group sync
+    void append(JournalOperation operation, const std::string &payload) {
+        ScopedTimer timer(Probe::JournalAppend);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!file) return;
+        std::string body;
+        appendBytes(body, nextSequence++);
+        appendBytes(body, operation);
+        body += payload;
+
+        std::string record;
+        appendBytes(record, static_cast<uint32_t>(payload.size()));
+        appendBytes(record, static_cast<uint32_t>(fnv1a(body.data(), body.size())));
+        record += body;
+        std::fwrite(record.data(), 1, record.size(), file);
+        std::fflush(file);
+        dirty = true;
+    }
+
+    // Writes outstanding records to disk now
+    void sync() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (file && dirty) {
+            syncFile(file);
+            dirty = false;
+        }
+    }
+
+    // Moves the current journal to rotatedPath and starts an empty one, returning the sequence of
+    // the first record that will go into the new journal
+    uint64_t rotate(const std::string &rotatedPath) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!file) return nextSequence;
+        syncFile(file);
+        std::fclose(file);
+        dirty = false;
+        std::filesystem::rename(filename, rotatedPath);
+        file = std::fopen(filename.c_str(), "ab");
+        if (!file) throw std::runtime_error("Cannot open " + filename);
+        return nextSequence;
+    }
+};
+
+// Calls apply for every intact record of a journal file whose sequence is at least fromSequence.
+// Reading stops at the first torn or corrupted record; the returned offset is where it starts.
+uint64_t replayJournal(const std::string &filename, uint64_t fromSequence,
+                       const std::function<void(uint64_t, JournalOperation, ByteReader &)> &apply) {
+    std::ifstream in(filename, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    ByteReader reader(contents.data(), contents.size());
+    uint64_t offset = 0;
+    while (true) {
+        uint32_t payloadSize, checksum;
+        if (!reader.read(payloadSize) || !reader.read(checksum)) break;
+        const size_t bodySize = sizeof(uint64_t) + sizeof(JournalOperation) + payloadSize;
+        const size_t bodyOffset = offset + 2 * sizeof(uint32_t);
+        if (contents.size() - bodyOffset < bodySize ||
+            static_cast<uint32_t>(fnv1a(contents.data() + bodyOffset, bodySize)) != checksum) {
+            break;
+        }
+
+        ByteReader body(contents.data() + bodyOffset, bodySize);
+        uint64_t sequence = 0;
+        JournalOperation operation{};
+        body.read(sequence);
+        body.read(operation);
+        if (sequence >= fromSequence) apply(sequence, operation, body);
+
+        offset = bodyOffset + bodySize;
+        reader = ByteReader(contents.data() + offset, contents.size() - offset);
+    }
+    return offset;
+}
+
+// Writes snapshots of a ledger on a background thread, so saving never holds up the change that asked
+// for it. A snapshot submitted while another is being written replaces any that is still waiting, so a
+// burst of requests costs at most two writes. The thread only runs while there is something to write.
+class SnapshotWriter {
+private:
+    std::string ledgerPath;
+    std::string backupPath;
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::shared_ptr<const Ledger> pending; // Next snapshot to write, or null
+    uint64_t pendingSequence = 0;
+    uint64_t written = 0;                  // Journal sequence of the last snapshot on disk
+    bool writing = false;
+    std::thread thread;
+
+    void writeLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (pending) {
+            std::shared_ptr<const Ledger> version = std::move(pending);
+            const uint64_t sequence = pendingSequence;
+            lock.unlock();
+            bool succeeded = true;
+            try {
+                writeLedgerFile(*version, ledgerPath, sequence, backupPath);
+            } catch (const std::exception &e) {
+                std::cerr << "Error saving items: " << e.what() << std::endl;
+                succeeded = false;
+            }
+            version.reset();
+            lock.lock();
+            if (succeeded) written = std::max(written, sequence);
+        }
+        writing = false;
+        finished.notify_all();
+    }
+
+public:
+    SnapshotWriter(std::string ledgerPath, std::string backupPath)
+        : ledgerPath(std::move(ledgerPath)), backupPath(std::move(backupPath)) {
+    }
+
+    ~SnapshotWriter() {
+        drain();
+    }
+
+    SnapshotWriter(const SnapshotWriter &) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+    // Queues a version of the ledger that includes every journal record before sequence
+    void submit(std::shared_ptr<const Ledger> version, uint64_t sequence) {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = std::move(version);
+        pendingSequence = sequence;
+        if (writing) return; // The running thread writes it next
+        if (thread.joinable()) thread.join();
+        writing = true;
+        thread = std::thread(&SnapshotWriter::writeLoop, this);
+    }
+
+    // Waits until every queued snapshot has been written
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return !writing; });
+        if (thread.joinable()) thread.join();
+    }
+
+    // Returns the journal sequence of the last snapshot written
+    [[nodiscard]] uint64_t writtenSequence() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return written;
+    }
+
+    // Records the journal sequence of the snapshot already on disk; call while nothing is queued
+    void setWrittenSequence(uint64_t sequence) {
+        std::lock_guard<std::mutex> lock(mutex);
+        written = sequence;
+    }
+};
+
+// Totals shown by the detailed summary, kept up to date as items are added, edited and deleted so
+// that the summary never rescans the ledger. Per-type month totals live in the ledger's month index.
+// Everything here depends on today's date: the totals are for a reference day and are rebuilt from
+// the ledger when the day changes.
+class SummaryAggregates {
+private:
+    static constexpr int32_t STALE = std::numeric_limits<int32_t>::min();
+
+    int32_t referenceDay = STALE;
+    int32_t monthEnd = STALE;
+    int64_t currentAssets = 0;   // Assets and income minus expenses dated on or before the reference day
+    int64_t projectedAssets = 0; // The same through the end of the reference day's month
+    std::vector<int64_t> expenses;      // Expenses through the end of the month, by category id
+    std::vector<int64_t> expenseCounts; // Number of those expense rows, by category id
+    std::set<std::pair<int64_t, uint32_t> > ranking; // (-total, category id) of categories with expenses
+
+public:
+    // Rebuilds every total for the given day
+    void rebuild(const Ledger &items, int32_t today) {
+        ScopedTimer timer(Probe::RebuildAggregates);
+        referenceDay = today;
+        monthEnd = lastDayOfMonth(today);
+        currentAssets = projectedAssets = 0;
+        expenses.assign(items.categories().size(), 0);
+        expenseCounts.assign(items.categories().size(), 0);
+        ranking.clear();
+        const size_t end = items.months().monthRows(monthOf(today)).second;
+        for (size_t row = 0; row < end; ++row) update(items, row, 1);
+        for (size_t index = 0; index < items.recurrenceCount(); ++index) {
+            updateRecurrence(items.recurrence(index), 1);
+        }
+    }
+
+    // Rebuilds the totals if they are for a different day or were invalidated
+    void refresh(const Ledger &items, int32_t today) {
+        if (today != referenceDay) rebuild(items, today);
+    }
+
+    // Forgets the totals after a bulk change; the next refresh rebuilds them
+    void invalidate() {
+        referenceDay = STALE;
+    }
+
+    // Adds (sign 1) or removes (sign -1) the contribution of a row
+    void update(const Ledger &items, size_t row, int64_t sign) {
+        const int32_t date = items.date(row);
+        if (referenceDay == STALE || date > monthEnd) return;
+        const ItemType type = items.type(row);
+        if (type != ItemType::Liability) {
+            projectedAssets += sign * items.signedAmount(row);
+            if (date <= referenceDay) currentAssets += sign * items.signedAmount(row);
+        }
+        if (type == ItemType::Expense) updateExpenses(items.categoryId(row), sign * items.amount(row), sign);
+    }
+
+    // Adds (sign 1) or removes (sign -1) the contribution of a recurrence rule's occurrences, which
+    // are counted up to the reference day and the end of its month without being expanded
+    void updateRecurrence(const RecurrenceRule &rule, int64_t sign) {
+        if (referenceDay == STALE) return;
+        const auto projected = static_cast<int64_t>(rule.schedule.countThrough(monthEnd));
+        if (projected == 0) return;
+        if (rule.type != ItemType::Liability) {
+            const auto current = static_cast<int64_t>(rule.schedule.countThrough(referenceDay));
+            projectedAssets += sign * projected * signedAmount(rule.type, rule.amount);
+            currentAssets += sign * current * signedAmount(rule.type, rule.amount);
+        }
+        if (rule.type == ItemType::Expense) {
+            updateExpenses(rule.categoryId, sign * projected * rule.amount, sign * projected);
+        }
+    }
+
+    // Changes the expense total and number of expenses of a category, keeping the ranking in order
+    void updateExpenses(uint32_t category, int64_t amount, int64_t count) {
+        if (category >= expenses.size()) {
+            expenses.resize(category + 1, 0);
+            expenseCounts.resize(category + 1, 0);
+        }
+        if (expenseCounts[category] > 0) ranking.erase({-expenses[category], category});
+        expenses[category] += amount;
+        expenseCounts[category] += count;
+        if (expenseCounts[category] > 0) ranking.insert({-expenses[category], category});
+    }
+
+    [[nodiscard]] int64_t getCurrentAssets() const { return currentAssets; }
+    [[nodiscard]] int64_t getProjectedAssets() const { return projectedAssets; }
+    [[nodiscard]] int32_t getReferenceDay() const { return referenceDay; }
+
+    // Returns up to k (category id, total) pairs with the largest expense totals, largest first
+    [[nodiscard]] std::vector<std::pair<uint32_t, int64_t> > topExpenseCategories(size_t k) const {
+        std::vector<std::pair<uint32_t, int64_t> > top;
+        for (auto it = ranking.begin(); it != ranking.end() && top.size() < k; ++it) {
+            top.emplace_back(it->second, -it->first);
+        }
+        return top;
+    }
+
+    // Returns true if both hold the same totals
+    [[nodiscard]] bool matches(const SummaryAggregates &other) const {
+        return referenceDay == other.referenceDay && currentAssets == other.currentAssets &&
+               projectedAssets == other.projectedAssets && ranking == other.ranking;
+    }
+};
+
+// Projection lengths in years
+constexpr int32_t DEFAULT_PROJECTION_YEARS = 5;
+constexpr int32_t MAX_PROJECTION_YEARS = 100;
+
+// Projected position at the end of one month. The type totals count every item and recurring
+// occurrence dated up to the end of the month in full, as the monthly summary does. The outcomes are
+// total assets as the scenario evaluation computes them: every uncertain item weighted by its
+// probability for the expected outcome, or taken the way that hurts or helps most for the worst and
+// best cases, with each scenario group taken as a whole.
+struct ProjectionMonth {
+    int32_t month = 0;           // Key from monthOf()
+    TypeTotals totals{};         // Running totals by ItemType
+    int64_t worstCase = 0;
+    int64_t expectedOutcome = 0; // Rounded to the nearest minor unit
+    int64_t bestCase = 0;
+};
+
+// Returns the first day of a month given its key from monthOf()
+int32_t firstDayOfMonthKey(int32_t month) {
+    return daysFromCivil(month / 12, month % 12 + 1, 1);
+}
+
+// Manages the state of all financial items. Every mutation is applied in memory and appended to
+// the journal; the journal is compacted into a new snapshot in the background once it grows.
+// Snapshots are written by a SnapshotWriter, so no change waits for the ledger file to be written.
+// The ledger's files live in one directory, so one process can keep several ledgers loaded.
+//
+// Changes are made on one thread. Work on other threads reads a published version of the items from
+// snapshot(), which those changes never alter, so it neither blocks them nor copies the ledger.
+struct GlobalState {
+    std::filesystem::path directory;
+    Ledger items;
+    std::shared_ptr<const Ledger> published; // Latest snapshot of the items, or null if they changed since
+    Journal journal;
+    uint64_t snapshotSequence = 0; // First journal record not included in the latest snapshot written or queued
+    bool persistent = false;       // False when loading failed, so a partial ledger is never written
+    SnapshotWriter writer{(directory / LEDGER_FILENAME).string(), (directory / LEDGER_BACKUP_FILENAME).string()};
+    SummaryAggregates aggregates;
+    bool checkAggregates = false;  // Compare the maintained aggregates with a recompute after each change
+    bool batching = false;         // Compaction waits until the current batch of changes ends
+    bool compactionDue = false;    // Rows were added in bulk, so compact at the next chance whatever the journal length
+    // While the journal is replayed: whether records from before item ids number rows in the order of
+    // their ids (see findLegacyRow()), and if so those ids in that order
+    bool legacyOrderKnown = false;
+    std::vector<uint64_t> legacyRowIds;
+
+    explicit GlobalState(std::filesystem::path directory = ".") : directory(std::move(directory)) {
+        load();
+    }
+
+    ~GlobalState() {
+        save();
+        journal.close();
+    }
+
+    // Returns the path of one of the ledger's files
+    [[nodiscard]] std::string pathOf(const std::string &filename) const {
+        return (directory / filename).string();
+    }
+
+    // Sorts items by date, keeping the existing order of items on the same day
+    void sortByDate() {
+        beforeChange();
+        items.sortByDate();
+    }
+
+    // Returns all items
+    [[nodiscard]] const Ledger &getItems() const {
+        return items;
+    }
+
+    // Returns an immutable version of the items as they are now. Taking one is cheap, and repeated
+    // calls between changes share the same version.
+    [[nodiscard]] std::shared_ptr<const Ledger> snapshot() {
+        if (!published) published = items.snapshot();
+        return published;
+    }
+
+    // Unpublishes the current version before the items change. A version nobody else holds is simply
+    // dropped, so the change can be made in place instead of copying the columns.
+    void beforeChange() {
+        published.reset();
+    }
+
+    // Returns the totals of each item type for the current month, including recurring items
+    [[nodiscard]] TypeTotals getTotalsThisMonth() const {
+        const int32_t today = currentDay();
+        TypeTotals totals = items.months().monthTotals(monthOf(today));
+        TypeTotals recurring = items.recurringTotals(firstDayOfMonth(today), lastDayOfMonth(today));
+        for (size_t type = 0; type < ITEM_TYPE_COUNT; ++type) totals[type] += recurring[type];
+        return totals;
+    }
+
+    // Adds an item and returns its id
+    uint64_t addItem(const FinancialItem &item) {
+        beforeChange();
+        size_t row = items.insert(item);
+        aggregates.update(items, row, 1);
+        if (persistent) journal.append(JournalOperation::AddItem, encodeJournalRow(items, row));
+        afterChange();
+        return items.id(row);
+    }
+
+    // Replaces the item with the given id; returns false if there is none
+    bool editItem(uint64_t id, const FinancialItem &item) {
+        size_t row;
+        if (!items.findRow(id, row)) return false;
+        beforeChange();
+        aggregates.update(items, row, -1);
+        try {
+            row = items.set(row, item);
+        } catch (const std::invalid_argument &) {
+            aggregates.update(items, row, 1); // The row is unchanged
+            throw;
+        }
+        aggregates.update(items, row, 1);
+        if (persistent) journal.append(JournalOperation::EditItem, encodeJournalRow(items, row));
+        afterChange();
+        return true;
+    }
+
+    // Deletes the item with the given id; returns false if there is none
+    bool deleteItem(uint64_t id) {
+        size_t row;
+        if (!items.findRow(id, row)) return false;
+        beforeChange();
+        aggregates.update(items, row, -1);
+        items.eraseRow(row);
+        std::string payload;
+        appendBytes(payload, id);
+        if (persistent) journal.append(JournalOperation::DeleteItem, payload);
+        afterChange();
+        return true;
+    }
+
+    // Deletes every item with the given name and returns how many were deleted
+    size_t deleteByName(const std::string &name) {
+        beforeChange();
+        size_t row;
+        for (uint64_t id: items.idsWithName(name)) {
+            if (items.findRow(id, row)) aggregates.update(items, row, -1);
+        }
+        size_t erased = items.eraseByName(name);
+        if (erased == 0) return 0;
+        std::string payload;
+        appendString(payload, name);
+        if (persistent) journal.append(JournalOperation::DeleteByName, payload);
+        afterChange();
+        return erased;
+    }
+
+    // Adds a recurring item that first occurs on the item's date and returns its id
+    uint64_t addRecurrence(const FinancialItem &item, const RecurrenceSchedule &schedule) {
+        beforeChange();
+        items.addRecurrence(item, schedule);
+        const RecurrenceRule &rule = items.recurrence(items.recurrenceCount() - 1); // Rules are appended
+        aggregates.updateRecurrence(rule, 1);
+        if (persistent) journal.append(JournalOperation::AddRecurrence, encodeJournalRecurrence(items, rule));
+        afterChange();
+        return rule.id;
+    }
+
+    // Deletes the recurrence rule with the given id; returns false if there is none
+    bool deleteRecurrence(uint64_t id) {
+        size_t index;
+        if (!items.findRecurrence(id, index)) return false;
+        beforeChange();
+        aggregates.updateRecurrence(items.recurrence(index), -1);
+        items.eraseRecurrence(id);
+        std::string payload;
+        appendBytes(payload, id);
+        if (persistent) journal.append(JournalOperation::DeleteRecurrence, payload);
+        afterChange();
+        return true;
+    }
+
+    // Adds a scenario group over existing items and returns its id.
+    // Throws std::invalid_argument if the group is invalid.
+    uint64_t addScenarioGroup(ScenarioGroupKind kind, std::string_view name, double probability, uint64_t parentId,
+                              const std::vector<uint64_t> &memberIds) {
+        beforeChange();
+        uint64_t id = items.insertScenarioGroup(kind, name, probability, parentId, memberIds);
+        const size_t index = items.scenarioGroupCount() - 1; // Groups are appended
+        if (persistent) journal.append(JournalOperation::AddScenarioGroup, encodeJournalScenarioGroup(items, index));
+        afterChange();
+        return id;
+    }
+
+    // Deletes the scenario group with the given id, leaving its items; returns false if there is none
+    bool deleteScenarioGroup(uint64_t id) {
+        size_t index;
+        if (!items.findScenarioGroup(id, index)) return false;
+        beforeChange();
+        items.eraseScenarioGroup(id);
+        std::string payload;
+        appendBytes(payload, id);
+        if (persistent) journal.append(JournalOperation::DeleteScenarioGroup, payload);
+        afterChange();
+        return true;
+    }
+
+    // Adds every row of another ledger and restores date order. The new rows are journaled in AddItems
+    // records, which are synced before this returns, and the ledger is then compacted into a new snapshot,
+    // or once the current batch of changes ends.
+    void addItems(const Ledger &imported) {
+        beforeChange();
+        const size_t firstRow = items.size();
+        items.append(imported);
+        if (persistent) {
+            for (size_t row = firstRow; row < items.size(); row += JOURNAL_BULK_ROWS) {
+                const size_t lastRow = std::min(items.size(), row + JOURNAL_BULK_ROWS);
+                journal.append(JournalOperation::AddItems, encodeJournalRows(items, row, lastRow));
+            }
+        }
+        items.sortByDate();
+        aggregates.invalidate();
+        journal.sync();
+        compactionDue = true;
+        compactIfNeeded();
+    }
+
+    // Closes every month from the end of the last closed period (or the first item) through the month
+    // that contains throughDay, which must be before this month. The settled items of those months are
+    // written to a cold segment file first, then replaced by closing balances in the ledger (see
+    // Ledger::closePeriod()). Returns the number of items moved. Throws std::invalid_argument if there
+    // is nothing to close.
+    size_t closePeriod(int32_t throughDay) {
+        ScopedTimer timer(Probe::ClosePeriod);
+        if (!persistent) throw std::invalid_argument("The ledger is not being saved");
+        const int32_t lastDay = lastDayOfMonth(throughDay);
+        if (lastDay >= firstDayOfMonth(currentDay())) throw std::invalid_argument("Only past months can be closed");
+        int32_t firstDay = items.empty() ? firstDayOfMonth(lastDay) : firstDayOfMonth(items.date(0));
+        if (items.closedPeriodCount() > 0) {
+            const int32_t closedThrough = items.closedPeriod(items.closedPeriodCount() - 1).lastDay;
+            if (lastDay <= closedThrough) throw std::invalid_argument("That month is already closed");
+            firstDay = closedThrough + 1;
+        }
+        // A month before the first item has nothing to close
+        Ledger settled = firstDay <= lastDay ? items.settledRows(firstDay, lastDay) : Ledger();
+        if (settled.empty()) throw std::invalid_argument("No settled transactions to close");
+
+        writeColdSegment(settled, pathOf(coldSegmentFilename(firstDay, lastDay)), firstDay, lastDay);
+        beforeChange();
+        const size_t closed = items.closePeriod(firstDay, lastDay);
+        aggregates.invalidate();
+        std::string payload;
+        appendBytes(payload, firstDay);
+        appendBytes(payload, lastDay);
+        journal.append(JournalOperation::ClosePeriod, payload);
+        compact();
+        return closed;
+    }
+
+    // Reads the items of the closed period that contains a day from its cold segment.
+    // Throws std::invalid_argument if the day is not in a closed period.
+    [[nodiscard]] Ledger openClosedPeriod(int32_t day) const {
+        size_t index;
+        if (!items.findClosedPeriod(day, index)) throw std::invalid_argument("That month is not closed");
+        const ClosedPeriod &period = items.closedPeriod(index);
+        return openColdSegment(pathOf(coldSegmentFilename(period.firstDay, period.lastDay)));
+    }
+
+    // Returns the summary aggregates for today
+    const SummaryAggregates &getAggregates() {
+        aggregates.refresh(items, currentDay());
+        return aggregates;
+    }
+
+    // Compares the maintained aggregates and month index with a full recompute, reporting and
+    // repairing any difference
+    bool verifyAggregates() {
+        SummaryAggregates recomputed;
+        bool consistent = items.monthIndexConsistent();
+        if (aggregates.getReferenceDay() == currentDay()) {
+            recomputed.rebuild(items, aggregates.getReferenceDay());
+            consistent = consistent && recomputed.matches(aggregates);
+        }
+        if (!consistent) {
+            std::cerr << "Maintained aggregates differ from a full recompute" << std::endl;
+            aggregates.invalidate();
+        }
+        return consistent;
+    }
+
+    // Defers compaction while a batch of changes is applied
+    void beginBatch() {
+        batching = true;
+    }
+
+    // Ends a batch: syncs the journal once and compacts if the batch made it long enough
+    void endBatch() {
+        batching = false;
+        journal.sync();
+        compactIfNeeded();
+    }
+
+    // Runs after every single-item change
+    void afterChange() {
+        if (checkAggregates) verifyAggregates();
+        compactIfNeeded();
+    }
+
+    // Finds the row that a journal record from before item ids identifies by position. Versions before
+    // the ledger was kept in date order numbered rows in the order of their snapshot file, with added
+    // rows at the end. A snapshot they wrote out of date order is sorted when it is opened, but its rows
+    // were numbered in file order, so their ids still give the order those records use. Later versions
+    // numbered rows in date order, as the ledger is now.
+    bool findLegacyRow(uint64_t position, size_t &row) {
+        if (!legacyOrderKnown) {
+            legacyOrderKnown = true;
+            for (size_t index = 1; index < items.size(); ++index) {
+                if (items.id(index) >= items.id(index - 1)) continue;
+                legacyRowIds.resize(items.size());
+                for (size_t i = 0; i < items.size(); ++i) legacyRowIds[i] = items.id(i);
+                std::sort(legacyRowIds.begin(), legacyRowIds.end());
+                break;
+            }
+        }
+        if (legacyRowIds.empty()) {
+            row = position;
+            return position < items.size();
+        }
+        return position < legacyRowIds.size() && items.findRow(legacyRowIds[position], row);
+    }
+
+    // Re-applies one journal record during recovery
+    void applyJournalRecord(JournalOperation operation, ByteReader &reader) {
+        auto readRow = [&reader](ItemType &type, int64_t &amount, int32_t &date, double &probability,
+                                 std::string_view &category, std::string_view &name) {
+            return reader.read(type) && reader.read(amount) && reader.read(date) && reader.read(probability) &&
+                   reader.readString(category) && reader.readString(name);
+        };
+        ItemType type;
+        int64_t amount;
+        int32_t date, firstDay, lastDay;
+        double probability;
+        std::string_view category, name;
+        uint64_t row, id, parentId, member;
+        RecurrenceSchedule schedule;
+        ScenarioGroupKind kind;
+        uint32_t memberCount, rowCount;
+        std::vector<uint64_t> memberIds;
+
+        switch (operation) {
+            case JournalOperation::AddRow:
+                if (!readRow(type, amount, date, probability, category, name)) break;
+                row = items.insertRow(type, amount, date, category, name, probability);
+                if (!legacyRowIds.empty()) legacyRowIds.push_back(items.id(row)); // The largest id so far
+                return;
+            case JournalOperation::EditRow:
+                if (!reader.read(id) || !findLegacyRow(id, row) ||
+                    !readRow(type, amount, date, probability, category, name)) {
+                    break;
+                }
+                items.replaceRow(row, type, amount, date, category, name, probability);
+                return;
+            case JournalOperation::DeleteByName:
+                if (!reader.readString(name)) break;
+                if (!legacyRowIds.empty()) {
+                    const std::vector<uint64_t> &erased = items.idsWithName(name);
+                    std::erase_if(legacyRowIds, [&erased](uint64_t id) {
+                        return std::find(erased.begin(), erased.end(), id) != erased.end();
+                    });
+                }
+                items.eraseByName(name);
+                return;
+            case JournalOperation::AddItem:
+                if (!reader.read(id) || !readRow(type, amount, date, probability, category, name)) break;
+                items.insertRow(type, amount, date, category, name, probability, id);
+                return;
+            case JournalOperation::EditItem:
+                if (!reader.read(id) || !items.findRow(id, row) ||
+                    !readRow(type, amount, date, probability, category, name)) {
+                    break;
+                }
+                items.replaceRow(row, type, amount, date, category, name, probability);
+                return;
+            case JournalOperation::DeleteItem:
+                if (!reader.read(id) || !items.eraseById(id)) break;
+                return;
+            case JournalOperation::AddRecurrence:
+                if (!reader.read(id) || !reader.read(type) || !reader.read(amount) || !reader.read(probability) ||
+                    !reader.read(schedule.start) || !reader.read(schedule.end) || !reader.read(schedule.count) ||
+                    !reader.read(schedule.interval) || !reader.read(schedule.unit) || !reader.readString(category) ||
+                    !reader.readString(name)) {
+                    break;
+                }
+                items.insertRecurrence(type, amount, category, name, probability, schedule, id);
+                return;
+            case JournalOperation::DeleteRecurrence:
+                if (!reader.read(id) || !items.eraseRecurrence(id)) break;
+                return;
+            case JournalOperation::AddScenarioGroup:
+                if (!reader.read(id) || !reader.read(kind) || !reader.read(probability) || !reader.read(parentId) ||
+                    !reader.readString(name) || !reader.read(memberCount)) {
+                    break;
+                }
+                while (memberIds.size() < memberCount && reader.read(member)) memberIds.push_back(member);
+                if (memberIds.size() < memberCount) break;
+                items.insertScenarioGroup(kind, name, probability, parentId, memberIds, id);
+                return;
+            case JournalOperation::DeleteScenarioGroup:
+                if (!reader.read(id) || !items.eraseScenarioGroup(id)) break;
+                return;
+            case JournalOperation::ClosePeriod:
+                // The items were written to the cold segment before the record
+                if (!reader.read(firstDay) || !reader.read(lastDay)) break;
+                items.closePeriod(firstDay, lastDay);
+                return;
+            case JournalOperation::AddItems:
+                // The rows were appended in this order and then sorted, so replaying them does the same
+                if (!reader.read(rowCount)) break;
+                for (; rowCount > 0 && reader.read(id) && readRow(type, amount, date, probability, category, name);
+                     --rowCount) {
+                    items.appendRow(type, amount, date, category, name, probability, id);
+                }
+                if (rowCount > 0) break;
+                items.sortByDate();
+                return;
+        }
+        throw std::runtime_error("Invalid journal record");
+    }
+
+    // Removes the rotated journal once a snapshot that includes all of its records is on disk.
+    // Returns false while it is still needed, or before it has been replayed by load().
+    bool retireCompactingJournal() {
+        if (!std::filesystem::exists(pathOf(COMPACTING_JOURNAL_FILENAME))) return true;
+        if (!persistent || writer.writtenSequence() < snapshotSequence) return false;
+        std::filesystem::remove(pathOf(COMPACTING_JOURNAL_FILENAME));
+        return true;
+    }
+
+    // Starts a background compaction once enough records have been journaled since the last snapshot, or
+    // rows were added in bulk. The journal is rotated first, so records appended during the compaction go to
+    // a fresh file. While the previous snapshot is still being written, records keep collecting in the journal.
+    void compactIfNeeded() {
+        if (!persistent || batching) return;
+        if (!compactionDue && journal.sequence() - snapshotSequence < JOURNAL_COMPACTION_THRESHOLD) return;
+        try {
+            if (!retireCompactingJournal()) return;
+            uint64_t sequence = journal.rotate(pathOf(COMPACTING_JOURNAL_FILENAME));
+            snapshotSequence = sequence;
+            compactionDue = false;
+            writer.submit(snapshot(), sequence);
+        } catch (const std::exception &e) {
+            std::cerr << "Error compacting items: " << e.what() << std::endl;
+        }
+    }
+
+    // Queues a snapshot of the whole ledger, for changes that are not journaled. Journal records
+    // before it are skipped on replay and dropped with the next rotation.
+    void compact() {
+        ScopedTimer timer(Probe::Compact);
+        if (!persistent) return;
+        journal.sync();
+        snapshotSequence = journal.sequence();
+        writer.submit(snapshot(), snapshotSequence);
+    }
+
+    // Makes every change durable: syncs the journal and waits for queued snapshots to be written
+    void save() {
+        ScopedTimer timer(Probe::Save);
+        journal.sync();
+        writer.drain();
+        try {
+            retireCompactingJournal();
+        } catch (const std::exception &e) {
+            std::cerr << "Error saving items: " << e.what() << std::endl;
+        }
+    }
+
+    // Loads the state from disk: maps the last snapshot and replays the journal on top of it.
+    // A CSV ledger from before the binary format is imported once and written as a snapshot.
+    void load() {
+        ScopedTimer timer(Probe::Load);
+        save();
+        journal.close();
+        persistent = false;
+        try {
+            beforeChange();
+            items.clear();
+            aggregates.invalidate();
+            uint64_t sequence = 0;
+            bool importedCsv = false;
+            if (std::filesystem::exists(pathOf(LEDGER_FILENAME))) {
+                items = openLedgerFile(pathOf(LEDGER_FILENAME), &sequence);
+            } else if (std::filesystem::exists(pathOf(CSV_FILENAME))) {
+                reportCsvErrors(deserializeAllItems(items, pathOf(CSV_FILENAME)), std::cerr);
+                this->sortByDate();
+                importedCsv = true;
+            }
+            snapshotSequence = sequence;
+            writer.setWrittenSequence(sequence);
+            legacyOrderKnown = false;
+            legacyRowIds.clear();
+
+            uint64_t nextSequence = sequence;
+            auto apply = [this, &nextSequence](uint64_t recordSequence, JournalOperation operation,
+                                               ByteReader &reader) {
+                applyJournalRecord(operation, reader);
+                nextSequence = recordSequence + 1;
+            };
+            bool interruptedCompaction = std::filesystem::exists(pathOf(COMPACTING_JOURNAL_FILENAME));
+            if (interruptedCompaction) replayJournal(pathOf(COMPACTING_JOURNAL_FILENAME), sequence, apply);
+            if (std::filesystem::exists(pathOf(JOURNAL_FILENAME))) {
+                // Drop a record torn by a crash so new records are appended after the last intact one
+                uint64_t intactSize = replayJournal(pathOf(JOURNAL_FILENAME), sequence, apply);
+                if (intactSize < std::filesystem::file_size(pathOf(JOURNAL_FILENAME))) {
+                    std::filesystem::resize_file(pathOf(JOURNAL_FILENAME), intactSize);
+                }
+            }
+
+            legacyRowIds.clear();
+            journal.open(pathOf(JOURNAL_FILENAME), nextSequence);
+            persistent = true;
+            // The recovered ledger is on disk before load returns, before anything else is journaled
+            if (interruptedCompaction || importedCsv) {
+                compact();
+                save();
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Error loading items: " << e.what() << std::endl;
+            std::cerr << "Changes in this session will not be saved." << std::endl;
+        }
+    }
+};
+
+// Returns the state of the ledger in the working directory. It is created, and the ledger loaded, on first
+// use, so commands that never touch the ledger do not open or create its files.
+GlobalState &globalState() {
+    static GlobalState state;
+    return state;
+}
+
+// Bank statements are read in blocks of about this many bytes, cut at record boundaries
+constexpr size_t STATEMENT_BLOCK_BYTES = 1 << 20;
+
+// Blocks or batches of rows waiting between two stages of a statement import. With the block size this
+// bounds the memory of an import, whatever the size of the file.
+constexpr size_t STATEMENT_QUEUE_CAPACITY = 4;
+
+// New rows of a statement import are added to the ledger this many at a time
+constexpr size_t STATEMENT_INSERT_ROWS = 1 << 18;
+
+// Order of the parts of the dates in a bank statement
+enum class DateOrder {
+    YearMonthDay,
+    DayMonthYear,
+    MonthDayYear
+};
+
+// Parses a date order name: ymd, dmy or mdy
+DateOrder parseDateOrder(std::string_view name) {
+    if (name == "ymd") return DateOrder::YearMonthDay;
+    if (name == "dmy") return DateOrder::DayMonthYear;
+    if (name == "mdy") return DateOrder::MonthDayYear;
+    throw std::invalid_argument("Invalid date order: " + std::string(name));
+}
+
+// Parses a statement date such as 2024-03-31, 31/03/2024 or 03.31.24 in the given order. The parts may
+// be separated by '-', '/' or '.', and two-digit years are in 2000-2099. Days past the end of the month,
+// such as 2024-02-30, are rejected.
+bool tryParseStatementDate(std::string_view text, DateOrder order, int32_t &days) {
+    int parts[3];
+    for (int &part: parts) {
+        const size_t separator = std::min(text.find_first_of("-/."), text.size());
+        if (!parseNumber(text.substr(0, separator), part)) return false;
+        text.remove_prefix(std::min(separator + 1, text.size()));
+    }
+    if (!text.empty()) return false;
+    auto [year, month, day] = order == DateOrder::YearMonthDay ? std::array{parts[0], parts[1], parts[2]}
+                              : order == DateOrder::DayMonthYear ? std::array{parts[2], parts[1], parts[0]}
+                                                                 : std::array{parts[2], parts[0], parts[1]};
+    if (year >= 0 && year < 100) year += 2000;
+    if (month < 1 || month > 12 || day < 1 || day > daysInMonth(year, month)) return false;
+    days = daysFromCivil(year, month, day);
+    return true;
+}
+
+// Parses a statement amount in currency units. Currency symbols and spaces are ignored, and an amount in
+// parentheses is negative. The decimal separator is '.', and ',' may only separate groups of three digits
+// before it, so an amount written the other way round, such as 1.234,56, is rejected rather than misread.
+// Returns false if the amount has letters, as in 1e300, or no number remains.
+bool tryParseStatementAmount(std::string_view text, int64_t &minorUnits) {
+    std::string number;
+    bool negative = false, decimal = false;
+    int groupDigits = -1; // Digits since the last ',', or -1 outside a group; a group ends with 3
+    for (char c: text) {
+        if (c >= '0' && c <= '9') {
+            number += c;
+            if (groupDigits >= 0) ++groupDigits;
+        } else if (c == ',') {
+            if (decimal || number.empty() || (groupDigits >= 0 && groupDigits != 3)) return false;
+            groupDigits = 0;
+        } else if (c == '.') {
+            if (decimal || (groupDigits >= 0 && groupDigits != 3)) return false;
+            number += c;
+            decimal = true;
+            groupDigits = -1;
+        } else if (c == '-' || c == '(') {
+            negative = true;
+        } else if (std::isalpha(static_cast<unsigned char>(c))) {
+            return false;
+        }
+    }
+    if (groupDigits >= 0 && groupDigits != 3) return false;
+    double amount;
+    if (!parseNumber(number, amount) || !isValidAmount(amount)) return false;
+    minorUnits = toMinorUnits(negative ? -amount : amount);
+    return true;
+}
+
+// Columns of a bank statement, found by their header names. An amount is either one signed column, or
+// a debit (money out) and a credit (money in) column of which each row fills one.
+struct StatementColumns {
+    static constexpr size_t NONE = std::numeric_limits<size_t>::max();
+    size_t date = NONE;
+    size_t name = NONE;
+    size_t amount = NONE;
+    size_t debit = NONE;
+    size_t credit = NONE;
+    size_t category = NONE;
+
+    // Finds the columns in a header record. Throws std::invalid_argument if a date, description or
+    // amount column is missing.
+    explicit StatementColumns(const CsvRecord &header) {
+        static const std::pair<size_t StatementColumns::*, std::vector<std::string_view> > names[] = {
+            {&StatementColumns::date, {"date", "transaction date", "posting date", "posted date", "booking date",
+                                       "value date"}},
+            {&StatementColumns::name, {"description", "name", "payee", "merchant", "details", "narrative", "memo",
+                                       "transaction description"}},
+            {&StatementColumns::amount, {"amount", "value", "transaction amount"}},
+            {&StatementColumns::debit, {"debit", "debits", "withdrawal", "withdrawals", "money out", "paid out"}},
+            {&StatementColumns::credit, {"credit", "credits", "deposit", "deposits", "money in", "paid in"}},
+            {&StatementColumns::category, {"category"}}
+        };
+        for (size_t field = 0; field < std::min(header.fieldCount, CSV_MAX_FIELDS); ++field) {
+            std::string name;
+            for (char c: header.fields[field]) name += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            while (!name.empty() && name.back() == ' ') name.pop_back();
+            while (!name.empty() && name.front() == ' ') name.erase(0, 1);
+            for (const auto &[column, aliases]: names) {
+                if (this->*column == NONE && std::find(aliases.begin(), aliases.end(), name) != aliases.end()) {
+                    this->*column = field;
+                }
+            }
+        }
+        if (date == NONE || name == NONE || (amount == NONE && debit == NONE && credit == NONE)) {
+            throw std::invalid_argument("The statement needs a date, a description and an amount column");
+        }
+    }
+};
+
+// Sets the category, and optionally the type, of statement rows whose description contains a text.
+// Matching ignores case.
+struct CategoryRule {
+    std::string match; // Lower case
+    std::string category;
+    std::optional<ItemType> type;
+};
+
+// Reads category rules from a CSV file of Match,Category[,Type] rows. Earlier rules take precedence.
+// Blank lines and lines starting with '#' are skipped.
+std::vector<CategoryRule> readCategoryRules(const std::string &filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) throw std::runtime_error("Cannot open " + filename);
+    std::string text(std::istreambuf_iterator<char>(in), {});
+    CsvReader reader(text.data(), text.size());
+    CsvRecord record;
+    std::vector<CategoryRule> rules;
+    while (reader.next(record)) {
+        if (record.text.empty() || record.text.front() == '#') continue;
+        if (record.malformed || record.fieldCount < 2 || record.fieldCount > 3 || record.fields[0].empty()) {
+            throw std::invalid_argument(filename + " line " + std::to_string(record.line) +
+                                        ": expected Match,Category[,Type]");
+        }
+        CategoryRule rule;
+        for (char c: record.fields[0]) rule.match += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        rule.category = record.fields[1];
+        if (record.fieldCount == 3) rule.type = parseItemType(record.fields[2]);
+        rules.push_back(std::move(rule));
+    }
+    return rules;
+}
+
+// Options of a bank statement import
+struct StatementOptions {
+    DateOrder dateOrder = DateOrder::YearMonthDay;
+    std::vector<CategoryRule> rules;
+    std::string defaultCategory = "Uncategorized";
+};
+
+// Outcome of a bank statement import
+struct StatementImport {
+    size_t rows = 0;       // Rows read, not counting the header
+    size_t imported = 0;
+    size_t duplicates = 0; // Rows already in the ledger
+    size_t invalid = 0;
+    std::vector<CsvRowError> errors; // The first MAX_REPORTED_CSV_ERRORS invalid rows
+};
+
+// A block of whole records of a statement and the line it starts on
+struct StatementBlock {
+    std::string text;
+    size_t firstLine = 1;
+};
+
+// One statement row on its way through the import. The parse stage fills in the date, signed amount,
+// name and category column; the map stage the item type, amount and category.
+struct StatementRow {
+    int32_t date = 0;
+    int64_t amount = 0; // Minor units; signed until mapped, then the amount of the item
+    ItemType type = ItemType::Expense;
+    std::string name;
+    std::string category;
+};
+
+// Returns the key that identifies a transaction for deduplication: a hash of its date, signed amount
+// and name. Two transactions with the same key are taken to be the same one.
+uint64_t transactionKey(int32_t date, int64_t signedAmount, std::string_view name) {
+    uint64_t hash = fnv1a(&date, sizeof(date));
+    hash = fnv1a(&signedAmount, sizeof(signedAmount), hash);
+    return fnv1a(name.data(), name.size(), hash);
+}
+
+// Imports a bank statement CSV into the ledger as a pipeline of concurrent stages linked by bounded
+// queues, so the file is never held in memory whole:
+//   read:   reads blocks of STATEMENT_BLOCK_BYTES, cut after the last record; a longer record fails
+//   parse:  splits the records, finds the columns in the header, and parses dates and amounts
+//   map:    negative amounts become expenses and others income, then the category rules apply
+//   dedup:  drops rows whose (date, amount, name) key is already in the ledger
+//   insert: collects the rows on the calling thread and adds them to the ledger STATEMENT_INSERT_ROWS at a time
+// Deduplication counts the keys of the ledger, so importing the same statement again adds nothing, while
+// a statement that has the same transaction twice keeps both. The keys of a closed period's cold
+// segment are only read when a statement row falls in that period. Throws std::invalid_argument or
+// std::runtime_error if the file cannot be read or has no usable header; the rows added before that stay,
+// and importing the file again adds only the rest.
+StatementImport importStatement(GlobalState &state, const std::string &filename, const StatementOptions &options) {
+    ScopedTimer timer(Probe::ImportStatement);
+    std::FILE *file = std::fopen(filename.c_str(), "rb");
+    if (!file) throw std::runtime_error("Cannot open " + filename);
+
+    StatementImport result;
+    // Taken here, as the state is not thread-safe: the stages only read this version and its cold segments
+    const std::shared_ptr<const Ledger> items = state.snapshot();
+    std::vector<std::string> segmentPaths;
+    for (size_t index = 0; index < items->closedPeriodCount(); ++index) {
+        const ClosedPeriod &period = items->closedPeriod(index);
+        segmentPaths.push_back(state.pathOf(coldSegmentFilename(period.firstDay, period.lastDay)));
+    }
+    BoundedQueue<StatementBlock> blocks(STATEMENT_QUEUE_CAPACITY);
+    BoundedQueue<std::vector<StatementRow> > parsed(STATEMENT_QUEUE_CAPACITY);
+    BoundedQueue<std::vector<StatementRow> > mapped(STATEMENT_QUEUE_CAPACITY);
+    BoundedQueue<std::vector<StatementRow> > unique(STATEMENT_QUEUE_CAPACITY);
+    std::exception_ptr failures[4];
+
+    // Runs a stage on its own thread. A stage that stops, normally or not, closes its queues, so the
+    // stages before it stop pushing and the ones after it finish what is queued.
+    auto runStage = [&failures](size_t index, std::function<void()> body, std::function<void()> closeQueues) {
+        return std::thread([&failures, index, body = std::move(body), closeQueues = std::move(closeQueues)] {
+            try {
+                body();
+            } catch (...) {
+                failures[index] = std::current_exception();
+            }
+            closeQueues();
+        });
+    };
+
+    std::thread reader = runStage(0, [&] {
+        CsvRecordScanner scanner;
+        StatementBlock block;
+        size_t line = 1;
+        size_t scanned = 0, lines = 0; // Bytes of block.text scanned so far, and the line breaks among them
+        std::vector<char> buffer(STATEMENT_BLOCK_BYTES);
+        bool first = true;
+        while (true) {
+            const size_t count = std::fread(buffer.data(), 1, buffer.size(), file);
+            const bool done = count < buffer.size();
+            std::string_view data(buffer.data(), count);
+            if (first && data.starts_with("\xEF\xBB\xBF")) data.remove_prefix(3); // UTF-8 byte order mark
+            first = false;
+            block.text.append(data);
+
+            // Find the last record boundary; the rest is carried over to the next block. The scan picks up
+            // where the previous one stopped, so each byte is scanned once.
+            size_t cut = 0, linesBeforeCut = 0;
+            for (; scanned < block.text.size(); ++scanned) {
+                const char c = block.text[scanned];
+                if (c == '\n') ++lines;
+                if (scanner.advance(c)) {
+                    cut = scanned + 1;
+                    linesBeforeCut = lines;
+                }
+            }
+            if (block.text.size() - cut > STATEMENT_BLOCK_BYTES) {
+                throw std::invalid_argument(filename + " line " + std::to_string(line + linesBeforeCut) +
+                                            ": record longer than " + std::to_string(STATEMENT_BLOCK_BYTES) +
+                                            " bytes");
+            }
+            if (done) {
+                cut = block.text.size();
+                linesBeforeCut = lines;
+            }
+            if (cut > 0) {
+                StatementBlock whole{block.text.substr(0, cut), line};
+                block.text.erase(0, cut);
+                scanned -= cut;
+                line += linesBeforeCut;
+                lines -= linesBeforeCut;
+                if (!blocks.push(std::move(whole))) return;
+            }
+            if (done) {
+                if (std::ferror(file)) throw std::runtime_error("Cannot read " + filename);
+                return;
+            }
+        }
+    }, [&] { blocks.close(); });
+
+    std::thread parser = runStage(1, [&] {
+        std::optional<StatementColumns> columns;
+        StatementBlock block;
+        CsvRecord record;
+        auto field = [&record](size_t index) {
+            return index < std::min(record.fieldCount, CSV_MAX_FIELDS) ? record.fields[index] : std::string_view();
+        };
+        while (blocks.pop(block)) {
+            std::vector<StatementRow> rows;
+            CsvReader csv(block.text.data(), block.text.size());
+            while (csv.next(record)) {
+                if (record.text.empty()) continue;
+                if (!columns) {
+                    columns.emplace(record);
+                    continue;
+                }
+                ++result.rows;
+                StatementRow row;
+                int64_t debit = 0, credit = 0;
+                const char *error = nullptr;
+                if (record.malformed) {
+                    error = "Malformed quoted field";
+                } else if (!tryParseStatementDate(field(columns->date), options.dateOrder, row.date)) {
+                    error = "Invalid date";
+                } else if (columns->amount != StatementColumns::NONE) {
+                    if (!tryParseStatementAmount(field(columns->amount), row.amount)) error = "Invalid amount";
+                } else if (!field(columns->debit).empty() && !tryParseStatementAmount(field(columns->debit), debit)) {
+                    error = "Invalid debit";
+                } else if (!field(columns->credit).empty() &&
+                           !tryParseStatementAmount(field(columns->credit), credit)) {
+                    error = "Invalid credit";
+                } else {
+                    row.amount = std::llabs(credit) - std::llabs(debit);
+                }
+                if (error) {
+                    if (result.errors.size() < MAX_REPORTED_CSV_ERRORS) {
+                        result.errors.push_back({block.firstLine + record.line - 1, error});
+                    }
+                    ++result.invalid;
+                    continue;
+                }
+                row.name = field(columns->name);
+                if (columns->category != StatementColumns::NONE) row.category = field(columns->category);
+                rows.push_back(std::move(row));
+            }
+            if (!parsed.push(std::move(rows))) return;
+        }
+        if (!columns) throw std::invalid_argument(filename + " is empty");
+    }, [&] {
+        blocks.close();
+        parsed.close();
+    });
+
+    std::thread mapper = runStage(2, [&] {
+        std::vector<StatementRow> rows;
+        std::string lowerName;
+        while (parsed.pop(rows)) {
+            for (StatementRow &row: rows) {
+                row.type = row.amount < 0 ? ItemType::Expense : ItemType::Income;
+                row.amount = std::llabs(row.amount);
+                lowerName.clear();
+                for (char c: row.name) lowerName += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                auto rule = std::find_if(options.rules.begin(), options.rules.end(), [&](const CategoryRule &rule) {
+                    return lowerName.find(rule.match) != std::string::npos;
+                });
+                if (rule != options.rules.end()) {
+                    row.category = rule->category;
+                    if (rule->type) row.type = *rule->type;
+                } else if (row.category.empty()) {
+                    row.category = options.defaultCategory;
+                }
+            }
+            if (!mapped.push(std::move(rows))) return;
+        }
+    }, [&] {
+        parsed.close();
+        mapped.close();
+    });
+
+    std::thread deduplicator = runStage(3, [&] {
+        // Counts of the keys in the ledger that no statement row has matched yet
+        std::unordered_map<uint64_t, uint32_t> known;
+        known.reserve(items->size());
+        auto addKeys = [&known](const Ledger &ledger) {
+            for (size_t row = 0; row < ledger.size(); ++row) {
+                ++known[transactionKey(ledger.date(row), ledger.signedAmount(row), ledger.name(row))];
+            }
+        };
+        addKeys(*items);
+        std::vector<bool> periodRead(items->closedPeriodCount());
+        std::vector<StatementRow> rows;
+        while (mapped.pop(rows)) {
+            std::erase_if(rows, [&](const StatementRow &row) {
+                size_t period;
+                if (items->findClosedPeriod(row.date, period) && !periodRead[period]) {
+                    addKeys(openColdSegment(segmentPaths[period]));
+                    periodRead[period] = true;
+                }
+                auto it = known.find(transactionKey(row.date, signedAmount(row.type, row.amount), row.name));
+                if (it == known.end() || it->second == 0) return false;
+                --it->second;
+                return true;
+            });
+            if (!unique.push(std::move(rows))) return;
+        }
+    }, [&] {
+        mapped.close();
+        unique.close();
+    });
+
+    // Compaction waits for the last batch, as every batch is journaled
+    Ledger imported;
+    std::exception_ptr insertFailure;
+    state.beginBatch();
+    try {
+        std::vector<StatementRow> rows;
+        while (unique.pop(rows)) {
+            for (const StatementRow &row: rows) {
+                imported.appendRow(row.type, row.amount, row.date, row.category, row.name, 1.0);
+            }
+            if (imported.size() >= STATEMENT_INSERT_ROWS) {
+                state.addItems(imported);
+                result.imported += imported.size();
+                imported = Ledger();
+            }
+        }
+    } catch (...) {
+        insertFailure = std::current_exception();
+    }
+    unique.close();
+    for (std::thread *stage: {&reader, &parser, &mapper, &deduplicator}) stage->join();
+    std::fclose(file);
+    std::exception_ptr failure = insertFailure;
+    for (const std::exception_ptr &stageFailure: failures) {
+        if (!failure) failure = stageFailure;
+    }
+    if (!failure && !imported.empty()) state.addItems(imported);
+    state.endBatch();
+    if (failure) std::rethrow_exception(failure);
+
+    result.imported += imported.size();
+    result.duplicates = result.rows - result.invalid - result.imported;
+    return result;
+}
+
+// Prints the outcome of a bank statement import, with the first rows that could not be imported
+void reportStatementImport(const StatementImport &result, std::ostream &out) {
+    out << "Read " << result.rows << " rows: " << result.imported << " imported, " << result.duplicates
+        << " already in the ledger, " << result.invalid << " invalid\n";
+    for (const CsvRowError &error: result.errors) out << "  line " << error.line << ": " << error.message << "\n";
+    if (result.invalid > result.errors.size()) {
+        out << "  ... and " << result.invalid - result.errors.size() << " more\n";
+    }
+}
+
+#pragma endregion Model
+
+#pragma region CLIUtility
+
+// Output formats of the report writer
+enum class ReportFormat {
+    Text, // Aligned for reading in the console
+    Csv,
+    Tsv,
+    Json  // One JSON object per line
+};
+
+// Parses a report format name: text, csv, tsv or json
+ReportFormat parseReportFormat(std::string_view name) {
+    if (name == "text") return ReportFormat::Text;
+    if (name == "csv") return ReportFormat::Csv;
+    if (name == "tsv") return ReportFormat::Tsv;
+    if (name == "json") return ReportFormat::Json;
+    throw std::invalid_argument("Invalid report format: " + std::string(name));
+}
+
+// One value in a report row
+struct ReportCell {
+    enum Kind {
+        Text,
+        Amount,
+        Count,
+        Percentage,
+        Separator // Only shown in text reports, such as the dash in "IDR 1 - IDR 2"
+    };
+
+    Kind kind;
+    std::string_view text;
+    Money amount;
+    uint64_t count = 0;
+    double fraction = 0.0;
+
+    ReportCell(Money amount) : kind(Amount), amount(amount) {
+    }
+
+    ReportCell(std::string_view text) : kind(Text), text(text) {
+    }
+
+    ReportCell(const char *text) : kind(Text), text(text) {
+    }
+
+    static ReportCell ofCount(uint64_t count) {
+        ReportCell cell("");
+        cell.kind = Count;
+        cell.count = count;
+        return cell;
+    }
+
+    static ReportCell ofPercentage(double fraction) {
+        ReportCell cell("");
+        cell.kind = Percentage;
+        cell.fraction = fraction;
+        return cell;
+    }
+
+    static ReportCell ofSeparator(std::string_view text) {
+        ReportCell cell(text);
+        cell.kind = Separator;
+        return cell;
+    }
+};
+
+// Size at which buffered report output is written to the stream
+constexpr size_t REPORT_BUFFER_BYTES = 1 << 16;
+
+// Width of the amount columns of text tables
+constexpr size_t REPORT_AMOUNT_WIDTH = 20;
+
+// Renders reports into one reusable buffer that is written to the stream in large blocks, so a
+// report of any length streams at the speed of the output without being held in memory, and stdout
+// is flushed once per report instead of once per line.
+//
+// A report is a sequence of headings, key/value fields and ledger items. In text reports the fields
+// between beginBlock() and endBlock() are aligned on the longest key. In CSV, TSV and JSON reports
+// every field is one record holding the last heading, the key and the values; amounts are plain
+// numbers and text-only rows are left out.
+class ReportWriter {
+private:
+    std::ostream &out;
+    ReportFormat format;
+    std::string buffer;
+    std::string section;    // Last heading, written with each field in machine-readable formats
+    bool inBlock = false;
+    std::string blockText;  // Keys and values of the open text block, back to back
+    std::vector<std::pair<size_t, size_t> > blockRows; // End offsets of each key and value in blockText
+    std::string valueText;  // Scratch space for rendering the values of a text row
+    bool itemHeaderWritten = false;
+    bool recurrenceHeaderWritten = false;
+    bool scenarioGroupHeaderWritten = false;
+    bool projectionHeaderWritten = false;
+
+    void writeIfFull() {
+        if (buffer.size() < REPORT_BUFFER_BYTES) return;
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+    }
+
+    // Appends a text value, quoted or escaped as the format requires
+    void appendText(std::string_view text) {
+        switch (format) {
+            case ReportFormat::Text:
+                buffer += text;
+                break;
+            case ReportFormat::Csv:
+                if (text.find_first_of(",\"\r\n") == std::string_view::npos) {
+                    buffer += text;
+                    break;
+                }
+                buffer += '"';
+                for (char c: text) {
+                    if (c == '"') buffer += '"';
+                    buffer += c;
+                }
+                buffer += '"';
+                break;
+            case ReportFormat::Tsv:
+                // TSV has no quoting, so tabs and line breaks become spaces
+                for (char c: text) buffer += c == '\t' || c == '\n' || c == '\r' ? ' ' : c;
+                break;
+            case ReportFormat::Json:
+                appendJsonString(buffer, text);
+                break;
+        }
+    }
+
+    void appendDelimiter() {
+        buffer += format == ReportFormat::Tsv ? '\t' : ',';
+    }
+
+    void appendNumber(double value) {
+        char digits[32];
+        buffer.append(digits, std::to_chars(digits, digits + sizeof digits, value).ptr);
+    }
+
+    void appendMinorUnits(int64_t minorUnits) {
+        char digits[MAX_MINOR_UNITS_LENGTH];
+        buffer.append(digits, writeMinorUnits(digits, minorUnits));
+    }
+
+    // Appends a cell as shown in text reports: amounts with the currency and percentages in parentheses
+    static void appendDisplayCell(std::string &to, const ReportCell &cell, bool first) {
+        char digits[32];
+        switch (cell.kind) {
+            case ReportCell::Text:
+            case ReportCell::Separator:
+                to += cell.text;
+                break;
+            case ReportCell::Amount:
+                to += formatMoney(cell.amount).view();
+                break;
+            case ReportCell::Count:
+                to.append(digits, std::to_chars(digits, digits + sizeof digits, cell.count).ptr);
+                break;
+            case ReportCell::Percentage: {
+                // Whole percent, clamped to 0-100%
+                int percentage = static_cast<int>(std::clamp(cell.fraction * 100, 0.0, 100.0));
+                if (!first) to += '(';
+                to.append(digits, std::to_chars(digits, digits + sizeof digits, percentage).ptr);
+                to += first ? "%" : "%)";
+                break;
+            }
+        }
+    }
+
+    // Appends a cell as a machine-readable value
+    void appendValueCell(const ReportCell &cell) {
+        switch (cell.kind) {
+            case ReportCell::Text: appendText(cell.text); break;
+            case ReportCell::Amount: appendMinorUnits(cell.amount.minorUnits); break;
+            case ReportCell::Count: {
+                char digits[24];
+                buffer.append(digits, std::to_chars(digits, digits + sizeof digits, cell.count).ptr);
+                break;
+            }
+            case ReportCell::Percentage: appendNumber(cell.fraction); break;
+            case ReportCell::Separator: break;
+        }
+    }
+
+    // Appends a text line with the key padded to the given width
+    void appendPadded(std::string_view key, std::string_view value, size_t width) {
+        buffer += key;
+        buffer.append(width - key.size(), ' ');
+        buffer += value;
+        buffer += '\n';
+        writeIfFull();
+    }
+
+    // Adds a text row to the open block, or writes it straight away outside a block
+    void addTextRow(std::string_view key, std::string_view value) {
+        if (!inBlock) {
+            appendPadded(key, value, key.size() + 2);
+            return;
+        }
+        blockText += key;
+        size_t keyEnd = blockText.size();
+        blockText += value;
+        blockRows.emplace_back(keyEnd, blockText.size());
+    }
+
+public:
+    explicit ReportWriter(std::ostream &out, ReportFormat format = ReportFormat::Text) : out(out), format(format) {
+        buffer.reserve(REPORT_BUFFER_BYTES * 2);
+    }
+
+    ReportWriter(const ReportWriter &) = delete;
+    ReportWriter &operator=(const ReportWriter &) = delete;
+
+    ~ReportWriter() {
+        flush();
+    }
+
+    [[nodiscard]] ReportFormat getFormat() const { return format; }
+
+    // Starts a group of text rows that are aligned together
+    void beginBlock() {
+        endBlock();
+        inBlock = true;
+    }
+
+    // Writes the open block with every value starting two columns after the longest key
+    void endBlock() {
+        if (!inBlock) return;
+        inBlock = false;
+        size_t width = 0, start = 0;
+        for (auto [keyEnd, valueEnd]: blockRows) {
+            width = std::max(width, keyEnd - start);
+            start = valueEnd;
+        }
+        start = 0;
+        const std::string_view text = blockText;
+        for (auto [keyEnd, valueEnd]: blockRows) {
+            appendPadded(text.substr(start, keyEnd - start), text.substr(keyEnd, valueEnd - keyEnd), width + 2);
+            start = valueEnd;
+        }
+        blockText.clear();
+        blockRows.clear();
+    }
+
+    // Starts a section: a line of its own in text reports, the section column of the following fields otherwise
+    void heading(std::string_view title) {
+        if (format == ReportFormat::Text) {
+            addTextRow(title, "");
+        } else {
+            section = title;
+        }
+    }
+
+    // Adds an empty line to text reports
+    void blank() {
+        if (format == ReportFormat::Text) addTextRow("", "");
+    }
+
+    // Adds a key with one or more values
+    void field(std::string_view key, std::initializer_list<ReportCell> cells) {
+        if (format == ReportFormat::Text) {
+            valueText.assign(": ");
+            bool first = true;
+            for (const ReportCell &cell: cells) {
+                if (!first) valueText += ' ';
+                appendDisplayCell(valueText, cell, first);
+                first = false;
+            }
+            addTextRow(key, valueText);
+            return;
+        }
+
+        if (format == ReportFormat::Json) {
+            buffer += "{\"section\":";
+            appendJsonString(buffer, section);
+            buffer += ",\"key\":";
+            appendJsonString(buffer, key);
+            buffer += ",\"values\":[";
+        } else {
+            appendText(section);
+            appendDelimiter();
+            appendText(key);
+        }
+        bool first = true;
+        for (const ReportCell &cell: cells) {
+            if (cell.kind == ReportCell::Separator) continue;
+            if (format != ReportFormat::Json || !first) appendDelimiter();
+            appendValueCell(cell);
+            first = false;
+        }
+        buffer += format == ReportFormat::Json ? "]}\n" : "\n";
+        writeIfFull();
+    }
+
+    // Adds one ledger row. Text reports show it on one line; the other formats write a record with
+    // the id, type, name, category, amount, date and probability, after a header row in CSV and TSV.
+    void item(const Ledger &items, size_t row) {
+        char digits[32];
+        char date[MAX_DATE_LENGTH];
+        const std::string_view dateText(date, writeDate(date, items.date(row)));
+        const std::string_view typeName = itemTypeName(items.type(row));
+        const std::string_view idText(digits, std::to_chars(digits, digits + sizeof digits, items.id(row)).ptr);
+
+        switch (format) {
+            case ReportFormat::Text:
+                buffer += '#';
+                buffer += idText;
+                buffer += " (";
+                buffer += dateText;
+                buffer += ") ";
+                buffer += items.name(row);
+                buffer += " (";
+                buffer += items.category(row);
+                buffer += "): ";
+                buffer += formatMoney(Money(items.amount(row))).view();
+                buffer += " (";
+                buffer += typeName;
+                buffer += ") ";
+                buffer.append(digits, std::to_chars(digits, digits + sizeof digits, items.probability(row) * 100,
+                                                    std::chars_format::general, 6).ptr);
+                buffer += "%\n";
+                break;
+            case ReportFormat::Json:
+                buffer += "{\"id\":";
+                buffer += idText;
+                buffer += ",\"type\":";
+                appendText(typeName);
+                buffer += ",\"name\":";
+                appendText(items.name(row));
+                buffer += ",\"category\":";
+                appendText(items.category(row));
+                buffer += ",\"amount\":";
+                appendMinorUnits(items.amount(row));
+                buffer += ",\"date\":";
+                appendText(dateText);
+                buffer += ",\"probability\":";
+                appendNumber(items.probability(row));
+                buffer += "}\n";
+                break;
+            case ReportFormat::Csv:
+            case ReportFormat::Tsv:
+                if (!itemHeaderWritten) {
+                    for (std::string_view column: {"Id", "Type", "Name", "Category", "Amount", "Date"}) {
+                        buffer += column;
+                        appendDelimiter();
+                    }
+                    buffer += "Probability\n";
+                    itemHeaderWritten = true;
+                }
+                buffer += idText;
+                appendDelimiter();
+                appendText(typeName);
+                appendDelimiter();
+                appendText(items.name(row));
+                appendDelimiter();
+                appendText(items.category(row));
+                appendDelimiter();
+                appendMinorUnits(items.amount(row));
+                appendDelimiter();
+                buffer += dateText;
+                appendDelimiter();
+                appendNumber(items.probability(row));
+                buffer += '\n';
+                break;
+        }
+        writeIfFull();
+    }
+
+    // Adds one recurrence rule. Text reports show it on one line; the other formats write a record
+    // with the id, type, name, category, amount, start, interval, unit, end (empty if none), count
+    // (0 if unlimited) and probability, after a header row in CSV and TSV.
+    void recurrence(const Ledger &items, size_t index) {
+        const RecurrenceRule &rule = items.recurrence(index);
+        const RecurrenceSchedule &schedule = rule.schedule;
+        char digits[32];
+        char start[MAX_DATE_LENGTH], end[MAX_DATE_LENGTH];
+        const std::string_view startText(start, writeDate(start, schedule.start));
+        const std::string_view endText(end, schedule.end == NO_END_DATE ? end : writeDate(end, schedule.end));
+        const std::string_view typeName = itemTypeName(rule.type);
+        const std::string_view name = items.names().get(rule.nameId);
+        const std::string_view category = items.categories().get(rule.categoryId);
+        auto appendCount = [this, &digits](uint64_t value) {
+            buffer.append(digits, std::to_chars(digits, digits + sizeof digits, value).ptr);
+        };
+
+        switch (format) {
+            case ReportFormat::Text:
+                buffer += '#';
+                appendCount(rule.id);
+                buffer += ' ';
+                buffer += name;
+                buffer += " (";
+                buffer += category;
+                buffer += "): ";
+                buffer += formatMoney(Money(rule.amount)).view();
+                buffer += " (";
+                buffer += typeName;
+                buffer += ") ";
+                buffer.append(digits, std::to_chars(digits, digits + sizeof digits, rule.probability * 100,
+                                                    std::chars_format::general, 6).ptr);
+                buffer += "% every ";
+                appendCount(schedule.interval);
+                buffer += ' ';
+                buffer += recurrenceUnitName(schedule.unit);
+                if (schedule.interval != 1) buffer += 's';
+                buffer += " from ";
+                buffer += startText;
+                if (!endText.empty()) {
+                    buffer += " until ";
+                    buffer += endText;
+                }
+                if (schedule.count != 0) {
+                    buffer += ", ";
+                    appendCount(schedule.count);
+                    buffer += " times";
+                }
+                buffer += '\n';
+                break;
+            case ReportFormat::Json:
+                buffer += "{\"id\":";
+                appendCount(rule.id);
+                buffer += ",\"type\":";
+                appendText(typeName);
+                buffer += ",\"name\":";
+                appendText(name);
+                buffer += ",\"category\":";
+                appendText(category);
+                buffer += ",\"amount\":";
+                appendMinorUnits(rule.amount);
+                buffer += ",\"start\":";
+                appendText(startText);
+                buffer += ",\"interval\":";
+                appendCount(schedule.interval);
+                buffer += ",\"unit\":";
+                appendText(recurrenceUnitName(schedule.unit));
+                buffer += ",\"end\":";
+                if (endText.empty()) {
+                    buffer += "null";
+                } else {
+                    appendText(endText);
+                }
+                buffer += ",\"count\":";
+                appendCount(schedule.count);
+                buffer += ",\"probability\":";
+                appendNumber(rule.probability);
+                buffer += "}\n";
+                break;
+            case ReportFormat::Csv:
+            case ReportFormat::Tsv:
+                if (!recurrenceHeaderWritten) {
+                    for (std::string_view column: {"Id", "Type", "Name", "Category", "Amount", "Start", "Interval",
+                                                   "Unit", "End", "Count"}) {
+                        buffer += column;
+                        appendDelimiter();
+                    }
+                    buffer += "Probability\n";
+                    recurrenceHeaderWritten = true;
+                }
+                appendCount(rule.id);
+                appendDelimiter();
+                appendText(typeName);
+                appendDelimiter();
+                appendText(name);
+                appendDelimiter();
+                appendText(category);
+                appendDelimiter();
+                appendMinorUnits(rule.amount);
+                appendDelimiter();
+                buffer += startText;
+                appendDelimiter();
+                appendCount(schedule.interval);
+                appendDelimiter();
+                buffer += recurrenceUnitName(schedule.unit);
+                appendDelimiter();
+                buffer += endText;
+                appendDelimiter();
+                appendCount(schedule.count);
+                appendDelimiter();
+                appendNumber(rule.probability);
+                buffer += '\n';
+                break;
+        }
+        writeIfFull();
+    }
+
+    // Adds one scenario group. Text reports show it on one line; the other formats write a record with
+    // the id, name, kind, probability (of a bundle, otherwise empty), parent id (of a conditional group,
+    // otherwise empty) and the member ids separated by spaces, after a header row in CSV and TSV.
+    void scenarioGroup(const Ledger &items, size_t index) {
+        const ScenarioGroup &group = items.scenarioGroup(index);
+        const std::span<const uint64_t> members = items.scenarioGroupMembers(index);
+        const std::string_view name = items.names().get(group.nameId);
+        const std::string_view kindName = scenarioGroupKindName(group.kind);
+        const bool bundle = group.kind == ScenarioGroupKind::Bundle;
+        const bool conditional = group.kind == ScenarioGroupKind::Conditional;
+        char digits[32];
+        auto appendCount = [this, &digits](uint64_t value) {
+            buffer.append(digits, std::to_chars(digits, digits + sizeof digits, value).ptr);
+        };
+        auto appendMembers = [&](std::string_view separator, std::string_view prefix) {
+            for (size_t i = 0; i < members.size(); ++i) {
+                if (i > 0) buffer += separator;
+                buffer += prefix;
+                appendCount(members[i]);
+            }
+        };
+
+        switch (format) {
+            case ReportFormat::Text:
+                buffer += '#';
+                appendCount(group.id);
+                buffer += ' ';
+                buffer += name;
+                buffer += " (";
+                buffer += kindName;
+                if (bundle) {
+                    buffer += ", ";
+                    buffer.append(digits, std::to_chars(digits, digits + sizeof digits, group.probability * 100,
+                                                        std::chars_format::general, 6).ptr);
+                    buffer += '%';
+                } else if (conditional) {
+                    buffer += " on #";
+                    appendCount(group.parentId);
+                }
+                buffer += "): ";
+                appendMembers(" ", "#");
+                buffer += '\n';
+                break;
+            case ReportFormat::Json:
+                buffer += "{\"id\":";
+                appendCount(group.id);
+                buffer += ",\"name\":";
+                appendText(name);
+                buffer += ",\"kind\":";
+                appendText(kindName);
+                buffer += ",\"probability\":";
+                if (bundle) {
+                    appendNumber(group.probability);
+                } else {
+                    buffer += "null";
+                }
+                buffer += ",\"parent\":";
+                if (conditional) {
+                    appendCount(group.parentId);
+                } else {
+                    buffer += "null";
+                }
+                buffer += ",\"members\":[";
+                appendMembers(",", "");
+                buffer += "]}\n";
+                break;
+            case ReportFormat::Csv:
+            case ReportFormat::Tsv:
+                if (!scenarioGroupHeaderWritten) {
+                    for (std::string_view column: {"Id", "Name", "Kind", "Probability", "Parent"}) {
+                        buffer += column;
+                        appendDelimiter();
+                    }
+                    buffer += "Members\n";
+                    scenarioGroupHeaderWritten = true;
+                }
+                appendCount(group.id);
+                appendDelimiter();
+                appendText(name);
+                appendDelimiter();
+                buffer += kindName;
+                appendDelimiter();
+                if (bundle) appendNumber(group.probability);
+                appendDelimiter();
+                if (conditional) appendCount(group.parentId);
+                appendDelimiter();
+                appendMembers(" ", "");
+                buffer += '\n';
+                break;
+        }
+        writeIfFull();
+    }
+
+    // Adds one month of a projection. Text reports show a table of right-aligned amounts under a header
+    // line; the other formats write a record with the month, the running totals of each item type and
+    // the worst, expected and best outcomes, after a header row in CSV and TSV.
+    void projection(const ProjectionMonth &month) {
+        static constexpr std::string_view columns[] = {"Assets", "Liabilities", "Income", "Expenses",
+                                                       "Worst Case", "Expected", "Best Case"};
+        static constexpr std::string_view jsonKeys[] = {"assets", "liabilities", "income", "expenses",
+                                                        "worstCase", "expectedOutcome", "bestCase"};
+        const int64_t values[] = {month.totals[static_cast<size_t>(ItemType::Asset)],
+                                  month.totals[static_cast<size_t>(ItemType::Liability)],
+                                  month.totals[static_cast<size_t>(ItemType::Income)],
+                                  month.totals[static_cast<size_t>(ItemType::Expense)],
+                                  month.worstCase, month.expectedOutcome, month.bestCase};
+        char date[MAX_DATE_LENGTH];
+        const std::string_view monthText(date, writeDate(date, firstDayOfMonthKey(month.month)) - date - 3);
+        auto appendRightAligned = [this](std::string_view text) {
+            buffer.append(REPORT_AMOUNT_WIDTH - std::min(REPORT_AMOUNT_WIDTH, text.size()), ' ');
+            buffer += text;
+        };
+
+        switch (format) {
+            case ReportFormat::Text:
+                if (!projectionHeaderWritten) {
+                    buffer += "Month  ";
+                    for (std::string_view column: columns) appendRightAligned(column);
+                    buffer += '\n';
+                    projectionHeaderWritten = true;
+                }
+                buffer += monthText;
+                for (int64_t value: values) appendRightAligned(formatMoney(Money(value)).view());
+                buffer += '\n';
+                break;
+            case ReportFormat::Json:
+                buffer += "{\"month\":";
+                appendText(monthText);
+                for (size_t i = 0; i < std::size(values); ++i) {
+                    buffer += ",\"";
+                    buffer += jsonKeys[i];
+                    buffer += "\":";
+                    appendMinorUnits(values[i]);
+                }
+                buffer += "}\n";
+                break;
+            case ReportFormat::Csv:
+            case ReportFormat::Tsv:
+                if (!projectionHeaderWritten) {
+                    buffer += "Month";
+                    for (std::string_view column: columns) {
+                        appendDelimiter();
+                        buffer += column;
+                    }
+                    buffer += '\n';
+                    projectionHeaderWritten = true;
+                }
+                buffer += monthText;
+                for (int64_t value: values) {
+                    appendDelimiter();
+                    appendMinorUnits(value);
+                }
+                buffer += '\n';
+                break;
+        }
+        writeIfFull();
+    }
+
+    // Writes everything rendered so far and flushes the stream
+    void flush() {
+        endBlock();
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+        out.flush();
+    }
+};
+
+// Clears the console screen with ANSI escape codes. Nothing is written when the output is not a
+// terminal, so redirected output stays free of escape codes.
+void clearScreen() {
+    ScopedTimer timer(Probe::ClearScreen);
+#ifdef _WIN32
+    static const bool virtualTerminal = [] {
+        HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        return GetConsoleMode(output, &mode) && SetConsoleMode(output, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    }();
+    if (!virtualTerminal) return;
+#else
+    if (!isatty(fileno(stdout))) return;
+#endif
+    std::cout << "\033[H\033[2J\033[3J" << std::flush;
+}
+
+// Saves the program state to disk
+void saveProgram() {
+    globalState().save();
+}
+
+
+// Exits the program after saving the state
+void exitProgram() {
+    std::cout << "Exiting program...\n";
+    saveProgram();
+    exit(0);
+}
+
+// Pauses execution until the user presses Enter
+void waitToContinue() {
+    std::cout << std::endl;
+    std::cout << "Press Enter to continue...";
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    std::cin.get();
+    std::cout << std::endl;
+}
+
+// Template function to get user input with a default value
+template<typename T>
+void getInput(const std::string &fieldName, T *variable, const T &defaultValue) {
+    std::cout << "Enter " << fieldName << " [" << defaultValue << "]: ";
+    std::string input;
+    std::getline(std::cin, input);
+
+    if (input.empty()) {
+        *variable = defaultValue;
+    } else {
+        std::istringstream(input) >> *variable;
+    }
+}
+
+// Displays a menu and executes the selected option
+void displayMenu(const std::vector<std::pair<std::string, std::function<void()> > > &menu) {
+    std::string choice;
+    while (true) {
+        std::cout << "\n-------- Main Menu --------\n";
+        for (size_t i = 0; i < menu.size(); ++i) {
+            std::cout << i + 1 << ". " << menu[i].first << "\n";
+        }
+
+        getInput("choice", &choice, std::string(""));
+
+        try {
+            int index = std::stoi(choice) - 1;
+            if (index >= 0 && index < static_cast<int>(menu.size())) {
+                clearScreen();
+                menu[index].second();
+                break;
+            } else {
+                std::cout << "Invalid choice. Please try again.\n";
+            }
+        } catch (const std::exception &) {
+            std::cout << "Invalid input. Please enter a number.\n";
+        }
+        waitToContinue();
+        clearScreen();
+    }
+    waitToContinue();
+}
+
+#pragma endregion CLIUtility
+
+#pragma region Scenarios
+
+// Maximum number of distinct outcomes kept before the distribution is coarsened
+constexpr size_t MAX_DISTRIBUTION_SUPPORT = 1 << 16;
+
+// Rounds a value to the nearest multiple of step (step > 0)
+int64_t roundToMultiple(int64_t value, int64_t step) {
+    int64_t quotient = value / step;
+    int64_t remainder = value % step;
+    if (remainder * 2 >= step) ++quotient;
+    else if (remainder * 2 < -step) --quotient;
+    return quotient * step;
+}
+
+// Probability distribution of the total outcome of independent items.
+// Outcomes are kept sorted and unique, so each added item is a linear merge.
+struct OutcomeDistribution {
+    std::vector<std::pair<int64_t, double> > outcomes{{0, 1.0}};
+    int64_t resolution = 1; // Bucket width in minor units, 1 while the distribution is exact
+
+    // Folds in an item that adds delta with the given probability
+    void addItem(int64_t delta, double probability) {
+        delta = roundToMultiple(delta, resolution);
+        std::vector<std::pair<int64_t, double> > merged;
+        merged.reserve(outcomes.size() * 2);
+
+        // Merge "item absent" (unchanged) with "item present" (shifted by delta); both are sorted
+        size_t absent = 0, present = 0;
+        while (absent < outcomes.size() || present < outcomes.size()) {
+            bool takeAbsent = present == outcomes.size() ||
+                              (absent < outcomes.size() &&
+                               outcomes[absent].first <= outcomes[present].first + delta);
+            std::pair<int64_t, double> next = takeAbsent
+                                                  ? std::make_pair(outcomes[absent].first,
+                                                                   outcomes[absent].second * (1 - probability))
+                                                  : std::make_pair(outcomes[present].first + delta,
+                                                                   outcomes[present].second * probability);
+            takeAbsent ? ++absent : ++present;
+            if (!merged.empty() && merged.back().first == next.first) {
+                merged.back().second += next.second;
+            } else {
+                merged.push_back(next);
+            }
+        }
+        outcomes.swap(merged);
+
+        while (outcomes.size() > MAX_DISTRIBUTION_SUPPORT) coarsen();
+    }
+
+    // Folds in a factor whose outcomes exclude each other: each adds its delta with its probability, and
+    // the probabilities add up to 1. The distribution is coarsened first if the product would be too large.
+    void addFactor(const std::vector<std::pair<int64_t, double> > &factorOutcomes) {
+        while (outcomes.size() > 1 && outcomes.size() * factorOutcomes.size() > MAX_DISTRIBUTION_SUPPORT * 16) {
+            coarsen();
+        }
+        // Each factor outcome shifts the sorted outcomes by a constant, so the combination is a set of
+        // sorted runs that are merged pairwise
+        std::vector<std::pair<int64_t, double> > combined;
+        combined.reserve(outcomes.size() * factorOutcomes.size());
+        for (const auto &[delta, probability]: factorOutcomes) {
+            const int64_t rounded = roundToMultiple(delta, resolution);
+            for (const auto &[outcome, outcomeProbability]: outcomes) {
+                combined.emplace_back(outcome + rounded, outcomeProbability * probability);
+            }
+        }
+        const size_t run = outcomes.size();
+        for (size_t width = run; width < combined.size(); width *= 2) {
+            for (size_t begin = 0; begin + width < combined.size(); begin += width * 2) {
+                auto first = combined.begin() + static_cast<ptrdiff_t>(begin);
+                auto end = combined.begin() + static_cast<ptrdiff_t>(std::min(begin + width * 2, combined.size()));
+                std::inplace_merge(first, first + static_cast<ptrdiff_t>(width), end,
+                                   [](const auto &a, const auto &b) { return a.first < b.first; });
+            }
+        }
+        outcomes.clear();
+        for (const auto &next: combined) {
+            if (!outcomes.empty() && outcomes.back().first == next.first) {
+                outcomes.back().second += next.second;
+            } else {
+                outcomes.push_back(next);
+            }
+        }
+
+        while (outcomes.size() > MAX_DISTRIBUTION_SUPPORT) coarsen();
+    }
+
+    // Doubles the bucket width and merges outcomes that fall into the same bucket
+    void coarsen() {
+        resolution *= 2;
+        size_t write = 0;
+        for (size_t read = 0; read < outcomes.size(); ++read) {
+            int64_t bucket = roundToMultiple(outcomes[read].first, resolution);
+            if (write > 0 && outcomes[write - 1].first == bucket) {
+                outcomes[write - 1].second += outcomes[read].second;
+            } else {
+                outcomes[write++] = {bucket, outcomes[read].second};
+            }
+        }
+        outcomes.resize(write);
+    }
+
+    // Returns the smallest outcome whose cumulative probability reaches the given fraction
+    [[nodiscard]] int64_t percentile(double fraction) const {
+        double cumulative = 0.0;
+        for (const auto &[outcome, probability]: outcomes) {
+            cumulative += probability;
+            if (cumulative >= fraction - 1e-12) return outcome;
+        }
+        return outcomes.back().first;
+    }
+};
+
+// How a scenario item depends on the items before it
+enum class ScenarioLink : uint8_t {
+    Independent, // Starts a new factor
+    Exclusive,   // Another alternative of the current factor, of which at most one occurs
+    Conditional  // Can only occur, with its probability, when the factor's last alternative occurs
+};
+
+// An uncertain change to total assets: delta minor units that occur with the given probability.
+// An independent item and the linked items that follow it form one factor of the scenario space.
+struct ScenarioItem {
+    int64_t delta;
+    double probability;
+    ScenarioLink link = ScenarioLink::Independent;
+};
+
+// Alternatives whose probabilities add up to within this of 1 leave no chance that none of them occurs
+constexpr double EXCLUSIVE_PROBABILITY_TOLERANCE = 1e-9;
+
+// The items [first, last) of a scenario item list that make up one factor: its alternatives, each
+// followed by the items conditional on it
+struct ScenarioFactor {
+    size_t first;
+    size_t last;
+    double noneProbability; // Chance that none of the alternatives occurs
+};
+
+// Splits scenario items into factors, which are independent of each other
+std::vector<ScenarioFactor> scenarioFactors(const std::vector<ScenarioItem> &variableItems) {
+    std::vector<ScenarioFactor> factors;
+    for (size_t first = 0; first < variableItems.size();) {
+        ScenarioFactor factor{first, first + 1, 1 - variableItems[first].probability};
+        bool exclusive = false;
+        for (; factor.last < variableItems.size(); ++factor.last) {
+            const ScenarioItem &item = variableItems[factor.last];
+            if (item.link == ScenarioLink::Independent) break;
+            if (item.link == ScenarioLink::Exclusive) {
+                factor.noneProbability -= item.probability;
+                exclusive = true;
+            }
+        }
+        if (exclusive && factor.noneProbability < EXCLUSIVE_PROBABILITY_TOLERANCE) factor.noneProbability = 0.0;
+        factors.push_back(factor);
+        first = factor.last;
+    }
+    return factors;
+}
+
+// Returns the last day whose recurring occurrences scenarios include by default: the end of the
+// current month, or of the month of the latest item if that is later
+int32_t defaultScenarioHorizon(const Ledger &items) {
+    const int32_t today = currentDay();
+    return lastDayOfMonth(items.empty() ? today : std::max(today, items.date(items.size() - 1)));
+}
+
+// Collects the scenario groups of a ledger as factors and returns the total of the grouped items that
+// are certain to occur, in minor units. Exclusive members become the alternatives of a factor, a bundle
+// one alternative with the members' total, and the members of a conditional group items conditional on
+// their parent's alternative. The rows of grouped items, parents included, are added to groupedRows.
+// Items dated after lastDay are left out, as deleted items are.
+int64_t separateScenarioGroups(const Ledger &items, std::vector<ScenarioItem> &variableItems,
+                               std::vector<size_t> &groupedRows,
+                               int32_t lastDay = std::numeric_limits<int32_t>::max()) {
+    struct Alternative {
+        int64_t delta;
+        double probability;
+        std::vector<ScenarioItem> conditions;
+    };
+    std::vector<std::vector<Alternative> > factors;
+    std::unordered_map<uint64_t, std::pair<size_t, size_t> > alternativeOf; // Factor and alternative of an item
+    size_t row;
+    auto findRow = [&items, lastDay](uint64_t id, size_t &row) {
+        return items.findRow(id, row) && items.date(row) <= lastDay;
+    };
+
+    for (size_t index = 0; index < items.scenarioGroupCount(); ++index) {
+        const ScenarioGroup &group = items.scenarioGroup(index);
+        if (group.kind == ScenarioGroupKind::Conditional) continue;
+        std::vector<Alternative> &factor = factors.emplace_back();
+        for (uint64_t member: items.scenarioGroupMembers(index)) {
+            if (!findRow(member, row)) continue;
+            groupedRows.push_back(row);
+            if (group.kind == ScenarioGroupKind::Exclusive || factor.empty()) {
+                const bool bundle = group.kind == ScenarioGroupKind::Bundle;
+                factor.push_back({0, bundle ? group.probability : items.probability(row), {}});
+            }
+            factor.back().delta += items.signedAmount(row);
+            alternativeOf[member] = {factors.size() - 1, factor.size() - 1};
+        }
+    }
+
+    // A conditional group whose parent was deleted no longer links its members
+    for (size_t index = 0; index < items.scenarioGroupCount(); ++index) {
+        const ScenarioGroup &group = items.scenarioGroup(index);
+        if (group.kind != ScenarioGroupKind::Conditional || !findRow(group.parentId, row)) continue;
+        auto [parent, added] = alternativeOf.try_emplace(group.parentId, factors.size(), 0);
+        if (added) {
+            factors.push_back({{items.signedAmount(row), items.probability(row), {}}});
+            groupedRows.push_back(row);
+        }
+        Alternative &alternative = factors[parent->second.first][parent->second.second];
+        for (uint64_t member: items.scenarioGroupMembers(index)) {
+            if (!findRow(member, row)) continue;
+            groupedRows.push_back(row);
+            alternative.conditions.push_back(
+                {items.signedAmount(row), items.probability(row), ScenarioLink::Conditional});
+        }
+    }
+
+    int64_t fixedAssets = 0;
+    for (std::vector<Alternative> &factor: factors) {
+        // Impossible alternatives and conditions are dropped, and certain conditions become part of their alternative
+        std::erase_if(factor, [](const Alternative &alternative) { return alternative.probability <= 0.0; });
+        double total = 0.0;
+        for (Alternative &alternative: factor) {
+            std::erase_if(alternative.conditions, [&alternative](const ScenarioItem &condition) {
+                if (condition.probability >= 1.0) alternative.delta += condition.delta;
+                return condition.probability <= 0.0 || condition.probability >= 1.0;
+            });
+            total += alternative.probability;
+        }
+        // Exclusive items edited after their group was made may add up to more than 1; they are scaled back
+        if (total > 1.0) {
+            for (Alternative &alternative: factor) alternative.probability /= total;
+        }
+        if (factor.size() == 1 && factor[0].probability >= 1.0) {
+            // A certain alternative leaves only its conditions uncertain, and those are independent
+            fixedAssets += factor[0].delta;
+            for (const ScenarioItem &condition: factor[0].conditions) {
+                variableItems.push_back({condition.delta, condition.probability});
+            }
+            continue;
+        }
+        for (size_t i = 0; i < factor.size(); ++i) {
+            const ScenarioLink link = i == 0 ? ScenarioLink::Independent : ScenarioLink::Exclusive;
+            variableItems.push_back({factor[i].delta, factor[i].probability, link});
+            variableItems.insert(variableItems.end(), factor[i].conditions.begin(), factor[i].conditions.end());
+        }
+    }
+    return fixedAssets;
+}
+
+// Collects the variable items (probability between 0 and 1) and returns the total of the fixed ones
+// in minor units. Scenario groups contribute one factor each. Recurrence rules contribute their
+// occurrences up to the horizon: certain ones are counted in O(1), and only uncertain ones are expanded
+// into one variable item per occurrence.
+int64_t separateScenarioItems(const Ledger &items, int32_t horizon, std::vector<ScenarioItem> &variableItems) {
+    std::vector<ScenarioItem> groupItems;
+    std::vector<size_t> groupedRows;
+    int64_t fixedAssets = 0; // Total assets from items with probability 1
+    if (items.scenarioGroupCount() > 0) {
+        fixedAssets = separateScenarioGroups(items, groupItems, groupedRows);
+        std::sort(groupedRows.begin(), groupedRows.end());
+        groupedRows.erase(std::unique(groupedRows.begin(), groupedRows.end()), groupedRows.end());
+    }
+
+    auto nextGrouped = groupedRows.begin();
+    for (size_t row = 0; row < items.size(); ++row) {
+        if (nextGrouped != groupedRows.end() && *nextGrouped == row) {
+            ++nextGrouped;
+            continue; // Counted with its group
+        }
+        if (items.probability(row) == 0.0) {
+            continue; // Skip impossible events
+        }
+        if (items.probability(row) == 1.0) {
+            fixedAssets += items.signedAmount(row);
+        } else {
+            variableItems.push_back({items.signedAmount(row), items.probability(row)});
+        }
+    }
+    variableItems.insert(variableItems.end(), groupItems.begin(), groupItems.end());
+    for (size_t index = 0; index < items.recurrenceCount(); ++index) {
+        const RecurrenceRule &rule = items.recurrence(index);
+        const int64_t delta = signedAmount(rule.type, rule.amount);
+        if (rule.probability == 0.0) continue;
+        if (rule.probability == 1.0) {
+            fixedAssets += static_cast<int64_t>(rule.schedule.countThrough(horizon)) * delta;
+        } else {
+            rule.schedule.forEachOccurrence(rule.schedule.start, horizon, [&](int32_t) {
+                variableItems.push_back({delta, rule.probability});
+            });
+        }
+    }
+    return fixedAssets;
+}
+
+// Summary statistics over every combination of the uncertain items
+struct ScenarioSummary {
+    size_t variableItemCount = 0;
+    Money bestCase;
+    Money worstCase;
+    Money mostLikelyOutcome;
+    double mostLikelyProbability = 1.0;
+    Money leastLikelyOutcome;
+    double leastLikelyProbability = 1.0;
+    Money expectedOutcome; // Rounded to the nearest minor unit
+    Money percentile5;
+    Money median;
+    Money percentile95;
+    bool exactDistribution = true;
+};
+
+// The choices one factor offers a scenario: its extremes, its most and least likely choice, its expected
+// change and the distribution of its change
+struct FactorSummary {
+    int64_t bestCase = std::numeric_limits<int64_t>::min();
+    int64_t worstCase = std::numeric_limits<int64_t>::max();
+    int64_t mostLikelyOutcome = 0;
+    double mostLikelyProbability = -1.0;
+    int64_t leastLikelyOutcome = 0;
+    double leastLikelyProbability = 2.0;
+    double expectedChange = 0.0;
+    std::vector<std::pair<int64_t, double> > outcomes; // Sorted by change
+    bool exactDistribution = true;
+};
+
+// Summarizes a factor of linked items. A choice is none of the alternatives, or one of them together
+// with any of its conditional items, which are independent given the alternative; the best choice for
+// each alternative is therefore made item by item, as for independent items. None comes first, so
+// ties resolve to it.
+FactorSummary summarizeFactor(const std::vector<ScenarioItem> &variableItems, const ScenarioFactor &factor) {
+    FactorSummary summary;
+    auto choose = [&summary](int64_t best, int64_t worst, int64_t mostLikely, double mostLikelyProbability,
+                             int64_t leastLikely, double leastLikelyProbability) {
+        summary.bestCase = std::max(summary.bestCase, best);
+        summary.worstCase = std::min(summary.worstCase, worst);
+        if (mostLikelyProbability > summary.mostLikelyProbability) {
+            summary.mostLikelyOutcome = mostLikely;
+            summary.mostLikelyProbability = mostLikelyProbability;
+        }
+        if (leastLikelyProbability < summary.leastLikelyProbability) {
+            summary.leastLikelyOutcome = leastLikely;
+            summary.leastLikelyProbability = leastLikelyProbability;
+        }
+    };
+    if (factor.noneProbability > 0.0) {
+        choose(0, 0, 0, factor.noneProbability, 0, factor.noneProbability);
+        summary.outcomes.emplace_back(0, factor.noneProbability);
+    }
+
+    for (size_t i = factor.first; i < factor.last;) {
+        const ScenarioItem &alternative = variableItems[i];
+        int64_t best = alternative.delta, worst = alternative.delta;
+        int64_t mostLikely = alternative.delta, leastLikely = alternative.delta;
+        double mostLikelyProbability = alternative.probability, leastLikelyProbability = alternative.probability;
+        double expected = static_cast<double>(alternative.delta);
+        OutcomeDistribution conditions;
+        for (++i; i < factor.last && variableItems[i].link == ScenarioLink::Conditional; ++i) {
+            const auto &[delta, probability, link] = variableItems[i];
+            (delta > 0 ? best : worst) += delta;
+            if (probability > 1 - probability) {
+                mostLikely += delta;
+                mostLikelyProbability *= probability;
+            } else {
+                mostLikelyProbability *= (1 - probability);
+            }
+            if (probability < 1 - probability) {
+                leastLikely += delta;
+                leastLikelyProbability *= probability;
+            } else {
+                leastLikelyProbability *= (1 - probability);
+            }
+            expected += static_cast<double>(delta) * probability;
+            conditions.addItem(delta, probability);
+        }
+        choose(best, worst, mostLikely, mostLikelyProbability, leastLikely, leastLikelyProbability);
+        summary.expectedChange += expected * alternative.probability;
+        summary.exactDistribution = summary.exactDistribution && conditions.resolution == 1;
+        for (const auto &[outcome, probability]: conditions.outcomes) {
+            summary.outcomes.emplace_back(alternative.delta + outcome, alternative.probability * probability);
+        }
+    }
+
+    std::sort(summary.outcomes.begin(), summary.outcomes.end());
+    size_t write = 0;
+    for (size_t read = 0; read < summary.outcomes.size(); ++read) {
+        if (write > 0 && summary.outcomes[write - 1].first == summary.outcomes[read].first) {
+            summary.outcomes[write - 1].second += summary.outcomes[read].second;
+        } else {
+            summary.outcomes[write++] = summary.outcomes[read];
+        }
+    }
+    summary.outcomes.resize(write);
+    return summary;
+}
+
+// Computes the scenario summary of the items found by separateScenarioItems without enumerating
+// the 2^n combinations. Because factors are independent, the extreme and most/least likely scenarios
+// are chosen factor by factor in O(n), and the outcome distribution is built by dynamic programming.
+// Only the collected items are read, so this can run on another thread while the ledger changes.
+ScenarioSummary summarizeScenarioItems(int64_t fixedAssets, const std::vector<ScenarioItem> &variableItems) {
+    ScenarioSummary summary;
+    summary.variableItemCount = variableItems.size();
+
+    int64_t bestVariable = 0, worstVariable = 0;
+    int64_t mostLikelyVariable = 0, leastLikelyVariable = 0;
+    double expectedVariable = 0.0;
+    OutcomeDistribution distribution;
+    bool exactFactors = true;
+
+    // Probabilities are multiplied in item order so they match a scenario-by-scenario evaluation
+    for (const ScenarioFactor &factor: scenarioFactors(variableItems)) {
+        if (factor.last - factor.first > 1) {
+            const FactorSummary linked = summarizeFactor(variableItems, factor);
+            bestVariable += linked.bestCase;
+            worstVariable += linked.worstCase;
+            mostLikelyVariable += linked.mostLikelyOutcome;
+            summary.mostLikelyProbability *= linked.mostLikelyProbability;
+            leastLikelyVariable += linked.leastLikelyOutcome;
+            summary.leastLikelyProbability *= linked.leastLikelyProbability;
+            expectedVariable += linked.expectedChange;
+            distribution.addFactor(linked.outcomes);
+            exactFactors = exactFactors && linked.exactDistribution;
+            continue;
+        }
+
+        const auto &[amount, probability, link] = variableItems[factor.first];
+        if (amount > 0) bestVariable += amount;
+        if (amount < 0) worstVariable += amount;
+
+        // Ties (probability 0.5) resolve to the item not occurring
+        if (probability > 1 - probability) {
+            mostLikelyVariable += amount;
+            summary.mostLikelyProbability *= probability;
+        } else {
+            summary.mostLikelyProbability *= (1 - probability);
+        }
+        if (probability < 1 - probability) {
+            leastLikelyVariable += amount;
+            summary.leastLikelyProbability *= probability;
+        } else {
+            summary.leastLikelyProbability *= (1 - probability);
+        }
+
+        expectedVariable += static_cast<double>(amount) * probability;
+        distribution.addItem(amount, probability);
+    }
+
+    summary.bestCase = Money(fixedAssets + bestVariable);
+    summary.worstCase = Money(fixedAssets + worstVariable);
+    summary.mostLikelyOutcome = Money(fixedAssets + mostLikelyVariable);
+    summary.leastLikelyOutcome = Money(fixedAssets + leastLikelyVariable);
+    summary.expectedOutcome = Money(fixedAssets + std::llround(expectedVariable));
+    summary.percentile5 = Money(fixedAssets + distribution.percentile(0.05));
+    summary.median = Money(fixedAssets + distribution.percentile(0.5));
+    summary.percentile95 = Money(fixedAssets + distribution.percentile(0.95));
+    summary.exactDistribution = distribution.resolution == 1 && exactFactors;
+    return summary;
+}
+
+// Computes the scenario summary of a ledger, including recurring items up to the horizon
+ScenarioSummary summarizeScenarios(const Ledger &items, int32_t horizon) {
+    ScopedTimer timer(Probe::SummarizeScenarios);
+    std::vector<ScenarioItem> variableItems;
+    int64_t fixedAssets = separateScenarioItems(items, horizon, variableItems);
+    return summarizeScenarioItems(fixedAssets, variableItems);
+}
+
+// Returns the effect on total assets of the items in scenario groups dated up to lastDay, taking each
+// group as one factor the way the scenario evaluation does: its best and worst choices are the gains
+// and losses, and the expected change weights a conditional item by its parent's probability too.
+// groupedRows is every grouped row, sorted; those the groups do not link by lastDay, such as the
+// members of a conditional group whose parent comes later, count on their own.
+OutcomeTotals groupedOutcomeTotals(const Ledger &items, const std::vector<size_t> &groupedRows, int32_t lastDay) {
+    std::vector<ScenarioItem> variableItems;
+    std::vector<size_t> linkedRows;
+    OutcomeTotals totals;
+    totals.certain = separateScenarioGroups(items, variableItems, linkedRows, lastDay);
+    std::sort(linkedRows.begin(), linkedRows.end());
+    for (size_t row: groupedRows) {
+        if (items.date(row) <= lastDay && !std::binary_search(linkedRows.begin(), linkedRows.end(), row)) {
+            totals.add(items.rowOutcome(row));
+        }
+    }
+    for (const ScenarioFactor &factor: scenarioFactors(variableItems)) {
+        if (factor.last - factor.first > 1) {
+            const FactorSummary linked = summarizeFactor(variableItems, factor);
+            totals.gains += linked.bestCase;
+            totals.losses += linked.worstCase;
+            totals.expectedChange += linked.expectedChange;
+            continue;
+        }
+        const ScenarioItem &item = variableItems[factor.first];
+        (item.delta < 0 ? totals.losses : totals.gains) += item.delta;
+        totals.expectedChange += static_cast<double>(item.delta) * item.probability;
+    }
+    return totals;
+}
+
+// Projects the ledger month by month for monthCount months starting with firstMonth (a key from
+// monthOf()). Everything before the first month is the opening position. The type totals come from the
+// month index's running totals. The outcomes of ungrouped rows are summed over each month's range of
+// the date-ordered rows and accumulated from month to month; the scenario groups are evaluated again
+// as a whole for each month in which one of their items falls. Recurrence rules are counted per month
+// without being expanded, so the cost is one pass over the rows up to the last month plus one count
+// per rule and month.
+std::vector<ProjectionMonth> projectCashFlow(const Ledger &items, int32_t firstMonth, size_t monthCount) {
+    ScopedTimer timer(Probe::ProjectCashFlow);
+    const MonthIndex &months = items.months();
+    std::vector<ProjectionMonth> projection(monthCount);
+    std::vector<ScenarioItem> unused;
+    std::vector<size_t> groupedRows;
+    if (items.scenarioGroupCount() > 0) {
+        separateScenarioGroups(items, unused, groupedRows);
+        std::sort(groupedRows.begin(), groupedRows.end());
+        groupedRows.erase(std::unique(groupedRows.begin(), groupedRows.end()), groupedRows.end());
+    }
+    auto hasGroupedRows = [&groupedRows](size_t firstRow, size_t lastRow) {
+        auto row = std::lower_bound(groupedRows.begin(), groupedRows.end(), firstRow);
+        return row != groupedRows.end() && *row < lastRow;
+    };
+
+    TypeTotals totals = months.totalsThrough(firstMonth - 1);
+    const size_t openingRows = months.monthRows(firstMonth).first;
+    OutcomeTotals outcomes = items.outcomeTotals(0, openingRows, groupedRows);
+    OutcomeTotals groupOutcomes;
+    if (hasGroupedRows(0, openingRows)) {
+        groupOutcomes = groupedOutcomeTotals(items, groupedRows, firstDayOfMonthKey(firstMonth) - 1);
+    }
+    auto addOccurrences = [&totals, &outcomes](const RecurrenceRule &rule, uint64_t count) {
+        if (count == 0) return;
+        const auto occurrences = static_cast<int64_t>(count);
+        totals[static_cast<size_t>(rule.type)] += occurrences * rule.amount;
+        if (rule.probability == 0.0) return;
+        const int64_t delta = occurrences * signedAmount(rule.type, rule.amount);
+        if (rule.probability == 1.0) {
+            outcomes.certain += delta;
+        } else {
+            (delta > 0 ? outcomes.gains : outcomes.losses) += delta;
+            outcomes.expectedChange += static_cast<double>(delta) * rule.probability;
+        }
+    };
+    for (size_t index = 0; index < items.recurrenceCount(); ++index) {
+        const RecurrenceRule &rule = items.recurrence(index);
+        addOccurrences(rule, rule.schedule.countThrough(firstDayOfMonthKey(firstMonth) - 1));
+    }
+
+    for (size_t i = 0; i < monthCount; ++i) {
+        const auto month = static_cast<int32_t>(firstMonth + i);
+        const TypeTotals monthTotals = months.monthTotals(month);
+        for (size_t type = 0; type < ITEM_TYPE_COUNT; ++type) totals[type] += monthTotals[type];
+        const auto [firstRow, lastRow] = months.monthRows(month);
+        const int32_t firstDay = firstDayOfMonthKey(month), lastDay = firstDayOfMonthKey(month + 1) - 1;
+        outcomes.add(items.outcomeTotals(firstRow, lastRow, groupedRows));
+        if (hasGroupedRows(firstRow, lastRow)) groupOutcomes = groupedOutcomeTotals(items, groupedRows, lastDay);
+        for (size_t index = 0; index < items.recurrenceCount(); ++index) {
+            const RecurrenceRule &rule = items.recurrence(index);
+            addOccurrences(rule, rule.schedule.countBetween(firstDay, lastDay));
+        }
+
+        ProjectionMonth &result = projection[i];
+        result.month = month;
+        result.totals = totals;
+        OutcomeTotals all = outcomes;
+        all.add(groupOutcomes);
+        result.worstCase = all.certain + all.losses;
+        result.expectedOutcome = all.certain + std::llround(all.expectedChange);
+        result.bestCase = all.certain + all.gains;
+    }
+    return projection;
+}
+
+// Settings for the Monte Carlo scenario simulation
+struct MonteCarloOptions {
+    uint64_t samples = 1000000;
+    uint64_t seed = 20240101;
+    unsigned threads = 0; // 0 uses every hardware thread
+};
+
+// Risk statistics estimated from sampled scenarios
+struct MonteCarloResult {
+    uint64_t samples = 0;
+    double expectedOutcome = 0.0;
+    double percentile5 = 0.0;
+    double median = 0.0;
+    double percentile95 = 0.0;
+    double expectedShortfall5 = 0.0; // Mean outcome of the worst 5% of scenarios
+    double confidenceLow = 0.0;      // 95% confidence interval of the expected outcome
+    double confidenceHigh = 0.0;
+};
+
+// Scenarios are drawn in fixed-size batches and tallied into this many histogram bins
+constexpr size_t MONTE_CARLO_BATCH_SIZE = 1024;
+constexpr size_t MONTE_CARLO_BINS = 1 << 16;
+
+// Scenarios are split into chunks of this size, each with its own random stream, so the result does
+// not depend on how many threads draw them
+constexpr uint64_t MONTE_CARLO_CHUNK_SIZE = 1 << 16;
+
+// SplitMix64, used to derive independent seeds for each chunk
+uint64_t splitMix64(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// xoshiro256** generator, one stream per chunk
+struct Xoshiro256 {
+    uint64_t state[4];
+
+    explicit Xoshiro256(uint64_t seed) {
+        for (auto &word: state) word = splitMix64(seed);
+    }
+
+    uint64_t next() {
+        const uint64_t result = rotateLeft(state[1] * 5, 7) * 9;
+        const uint64_t shifted = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= shifted;
+        state[3] = rotateLeft(state[3], 45);
+        return result;
+    }
+
+    static uint64_t rotateLeft(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+// Count, mean and sum of squared deviations of a set of samples. Sets are merged with the pairwise
+// update of Chan et al., which keeps the variance accurate where E[x^2] - mean^2 would cancel.
+struct SampleMoments {
+    uint64_t count = 0;
+    double mean = 0.0;
+    double squaredDeviations = 0.0;
+
+    void merge(const SampleMoments &other) {
+        if (other.count == 0) return;
+        const auto total = static_cast<double>(count + other.count);
+        const double delta = other.mean - mean;
+        mean += delta * static_cast<double>(other.count) / total;
+        squaredDeviations += other.squaredDeviations +
+                             delta * delta * static_cast<double>(count) * static_cast<double>(other.count) / total;
+        count += other.count;
+    }
+};
+
+// Estimates the outcome distribution by sampling scenarios on every core.
+// Each worker fills a private histogram and adds it to the shared one with atomic operations. The
+// histogram holds integers and the moments of each chunk are merged in chunk order, so the same seed
+// gives the same result on any number of cores.
+MonteCarloResult simulateScenarios(const Ledger &items, int32_t horizon, const MonteCarloOptions &options) {
+    ScopedTimer timer(Probe::SimulateScenarios);
+    std::vector<ScenarioItem> variableItems;
+    double fixedAssets = fromMinorUnits(separateScenarioItems(items, horizon, variableItems));
+
+    // Each item is a minor-unit delta that occurs when a 64-bit draw falls in [low, high). The
+    // alternatives of a factor share one draw and split its range; a conditional item has a draw of its
+    // own and also needs its alternative to occur.
+    std::vector<int64_t> deltas;
+    std::vector<uint64_t> lows, highs;
+    std::vector<ScenarioLink> links;
+    int64_t lowest = 0, highest = 0;
+    double covered = 0.0; // Share of the draw range taken by the factor's alternatives so far
+    auto threshold = [](double probability) {
+        return probability >= 1.0 ? std::numeric_limits<uint64_t>::max()
+                                  : static_cast<uint64_t>(std::ldexp(probability, 64));
+    };
+    for (const ScenarioItem &item: variableItems) {
+        int64_t delta = item.delta;
+        double probability = std::clamp(item.probability, 0.0, 1.0);
+        if (item.link == ScenarioLink::Independent) covered = 0.0;
+        if (item.link == ScenarioLink::Conditional) {
+            lows.push_back(0);
+            highs.push_back(threshold(probability));
+        } else {
+            lows.push_back(threshold(covered));
+            covered = std::min(1.0, covered + probability);
+            highs.push_back(threshold(covered));
+        }
+        deltas.push_back(delta);
+        links.push_back(item.link);
+        (delta < 0 ? lowest : highest) += delta;
+    }
+
+    // A bin's outcomes are held as offsets from its first minor unit, so their sums are exact
+    const double binWidth = std::max(1.0, static_cast<double>(highest - lowest + 1) / MONTE_CARLO_BINS);
+    auto binOf = [&](int64_t outcome) {
+        auto bin = static_cast<size_t>(static_cast<double>(outcome - lowest) / binWidth);
+        return std::min(bin, MONTE_CARLO_BINS - 1);
+    };
+    auto binStart = [&](size_t bin) {
+        return lowest + static_cast<int64_t>(static_cast<double>(bin) * binWidth);
+    };
+    std::vector<std::atomic<uint64_t> > binCounts(MONTE_CARLO_BINS);
+    std::vector<std::atomic<uint64_t> > binOffsets(MONTE_CARLO_BINS);
+
+    const uint64_t chunkCount = options.samples / MONTE_CARLO_CHUNK_SIZE +
+                                (options.samples % MONTE_CARLO_CHUNK_SIZE != 0);
+    std::vector<SampleMoments> chunkMoments(chunkCount);
+    std::atomic<uint64_t> nextChunk{0};
+    unsigned threadCount = options.threads ? options.threads : sharedPool().size();
+    threadCount = static_cast<unsigned>(std::min<uint64_t>(threadCount, std::max<uint64_t>(1, chunkCount)));
+
+    auto worker = [&] {
+        std::vector<uint64_t> counts(MONTE_CARLO_BINS, 0);
+        std::vector<uint64_t> offsets(MONTE_CARLO_BINS, 0);
+        int64_t outcomes[MONTE_CARLO_BATCH_SIZE];
+        uint64_t draws[MONTE_CARLO_BATCH_SIZE];
+        int64_t occurred[MONTE_CARLO_BATCH_SIZE]; // All ones where the factor's last alternative occurred
+
+        for (uint64_t chunk; (chunk = nextChunk.fetch_add(1, std::memory_order_relaxed)) < chunkCount;) {
+            uint64_t seed = options.seed ^ (0xD1B54A32D192ED03ULL * (chunk + 1));
+            Xoshiro256 rng(splitMix64(seed));
+            const uint64_t begin = chunk * MONTE_CARLO_CHUNK_SIZE;
+            const uint64_t end = begin + std::min(MONTE_CARLO_CHUNK_SIZE, options.samples - begin);
+
+            for (uint64_t batchStart = begin; batchStart < end; batchStart += MONTE_CARLO_BATCH_SIZE) {
+                size_t batch = static_cast<size_t>(std::min<uint64_t>(MONTE_CARLO_BATCH_SIZE, end - batchStart));
+                std::fill(outcomes, outcomes + batch, 0);
+
+                // Masking instead of branching keeps the inner loops free of unpredictable jumps
+                for (size_t itemIndex = 0; itemIndex < deltas.size(); ++itemIndex) {
+                    const int64_t delta = deltas[itemIndex];
+                    const uint64_t low = lows[itemIndex], width = highs[itemIndex] - low;
+                    if (links[itemIndex] == ScenarioLink::Conditional) {
+                        for (size_t s = 0; s < batch; ++s) {
+                            outcomes[s] += delta & occurred[s] & -static_cast<int64_t>(rng.next() < width);
+                        }
+                        continue;
+                    }
+                    if (links[itemIndex] == ScenarioLink::Independent) {
+                        for (size_t s = 0; s < batch; ++s) draws[s] = rng.next();
+                    }
+                    for (size_t s = 0; s < batch; ++s) {
+                        occurred[s] = -static_cast<int64_t>(draws[s] - low < width);
+                        outcomes[s] += delta & occurred[s];
+                    }
+                }
+
+                SampleMoments moments;
+                double sum = 0.0;
+                for (size_t s = 0; s < batch; ++s) {
+                    const size_t bin = binOf(outcomes[s]);
+                    counts[bin] += 1;
+                    offsets[bin] += static_cast<uint64_t>(outcomes[s] - binStart(bin));
+                    sum += fromMinorUnits(outcomes[s]);
+                }
+                moments.count = batch;
+                moments.mean = sum / static_cast<double>(batch);
+                for (size_t s = 0; s < batch; ++s) {
+                    const double deviation = fromMinorUnits(outcomes[s]) - moments.mean;
+                    moments.squaredDeviations += deviation * deviation;
+                }
+                chunkMoments[chunk].merge(moments);
+            }
+        }
+
+        for (size_t bin = 0; bin < MONTE_CARLO_BINS; ++bin) {
+            if (counts[bin] == 0) continue;
+            binCounts[bin].fetch_add(counts[bin], std::memory_order_relaxed);
+            binOffsets[bin].fetch_add(offsets[bin], std::memory_order_relaxed);
+        }
+    };
+
+    parallelFor(threadCount, [&](size_t) { worker(); });
+
+    MonteCarloResult result;
+    result.samples = options.samples;
+    if (options.samples == 0) {
+        result.expectedOutcome = result.percentile5 = result.median = result.percentile95 = fixedAssets;
+        result.expectedShortfall5 = result.confidenceLow = result.confidenceHigh = fixedAssets;
+        return result;
+    }
+
+    SampleMoments moments;
+    for (const SampleMoments &chunk: chunkMoments) moments.merge(chunk);
+    const auto sampleCount = static_cast<double>(options.samples);
+    double variance = moments.squaredDeviations / sampleCount;
+    double margin = 1.96 * std::sqrt(variance / sampleCount);
+    result.expectedOutcome = fixedAssets + moments.mean;
+    result.confidenceLow = result.expectedOutcome - margin;
+    result.confidenceHigh = result.expectedOutcome + margin;
+
+    // Walk the merged histogram; a percentile is the mean of the bin where it falls
+    const uint64_t tailCount = std::max<uint64_t>(1, options.samples / 20);
+    uint64_t cumulative = 0, tailTaken = 0;
+    double tailSum = 0.0;
+    bool found5 = false, found50 = false, found95 = false;
+    for (size_t bin = 0; bin < MONTE_CARLO_BINS; ++bin) {
+        uint64_t count = binCounts[bin].load();
+        if (count == 0) continue;
+        double binMean = fromMinorUnits(binStart(bin)) + static_cast<double>(binOffsets[bin].load()) /
+                                                         static_cast<double>(count) / MINOR_UNITS_PER_UNIT;
+        if (tailTaken < tailCount) {
+            uint64_t take = std::min(count, tailCount - tailTaken);
+            tailSum += binMean * static_cast<double>(take);
+            tailTaken += take;
+        }
+        cumulative += count;
+        if (!found5 && cumulative * 20 >= options.samples) {
+            result.percentile5 = fixedAssets + binMean;
+            found5 = true;
+        }
+        if (!found50 && cumulative * 2 >= options.samples) {
+            result.median = fixedAssets + binMean;
+            found50 = true;
+        }
+        if (!found95 && cumulative * 20 >= options.samples * 19) {
+            result.percentile95 = fixedAssets + binMean;
+            found95 = true;
+        }
+    }
+    result.expectedShortfall5 = fixedAssets + tailSum / static_cast<double>(tailTaken);
+    return result;
+}
+
+// Maximum number of variable items that fit in a scenario mask
+constexpr size_t MAX_EXHAUSTIVE_ITEMS = 63;
+
+// Log-probabilities closer than this are treated as equal, so ties resolve to the lowest mask
+constexpr double LOG_PROBABILITY_TOLERANCE = 1e-9;
+
+// Extreme scenarios found by enumerating every combination of the variable items.
+// Outcomes are relative to the fixed items and held in minor units.
+struct ScenarioExtremes {
+    int64_t bestCase = std::numeric_limits<int64_t>::min();
+    int64_t worstCase = std::numeric_limits<int64_t>::max();
+    int64_t mostLikelyOutcome = 0;
+    double mostLikelyLogProbability = -std::numeric_limits<double>::infinity();
+    uint64_t mostLikelyMask = std::numeric_limits<uint64_t>::max();
+    int64_t leastLikelyOutcome = 0;
+    double leastLikelyLogProbability = std::numeric_limits<double>::infinity();
+    uint64_t leastLikelyMask = std::numeric_limits<uint64_t>::max();
+
+    // Records one scenario (bit i of mask set when variable item i occurs)
+    void consider(uint64_t mask, int64_t outcome, double logProbability) {
+        bestCase = std::max(bestCase, outcome);
+        worstCase = std::min(worstCase, outcome);
+        if (logProbability > mostLikelyLogProbability + LOG_PROBABILITY_TOLERANCE ||
+            (logProbability >= mostLikelyLogProbability - LOG_PROBABILITY_TOLERANCE && mask < mostLikelyMask)) {
+            mostLikelyLogProbability = logProbability;
+            mostLikelyMask = mask;
+            mostLikelyOutcome = outcome;
+        }
+        if (logProbability < leastLikelyLogProbability - LOG_PROBABILITY_TOLERANCE ||
+            (logProbability <= leastLikelyLogProbability + LOG_PROBABILITY_TOLERANCE && mask < leastLikelyMask)) {
+            leastLikelyLogProbability = logProbability;
+            leastLikelyMask = mask;
+            leastLikelyOutcome = outcome;
+        }
+    }
+
+    // Combines the extremes found over another part of the mask space
+    void merge(const ScenarioExtremes &other) {
+        bestCase = std::max(bestCase, other.bestCase);
+        worstCase = std::min(worstCase, other.worstCase);
+        if (other.mostLikelyMask != std::numeric_limits<uint64_t>::max()) {
+            consider(other.mostLikelyMask, other.mostLikelyOutcome, other.mostLikelyLogProbability);
+        }
+        if (other.leastLikelyMask != std::numeric_limits<uint64_t>::max()) {
+            consider(other.leastLikelyMask, other.leastLikelyOutcome, other.leastLikelyLogProbability);
+        }
+    }
+};
+
+// Enumerates every combination of variable items that include linked ones and returns the extreme
+// scenarios among the possible ones. A combination with two alternatives of one factor, or with a
+// conditional item but not its alternative, is impossible and skipped. As in enumerateScenarios, each
+// step flips one item; the log-probability of that item's factor is then recomputed in O(1).
+ScenarioExtremes enumerateLinkedScenarios(const std::vector<ScenarioItem> &variableItems) {
+    const size_t n = variableItems.size();
+    const std::vector<ScenarioFactor> factors = scenarioFactors(variableItems);
+    std::vector<size_t> factorOf(n), alternativeOf(n);
+    std::vector<double> logNone(factors.size()), logOccurs(n), logMissing(n);
+    for (size_t f = 0; f < factors.size(); ++f) {
+        logNone[f] = std::log(factors[f].noneProbability);
+        for (size_t i = factors[f].first; i < factors[f].last; ++i) {
+            const bool conditional = variableItems[i].link == ScenarioLink::Conditional && i > factors[f].first;
+            factorOf[i] = f;
+            alternativeOf[i] = conditional ? alternativeOf[i - 1] : i;
+            logOccurs[i] = std::log(variableItems[i].probability);
+            logMissing[i] = std::log(1 - variableItems[i].probability);
+        }
+    }
+
+    const uint64_t scenarioCount = uint64_t{1} << n;
+    const uint64_t rangeCount = std::min<uint64_t>(scenarioCount, uint64_t{sharedPool().size()} * 16);
+    std::vector<ScenarioExtremes> partials(rangeCount);
+
+    parallelFor(rangeCount, [&](size_t rangeIndex) {
+        const uint64_t begin = scenarioCount / rangeCount * rangeIndex;
+        const uint64_t end = rangeIndex + 1 == rangeCount ? scenarioCount
+                                                          : scenarioCount / rangeCount * (rangeIndex + 1);
+        ScenarioExtremes &extremes = partials[rangeIndex];
+
+        // Per factor, the alternatives that occur (their count and the xor of their indexes) and the number
+        // of its conditional items that occur; per alternative, the same count and the log-probability
+        // of the state of its conditional items
+        std::vector<uint32_t> chosenCount(factors.size(), 0), conditionsInFactor(factors.size(), 0);
+        std::vector<size_t> chosenXor(factors.size(), 0);
+        std::vector<uint32_t> conditionCount(n, 0);
+        std::vector<double> conditionLog(n, 0.0);
+        auto factorLog = [&](size_t f) {
+            if (chosenCount[f] == 0) {
+                return conditionsInFactor[f] == 0 ? logNone[f] : -std::numeric_limits<double>::infinity();
+            }
+            const size_t chosen = chosenXor[f];
+            if (chosenCount[f] > 1 || conditionsInFactor[f] != conditionCount[chosen]) {
+                return -std::numeric_limits<double>::infinity();
+            }
+            return logOccurs[chosen] + conditionLog[chosen];
+        };
+
+        // Impossible factors are counted rather than added, so the sum of the others stays finite
+        uint64_t mask = begin ^ (begin >> 1);
+        int64_t outcome = 0;
+        double logProbability = 0.0;
+        int64_t impossibleFactors = 0;
+        auto addFactorLog = [&](double factorLogProbability, int sign) {
+            if (std::isinf(factorLogProbability)) {
+                impossibleFactors += sign;
+            } else {
+                logProbability += sign * factorLogProbability;
+            }
+        };
+        for (size_t i = 0; i < n; ++i) {
+            const bool occurs = (mask >> i) & 1;
+            const size_t f = factorOf[i], alternative = alternativeOf[i];
+            outcome += occurs ? variableItems[i].delta : 0;
+            if (alternative != i) {
+                conditionLog[alternative] += occurs ? logOccurs[i] : logMissing[i];
+                conditionCount[alternative] += occurs;
+                conditionsInFactor[f] += occurs;
+            } else if (occurs) {
+                ++chosenCount[f];
+                chosenXor[f] ^= i;
+            }
+        }
+        for (size_t f = 0; f < factors.size(); ++f) addFactorLog(factorLog(f), 1);
+        if (impossibleFactors == 0) extremes.consider(mask, outcome, logProbability);
+
+        for (uint64_t step = begin + 1; step < end; ++step) {
+            const int itemIndex = std::countr_zero(step);
+            mask ^= uint64_t{1} << itemIndex;
+            const bool occurs = (mask >> itemIndex) & 1;
+            const size_t f = factorOf[itemIndex], alternative = alternativeOf[itemIndex];
+            addFactorLog(factorLog(f), -1);
+            if (alternative != static_cast<size_t>(itemIndex)) {
+                const double logRatio = logOccurs[itemIndex] - logMissing[itemIndex];
+                conditionLog[alternative] += occurs ? logRatio : -logRatio;
+                conditionCount[alternative] += occurs ? 1 : -1;
+                conditionsInFactor[f] += occurs ? 1 : -1;
+            } else {
+                chosenCount[f] += occurs ? 1 : -1;
+                chosenXor[f] ^= itemIndex;
+            }
+            addFactorLog(factorLog(f), 1);
+            outcome += occurs ? variableItems[itemIndex].delta : -variableItems[itemIndex].delta;
+            if (impossibleFactors == 0) extremes.consider(mask, outcome, logProbability);
+        }
+    });
+
+    ScenarioExtremes result;
+    for (const auto &partial: partials) result.merge(partial);
+    return result;
+}
+
+// Enumerates every combination of the variable items and returns the extreme scenarios.
+// Masks are visited in Gray-code order, so each step flips one item and updates the running
+// outcome and log-probability in O(1). The mask space is split into ranges that run on the shared pool.
+ScenarioExtremes enumerateScenarios(const std::vector<ScenarioItem> &variableItems) {
+    ScopedTimer timer(Probe::EnumerateScenarios);
+    const size_t n = variableItems.size();
+    if (n > MAX_EXHAUSTIVE_ITEMS) {
+        throw std::invalid_argument("Too many variable items for exhaustive enumeration");
+    }
+    if (std::any_of(variableItems.begin(), variableItems.end(),
+                    [](const ScenarioItem &item) { return item.link != ScenarioLink::Independent; })) {
+        return enumerateLinkedScenarios(variableItems);
+    }
+
+    std::vector<int64_t> deltas(n);
+    std::vector<double> logOccurs(n), logMissing(n);
+    for (size_t i = 0; i < n; ++i) {
+        deltas[i] = variableItems[i].delta;
+        logOccurs[i] = std::log(variableItems[i].probability);
+        logMissing[i] = std::log(1 - variableItems[i].probability);
+    }
+
+    const uint64_t scenarioCount = uint64_t{1} << n;
+    const uint64_t rangeCount = std::min<uint64_t>(scenarioCount, uint64_t{sharedPool().size()} * 16);
+    std::vector<ScenarioExtremes> partials(rangeCount);
+
+    parallelFor(rangeCount, [&](size_t rangeIndex) {
+        const uint64_t begin = scenarioCount / rangeCount * rangeIndex;
+        const uint64_t end = rangeIndex + 1 == rangeCount ? scenarioCount
+                                                          : scenarioCount / rangeCount * (rangeIndex + 1);
+        ScenarioExtremes &extremes = partials[rangeIndex];
+
+        // Each range starts from scratch so rounding in the running log-probability stays local
+        uint64_t mask = begin ^ (begin >> 1);
+        int64_t outcome = 0;
+        double logProbability = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            bool occurs = (mask >> i) & 1;
+            outcome += occurs ? deltas[i] : 0;
+            logProbability += occurs ? logOccurs[i] : logMissing[i];
+        }
+        extremes.consider(mask, outcome, logProbability);
+
+        // Gray code: step i flips the item at the position of the lowest set bit of i
+        for (uint64_t step = begin + 1; step < end; ++step) {
+            const int itemIndex = std::countr_zero(step);
+            mask ^= uint64_t{1} << itemIndex;
+            const bool occurs = (mask >> itemIndex) & 1;
+            const double logRatio = logOccurs[itemIndex] - logMissing[itemIndex];
+            outcome += occurs ? deltas[itemIndex] : -deltas[itemIndex];
+            logProbability += occurs ? logRatio : -logRatio;
+            extremes.consider(mask, outcome, logProbability);
+        }
+    });
+
+    ScenarioExtremes result;
+    for (const auto &partial: partials) result.merge(partial);
+    return result;
+}
+
+#pragma endregion Scenarios
+
+#pragma region Application
+
+// Writes Monte Carlo risk statistics
+void writeMonteCarloResult(ReportWriter &report, const MonteCarloResult &result) {
+    // Outcomes are sums of whole ledgers, so they may exceed the limit on a single item's amount
+    auto money = [](double amount) { return Money(std::llround(amount * MINOR_UNITS_PER_UNIT)); };
+    report.field("Simulated Scenarios", {ReportCell::ofCount(result.samples)});
+    report.field("5th Percentile (VaR 95%)", {money(result.percentile5)});
+    report.field("Median Outcome", {money(result.median)});
+    report.field("95th Percentile", {money(result.percentile95)});
+    report.field("Expected Shortfall (5%)", {money(result.expectedShortfall5)});
+    report.field("Expected Outcome 95% CI", {money(result.confidenceLow), ReportCell::ofSeparator("-"),
+                                             money(result.confidenceHigh)});
+}
+
+// Evaluates all possible financial scenarios and writes a summary
+void writeScenarioEvaluation(ReportWriter &report, const Ledger &items) {
+    const int32_t horizon = defaultScenarioHorizon(items);
+    ScenarioSummary summary = summarizeScenarios(items, horizon);
+
+    report.blank();
+    report.heading("Scenarios Evaluation of All Budget Items");
+    report.heading("Projected Total Assets by The End");
+    report.field("Best Case Scenario", {summary.bestCase});
+    report.field("Worst Case Scenario", {summary.worstCase});
+    report.field("Most Likely Outcome",
+                 {summary.mostLikelyOutcome, ReportCell::ofPercentage(summary.mostLikelyProbability)});
+    report.field("Least Likely Outcome",
+                 {summary.leastLikelyOutcome, ReportCell::ofPercentage(summary.leastLikelyProbability)});
+    report.field("Expected Outcome", {summary.expectedOutcome});
+
+    // Too many distinct outcomes for an exact distribution, so estimate the percentiles by sampling
+    if (!summary.exactDistribution) {
+        writeMonteCarloResult(report, simulateScenarios(items, horizon, MonteCarloOptions()));
+        return;
+    }
+    report.field("5th Percentile", {summary.percentile5});
+    report.field("Median Outcome", {summary.median});
+    report.field("95th Percentile", {summary.percentile95});
+}
+
+// Runs a Monte Carlo simulation with a user-chosen sample count and seed
+void runMonteCarloSimulation() {
+    MonteCarloOptions options;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("number of samples", &options.samples, options.samples);
+    getInput("seed", &options.seed, options.seed);
+
+    ReportWriter report(std::cout);
+    report.beginBlock();
+    report.heading("Monte Carlo Simulation of All Budget Items");
+    const Ledger &items = globalState().getItems();
+    writeMonteCarloResult(report, simulateScenarios(items, defaultScenarioHorizon(items), options));
+}
+
+// Evaluates every scenario exhaustively, for when the exact brute-force answer is required
+void viewExhaustiveScenarios() {
+    const Ledger &items = globalState().getItems();
+    std::vector<ScenarioItem> variableItems;
+    int64_t fixedAssets = separateScenarioItems(items, defaultScenarioHorizon(items), variableItems);
+    if (variableItems.size() > MAX_EXHAUSTIVE_ITEMS) {
+        std::cout << "Too many uncertain items (" << variableItems.size()
+                  << ") for exhaustive enumeration. Use the Monte Carlo simulation instead.\n";
+        return;
+    }
+
+    ScenarioExtremes extremes = enumerateScenarios(variableItems);
+    ReportWriter report(std::cout);
+    report.beginBlock();
+    report.heading("Exhaustive Evaluation of All Budget Items");
+    report.field("Scenarios Evaluated", {ReportCell::ofCount(uint64_t{1} << variableItems.size())});
+    report.field("Best Case Scenario", {Money(fixedAssets + extremes.bestCase)});
+    report.field("Worst Case Scenario", {Money(fixedAssets + extremes.worstCase)});
+    report.field("Most Likely Outcome", {Money(fixedAssets + extremes.mostLikelyOutcome),
+                                         ReportCell::ofPercentage(std::exp(extremes.mostLikelyLogProbability))});
+    report.field("Least Likely Outcome", {Money(fixedAssets + extremes.leastLikelyOutcome),
+                                          ReportCell::ofPercentage(std::exp(extremes.leastLikelyLogProbability))});
+}
+
+// Writes the detailed financial summary: this month's assets and top expense categories, then the
+// scenario evaluation
+void writeDetailedSummary(ReportWriter &report) {
+    const Ledger &items = globalState().getItems();
+    const SummaryAggregates &aggregates = globalState().getAggregates();
+
+    report.beginBlock();
+    report.heading("Summary This Month");
+    report.field("Projected End of Month Assets", {Money(aggregates.getProjectedAssets())});
+    report.field("Current Assets", {Money(aggregates.getCurrentAssets())});
+    report.blank();
+    report.heading("Top 3 Expense by Categories");
+    char rank[] = "1. ";
+    std::string key;
+    for (auto [category, total]: aggregates.topExpenseCategories(3)) {
+        key.assign(rank).append(items.categories().get(category));
+        report.field(key, {Money(total)});
+        ++rank[0];
+    }
+    writeScenarioEvaluation(report, items);
+    report.endBlock();
+}
+
+// Displays a detailed financial summary
+void viewDetailedSummary() {
+    ReportWriter report(std::cout);
+    writeDetailedSummary(report);
+}
+
+// Writes the month-by-month projection of the ledger from this month on for the given number of years
+void writeProjection(ReportWriter &report, const Ledger &items, int32_t years) {
+    if (years < 1 || years > MAX_PROJECTION_YEARS) {
+        throw std::invalid_argument("Projection years must be between 1 and " + std::to_string(MAX_PROJECTION_YEARS));
+    }
+    for (const ProjectionMonth &month: projectCashFlow(items, monthOf(currentDay()), size_t(years) * 12)) {
+        report.projection(month);
+    }
+}
+
+// Displays the cash-flow projection over a user-chosen number of years
+void viewCashFlowProjection() {
+    int32_t years;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("number of years", &years, DEFAULT_PROJECTION_YEARS);
+    try {
+        ReportWriter report(std::cout);
+        writeProjection(report, globalState().getItems(), years);
+    } catch (const std::invalid_argument &e) {
+        std::cout << e.what() << "\n";
+    }
+}
+
+// Number of subcategories a date-range query lists
+constexpr size_t RANGE_QUERY_TOP_CATEGORIES = 5;
+
+// Displays the total of one item type in a category between two dates, and the subcategories with the
+// largest totals. Subcategories are separated by '/', and a category includes its subcategories.
+void queryDateRange() {
+    int typeInt;
+    std::string category, from, to;
+    const std::string today = getCurrentDate();
+    std::cout << "Leave blank for [default value]\n";
+    getInput("type (0: Asset, 1: Liability, 2: Income, 3: Expense)", &typeInt, 3);
+    getInput("category, such as Food or Food/Groceries (- for all)", &category, std::string("-"));
+    getInput("first date", &from, today.substr(0, 5) + "01-01");
+    getInput("last date", &to, today);
+    if (category == "-") category.clear();
+    try {
+        if (typeInt < 0 || static_cast<size_t>(typeInt) >= ITEM_TYPE_COUNT) {
+            throw std::invalid_argument("Invalid item type");
+        }
+        const auto type = static_cast<ItemType>(typeInt);
+        const int32_t firstDay = parseDate(from), lastDay = parseDate(to);
+        const Ledger &items = globalState().getItems();
+
+        ReportWriter report(std::cout);
+        report.beginBlock();
+        report.heading(std::string(itemTypeName(type)) + " from " + from + " to " + to);
+        report.field(category.empty() ? "All Categories" : category,
+                     {Money(items.rangeTotal(type, category, firstDay, lastDay))});
+        auto top = items.topCategories(type, category, firstDay, lastDay, RANGE_QUERY_TOP_CATEGORIES);
+        if (!top.empty()) {
+            report.blank();
+            report.heading(category.empty() ? "Top Categories" : "Top Subcategories");
+        }
+        char rank[] = "1. ";
+        std::string key;
+        for (const auto &[subcategory, total]: top) {
+            key.assign(rank).append(subcategory);
+            report.field(key, {Money(total)});
+            ++rank[0];
+        }
+        report.endBlock();
+    } catch (const std::invalid_argument &e) {
+        std::cout << e.what() << "\n";
+    }
+}
+
+// Writes the totals of each item type for the current month
+void writeSummary(ReportWriter &report) {
+    TypeTotals totals = globalState().getTotalsThisMonth();
+    report.beginBlock();
+    report.heading("Summary This Month");
+    report.field("Total Assets", {Money(totals[static_cast<size_t>(ItemType::Asset)])});
+    report.field("Total Liabilities", {Money(totals[static_cast<size_t>(ItemType::Liability)])});
+    report.field("Total Income", {Money(totals[static_cast<size_t>(ItemType::Income)])});
+    report.field("Total Expenses", {Money(totals[static_cast<size_t>(ItemType::Expense)])});
+    report.endBlock();
+}
+
+// Displays a summary of financial items for the current month
+void viewSummary() {
+    ReportWriter report(std::cout);
+    writeSummary(report);
 }
 
 // Collects transaction details from the user
@@ -597,79 +7574,1283 @@ void inputTransactionDetails(std::string &category, double &amount, std::string
     getInput("category", &category, category.empty() ? std::string("General") : category);
     getInput("amount", &amount, amount != 0.0 ? amount : 0.0);
 
-    const std::string &currentDate = getCurrentDate();
-    getInput("date", &date, date.empty() ? currentDate : date);
-    getInput("probability", &probability, probability != 0.0 ? probability : 1.0);
-}
+    const std::string &currentDate = getCurrentDate();
+    getInput("date", &date, date.empty() ? currentDate : date);
+    getInput("probability", &probability, probability != 0.0 ? probability : 1.0);
+}
+
+// Adds a new transaction
+void addTransaction() {
+    std::cout << "Adding transaction...\n";
+    std::string name, category, date;
+    double amount = 0, probability = 1.0;
+    int typeInt;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("type (0: Asset, 1: Liability, 2: Income, 3: Expense)", &typeInt, 0);
+    getInput("name", &name, std::string("Unnamed"));
+    inputTransactionDetails(category, amount, date, probability);
+
+    auto type = static_cast<ItemType>(typeInt);
+    try {
+        globalState().addItem(FinancialItem(type, name, category, Money::fromUnits(amount), date, probability));
+    } catch (const std::invalid_argument &e) {
+        std::cout << "Transaction not added: " << e.what() << "\n";
+    }
+}
+
+// Parses input of the form "#<id>"; returns false for anything else
+bool tryParseItemId(std::string_view text, uint64_t &id) {
+    return text.size() > 1 && text[0] == '#' && parseNumber(text.substr(1), id);
+}
+
+// Finds transactions by id when the input has the form "#<id>" and a transaction has that id,
+// otherwise by name, so a name that starts with '#' can still be found
+std::vector<uint64_t> findTransactions(const Ledger &items, const std::string &nameOrId) {
+    uint64_t id;
+    size_t row;
+    if (tryParseItemId(nameOrId, id) && items.findRow(id, row)) return {id};
+    return items.idsWithName(nameOrId);
+}
+
+// Displays the transactions with the given ids in ledger order
+void listTransactions(const std::vector<uint64_t> &ids) {
+    const Ledger &items = globalState().getItems();
+    std::vector<size_t> rows;
+    size_t row;
+    for (uint64_t id: ids) {
+        if (items.findRow(id, row)) rows.push_back(row);
+    }
+    std::sort(rows.begin(), rows.end());
+    ReportWriter report(std::cout);
+    for (size_t sortedRow: rows) report.item(items, sortedRow);
+}
+
+// Edits an existing transaction by name or id; when several share the name, asks which one
+void editTransaction() {
+    std::cout << "Editing transaction...\n";
+    std::string query;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("the name or #id of the transaction to edit", &query, std::string(""));
+
+    std::vector<uint64_t> matches = findTransactions(globalState().getItems(), query);
+    uint64_t id = matches.empty() ? 0 : matches.front();
+    if (matches.size() > 1) {
+        std::cout << matches.size() << " transactions have this name:\n";
+        listTransactions(matches);
+        getInput("the id of the transaction to edit", &id, id);
+    }
+    size_t row;
+    const Ledger &items = globalState().getItems();
+    if (std::find(matches.begin(), matches.end(), id) == matches.end() || !items.findRow(id, row)) {
+        std::cout << "Transaction not found.\n";
+        return;
+    }
+
+    FinancialItemView item = items[row];
+    std::string name(item.getName());
+    std::string newCategory(item.getCategory());
+    std::string newDate = item.getDate();
+    double newAmount = item.getAmount().units();
+    double newProbability = item.getProbability();
+    inputTransactionDetails(newCategory, newAmount, newDate, newProbability);
+
+    try {
+        globalState().editItem(id, FinancialItem(item.getType(), name, newCategory, Money::fromUnits(newAmount),
+                                               newDate, newProbability));
+    } catch (const std::invalid_argument &e) {
+        std::cout << "Transaction not changed: " << e.what() << "\n";
+    }
+}
+
+// Deletes a transaction by name or id; when several share the name, asks which one or deletes them all
+void deleteTransaction() {
+    std::cout << "Deleting transaction...\n";
+    std::string query;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("the name or #id of the transaction to delete", &query, std::string(""));
+
+    std::vector<uint64_t> matches = findTransactions(globalState().getItems(), query);
+    if (matches.size() > 1) {
+        std::cout << matches.size() << " transactions have this name:\n";
+        listTransactions(matches);
+        uint64_t id = 0;
+        getInput("the id of the transaction to delete, or 0 for all of them", &id, uint64_t{0});
+        if (id == 0) {
+            std::cout << globalState().deleteByName(query) << " transactions deleted.\n";
+            return;
+        }
+        matches = std::find(matches.begin(), matches.end(), id) != matches.end() ? std::vector<uint64_t>{id}
+                                                                                 : std::vector<uint64_t>{};
+    }
+
+    if (!matches.empty() && globalState().deleteItem(matches.front())) {
+        std::cout << "Transaction deleted.\n";
+    } else {
+        std::cout << "Transaction not found.\n";
+    }
+}
+
+// Adds a recurring transaction: the transaction details, with its date as the first occurrence, then the schedule
+void addRecurringTransaction() {
+    std::string name, category, date, end;
+    double amount = 0, probability = 1.0;
+    int typeInt, unitInt;
+    RecurrenceSchedule schedule;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("type (0: Asset, 1: Liability, 2: Income, 3: Expense)", &typeInt, 0);
+    getInput("name", &name, std::string("Unnamed"));
+    inputTransactionDetails(category, amount, date, probability);
+    getInput("unit (0: Day, 1: Week, 2: Month)", &unitInt, 2);
+    getInput("interval", &schedule.interval, schedule.interval);
+    getInput("end date, or - for none", &end, std::string("-"));
+    getInput("number of occurrences, or 0 for no limit", &schedule.count, schedule.count);
+
+    schedule.unit = static_cast<RecurrenceUnit>(unitInt);
+    try {
+        if (end != "-") schedule.end = parseDate(end);
+        auto type = static_cast<ItemType>(typeInt);
+        globalState().addRecurrence(FinancialItem(type, name, category, Money::fromUnits(amount), date, probability),
+                                  schedule);
+    } catch (const std::invalid_argument &e) {
+        std::cout << "Recurring transaction not added: " << e.what() << "\n";
+    }
+}
+
+// Lists the recurring transactions, then adds or deletes one
+void manageRecurringTransactions() {
+    const Ledger &items = globalState().getItems();
+    if (items.recurrenceCount() == 0) std::cout << "No recurring transactions.\n";
+    {
+        ReportWriter report(std::cout);
+        for (size_t index = 0; index < items.recurrenceCount(); ++index) report.recurrence(items, index);
+    }
+
+    int action;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("action (0: Back, 1: Add, 2: Delete)", &action, 0);
+    if (action == 1) {
+        addRecurringTransaction();
+    } else if (action == 2) {
+        uint64_t id = 0;
+        getInput("the id of the recurring transaction to delete", &id, id);
+        std::cout << (globalState().deleteRecurrence(id) ? "Recurring transaction deleted.\n"
+                                                       : "Recurring transaction not found.\n");
+    }
+}
+
+// Parses item ids separated by spaces or commas, each of which may be written as #id
+std::vector<uint64_t> parseItemIds(std::string_view text) {
+    std::vector<uint64_t> ids;
+    while (!text.empty()) {
+        const size_t end = text.find_first_of(" ,");
+        std::string_view token = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        if (token.empty()) continue;
+        if (token[0] == '#') token.remove_prefix(1);
+        uint64_t id;
+        if (!parseNumber(token, id)) throw std::invalid_argument("Invalid item id: " + std::string(token));
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+// Adds a scenario group: its kind and name, the probability of a bundle or the parent of a conditional
+// group, then its members
+void addScenarioGroup() {
+    std::string name, parent, members;
+    double probability = 0.5;
+    int kindInt;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("kind (0: Exclusive, 1: Bundle, 2: Conditional)", &kindInt, 0);
+    getInput("name", &name, std::string("Unnamed"));
+    auto kind = static_cast<ScenarioGroupKind>(kindInt);
+    if (kind == ScenarioGroupKind::Bundle) getInput("probability that all of them occur", &probability, probability);
+    if (kind == ScenarioGroupKind::Conditional) getInput("the #id of the parent transaction", &parent, std::string(""));
+    getInput("the #ids of the transactions in the group, separated by commas", &members, std::string(""));
+
+    try {
+        std::vector<uint64_t> parentIds = parseItemIds(parent);
+        globalState().addScenarioGroup(kind, name, probability, parentIds.empty() ? 0 : parentIds.front(),
+                                     parseItemIds(members));
+    } catch (const std::invalid_argument &e) {
+        std::cout << "Scenario group not added: " << e.what() << "\n";
+    }
+}
+
+// Lists the scenario groups, then adds or deletes one
+void manageScenarioGroups() {
+    const Ledger &items = globalState().getItems();
+    if (items.scenarioGroupCount() == 0) std::cout << "No scenario groups.\n";
+    {
+        ReportWriter report(std::cout);
+        for (size_t index = 0; index < items.scenarioGroupCount(); ++index) report.scenarioGroup(items, index);
+    }
+
+    int action;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("action (0: Back, 1: Add, 2: Delete)", &action, 0);
+    if (action == 1) {
+        addScenarioGroup();
+    } else if (action == 2) {
+        uint64_t id = 0;
+        getInput("the id of the scenario group to delete", &id, id);
+        std::cout << (globalState().deleteScenarioGroup(id) ? "Scenario group deleted.\n"
+                                                          : "Scenario group not found.\n");
+    }
+}
+
+// Parses a month given as YYYY-MM and returns its first day; returns false if it is invalid
+bool tryParseMonth(std::string_view text, int32_t &firstDay) {
+    return text.size() == 7 && tryParseDate(std::string(text) + "-01", firstDay);
+}
+
+// Lists the closed periods, and closes more months or shows the transactions of a closed month
+void manageClosedPeriods() {
+    const Ledger &items = globalState().getItems();
+    if (items.closedPeriodCount() == 0) std::cout << "No closed periods.\n";
+    for (size_t index = 0; index < items.closedPeriodCount(); ++index) {
+        const ClosedPeriod &period = items.closedPeriod(index);
+        std::cout << formatDate(period.firstDay).substr(0, 7) << " to " << formatDate(period.lastDay).substr(0, 7)
+                  << ": " << period.itemCount << " transactions in "
+                  << coldSegmentFilename(period.firstDay, period.lastDay) << "\n";
+    }
+
+    int action;
+    std::string month;
+    int32_t day;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("action (0: Back, 1: Close through a month, 2: View a closed month)", &action, 0);
+    if (action != 1 && action != 2) return;
+    const std::string lastMonth = formatDate(firstDayOfMonth(currentDay()) - 1).substr(0, 7);
+    getInput("month (YYYY-MM)", &month, lastMonth);
+    if (!tryParseMonth(month, day)) {
+        std::cout << "Invalid month: " << month << "\n";
+        return;
+    }
+    try {
+        if (action == 1) {
+            const size_t closed = globalState().closePeriod(day);
+            std::cout << closed << " transactions moved to the cold segment.\n";
+            return;
+        }
+        const Ledger detail = globalState().openClosedPeriod(day);
+        ReportWriter report(std::cout);
+        for (size_t row = 0; row < detail.size(); ++row) {
+            if (detail.date(row) >= day && detail.date(row) <= lastDayOfMonth(day)) report.item(detail, row);
+        }
+    } catch (const std::exception &e) {
+        std::cout << e.what() << "\n";
+    }
+}
+
+// Lists the transactions in a category, found through the category index
+void viewCategory() {
+    std::string category;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("category", &category, std::string("General"));
+
+    const std::vector<uint64_t> &ids = globalState().getItems().idsInCategory(category);
+    if (ids.empty()) {
+        std::cout << "No transactions in this category.\n";
+        return;
+    }
+    listTransactions(ids);
+}
+
+// Imports items from a CSV file into the ledger
+void importCsv() {
+    std::string filename;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("the CSV file to import", &filename, CSV_FILENAME);
+
+    Ledger imported;
+    try {
+        reportCsvErrors(deserializeAllItems(imported, filename), std::cout);
+    } catch (const std::exception &e) {
+        std::cout << "Import failed: " << e.what() << "\n";
+        return;
+    }
+    globalState().addItems(imported);
+    std::cout << "Imported " << imported.size() << " items.\n";
+}
+
+// Imports a bank statement CSV, skipping the transactions already in the ledger
+void importBankStatement() {
+    std::string filename, rulesFilename, dateOrder;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("the statement CSV file", &filename, std::string("statement.csv"));
+    getInput("the category rules CSV file (- for none)", &rulesFilename, std::string("-"));
+    getInput("the date order (ymd, dmy or mdy)", &dateOrder, std::string("ymd"));
+
+    try {
+        StatementOptions options;
+        options.dateOrder = parseDateOrder(dateOrder);
+        if (rulesFilename != "-") options.rules = readCategoryRules(rulesFilename);
+        reportStatementImport(importStatement(globalState(), filename, options), std::cout);
+    } catch (const std::exception &e) {
+        std::cout << "Import failed: " << e.what() << "\n";
+    }
+}
+
+// Exports the ledger to a CSV file
+void exportCsv() {
+    std::string filename;
+    std::cout << "Leave blank for [default value]\n";
+    getInput("the CSV file to export to", &filename, CSV_FILENAME);
+
+    serializeAllItems(globalState().getItems(), filename);
+    std::cout << "Exported " << globalState().getItems().size() << " items.\n";
+}
+
+// Shows the statistics collected so far and optionally writes them as JSON or a Chrome trace
+void viewStatistics() {
+    writeStatisticsTable(std::cout);
+    if (!instrumentationEnabled()) return;
+
+    std::string filename;
+    std::cout << "\nLeave blank to skip\n";
+    try {
+        getInput("the JSON file to write the statistics to", &filename, std::string(""));
+        if (!filename.empty()) writeStatisticsFile(filename, writeStatisticsJson);
+        if (instrumentation().tracing.load(std::memory_order_relaxed)) {
+            getInput("the file to write the Chrome trace to", &filename, std::string(""));
+            if (!filename.empty()) writeStatisticsFile(filename, writeChromeTrace);
+        }
+    } catch (const std::exception &e) {
+        std::cout << e.what() << "\n";
+    }
+}
+
+// Commands applied between two journal syncs and output flushes in batch mode
+constexpr size_t BATCH_SIZE = 1000;
+
+// Returns the one transaction a batch command refers to, by "#id" or by a name no other transaction has
+uint64_t findSingleTransaction(const Ledger &items, const std::string &target) {
+    std::vector<uint64_t> matches = findTransactions(items, target);
+    if (matches.empty()) throw std::invalid_argument("Transaction not found: " + target);
+    if (matches.size() > 1) {
+        throw std::invalid_argument(std::to_string(matches.size()) + " transactions are named " + target +
+                                    "; use #id");
+    }
+    return matches.front();
+}
+
+// Builds an item from the batch fields starting at first: type, name, category, amount, date and
+// an optional probability (default 1)
+FinancialItem parseBatchItem(const CsvRecord &record, size_t first) {
+    if (record.fieldCount < first + CSV_FIELD_COUNT - 1 || record.fieldCount > first + CSV_FIELD_COUNT) {
+        throw std::invalid_argument("Expected type, name, category, amount, date and probability");
+    }
+    const auto *fields = record.fields.data() + first;
+    ItemType type = parseItemType(fields[0]);
+    std::string name(fields[1]), category(fields[2]), date(fields[4]);
+    double amount, probability = 1.0;
+    if (!parseNumber(fields[3], amount) || !isValidAmount(amount)) {
+        throw std::invalid_argument("Invalid amount: " + std::string(fields[3]));
+    }
+    if (record.fieldCount == first + CSV_FIELD_COUNT &&
+        (!parseNumber(fields[5], probability) || !std::isfinite(probability))) {
+        throw std::invalid_argument("Invalid probability: " + std::string(fields[5]));
+    }
+    return {type, name, category, Money::fromUnits(amount), date, probability};
+}
+
+// Builds a schedule from the batch fields every ("[n ]day|week|month", plural allowed), end date
+// and count, where the last two may be empty
+RecurrenceSchedule parseBatchSchedule(const CsvRecord &record, size_t first) {
+    const auto *fields = record.fields.data() + first;
+    RecurrenceSchedule schedule;
+    std::string_view every = fields[0];
+    size_t space = every.find(' ');
+    if (space != std::string_view::npos) {
+        if (!parseNumber(every.substr(0, space), schedule.interval) || schedule.interval == 0) {
+            throw std::invalid_argument("Invalid interval: " + std::string(every));
+        }
+        every.remove_prefix(space + 1);
+    }
+    schedule.unit = parseRecurrenceUnit(every);
+    if (!fields[1].empty() && !tryParseDate(fields[1], schedule.end)) {
+        throw std::invalid_argument("Invalid end date: " + std::string(fields[1]));
+    }
+    if (!fields[2].empty() && !parseNumber(fields[2], schedule.count)) {
+        throw std::invalid_argument("Invalid count: " + std::string(fields[2]));
+    }
+    return schedule;
+}
+
+// Adds the scenario group of a batch command from its fields kind, name, the probability of a bundle or the
+// #id of a conditional group's parent (empty for an exclusive group) and the member ids separated by spaces.
+// Returns the group's id.
+uint64_t addBatchScenarioGroup(GlobalState &state, const CsvRecord &record) {
+    const auto *fields = record.fields.data() + 1;
+    const ScenarioGroupKind kind = parseScenarioGroupKind(fields[0]);
+    double probability = 1.0;
+    uint64_t parentId = 0;
+    if (kind == ScenarioGroupKind::Bundle && (!parseNumber(fields[2], probability) || !std::isfinite(probability))) {
+        throw std::invalid_argument("Invalid probability: " + std::string(fields[2]));
+    }
+    if (kind == ScenarioGroupKind::Conditional) {
+        std::vector<uint64_t> parentIds = parseItemIds(fields[2]);
+        if (parentIds.size() != 1) throw std::invalid_argument("Invalid parent: " + std::string(fields[2]));
+        parentId = parentIds.front();
+    }
+    return state.addScenarioGroup(kind, fields[1], probability, parentId, parseItemIds(fields[3]));
+}
+
+// Appends ,"key":value for an amount of money, in currency units
+void appendJsonAmount(std::string &out, const char *key, Money amount) {
+    char buffer[MAX_MINOR_UNITS_LENGTH];
+    out += ",\"";
+    out += key;
+    out += "\":";
+    out.append(buffer, writeMinorUnits(buffer, amount.minorUnits));
+}
+
+// Appends the summary of the current month: totals by type, current and projected assets and the
+// top expense categories
+void appendBatchSummary(GlobalState &state, std::string &out) {
+    const Ledger &items = state.getItems();
+    TypeTotals totals = state.getTotalsThisMonth();
+    const SummaryAggregates &aggregates = state.getAggregates();
+    out += ",\"month\":\"" + formatDate(currentDay()).substr(0, 7) + "\"";
+    appendJsonAmount(out, "assets", Money(totals[static_cast<size_t>(ItemType::Asset)]));
+    appendJsonAmount(out, "liabilities", Money(totals[static_cast<size_t>(ItemType::Liability)]));
+    appendJsonAmount(out, "income", Money(totals[static_cast<size_t>(ItemType::Income)]));
+    appendJsonAmount(out, "expenses", Money(totals[static_cast<size_t>(ItemType::Expense)]));
+    appendJsonAmount(out, "currentAssets", Money(aggregates.getCurrentAssets()));
+    appendJsonAmount(out, "projectedAssets", Money(aggregates.getProjectedAssets()));
+    out += ",\"topExpenseCategories\":[";
+    for (const auto &[category, total]: aggregates.topExpenseCategories(3)) {
+        if (out.back() != '[') out += ',';
+        out += "{\"category\":";
+        appendJsonString(out, items.categories().get(category));
+        appendJsonAmount(out, "total", Money(total));
+        out += '}';
+    }
+    out += ']';
+}
+
+// Parses the type, category and date range of a total or top command, starting at the given field
+void parseBatchRange(const CsvRecord &record, size_t first, ItemType &type, int32_t &firstDay, int32_t &lastDay) {
+    type = parseItemType(record.fields[first]);
+    if (!tryParseDate(record.fields[first + 2], firstDay) || !tryParseDate(record.fields[first + 3], lastDay)) {
+        throw std::invalid_argument("Invalid date range");
+    }
+}
+
+// Appends the subcategories of parent with the largest totals of one type in a date range
+void appendBatchTopCategories(const GlobalState &state, const CsvRecord &record, std::string &out) {
+    ItemType type;
+    int32_t firstDay, lastDay;
+    parseBatchRange(record, 1, type, firstDay, lastDay);
+    size_t count = RANGE_QUERY_TOP_CATEGORIES;
+    if (record.fieldCount == 6 && !parseNumber(record.fields[5], count)) {
+        throw std::invalid_argument("Invalid count: " + std::string(record.fields[5]));
+    }
+    out += ",\"categories\":[";
+    for (const auto &[category, total]: state.getItems().topCategories(type, record.fields[2], firstDay, lastDay,
+                                                                       count)) {
+        if (out.back() != '[') out += ',';
+        out += "{\"category\":";
+        appendJsonString(out, category);
+        appendJsonAmount(out, "total", Money(total));
+        out += '}';
+    }
+    out += ']';
+}
+
+// Parses the optional horizon date of a scenarios command; without one, the default horizon is used.
+// Returns false if the fields are invalid.
+bool tryParseBatchHorizon(const GlobalState &state, const CsvRecord &record, int32_t &horizon) {
+    horizon = defaultScenarioHorizon(state.getItems());
+    return !record.malformed && record.fieldCount <= 2 &&
+           (record.fieldCount < 2 || tryParseDate(record.fields[1], horizon));
+}
+
+// Appends a scenario summary that includes recurring items up to the horizon. Percentiles are only
+// included when the distribution is exact, so the batch never waits on a Monte Carlo simulation.
+void appendBatchScenarios(std::string &out, const ScenarioSummary &summary, int32_t horizon) {
+    auto appendProbability = [&out](const char *key, double probability) {
+        char buffer[32];
+        auto [end, error] = std::to_chars(buffer, buffer + sizeof buffer, probability);
+        out += ",\"";
+        out += key;
+        out += "\":";
+        out.append(buffer, end);
+    };
+    out += ",\"horizon\":\"" + formatDate(horizon) + "\"";
+    out += ",\"variableItems\":" + std::to_string(summary.variableItemCount);
+    appendJsonAmount(out, "bestCase", summary.bestCase);
+    appendJsonAmount(out, "worstCase", summary.worstCase);
+    appendJsonAmount(out, "mostLikelyOutcome", summary.mostLikelyOutcome);
+    appendProbability("mostLikelyProbability", summary.mostLikelyProbability);
+    appendJsonAmount(out, "leastLikelyOutcome", summary.leastLikelyOutcome);
+    appendProbability("leastLikelyProbability", summary.leastLikelyProbability);
+    appendJsonAmount(out, "expectedOutcome", summary.expectedOutcome);
+    out += summary.exactDistribution ? ",\"exactDistribution\":true" : ",\"exactDistribution\":false";
+    if (summary.exactDistribution) {
+        appendJsonAmount(out, "percentile5", summary.percentile5);
+        appendJsonAmount(out, "median", summary.median);
+        appendJsonAmount(out, "percentile95", summary.percentile95);
+    }
+}
+
+// Appends the JSON result line of one batch command. appendResult adds the fields of a successful
+// result; if it throws, the line reports the error instead. Returns false if the command failed.
+template<typename Function>
+bool appendBatchResult(std::string &out, size_t line, std::string_view command, Function appendResult) {
+    out += "{\"line\":" + std::to_string(line) + ",\"command\":";
+    appendJsonString(out, command);
+    const size_t resultStart = out.size();
+    try {
+        out += ",\"ok\":true";
+        appendResult();
+    } catch (const std::exception &e) {
+        out.resize(resultStart);
+        out += ",\"ok\":false,\"error\":";
+        appendJsonString(out, e.what());
+        out += "}\n";
+        return false;
+    }
+    out += "}\n";
+    return true;
+}
+
+// Runs one batch command on a ledger and appends its result to out as a JSON line; returns false if it failed
+bool runBatchCommand(GlobalState &state, const CsvRecord &record, std::string &out) {
+    ScopedTimer timer(Probe::BatchCommand);
+    const std::string_view command = record.fields[0];
+    return appendBatchResult(out, record.line, command, [&] {
+        if (record.malformed) throw std::invalid_argument("Malformed quoted field");
+        if (command == "add") {
+            out += ",\"id\":" + std::to_string(state.addItem(parseBatchItem(record, 1)));
+        } else if (command == "edit") {
+            if (record.fieldCount < 2) throw std::invalid_argument("Expected the name or #id to edit");
+            uint64_t id = findSingleTransaction(state.getItems(), std::string(record.fields[1]));
+            state.editItem(id, parseBatchItem(record, 2));
+            out += ",\"id\":" + std::to_string(id);
+        } else if (command == "recur") {
+            if (record.fieldCount < 4) throw std::invalid_argument("Expected every, end date and count");
+            RecurrenceSchedule schedule = parseBatchSchedule(record, 1);
+            out += ",\"id\":" + std::to_string(state.addRecurrence(parseBatchItem(record, 4), schedule));
+        } else if (command == "group") {
+            if (record.fieldCount != 5) {
+                throw std::invalid_argument("Expected kind, name, probability or parent, and members");
+            }
+            out += ",\"id\":" + std::to_string(addBatchScenarioGroup(state, record));
+        } else if (command == "delete") {
+            if (record.fieldCount != 2) throw std::invalid_argument("Expected the name or #id to delete");
+            std::string target(record.fields[1]);
+            uint64_t id;
+            size_t deleted;
+            // An id may be that of an item, a recurrence rule or a scenario group; anything else is a name
+            if (tryParseItemId(target, id) &&
+                (state.deleteItem(id) || state.deleteRecurrence(id) || state.deleteScenarioGroup(id))) {
+                deleted = 1;
+            } else {
+                deleted = state.deleteByName(target);
+            }
+            out += ",\"deleted\":" + std::to_string(deleted);
+        } else if (command == "close") {
+            int32_t day;
+            if (record.fieldCount != 2 || !tryParseMonth(record.fields[1], day)) {
+                throw std::invalid_argument("Expected the last month to close, as YYYY-MM");
+            }
+            out += ",\"closed\":" + std::to_string(state.closePeriod(day));
+        } else if (command == "summary") {
+            appendBatchSummary(state, out);
+        } else if (command == "total") {
+            if (record.fieldCount != 5) throw std::invalid_argument("Expected type, category, from and to");
+            ItemType type;
+            int32_t firstDay, lastDay;
+            parseBatchRange(record, 1, type, firstDay, lastDay);
+            appendJsonAmount(out, "total",
+                             Money(state.getItems().rangeTotal(type, record.fields[2], firstDay, lastDay)));
+        } else if (command == "top") {
+            if (record.fieldCount != 5 && record.fieldCount != 6) {
+                throw std::invalid_argument("Expected type, parent category, from, to and an optional count");
+            }
+            appendBatchTopCategories(state, record, out);
+        } else if (command == "scenarios") {
+            int32_t horizon;
+            if (!tryParseBatchHorizon(state, record, horizon)) {
+                throw std::invalid_argument("Expected an optional horizon date");
+            }
+            appendBatchScenarios(out, summarizeScenarios(state.getItems(), horizon), horizon);
+        } else {
+            throw std::invalid_argument("Unknown command: " + std::string(command));
+        }
+    });
+}
+
+// Reads batch commands as CSV records, one per line, and writes one JSON line per command.
+// Commands are applied BATCH_SIZE at a time; the journal is synced and the results are written
+// after each batch, and the ledger is compacted at most once per batch. Blank lines and lines
+// starting with '#' are skipped. Returns false if any command failed.
+bool runBatch(std::istream &in, std::ostream &out) {
+    std::string input(std::istreambuf_iterator<char>(in), {});
+    CsvReader reader(input.data(), input.size());
+    CsvRecord record;
+    std::string results;
+    size_t failed = 0, batched = 0;
+
+    globalState().beginBatch();
+    while (reader.next(record)) {
+        if (record.text.empty() || record.text[0] == '#') continue;
+        if (!runBatchCommand(globalState(), record, results)) ++failed;
+        if (++batched == BATCH_SIZE) {
+            globalState().endBatch();
+            out << results << std::flush;
+            results.clear();
+            batched = 0;
+            globalState().beginBatch();
+        }
+    }
+    globalState().endBatch();
+    out << results << std::flush;
+    globalState().save();
+    return failed == 0;
+}
+
+#ifndef _WIN32
+// Socket the ledger server listens on unless another path is given
+const std::string &SERVER_SOCKET_FILENAME = "budget.sock";
+
+// Ledger a server connection works on until it chooses another with "use"
+const std::string &DEFAULT_LEDGER_NAME = "default";
+
+// Most bytes read from a connection at a time
+constexpr size_t SERVER_READ_BYTES = 1 << 16;
+
+// Longest command line a connection may send; a longer one fails and ends the connection
+constexpr size_t SERVER_MAX_LINE_BYTES = 1 << 20;
+
+// Pending output above which a connection's input is not read until the client catches up
+constexpr size_t SERVER_OUTPUT_HIGH_WATER = 1 << 20;
+
+// Set by SIGINT and SIGTERM; the signal handler also writes to the server's wake pipe
+volatile std::sig_atomic_t serverStopRequested = 0;
+int serverWakeFd = -1;
+
+void requestServerStop(int) {
+    serverStopRequested = 1;
+    char byte = 0;
+    (void) !::write(serverWakeFd, &byte, 1);
+}
+
+// Returns true if a ledger name is safe as a directory name: 1 to 64 letters, digits, '-' and '_'
+bool isValidLedgerName(std::string_view name) {
+    return !name.empty() && name.size() <= 64 && std::all_of(name.begin(), name.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_';
+    });
+}
+
+// Returns the address of a Unix-domain socket, throwing std::runtime_error if the path is too long
+sockaddr_un unixSocketAddress(const std::string &path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) throw std::runtime_error("Socket path is too long: " + path);
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Makes reads and writes on a file descriptor return instead of blocking
+void setNonBlocking(int fd) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Serves batch commands for many ledgers to many clients over a Unix-domain socket. Each ledger is a
+// GlobalState in its own directory under the root, loaded when a client first uses it and kept
+// resident. Clients send one batch command per line and get one JSON result line per command, in
+// order; "use,<ledger>" switches the connection to another ledger.
+//
+// One thread runs a poll() event loop that accepts connections, reads commands, runs them and writes
+// the results, so resident ledgers are never touched by two threads. Loading a ledger and scenario
+// summaries, the only expensive work, run on a worker pool; the connection's later commands wait
+// until the result is back. The journals of the ledgers changed in one round of the loop are synced
+// once, before any result of that round is sent. A connection's input is not read while its output
+// is above SERVER_OUTPUT_HIGH_WATER, so a client that does not read its results cannot grow it.
+class LedgerServer {
+private:
+    struct Connection {
+        int fd;
+        GlobalState *ledger;
+        std::string input;        // Received bytes not yet run as commands
+        std::string output;       // Results not yet written
+        size_t lines = 0;         // Lines received, numbering the results
+        bool waiting = false;     // A ledger or a scenario summary for this connection is being prepared
+        bool inputClosed = false; // The client has sent everything
+
+        Connection(int fd, GlobalState *ledger) : fd(fd), ledger(ledger) {
+        }
+
+        // Returns true if the loop should read from the connection
+        [[nodiscard]] bool wantsInput() const {
+            return !inputClosed && !waiting && output.size() < SERVER_OUTPUT_HIGH_WATER;
+        }
+    };
+
+    // A ledger loaded by a worker, or the reason it could not be
+    struct LoadedLedger {
+        std::string name;
+        std::unique_ptr<GlobalState> state;
+        std::string error;
+    };
+
+    std::string socketPath;
+    std::filesystem::path root;
+    int listenFd = -1;
+    int wakeFds[2] = {-1, -1}; // Written by workers and signals to interrupt poll()
+    std::unordered_map<std::string, std::unique_ptr<GlobalState> > ledgers;
+    std::unordered_map<uint64_t, Connection> connections; // By connection id, since descriptors are reused
+    uint64_t nextConnectionId = 1;
+    // Connections waiting for a ledger a worker is loading, by ledger name, with the line of their "use"
+    std::unordered_map<std::string, std::vector<std::pair<uint64_t, size_t> > > loading;
+    std::mutex finishedMutex;
+    std::vector<std::pair<uint64_t, std::string> > finished; // Worker results by connection id
+    std::vector<LoadedLedger> loaded;                         // Ledgers loaded by workers
+    WorkStealingPool workers; // Declared last so it finishes its jobs before the rest is destroyed
+
+    // Loads a ledger from its directory under the root, creating the directory if needed
+    std::unique_ptr<GlobalState> loadLedger(const std::string &name) const {
+        std::filesystem::create_directories(root / name);
+        return std::make_unique<GlobalState>(root / name);
+    }
+
+    // Appends the result of a "use" that switched a connection to a ledger
+    static void appendUseResult(Connection &connection, size_t line, const std::string &name) {
+        appendBatchResult(connection.output, line, "use", [&] {
+            connection.output += ",\"ledger\":";
+            appendJsonString(connection.output, name);
+            connection.output += ",\"items\":" + std::to_string(connection.ledger->getItems().size());
+        });
+    }
+
+    void wake() {
+        char byte = 0;
+        (void) !::write(wakeFds[1], &byte, 1); // A full pipe already wakes the loop
+    }
+
+    void acceptConnections() {
+        int fd;
+        while ((fd = ::accept(listenFd, nullptr, nullptr)) >= 0) {
+            setNonBlocking(fd);
+            connections.emplace(nextConnectionId++, Connection(fd, ledgers.at(DEFAULT_LEDGER_NAME).get()));
+        }
+    }
+
+    // Runs one command line, or hands a scenario summary to the workers
+    void runCommand(uint64_t id, Connection &connection, std::string_view line, std::set<GlobalState *> &touched) {
+        CsvReader reader(line.data(), line.size());
+        CsvRecord record;
+        reader.next(record);
+        record.line = connection.lines;
+        const std::string_view command = record.fields[0];
+        GlobalState &state = *connection.ledger;
+
+        if (command == "use") {
+            if (record.malformed || record.fieldCount != 2 || !isValidLedgerName(record.fields[1])) {
+                appendBatchResult(connection.output, record.line, command, [] {
+                    throw std::invalid_argument("Expected a ledger name of letters, digits, '-' and '_'");
+                });
+                return;
+            }
+            std::string name(record.fields[1]);
+            if (auto it = ledgers.find(name); it != ledgers.end()) {
+                connection.ledger = it->second.get();
+                appendUseResult(connection, record.line, name);
+                return;
+            }
+            // Loading replays the journal, so it runs on a worker; one load serves every connection asking
+            connection.waiting = true;
+            auto &waiters = loading[name];
+            waiters.emplace_back(id, record.line);
+            if (waiters.size() > 1) return;
+            workers.submit([this, name] {
+                LoadedLedger result{name, nullptr, {}};
+                try {
+                    result.state = loadLedger(name);
+                } catch (const std::exception &e) {
+                    result.error = e.what();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(finishedMutex);
+                    loaded.push_back(std::move(result));
+                }
+                wake();
+            });
+            return;
+        }
+
+        int32_t horizon;
+        if (command == "scenarios" && tryParseBatchHorizon(state, record, horizon)) {
+            // The workers read a snapshot, so commands from other connections keep changing the ledger
+            connection.waiting = true;
+            workers.submit([this, id, lineNumber = record.line, horizon, items = state.snapshot()] {
+                std::string result;
+                appendBatchResult(result, lineNumber, "scenarios", [&] {
+                    appendBatchScenarios(result, summarizeScenarios(*items, horizon), horizon);
+                });
+                {
+                    std::lock_guard<std::mutex> lock(finishedMutex);
+                    finished.emplace_back(id, std::move(result));
+                }
+                wake();
+            });
+            return;
+        }
+
+        if (touched.insert(&state).second) state.beginBatch();
+        runBatchCommand(state, record, connection.output);
+    }
+
+    // Runs the complete lines received on a connection until one has to wait for a worker. A line
+    // longer than SERVER_MAX_LINE_BYTES fails, and the connection reads no further input.
+    void runCommands(uint64_t id, Connection &connection, std::set<GlobalState *> &touched) {
+        size_t start = 0;
+        while (!connection.waiting) {
+            size_t end = connection.input.find('\n', start);
+            if ((end == std::string::npos ? connection.input.size() : end) - start > SERVER_MAX_LINE_BYTES) {
+                appendBatchResult(connection.output, connection.lines + 1, "", [] {
+                    throw std::invalid_argument("Line is longer than " + std::to_string(SERVER_MAX_LINE_BYTES) +
+                                                " bytes");
+                });
+                connection.inputClosed = true;
+                connection.input.clear();
+                return;
+            }
+            if (end == std::string::npos) break;
+            std::string_view line(connection.input.data() + start, end - start);
+            start = end + 1;
+            ++connection.lines;
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            if (line.empty() || line[0] == '#') continue;
+            runCommand(id, connection, line, touched);
+        }
+        connection.input.erase(0, start);
+    }
+
+    // Reads what a client has sent; returns false if the connection failed
+    bool readFrom(uint64_t id, Connection &connection, std::set<GlobalState *> &touched) {
+        char buffer[SERVER_READ_BYTES];
+        ssize_t count = ::read(connection.fd, buffer, sizeof buffer);
+        if (count < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        if (count == 0) {
+            connection.inputClosed = true;
+            if (!connection.input.empty() && connection.input.back() != '\n') connection.input += '\n';
+        } else {
+            connection.input.append(buffer, static_cast<size_t>(count));
+        }
+        runCommands(id, connection, touched);
+        return true;
+    }
+
+    // Writes as much pending output as the socket takes; returns false if the connection failed
+    static bool writeTo(Connection &connection) {
+        while (!connection.output.empty()) {
+            ssize_t count = ::write(connection.fd, connection.output.data(), connection.output.size());
+            if (count < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+            connection.output.erase(0, static_cast<size_t>(count));
+        }
+        return true;
+    }
+
+    // Makes the ledgers loaded by workers resident, delivers the results of finished scenario summaries
+    // and resumes the waiting connections
+    void collectFinished(std::set<GlobalState *> &touched) {
+        char drain[256];
+        while (::read(wakeFds[0], drain, sizeof drain) > 0) {
+        }
+        std::vector<std::pair<uint64_t, std::string> > results;
+        std::vector<LoadedLedger> loads;
+        {
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            results.swap(finished);
+            loads.swap(loaded);
+        }
+        for (LoadedLedger &load: loads) {
+            GlobalState *state = nullptr;
+            if (load.state) state = ledgers.emplace(load.name, std::move(load.state)).first->second.get();
+            auto waiters = loading.extract(load.name);
+            for (auto [id, line]: waiters.mapped()) {
+                auto it = connections.find(id);
+                if (it == connections.end()) continue; // The client went away
+                Connection &connection = it->second;
+                if (state) {
+                    connection.ledger = state;
+                    appendUseResult(connection, line, load.name);
+                } else {
+                    appendBatchResult(connection.output, line, "use", [&] {
+                        throw std::runtime_error("Cannot load ledger " + load.name + ": " + load.error);
+                    });
+                }
+                connection.waiting = false;
+                runCommands(id, connection, touched);
+            }
+        }
+        for (auto &[id, result]: results) {
+            auto it = connections.find(id);
+            if (it == connections.end()) continue; // The client went away
+            it->second.output += result;
+            it->second.waiting = false;
+            runCommands(id, it->second, touched);
+        }
+    }
+
+    // Closes a connection and returns the next one
+    std::unordered_map<uint64_t, Connection>::iterator closeConnection(
+        std::unordered_map<uint64_t, Connection>::iterator it) {
+        ::close(it->second.fd);
+        return connections.erase(it);
+    }
+
+public:
+    LedgerServer(std::string socketPath, std::filesystem::path root)
+        : socketPath(std::move(socketPath)), root(std::move(root)) {
+        if (::pipe(wakeFds) != 0) throw std::runtime_error("Cannot create the wake pipe");
+        setNonBlocking(wakeFds[0]);
+        setNonBlocking(wakeFds[1]);
+
+        sockaddr_un address = unixSocketAddress(this->socketPath);
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0) throw std::runtime_error("Cannot create a socket");
+        // A socket file left by a server that is no longer running is replaced
+        if (::connect(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof address) == 0) {
+            throw std::runtime_error("A server is already listening on " + this->socketPath);
+        }
+        ::close(listenFd);
+        ::unlink(this->socketPath.c_str());
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof address) != 0 ||
+            ::listen(listenFd, SOMAXCONN) != 0) {
+            throw std::runtime_error("Cannot listen on " + this->socketPath);
+        }
+        setNonBlocking(listenFd);
+        ledgers.emplace(DEFAULT_LEDGER_NAME, loadLedger(DEFAULT_LEDGER_NAME));
+    }
+
+    ~LedgerServer() {
+        for (auto &[id, connection]: connections) ::close(connection.fd);
+        if (listenFd >= 0) ::close(listenFd);
+        ::unlink(socketPath.c_str());
+        ::close(wakeFds[0]);
+        ::close(wakeFds[1]);
+    }
 
-// Adds a new transaction
-void addTransaction() {
-    std::cout << "Adding transaction...\n";
-    std::string name, category, date;
-    double amount = 0, probability = 1.0;
-    int typeInt;
-    std::cout << "Leave blank for [default value]\n";
-    getInput("type (0: Asset, 1: Liability, 2: Income, 3: Expense)", &typeInt, 0);
-    getInput("name", &name, std::string("Unnamed"));
-    inputTransactionDetails(category, amount, date, probability);
+    LedgerServer(const LedgerServer &) = delete;
+    LedgerServer &operator=(const LedgerServer &) = delete;
 
-    auto type = static_cast<ItemType>(typeInt);
-    globalState.items.emplace_back(type, name, category, amount, date, probability);
-    globalState.save();
+    // Serves clients until SIGINT or SIGTERM
+    void run() {
+        serverWakeFd = wakeFds[1];
+        std::signal(SIGINT, requestServerStop);
+        std::signal(SIGTERM, requestServerStop);
+        std::signal(SIGPIPE, SIG_IGN);
+
+        std::vector<pollfd> polls;
+        std::vector<uint64_t> polledIds;
+        while (!serverStopRequested) {
+            polls.assign({{listenFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}});
+            polledIds.clear();
+            for (auto &[id, connection]: connections) {
+                short events = connection.wantsInput() ? POLLIN : 0;
+                if (!connection.output.empty()) events |= POLLOUT;
+                // poll() reports a hang-up even for no events, so a connection waiting for a worker is left
+                // out until its result is back; writing the result then finds out that the client went away
+                polls.push_back({events ? connection.fd : -1, events, 0});
+                polledIds.push_back(id);
+            }
+            if (::poll(polls.data(), polls.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("poll failed");
+            }
+
+            std::set<GlobalState *> touched;
+            if (polls[1].revents & POLLIN) collectFinished(touched);
+            for (size_t i = 0; i < polledIds.size(); ++i) {
+                auto it = connections.find(polledIds[i]);
+                if (it == connections.end()) continue;
+                const short revents = polls[i + 2].revents;
+                if (revents & (POLLIN | POLLHUP | POLLERR) && it->second.wantsInput() &&
+                    !readFrom(it->first, it->second, touched)) {
+                    closeConnection(it);
+                }
+            }
+            if (polls[0].revents & POLLIN) acceptConnections();
+
+            // Changes of this round reach the disk before their results are sent
+            for (GlobalState *state: touched) state->endBatch();
+            for (auto it = connections.begin(); it != connections.end();) {
+                Connection &connection = it->second;
+                if (!writeTo(connection) ||
+                    (connection.inputClosed && !connection.waiting && connection.output.empty())) {
+                    it = closeConnection(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    }
+};
+
+// Runs the ledger server until it is interrupted; returns the exit code
+int runServer(const std::string &socketPath, const std::filesystem::path &root) {
+    try {
+        LedgerServer server(socketPath, root);
+        std::cerr << "Serving ledgers in " << std::filesystem::absolute(root).string() << " on " << socketPath
+                  << std::endl;
+        server.run();
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
 }
 
-// Edits an existing transaction by name
-void editTransaction() {
-    std::cout << "Editing transaction...\n";
-    std::string name;
-    std::cout << "Leave blank for [default value]\n";
-    getInput("the name of the transaction to edit", &name, std::string(""));
-
-    for (auto &item: globalState.items) {
-        if (item.getName() == name) {
-            // Sequential Search
-            std::string newCategory = item.getTypeName();
-            std::string newDate = item.getDate();
-            double newAmount = item.getAmount();
-            double newProbability = item.getProbability();
-            inputTransactionDetails(newCategory, newAmount, newDate, newProbability);
-
-            item = FinancialItem(item.getType(), name, newCategory, newAmount, newDate, newProbability);
-            globalState.save();
-            return;
+// Blocking connection to a ledger server
+class ServerClient {
+private:
+    int fd = -1;
+    std::string received;
+    size_t receivedStart = 0; // Start of the first line in received that has not been returned
+
+public:
+    explicit ServerClient(const std::string &socketPath) {
+        sockaddr_un address = unixSocketAddress(socketPath);
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof address) != 0) {
+            if (fd >= 0) ::close(fd);
+            throw std::runtime_error("Cannot connect to " + socketPath);
+        }
+    }
+
+    ~ServerClient() {
+        ::close(fd);
+    }
+
+    ServerClient(const ServerClient &) = delete;
+    ServerClient &operator=(const ServerClient &) = delete;
+
+    // Sends text, throwing std::runtime_error if the connection fails
+    void send(std::string_view text) {
+        while (!text.empty()) {
+            ssize_t count = ::send(fd, text.data(), text.size(), 0);
+            if (count < 0 && errno == EINTR) continue;
+            if (count < 0) throw std::runtime_error("Connection to the server failed");
+            text.remove_prefix(static_cast<size_t>(count));
+        }
+    }
+
+    // Tells the server that nothing more will be sent
+    void finishSending() {
+        ::shutdown(fd, SHUT_WR);
+    }
+
+    // Reads one line without its line break; returns false once the server has closed the connection
+    bool readLine(std::string &line) {
+        while (true) {
+            size_t end = received.find('\n', receivedStart);
+            if (end != std::string::npos) {
+                line.assign(received, receivedStart, end - receivedStart);
+                receivedStart = end + 1;
+                return true;
+            }
+            received.erase(0, receivedStart);
+            receivedStart = 0;
+            char buffer[SERVER_READ_BYTES];
+            ssize_t count = ::read(fd, buffer, sizeof buffer);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return false;
+            received.append(buffer, static_cast<size_t>(count));
+        }
+    }
+};
+
+// Sends batch commands from a stream to a server, optionally on the given ledger, and prints the
+// results. Returns false if any command failed.
+bool runClient(const std::string &socketPath, const std::string &ledger, std::istream &in, std::ostream &out) {
+    ServerClient client(socketPath);
+    std::thread sender([&client, &ledger, &in] {
+        try {
+            if (!ledger.empty()) client.send("use," + ledger + "\n");
+            std::string line;
+            while (std::getline(in, line)) client.send(line + "\n");
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
         }
+        client.finishSending();
+    });
+    bool succeeded = true;
+    std::string line;
+    while (client.readLine(line)) {
+        succeeded = succeeded && line.find("\"ok\":false") == std::string::npos;
+        out << line << '\n';
     }
-    std::cout << "Transaction not found.\n";
+    out.flush();
+    sender.join();
+    return succeeded;
 }
+#endif
 
-// Deletes a transaction by name
-void deleteTransaction() {
-    std::cout << "Deleting transaction...\n";
-    std::string name;
-    std::cout << "Leave blank for [default value]\n";
-    getInput("the name of the transaction to delete", &name, std::string(""));
+#ifndef BUDGET_BENCHMARK
+// Where the statistics of the session go when it ends
+struct StatisticsOutput {
+    bool table = false;
+    std::string jsonPath;
+    std::string tracePath;
+};
 
-    auto it = std::remove_if(globalState.items.begin(), globalState.items.end(),
-                             [&name](const FinancialItem &item) { return item.getName() == name; });
-    if (it != globalState.items.end()) {
-        globalState.items.erase(it, globalState.items.end());
-        globalState.save();
-        std::cout << "Transaction deleted.\n";
-    } else {
-        std::cout << "Transaction not found.\n";
+StatisticsOutput statisticsOutput;
+
+// Writes the statistics requested on the command line; runs at exit, after the state is saved
+void writeSessionStatistics() {
+    try {
+        if (statisticsOutput.table) writeStatisticsTable(std::cerr);
+        if (!statisticsOutput.jsonPath.empty()) writeStatisticsFile(statisticsOutput.jsonPath, writeStatisticsJson);
+        if (!statisticsOutput.tracePath.empty()) writeStatisticsFile(statisticsOutput.tracePath, writeChromeTrace);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+// Removes --stats, --stats-json <file> and --trace <file> from the arguments, wherever they are, and
+// starts collecting statistics if any was given. Throws std::invalid_argument if a file is missing.
+void parseStatisticsOptions(std::vector<std::string> &args) {
+    std::vector<std::string> remaining;
+    for (size_t index = 0; index < args.size(); ++index) {
+        if (args[index] == "--stats") {
+            statisticsOutput.table = true;
+        } else if (args[index] == "--stats-json" || args[index] == "--trace") {
+            if (index + 1 == args.size()) throw std::invalid_argument(args[index] + " needs a file name");
+            (args[index] == "--trace" ? statisticsOutput.tracePath : statisticsOutput.jsonPath) = args[index + 1];
+            ++index;
+        } else {
+            remaining.push_back(args[index]);
+        }
     }
+    args.swap(remaining);
+    if (!statisticsOutput.table && statisticsOutput.jsonPath.empty() && statisticsOutput.tracePath.empty()) return;
+    enableInstrumentation(!statisticsOutput.tracePath.empty());
+    std::atexit(writeSessionStatistics);
 }
 
 // Main function
-int main() {
-    loadProgram();
+int main(int argc, char **argv) {
+    // Command-line tools for the binary ledger format
+    std::vector<std::string> args(argv + 1, argv + argc);
+    try {
+        parseStatisticsOptions(args);
+        if (args.size() == 3 && args[0] == "--convert") {
+            convertCsvToLedger(args[1], args[2]);
+            std::cout << "Converted " << args[1] << " to " << args[2] << "\n";
+            return 0;
+        }
+        if (args.size() == 2 && args[0] == "--verify") {
+            bool valid = verifyLedgerFile(args[1]);
+            std::cout << args[1] << (valid ? " is valid\n" : " is corrupted\n");
+            return valid ? 0 : 1;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (!args.empty() && (args[0] == "--serve" || args[0] == "--connect")) {
+#ifdef _WIN32
+        std::cerr << args[0] << " needs Unix-domain sockets, which this build does not support" << std::endl;
+        return 1;
+#else
+        const std::string &socketPath = args.size() > 1 ? args[1] : SERVER_SOCKET_FILENAME;
+        if (args[0] == "--serve") return runServer(socketPath, args.size() > 2 ? args[2] : ".");
+        try {
+            return runClient(socketPath, args.size() > 2 ? args[2] : "", std::cin, std::cout) ? 0 : 1;
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+#endif
+    }
+
+    globalState(); // Loads the ledger
     std::atexit(saveProgram);
+    if (!args.empty() && args[0] == "--batch") {
+        std::ifstream file;
+        if (args.size() > 1 && args[1] != "-") {
+            file.open(args[1]);
+            if (!file) {
+                std::cerr << "Cannot open " << args[1] << std::endl;
+                return 1;
+            }
+        }
+        return runBatch(file.is_open() ? file : std::cin, std::cout) ? 0 : 1;
+    }
+    if (args.size() >= 2 && args.size() <= 4 && args[0] == "--import-statement") {
+        try {
+            StatementOptions options;
+            if (args.size() >= 3 && args[2] != "-") options.rules = readCategoryRules(args[2]);
+            if (args.size() == 4) options.dateOrder = parseDateOrder(args[3]);
+            StatementImport result = importStatement(globalState(), args[1], options);
+            reportStatementImport(result, std::cout);
+            return result.invalid == 0 ? 0 : 1;
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    if (args.size() >= 2 && args.size() <= 4 && args[0] == "--report") {
+        try {
+            ReportWriter report(std::cout, args.size() >= 3 ? parseReportFormat(args[2]) : ReportFormat::Text);
+            if (args.size() == 4 && args[1] != "projection") throw std::invalid_argument("Too many arguments");
+            if (args[1] == "summary") {
+                writeSummary(report);
+                writeDetailedSummary(report);
+            } else if (args[1] == "list") {
+                const Ledger &items = globalState().getItems();
+                for (size_t row = 0; row < items.size(); ++row) report.item(items, row);
+            } else if (args[1] == "recurring") {
+                const Ledger &items = globalState().getItems();
+                for (size_t index = 0; index < items.recurrenceCount(); ++index) report.recurrence(items, index);
+            } else if (args[1] == "groups") {
+                const Ledger &items = globalState().getItems();
+                for (size_t index = 0; index < items.scenarioGroupCount(); ++index) report.scenarioGroup(items, index);
+            } else if (args[1] == "projection") {
+                int32_t years = DEFAULT_PROJECTION_YEARS;
+                if (args.size() == 4 && !parseNumber(args[3], years)) {
+                    throw std::invalid_argument("Invalid number of years: " + args[3]);
+                }
+                writeProjection(report, globalState().getItems(), years);
+            } else {
+                throw std::invalid_argument("Invalid report: " + args[1]);
+            }
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    if (std::find(args.begin(), args.end(), "--check") != args.end()) {
+        globalState().checkAggregates = true;
+        globalState().getAggregates();
+        globalState().verifyAggregates();
+    }
 
     std::vector<std::pair<std::string, std::function<void()> > > menu = {
         {"View Detailed Summary", viewDetailedSummary},
+        {"View Cash-Flow Projection", viewCashFlowProjection},
+        {"Query Date Range", queryDateRange},
+        {"Run Monte Carlo Simulation", runMonteCarloSimulation},
+        {"Evaluate All Scenarios (Exhaustive)", viewExhaustiveScenarios},
+        {"View Transactions by Category", viewCategory},
         {"Add Transaction", addTransaction},
         {"Edit Transaction", editTransaction},
         {"Delete Transaction", deleteTransaction},
+        {"Recurring Transactions", manageRecurringTransactions},
+        {"Scenario Groups", manageScenarioGroups},
+        {"Closed Periods", manageClosedPeriods},
+        {"Import CSV", importCsv},
+        {"Import Bank Statement", importBankStatement},
+        {"Export CSV", exportCsv},
+        {"Performance Statistics", viewStatistics},
         {"Exit", exitProgram}
     };
 
@@ -681,5 +8862,691 @@ int main() {
 
     return 0;
 }
+#endif
 
 #pragma endregion Application
+
+#pragma region Benchmark
+#ifdef BUDGET_BENCHMARK
+
+// Builds n variable items with deterministic pseudo-random amounts, types and probabilities
+std::vector<FinancialItem> makeBenchmarkItems(size_t n, uint64_t seed) {
+    Xoshiro256 rng(seed);
+    std::vector<FinancialItem> items;
+    std::string category = "Benchmark", date = "2024-01-01";
+    for (size_t i = 0; i < n; ++i) {
+        std::string name = "Item " + std::to_string(i);
+        auto type = static_cast<ItemType>(rng.next() % 4);
+        Money amount(static_cast<int64_t>(rng.next() % 10000000));
+        double probability = 0.05 + 0.9 * static_cast<double>(rng.next() % 1000) / 1000.0;
+        items.emplace_back(type, name, category, amount, date, probability);
+    }
+    return items;
+}
+
+// Builds n items with deterministic pseudo-random dates spread over twenty years
+std::vector<FinancialItem> makeDatedBenchmarkItems(size_t n, uint64_t seed) {
+    Xoshiro256 rng(seed);
+    std::vector<FinancialItem> items;
+    std::string category = "Benchmark";
+    const int32_t firstDay = daysFromCivil(2010, 1, 1);
+    for (size_t i = 0; i < n; ++i) {
+        std::string name = "Item " + std::to_string(i);
+        std::string date = formatDate(firstDay + static_cast<int32_t>(rng.next() % 7300));
+        auto type = static_cast<ItemType>(rng.next() % 4);
+        Money amount(static_cast<int64_t>(rng.next() % 10000000));
+        items.emplace_back(type, name, category, amount, date, 1.0);
+    }
+    return items;
+}
+
+// The original sort: insertion sort over FinancialItem copies, comparing date strings
+void legacySortByDate(std::vector<FinancialItem> &items) {
+    for (size_t i = 1; i < items.size(); ++i) {
+        FinancialItem key = items[i];
+        size_t j = i;
+        while (j > 0 && items[j - 1].getDate() > key.getDate()) {
+            items[j] = items[j - 1];
+            --j;
+        }
+        items[j] = key;
+    }
+}
+
+// Best, worst, most likely and least likely totals as computed by the original enumeration
+struct LegacyScenarioResult {
+    double maxAssets = -std::numeric_limits<double>::infinity();
+    double minAssets = std::numeric_limits<double>::infinity();
+    double mostLikelyAssets = 0.0;
+    double leastLikelyAssets = 0.0;
+};
+
+// The original enumeration: rebuilds the occurrence vector and recomputes every scenario from scratch
+LegacyScenarioResult legacyEnumerateScenarios(const std::vector<FinancialItem> &variableItems) {
+    size_t n = variableItems.size();
+    LegacyScenarioResult result;
+    double maxProbability = 0.0;
+    double minProbability = 1.0;
+    for (uint64_t i = 0; i < (uint64_t{1} << n); ++i) {
+        std::vector<bool> occurrence(n);
+        for (size_t itemIndex = 0; itemIndex < n; ++itemIndex) {
+            occurrence[itemIndex] = (i & (uint64_t{1} << itemIndex)) != 0;
+        }
+        double currentAssets = 0.0, currentProbability = 1.0;
+        for (size_t k = 0; k < n; ++k) {
+            if (!occurrence[k]) continue;
+            if (variableItems[k].getType() == ItemType::Expense || variableItems[k].getType() == ItemType::Liability) {
+                currentAssets -= variableItems[k].getAmount().units();
+            } else {
+                currentAssets += variableItems[k].getAmount().units();
+            }
+        }
+        for (size_t k = 0; k < n; ++k) {
+            currentProbability *= occurrence[k] ? variableItems[k].getProbability()
+                                                : 1 - variableItems[k].getProbability();
+        }
+        if (currentAssets > result.maxAssets) result.maxAssets = currentAssets;
+        if (currentAssets < result.minAssets) result.minAssets = currentAssets;
+        if (currentProbability > maxProbability) {
+            maxProbability = currentProbability;
+            result.mostLikelyAssets = currentAssets;
+        }
+        if (currentProbability < minProbability) {
+            minProbability = currentProbability;
+            result.leastLikelyAssets = currentAssets;
+        }
+    }
+    return result;
+}
+
+// Returns the wall-clock time of a call in milliseconds
+template<typename Function>
+double measureMilliseconds(Function &&function) {
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Compares the original enumeration loop with the Gray-code enumeration for n = 16..32
+void benchmarkScenarioEnumeration(size_t maxLegacyItems) {
+    std::cout << std::left << std::setw(6) << "n" << std::setw(16) << "legacy (ms)"
+              << std::setw(16) << "gray code (ms)" << "speedup\n";
+    for (size_t n = 16; n <= 32; n += 2) {
+        auto items = makeBenchmarkItems(n, n);
+        std::vector<ScenarioItem> variableItems;
+        for (const auto &item: items) {
+            variableItems.push_back({signedAmount(item.getType(), item.getAmount().minorUnits), item.getProbability()});
+        }
+
+        ScenarioExtremes extremes;
+        double grayMs = measureMilliseconds([&] { extremes = enumerateScenarios(variableItems); });
+
+        std::cout << std::left << std::setw(6) << n;
+        if (n <= maxLegacyItems) {
+            LegacyScenarioResult legacy;
+            double legacyMs = measureMilliseconds([&] { legacy = legacyEnumerateScenarios(items); });
+            if (toMinorUnits(legacy.maxAssets) != extremes.bestCase ||
+                toMinorUnits(legacy.minAssets) != extremes.worstCase ||
+                toMinorUnits(legacy.mostLikelyAssets) != extremes.mostLikelyOutcome ||
+                toMinorUnits(legacy.leastLikelyAssets) != extremes.leastLikelyOutcome) {
+                std::cout << "MISMATCH ";
+            }
+            std::cout << std::setw(16) << legacyMs << std::setw(16) << grayMs << legacyMs / grayMs << "x\n";
+        } else {
+            std::cout << std::setw(16) << "skipped" << std::setw(16) << grayMs << "-\n";
+        }
+    }
+}
+
+// Builds the variable items of groups of three: alternately three exclusive alternatives, and a parent
+// with two items conditional on it
+std::vector<ScenarioItem> makeBenchmarkGroups(size_t groups, uint64_t seed) {
+    auto items = makeBenchmarkItems(groups * 3, seed);
+    std::vector<ScenarioItem> variableItems;
+    for (size_t group = 0; group < groups; ++group) {
+        const bool exclusive = group % 2 == 0;
+        double total = 0.0;
+        for (size_t i = group * 3; i < group * 3 + 3; ++i) total += items[i].getProbability();
+        for (size_t i = group * 3; i < group * 3 + 3; ++i) {
+            const FinancialItem &item = items[i];
+            ScenarioLink link = i == group * 3 ? ScenarioLink::Independent
+                                : exclusive     ? ScenarioLink::Exclusive
+                                                : ScenarioLink::Conditional;
+            double probability = exclusive ? item.getProbability() * 0.9 / total : item.getProbability();
+            variableItems.push_back({signedAmount(item.getType(), item.getAmount().minorUnits), probability, link});
+        }
+    }
+    return variableItems;
+}
+
+// Compares enumerating every combination of grouped items with summarizing them factor by factor
+void benchmarkScenarioGroups(size_t maxExhaustiveItems) {
+    std::cout << std::left << std::setw(8) << "groups" << std::setw(8) << "items" << std::setw(18)
+              << "exhaustive (ms)" << "factored (ms)\n";
+    for (size_t groups: {size_t{4}, size_t{6}, size_t{8}, size_t{10}, size_t{1000}}) {
+        std::vector<ScenarioItem> variableItems = makeBenchmarkGroups(groups, groups);
+        ScenarioSummary summary;
+        double factoredMs = measureMilliseconds([&] { summary = summarizeScenarioItems(0, variableItems); });
+
+        std::cout << std::left << std::setw(8) << groups << std::setw(8) << variableItems.size();
+        if (variableItems.size() <= maxExhaustiveItems) {
+            ScenarioExtremes extremes;
+            double exhaustiveMs = measureMilliseconds([&] { extremes = enumerateScenarios(variableItems); });
+            if (summary.bestCase.minorUnits != extremes.bestCase ||
+                summary.worstCase.minorUnits != extremes.worstCase ||
+                summary.mostLikelyOutcome.minorUnits != extremes.mostLikelyOutcome ||
+                summary.leastLikelyOutcome.minorUnits != extremes.leastLikelyOutcome) {
+                std::cout << "MISMATCH ";
+            }
+            std::cout << std::setw(18) << exhaustiveMs << factoredMs << "\n";
+        } else {
+            std::cout << std::setw(18) << "skipped" << factoredMs << "\n";
+        }
+    }
+}
+
+// Compares the original insertion sort with the radix sort used for bulk loads, and measures
+// inserting single items into an already sorted ledger
+void benchmarkDateOrdering(size_t maxLegacySortItems) {
+    constexpr size_t INSERTED_ITEMS = 1000;
+    std::cout << std::left << std::setw(10) << "items" << std::setw(16) << "legacy (ms)" << std::setw(16)
+              << "radix (ms)" << std::setw(10) << "speedup" << "insert " << INSERTED_ITEMS << " (ms)\n";
+    for (size_t n: {size_t{10000}, size_t{100000}, size_t{1000000}}) {
+        auto items = makeDatedBenchmarkItems(n, n);
+        Ledger ledger;
+        ledger.reserve(n + INSERTED_ITEMS);
+        for (const auto &item: items) {
+            ledger.appendRow(item.getType(), item.getAmount().minorUnits, parseDate(item.getDate()),
+                             item.getCategory(), item.getName(), item.getProbability());
+        }
+        double radixMs = measureMilliseconds([&] { ledger.sortByDate(); });
+
+        auto inserted = makeDatedBenchmarkItems(INSERTED_ITEMS, n + 1);
+        double insertMs = measureMilliseconds([&] {
+            for (const auto &item: inserted) ledger.insert(item);
+        });
+
+        std::cout << std::left << std::setw(10) << n;
+        if (!ledger.isSortedByDate()) std::cout << "MISMATCH ";
+        if (n <= maxLegacySortItems) {
+            double legacyMs = measureMilliseconds([&] { legacySortByDate(items); });
+            std::cout << std::setw(16) << legacyMs << std::setw(16) << radixMs << std::setw(10)
+                      << std::to_string(static_cast<long long>(legacyMs / radixMs)) + "x";
+        } else {
+            std::cout << std::setw(16) << "skipped" << std::setw(16) << radixMs << std::setw(10) << "-";
+        }
+        std::cout << insertMs << "\n";
+    }
+}
+
+// A category of synthetic transactions: its type, how often it occurs and its typical amount
+struct SyntheticCategory {
+    const char *name;
+    ItemType type;
+    uint32_t weight;       // Relative number of rows
+    int64_t typicalAmount; // Median amount in minor units
+    int dayOfMonth;        // Day of recurring items, 0 for items on any day
+};
+
+// Household categories of the synthetic ledger, roughly in the proportions of a real one
+constexpr SyntheticCategory SYNTHETIC_CATEGORIES[] = {
+    {"Salary", ItemType::Income, 2, 1500000000, 25},
+    {"Freelance", ItemType::Income, 1, 300000000, 0},
+    {"Rent", ItemType::Expense, 2, 500000000, 1},
+    {"Utilities", ItemType::Expense, 4, 50000000, 10},
+    {"Groceries", ItemType::Expense, 30, 15000000, 0},
+    {"Dining", ItemType::Expense, 20, 8000000, 0},
+    {"Transport", ItemType::Expense, 20, 4000000, 0},
+    {"Entertainment", ItemType::Expense, 8, 20000000, 0},
+    {"Health", ItemType::Expense, 3, 30000000, 0},
+    {"Savings", ItemType::Asset, 3, 200000000, 0},
+    {"Loan", ItemType::Liability, 2, 100000000, 5}
+};
+
+// Number of distinct names (merchants, payers) per synthetic category
+constexpr uint32_t SYNTHETIC_NAMES_PER_CATEGORY = 50;
+
+// Years covered by the synthetic ledger, ending on SYNTHETIC_LAST_DAY
+constexpr int SYNTHETIC_YEARS = 5;
+const int32_t SYNTHETIC_LAST_DAY = daysFromCivil(2024, 12, 31);
+
+// Builds a ledger of n synthetic transactions in generation order (not date order). The same n,
+// seed and share always give the same ledger. Amounts are spread log-normally around each
+// category's typical amount, recurring categories fall on a fixed day of the month, and the given
+// share of rows gets a probability between 0.05 and 0.95 instead of 1.
+Ledger generateSyntheticLedger(size_t n, uint64_t seed, double uncertainShare) {
+    uint32_t totalWeight = 0;
+    for (const auto &category: SYNTHETIC_CATEGORIES) totalWeight += category.weight;
+    const int32_t firstMonth = monthOf(SYNTHETIC_LAST_DAY) - SYNTHETIC_YEARS * 12 + 1;
+    const uint64_t uncertainThreshold = static_cast<uint64_t>(std::ldexp(std::clamp(uncertainShare, 0.0, 1.0), 63));
+    auto uniform = [](Xoshiro256 &rng) { return static_cast<double>(rng.next() >> 11) * 0x1.0p-53; };
+
+    Xoshiro256 rng(seed);
+    Ledger ledger;
+    ledger.reserve(n);
+    std::string name;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t pick = static_cast<uint32_t>(rng.next() % totalWeight);
+        const SyntheticCategory *category = SYNTHETIC_CATEGORIES;
+        while (pick >= category->weight) pick -= category++->weight;
+
+        int32_t month = firstMonth + static_cast<int32_t>(rng.next() % (SYNTHETIC_YEARS * 12));
+        int32_t monthStart = daysFromCivil(month / 12, month % 12 + 1, 1);
+        int32_t daysInMonth = lastDayOfMonth(monthStart) - monthStart + 1;
+        int32_t date = monthStart + (category->dayOfMonth > 0
+                                         ? std::min(category->dayOfMonth, daysInMonth) - 1
+                                         : static_cast<int32_t>(rng.next() % daysInMonth));
+
+        // Irwin-Hall approximation of a standard normal draw
+        double normal = (uniform(rng) + uniform(rng) + uniform(rng) + uniform(rng) - 2.0) * std::sqrt(3.0);
+        int64_t amount = std::max<int64_t>(
+            100, std::llround(category->typicalAmount * std::exp(0.6 * normal) / 100) * 100);
+
+        double probability = 1.0;
+        if ((rng.next() >> 1) < uncertainThreshold) probability = 0.05 * static_cast<double>(1 + rng.next() % 19);
+
+        name.assign(category->name);
+        name.append(" ");
+        name.append(std::to_string(1 + rng.next() % SYNTHETIC_NAMES_PER_CATEGORY));
+        ledger.appendRow(category->type, amount, date, category->name, name, probability);
+    }
+    return ledger;
+}
+
+// Timings of repeated runs of one operation
+struct BenchmarkResult {
+    std::string operation;
+    size_t rows = 0;
+    std::vector<double> milliseconds;
+
+    [[nodiscard]] double fastest() const {
+        return *std::min_element(milliseconds.begin(), milliseconds.end());
+    }
+
+    [[nodiscard]] double median() const {
+        std::vector<double> sorted = milliseconds;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+// Times runs of an operation; setup runs before each timed call and is not counted
+template<typename Setup, typename Function>
+BenchmarkResult measureRuns(const std::string &operation, size_t rows, size_t runs, Setup &&setup,
+                            Function &&function) {
+    BenchmarkResult result{operation, rows, {}};
+    for (size_t run = 0; run < runs; ++run) {
+        setup();
+        result.milliseconds.push_back(measureMilliseconds(function));
+    }
+    std::cerr << operation << " " << rows << ": " << result.median() << " ms" << std::endl;
+    return result;
+}
+
+// Writes the suite results as JSON, one object per operation and size
+void writeBenchmarkJson(std::ostream &out, uint64_t seed, const std::vector<BenchmarkResult> &results) {
+    out << "{\n  \"seed\": " << seed << ",\n  \"threads\": " << sharedPool().size() << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult &result = results[i];
+        out << (i == 0 ? "\n" : ",\n") << "    {\"operation\": \"" << result.operation << "\", \"rows\": "
+            << result.rows << ", \"runs\": " << result.milliseconds.size() << ", \"fastestMs\": "
+            << result.fastest() << ", \"medianMs\": " << result.median() << ", \"rowsPerSecond\": "
+            << std::llround(static_cast<double>(result.rows) / (result.median() / 1000.0)) << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Imports rows into a ledger in a scratch directory, then edits and deletes some of them. A copy of the
+// directory as a crash right after the import leaves it, with the snapshot from before the import and
+// the journals, must load with every change.
+void checkImportRecovery(uint64_t seed) {
+    const std::filesystem::path temporary = std::filesystem::temp_directory_path();
+    const std::filesystem::path directory = temporary / "budget_benchmark_ledger";
+    const std::filesystem::path crashed = temporary / "budget_benchmark_crashed";
+    for (const std::filesystem::path &path: {directory, crashed}) {
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+    Ledger expected;
+    {
+        GlobalState state(directory);
+        state.addItems(generateSyntheticLedger(1000, seed, 0.9));
+        state.save();
+        std::filesystem::copy_file(directory / LEDGER_FILENAME, crashed / LEDGER_FILENAME);
+        const uint64_t firstImportedId = state.getItems().size() + 1;
+        state.addItems(generateSyntheticLedger(JOURNAL_BULK_ROWS + 1000, seed + 1, 0.9));
+        for (const std::string &journal: {COMPACTING_JOURNAL_FILENAME, JOURNAL_FILENAME}) {
+            if (std::filesystem::exists(directory / journal)) {
+                std::filesystem::copy_file(directory / journal, crashed / journal);
+            }
+        }
+        std::string name = "Edited", category = "Recovered", date = "2024-06-30";
+        state.editItem(firstImportedId, FinancialItem(ItemType::Expense, name, category, Money(1234), date, 1.0));
+        state.deleteItem(firstImportedId + JOURNAL_BULK_ROWS);
+        state.journal.sync();
+        std::filesystem::copy_file(directory / JOURNAL_FILENAME, crashed / JOURNAL_FILENAME,
+                                   std::filesystem::copy_options::overwrite_existing);
+        expected = state.getItems();
+    }
+    {
+        GlobalState recovered(crashed);
+        const Ledger &items = recovered.getItems();
+        bool same = recovered.persistent && items.size() == expected.size();
+        for (size_t row = 0; same && row < items.size(); ++row) {
+            same = items.id(row) == expected.id(row) && items.amount(row) == expected.amount(row) &&
+                   items.date(row) == expected.date(row) && items.name(row) == expected.name(row);
+        }
+        if (!same) std::cerr << "MISMATCH\n";
+    }
+    std::filesystem::remove_all(directory);
+    std::filesystem::remove_all(crashed);
+}
+
+// Runs every stage of the pipeline on synthetic ledgers of 1k rows up to maxRows (by factors of 10)
+// and scenario evaluation on 16 to 1024 uncertain items, returning the timings
+std::vector<BenchmarkResult> runBenchmarkSuite(size_t maxRows, uint64_t seed) {
+    constexpr size_t MONTH_QUERIES = 100000;
+    constexpr double UNCERTAIN_SHARE = 0.01;
+    const std::string csvFilename = (std::filesystem::temp_directory_path() / "budget_benchmark.csv").string();
+    const std::filesystem::path temporary = std::filesystem::temp_directory_path();
+    const std::string ledgerFilename = (temporary / "budget_benchmark.ledger").string();
+    const std::string reportFilename = (temporary / "budget_benchmark_report.csv").string();
+    std::vector<BenchmarkResult> results;
+    auto noSetup = [] {};
+
+    for (size_t n = 1000; n <= maxRows; n *= 10) {
+        const size_t runs = n <= 100000 ? 5 : n <= 1000000 ? 3 : 1;
+        Ledger generated;
+        results.push_back(measureRuns("generate", n, 1, noSetup, [&] {
+            generated = generateSyntheticLedger(n, seed, UNCERTAIN_SHARE);
+        }));
+
+        Ledger ledger;
+        results.push_back(measureRuns("sortByDate", n, runs, [&] { ledger = generated; }, [&] {
+            ledger.sortByDate();
+        }));
+        auto sortedCopy = [&] {
+            ledger = generated;
+            ledger.sortByDate();
+        };
+        results.push_back(measureRuns("monthIndexBuild", n, runs, sortedCopy, [&] { (void) ledger.months(); }));
+
+        const MonthIndex &months = ledger.months();
+        const int32_t lastMonth = monthOf(SYNTHETIC_LAST_DAY);
+        int64_t checksum = 0;
+        results.push_back(measureRuns("monthQuery", MONTH_QUERIES, runs, noSetup, [&] {
+            Xoshiro256 rng(seed);
+            for (size_t i = 0; i < MONTH_QUERIES; ++i) {
+                int32_t month = lastMonth - static_cast<int32_t>(rng.next() % (SYNTHETIC_YEARS * 12));
+                auto [first, last] = months.monthRows(month);
+                checksum += static_cast<int64_t>(last - first) + months.monthTotals(month)[0] +
+                            months.totalsThrough(month)[2];
+            }
+        }));
+
+        // Totals over random date ranges of up to the whole ledger, for one category or all of them
+        results.push_back(measureRuns("rangeIndexBuild", n, runs, noSetup, [&] {
+            Ledger copy = ledger;
+            checksum += copy.rangeTotal(ItemType::Expense, "", SYNTHETIC_LAST_DAY, SYNTHETIC_LAST_DAY);
+        }));
+        checksum += ledger.rangeTotal(ItemType::Expense, "", SYNTHETIC_LAST_DAY, SYNTHETIC_LAST_DAY);
+        results.push_back(measureRuns("rangeQuery", MONTH_QUERIES, runs, noSetup, [&] {
+            Xoshiro256 rng(seed);
+            const int32_t span = SYNTHETIC_YEARS * 366;
+            for (size_t i = 0; i < MONTH_QUERIES; ++i) {
+                const SyntheticCategory &category = SYNTHETIC_CATEGORIES[rng.next() % std::size(SYNTHETIC_CATEGORIES)];
+                const int32_t first = SYNTHETIC_LAST_DAY - static_cast<int32_t>(rng.next() % span);
+                const int32_t last = first + static_cast<int32_t>(rng.next() % span);
+                checksum += ledger.rangeTotal(category.type, i % 2 == 0 ? category.name : "", first, last);
+            }
+        }));
+
+        // Ranges like those, each checked against a sum over every row
+        const size_t rangeChecks = n <= 1000000 ? 100 : 10;
+        Xoshiro256 rangeRng(seed + 1);
+        for (size_t i = 0; i < rangeChecks; ++i) {
+            const int32_t span = SYNTHETIC_YEARS * 366;
+            const SyntheticCategory &category = SYNTHETIC_CATEGORIES[rangeRng.next() % std::size(SYNTHETIC_CATEGORIES)];
+            const std::string_view name = i % 2 == 0 ? category.name : "";
+            const int32_t first = SYNTHETIC_LAST_DAY - static_cast<int32_t>(rangeRng.next() % span);
+            const int32_t last = first + static_cast<int32_t>(rangeRng.next() % span);
+            int64_t expected = 0;
+            for (size_t row = 0; row < ledger.size(); ++row) {
+                if (ledger.type(row) == category.type && ledger.date(row) >= first && ledger.date(row) <= last &&
+                    isWithinCategory(ledger.category(row), name)) {
+                    expected += ledger.amount(row);
+                }
+            }
+            for (size_t index = 0; index < ledger.recurrenceCount(); ++index) {
+                const RecurrenceRule &rule = ledger.recurrence(index);
+                if (rule.type == category.type && isWithinCategory(ledger.categories().get(rule.categoryId), name)) {
+                    expected += static_cast<int64_t>(rule.schedule.countBetween(first, last)) * rule.amount;
+                }
+            }
+            if (ledger.rangeTotal(category.type, name, first, last) != expected) std::cerr << "MISMATCH\n";
+        }
+
+        results.push_back(measureRuns("detailedSummary", n, runs, noSetup, [&] {
+            SummaryAggregates aggregates;
+            aggregates.rebuild(ledger, SYNTHETIC_LAST_DAY);
+            checksum += aggregates.getCurrentAssets() + static_cast<int64_t>(aggregates.topExpenseCategories(3).size());
+        }));
+
+        // 30 years of months from the first synthetic month; the last month must match the scenario summary
+        const int32_t firstMonth = monthOf(daysFromCivil(2024 - SYNTHETIC_YEARS + 1, 1, 1));
+        std::vector<ProjectionMonth> projection;
+        results.push_back(measureRuns("cashFlowProjection", n, runs, noSetup, [&] {
+            projection = projectCashFlow(ledger, firstMonth, 30 * 12);
+        }));
+        auto checkProjection = [firstMonth](const Ledger &checked, const std::vector<ProjectionMonth> &projected) {
+            ScenarioSummary scenarios = summarizeScenarios(checked, firstDayOfMonthKey(firstMonth + 30 * 12) - 1);
+            if (projected.back().bestCase != scenarios.bestCase.minorUnits ||
+                projected.back().worstCase != scenarios.worstCase.minorUnits ||
+                std::llabs(projected.back().expectedOutcome - scenarios.expectedOutcome.minorUnits) > 1) {
+                std::cerr << "MISMATCH\n";
+            }
+        };
+        checkProjection(ledger, projection);
+
+        // Likewise with scenario groups of every kind, their items spread over the years
+        Ledger grouped = ledger;
+        Xoshiro256 groupRng(seed);
+        auto addGroupedRow = [&](double probability) {
+            const int32_t day = SYNTHETIC_LAST_DAY - static_cast<int32_t>(groupRng.next() % (SYNTHETIC_YEARS * 365));
+            const ItemType type = groupRng.next() % 2 == 0 ? ItemType::Income : ItemType::Expense;
+            const auto amount = static_cast<int64_t>(100 + groupRng.next() % 100000);
+            return grouped.id(grouped.insertRow(type, amount, day, "Scenarios", "Grouped", probability));
+        };
+        for (size_t group = 0; group < 20; ++group) {
+            const std::vector<uint64_t> alternatives{addGroupedRow(0.3), addGroupedRow(0.3), addGroupedRow(0.4)};
+            grouped.insertScenarioGroup(ScenarioGroupKind::Exclusive, "Exclusive", 1.0, 0, alternatives);
+            grouped.insertScenarioGroup(ScenarioGroupKind::Conditional, "Conditional", 1.0, alternatives[0],
+                                        {addGroupedRow(0.5)});
+            grouped.insertScenarioGroup(ScenarioGroupKind::Bundle, "Bundle", 0.6, 0,
+                                        {addGroupedRow(1.0), addGroupedRow(0.5)});
+            grouped.insertScenarioGroup(ScenarioGroupKind::Conditional, "Conditional", 1.0, addGroupedRow(0.7),
+                                        {addGroupedRow(0.5), addGroupedRow(1.0)});
+        }
+        checkProjection(grouped, projectCashFlow(grouped, firstMonth, 30 * 12));
+
+        results.push_back(measureRuns("listReport", n, runs, noSetup, [&] {
+            std::ofstream out(reportFilename, std::ios::binary);
+            ReportWriter report(out, ReportFormat::Csv);
+            for (size_t row = 0; row < ledger.size(); ++row) report.item(ledger, row);
+        }));
+
+        results.push_back(measureRuns("serializeAllItems", n, runs, noSetup, [&] {
+            serializeAllItems(ledger, csvFilename);
+        }));
+        results.push_back(measureRuns("deserializeAllItems", n, runs, noSetup, [&] {
+            Ledger loaded;
+            if (!deserializeAllItems(loaded, csvFilename).empty() || loaded.size() != n) std::cerr << "MISMATCH\n";
+        }));
+        results.push_back(measureRuns("writeLedgerFile", n, runs, noSetup, [&] {
+            writeLedgerFile(ledger, ledgerFilename);
+        }));
+        results.push_back(measureRuns("openLedgerFile", n, runs, noSetup, [&] {
+            if (openLedgerFile(ledgerFilename).size() != n) std::cerr << "MISMATCH\n";
+        }));
+        if (checksum == 0) std::cerr << "MISMATCH\n";
+    }
+    std::filesystem::remove(csvFilename);
+    std::filesystem::remove(ledgerFilename);
+    std::filesystem::remove(reportFilename);
+    checkImportRecovery(seed);
+
+    // evaluateScenarios falls back to a Monte Carlo simulation once the distribution is inexact,
+    // so its cost grows with the number of uncertain items rather than the ledger size
+    for (size_t n = 16; n <= 1024; n *= 4) {
+        Ledger ledger = generateSyntheticLedger(n, seed, 1.0);
+        ledger.sortByDate();
+        results.push_back(measureRuns("evaluateScenarios", n, n <= 64 ? 5 : 1, noSetup, [&] {
+            std::ostringstream text;
+            ReportWriter report(text);
+            writeScenarioEvaluation(report, ledger);
+            report.flush();
+            if (text.str().empty()) std::cerr << "MISMATCH\n";
+        }));
+    }
+    return results;
+}
+
+#ifndef _WIN32
+// Requests and latencies measured by a load test
+struct LoadTestResult {
+    size_t clients = 0;
+    uint64_t requests = 0;
+    uint64_t failed = 0;
+    double seconds = 0.0;
+    std::vector<double> latencies; // Milliseconds, sorted
+
+    [[nodiscard]] double percentile(double fraction) const {
+        if (latencies.empty()) return 0.0;
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(fraction * latencies.size()))];
+    }
+};
+
+// Runs many clients against a ledger server at once. Each client works on the given ledger and
+// sends requestsPerClient requests, one at a time: 70% adds (1% of them uncertain), 25% summaries
+// and 5% scenario summaries. Every request's latency is measured from sending it to receiving its result.
+LoadTestResult runLoadTest(const std::string &socketPath, size_t clientCount, size_t requestsPerClient,
+                           const std::string &ledger, uint64_t seed) {
+    const std::string today = getCurrentDate();
+    std::vector<std::unique_ptr<ServerClient> > clients;
+    std::string line;
+    for (size_t i = 0; i < clientCount; ++i) {
+        clients.push_back(std::make_unique<ServerClient>(socketPath));
+        clients.back()->send("use," + ledger + "\n");
+        if (!clients.back()->readLine(line) || line.find("\"ok\":true") == std::string::npos) {
+            throw std::runtime_error("Cannot use ledger " + ledger + ": " + line);
+        }
+    }
+
+    LoadTestResult result;
+    result.clients = clientCount;
+    std::vector<std::vector<double> > latencies(clientCount);
+    std::atomic<uint64_t> failed{0};
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < clientCount; ++i) {
+        threads.emplace_back([&, i] {
+            uint64_t state = seed ^ (0x9E3779B97F4A7C15ULL * (i + 1));
+            Xoshiro256 rng(splitMix64(state));
+            ServerClient &client = *clients[i];
+            std::string request, response;
+            latencies[i].reserve(requestsPerClient);
+            for (size_t n = 0; n < requestsPerClient; ++n) {
+                const uint64_t draw = rng.next() % 1000;
+                if (draw < 700) {
+                    request = "add,Expense,Load " + std::to_string(i) + ",Load," + std::to_string(1 + draw) + "," +
+                              today + (draw < 7 ? ",0.5\n" : "\n");
+                } else if (draw < 950) {
+                    request = "summary\n";
+                } else {
+                    request = "scenarios\n";
+                }
+                auto sent = std::chrono::steady_clock::now();
+                client.send(request);
+                if (!client.readLine(response)) {
+                    failed += requestsPerClient - n;
+                    return;
+                }
+                latencies[i].push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count());
+                if (response.find("\"ok\":true") == std::string::npos) ++failed;
+            }
+        });
+    }
+    for (auto &thread: threads) thread.join();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (const auto &clientLatencies: latencies) {
+        result.latencies.insert(result.latencies.end(), clientLatencies.begin(), clientLatencies.end());
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    result.requests = result.latencies.size();
+    result.failed = failed;
+    return result;
+}
+
+// Writes a load test result as JSON
+void writeLoadTestJson(std::ostream &out, const LoadTestResult &result) {
+    out << "{\"clients\": " << result.clients << ", \"requests\": " << result.requests << ", \"failed\": "
+        << result.failed << ", \"seconds\": " << result.seconds << ", \"requestsPerSecond\": "
+        << std::llround(static_cast<double>(result.requests) / result.seconds) << ", \"p50Ms\": "
+        << result.percentile(0.5) << ", \"p99Ms\": " << result.percentile(0.99) << ", \"maxMs\": "
+        << (result.latencies.empty() ? 0.0 : result.latencies.back()) << "}\n";
+}
+#endif
+
+// Benchmark entry point:
+//   benchmark.exe [max legacy n] [max legacy sort items]   compares the original algorithms
+//   benchmark.exe --suite [max rows] [seed]                 times the pipeline and prints JSON
+//   benchmark.exe --generate <rows> <file.csv> [seed]        writes a synthetic ledger
+//   benchmark.exe --load [socket] [clients] [requests per client] [ledger]
+//                                                           load-tests a running server
+int main(int argc, char **argv) {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    try {
+        if (!args.empty() && args[0] == "--suite") {
+            size_t maxRows = args.size() > 1 ? std::stoul(args[1]) : 1000000;
+            uint64_t seed = args.size() > 2 ? std::stoull(args[2]) : 20240101;
+            writeBenchmarkJson(std::cout, seed, runBenchmarkSuite(maxRows, seed));
+            return 0;
+        }
+        if (!args.empty() && args[0] == "--load") {
+#ifdef _WIN32
+            throw std::runtime_error("--load needs Unix-domain sockets, which this build does not support");
+#else
+            LoadTestResult result = runLoadTest(args.size() > 1 ? args[1] : SERVER_SOCKET_FILENAME,
+                                                args.size() > 2 ? std::stoul(args[2]) : 200,
+                                                args.size() > 3 ? std::stoul(args[3]) : 500,
+                                                args.size() > 4 ? args[4] : "load", 20240101);
+            writeLoadTestJson(std::cout, result);
+            return result.failed == 0 ? 0 : 1;
+#endif
+        }
+        if (args.size() >= 3 && args[0] == "--generate") {
+            const uint64_t seed = args.size() > 3 ? std::stoull(args[3]) : 20240101;
+            Ledger ledger = generateSyntheticLedger(std::stoul(args[1]), seed, 0.01);
+            ledger.sortByDate();
+            serializeAllItems(ledger, args[2]);
+            return 0;
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    size_t maxLegacyItems = args.size() > 0 ? std::stoul(args[0]) : 24;
+    size_t maxLegacySortItems = args.size() > 1 ? std::stoul(args[1]) : 10000;
+    benchmarkScenarioEnumeration(maxLegacyItems);
+    std::cout << "\n";
+    benchmarkScenarioGroups(MAX_EXHAUSTIVE_ITEMS);
+    std::cout << "\n";
+    benchmarkDateOrdering(maxLegacySortItems);
+    return 0;
+}
+
+#endif
+#pragma endregion Benchmark